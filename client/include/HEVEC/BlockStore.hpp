@@ -0,0 +1,117 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Metrics.hpp"
+#include "Server.hpp"
+#include "Type.hpp"
+
+namespace HEVEC {
+
+enum class BlockEviction {
+  LRU, // evict the block scanned least recently
+  LFU, // evict the block scanned least often; ties keep the resident one
+};
+
+// Optional series the store keeps up to date.
+struct BlockStoreMetrics {
+  std::shared_ptr<Counter> hits;      // acquires served from memory
+  std::shared_ptr<Counter> loads;     // blocks read from the file
+  std::shared_ptr<Counter> evictions; // resident blocks dropped
+  std::shared_ptr<Gauge> resident_bytes;
+};
+
+// Two-tier store for the full block caches of one collection. Every block
+// is written to a file; up to budgetBytes of them also stay resident, chosen
+// by the eviction policy. A cold block is read with io_uring (O_DIRECT where
+// the filesystem allows it) into one of a few buffers registered with the
+// ring, so a scan that prefetches block i + 1 while it scores block i keeps
+// the reads off its critical path. When all buffers are taken, an acquire
+// reads into a temporary buffer instead of waiting. Without io_uring the
+// store falls back to pread at acquire time. Blocks are stored bit-packed if
+// packed, in memory and on disk alike.
+class BlockStore {
+public:
+  // Creates the file, replacing any left at path.
+  BlockStore(const std::string &path, u64 rank, bool packed, u64 budgetBytes,
+             BlockEviction eviction, u64 numBuffers,
+             BlockStoreMetrics metrics = {});
+  // Waits for reads in flight.
+  ~BlockStore();
+
+  BlockStore(const BlockStore &) = delete;
+  BlockStore &operator=(const BlockStore &) = delete;
+
+  // Writes a full, NTT-form block and returns its index. It stays resident
+  // if the policy admits it.
+  u64 append(const CachedKeys &block);
+  // Starts reading block index unless it is resident, being read, or no
+  // buffer is free.
+  void prefetch(u64 index);
+  // Returns block index, tiled, waiting for its read if needed. The block
+  // stays valid while referenced, even once evicted.
+  std::shared_ptr<const CachedKeys> acquire(u64 index);
+
+  u64 getBlockBytes() const { return block_bytes_; }
+  u64 getResidentBytes() const;
+  bool usesIOUring() const { return ring_ != nullptr; }
+
+private:
+  class Ring;
+  struct BufferPool;
+  struct Load;
+
+  struct Entry {
+    std::shared_ptr<const CachedKeys> resident;
+    std::shared_ptr<Load> load; // in flight, or read but not yet acquired
+    u64 scans = 0;
+    std::list<u64>::iterator lru; // valid while resident
+  };
+
+  std::shared_ptr<const CachedKeys> makeBlock(std::shared_ptr<void> storage);
+  // Makes room for block index if the policy lets it in, evicting others,
+  // and reserves its bytes.
+  bool admit(u64 index);
+  void makeResident(u64 index, std::shared_ptr<const CachedKeys> block);
+  void evict(u64 index);
+  // Starts reading block index. Returns null if it needs a buffer and none
+  // is free while transient is false.
+  std::shared_ptr<Load> startLoad(std::unique_lock<std::mutex> &lock,
+                                  u64 index, bool transient);
+  void readSync(Load &load);
+  void finishLoad(const std::shared_ptr<Load> &load);
+  void reap();
+
+  const std::string path_;
+  const u64 rank_;
+  const bool packed_;
+  const u64 data_bytes_;  // of the scan layout
+  const u64 block_bytes_; // data_bytes_ padded for O_DIRECT
+  const u64 budget_bytes_;
+  const BlockEviction eviction_;
+  const BlockStoreMetrics metrics_;
+  int fd_ = -1;
+  int read_fd_ = -1;
+
+  std::unique_ptr<Ring> ring_;
+  std::shared_ptr<BufferPool> pool_;
+  std::thread reaper_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable loaded_;
+  std::deque<Entry> entries_; // deque: references survive appends
+  std::list<u64> lru_;        // resident blocks, least recent first
+  u64 resident_bytes_ = 0;
+  u64 reads_in_flight_ = 0; // ring reads submitted and not yet completed
+  u64 loads_in_flight_ = 0;
+  bool stop_ = false;
+};
+
+} // namespace HEVEC
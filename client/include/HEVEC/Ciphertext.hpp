@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstring>
 #include <vector>
 
 #include "Const.hpp"
@@ -8,12 +9,9 @@
 namespace HEVEC {
 class Ciphertext {
 public:
-  Ciphertext(bool is_extended = false) {
-    polys_.emplace_back(DEGREE, MOD_Q);
-    polys_.emplace_back(DEGREE, MOD_Q);
-    if (is_extended)
-      polys_.emplace_back(DEGREE, MOD_Q);
-  };
+  Ciphertext(bool is_extended = false)
+      : polys_(std::vector<PolynomialArray::Shape>(is_extended ? 3 : 2,
+                                                   {DEGREE, MOD_Q})) {};
 
   void setIsNTT(bool isNTT) {
     for (Polynomial &p : polys_)
@@ -32,7 +30,160 @@ public:
   const Polynomial &getB() const { return polys_[1]; }
   const Polynomial &getC() const { return polys_[2]; }
 
+  // A, B (and C), DEGREE words each.
+  PolynomialArray &getPolys() { return polys_; }
+  const PolynomialArray &getPolys() const { return polys_; }
+
+private:
+  PolynomialArray polys_;
+};
+
+// Coefficient tiles of the scan layout, one per thread of the multSum
+// kernels. A span in the scan layout stores tile t of every ciphertext (or
+// polynomial) together, tile after tile: A_0[t], B_0[t], A_1[t], B_1[t], ...
+// so each thread of a block scan streams one contiguous region instead of a
+// short burst from every polynomial.
+constexpr u64 SCAN_TILE = DEGREE / N_SCAN_TILES;
+
+// A tile can also be stored bit-packed: LOG_MOD_Q bits per coefficient,
+// LSB-first, in PACKED_SCAN_TILE words, since the low 54 bits of each word
+// are all a reduced coefficient uses.
+constexpr u64 PACKED_SCAN_TILE = SCAN_TILE * LOG_MOD_Q / 64;
+static_assert(SCAN_TILE * LOG_MOD_Q % 64 == 0,
+              "packed tiles must fill whole words");
+
+// Packs SCAN_TILE coefficients, each below 2 * MOD_Q, into one packed tile.
+inline void packScanTile(u64 *res, const u64 *coeffs) {
+  std::memset(res, 0, PACKED_SCAN_TILE * sizeof(u64));
+  for (u64 k = 0; k < SCAN_TILE; ++k) {
+    const u64 value = coeffs[k] >= MOD_Q ? coeffs[k] - MOD_Q : coeffs[k];
+    const u64 bit = k * LOG_MOD_Q, word = bit >> 6, shift = bit & 63;
+    res[word] |= value << shift;
+    if (shift + LOG_MOD_Q > 64)
+      res[word + 1] |= value >> (64 - shift);
+  }
+}
+
+inline void unpackScanTile(u64 *res, const u64 *packed) {
+  constexpr u64 MASK = (1ULL << LOG_MOD_Q) - 1;
+  for (u64 k = 0; k < SCAN_TILE; ++k) {
+    const u64 bit = k * LOG_MOD_Q, word = bit >> 6, shift = bit & 63;
+    u64 value = packed[word] >> shift;
+    if (shift + LOG_MOD_Q > 64)
+      value |= packed[word + 1] << (64 - shift);
+    res[k] = value & MASK;
+  }
+}
+
+// Read-only (A, B) parts of NTT-form ciphertexts, held as Ciphertext objects
+// or stored in the scan layout, packed or not.
+class CiphertextSpan {
+public:
+  CiphertextSpan(const std::vector<Ciphertext> &ctxts)
+      : ctxts_(&ctxts), size_(ctxts.size()) {}
+  // size ciphertexts in the scan layout, getTiledWords(size, packed) words
+  // at tiled.
+  CiphertextSpan(const u64 *tiled, u64 size, bool packed = false)
+      : tiled_(tiled), size_(size),
+        tile_words_(packed ? PACKED_SCAN_TILE : SCAN_TILE) {}
+
+  static u64 getTiledWords(u64 size, bool packed = false) {
+    return 2 * size * N_SCAN_TILES * (packed ? PACKED_SCAN_TILE : SCAN_TILE);
+  }
+
+  u64 size() const { return size_; }
+  bool isTiled() const { return tiled_ != nullptr; }
+  bool isPacked() const { return tile_words_ == PACKED_SCAN_TILE; }
+  bool getIsNTT() const { return ctxts_ ? (*ctxts_)[0].getIsNTT() : true; }
+  // The scan layout words of a tiled span.
+  const u64 *getData() const { return tiled_; }
+
+  // SCAN_TILE coefficients of A_i or B_i from offset, a multiple of
+  // SCAN_TILE. Not for packed spans; see loadA and loadB.
+  const u64 *getA(u64 i, u64 offset) const {
+    return ctxts_ ? (*ctxts_)[i].getA().getData() + offset
+                  : getTile(i, offset);
+  }
+  const u64 *getB(u64 i, u64 offset) const {
+    return ctxts_ ? (*ctxts_)[i].getB().getData() + offset
+                  : getTile(i, offset) + tile_words_;
+  }
+
+  // As getA and getB, unpacking a packed tile into scratch (SCAN_TILE
+  // words), where the caller reads it while it is still in L1.
+  const u64 *loadA(u64 i, u64 offset, u64 *scratch) const {
+    if (!isPacked())
+      return getA(i, offset);
+    unpackScanTile(scratch, getTile(i, offset));
+    return scratch;
+  }
+  const u64 *loadB(u64 i, u64 offset, u64 *scratch) const {
+    if (!isPacked())
+      return getB(i, offset);
+    unpackScanTile(scratch, getTile(i, offset) + tile_words_);
+    return scratch;
+  }
+
+  // Writes tile t of the span in the scan layout, packed or not:
+  // 2 * size() tiles of SCAN_TILE or PACKED_SCAN_TILE words.
+  void copyTile(u64 t, u64 *res, bool packed = false) const {
+    u64 scratch[SCAN_TILE];
+    for (u64 i = 0; i < size_; ++i) {
+      for (const bool isA : {true, false}) {
+        const u64 *coeffs = isA ? loadA(i, t * SCAN_TILE, scratch)
+                                : loadB(i, t * SCAN_TILE, scratch);
+        if (packed) {
+          packScanTile(res, coeffs);
+          res += PACKED_SCAN_TILE;
+        } else {
+          std::memcpy(res, coeffs, SCAN_TILE * sizeof(u64));
+          res += SCAN_TILE;
+        }
+      }
+    }
+  }
+
+private:
+  const u64 *getTile(u64 i, u64 offset) const {
+    return tiled_ + ((offset / SCAN_TILE) * size_ + i) * 2 * tile_words_;
+  }
+
+  const std::vector<Ciphertext> *ctxts_ = nullptr;
+  const u64 *tiled_ = nullptr;
+  u64 size_;
+  u64 tile_words_ = SCAN_TILE;
+};
+
+// Read-only NTT-form polynomials of DEGREE words, held as Polynomial objects
+// or stored in the scan layout (P_0[t], P_1[t], ... for each tile t).
+class PolynomialSpan {
+public:
+  PolynomialSpan(const std::vector<Polynomial> &polys)
+      : polys_(&polys), size_(polys.size()) {}
+  PolynomialSpan(const u64 *tiled, u64 size) : tiled_(tiled), size_(size) {}
+
+  static u64 getTiledWords(u64 size) { return size * DEGREE; }
+
+  u64 size() const { return size_; }
+  bool isTiled() const { return tiled_ != nullptr; }
+  bool getIsNTT() const { return polys_ ? (*polys_)[0].getIsNTT() : true; }
+
+  // SCAN_TILE coefficients of P_i from offset, a multiple of SCAN_TILE.
+  const u64 *get(u64 i, u64 offset) const {
+    return polys_ ? (*polys_)[i].getData() + offset
+                  : tiled_ + ((offset / SCAN_TILE) * size_ + i) * SCAN_TILE;
+  }
+
+  // Writes tile t of the span in the scan layout, size() * SCAN_TILE words.
+  void copyTile(u64 t, u64 *res) const {
+    for (u64 i = 0; i < size_; ++i)
+      std::memcpy(res + i * SCAN_TILE, get(i, t * SCAN_TILE),
+                  SCAN_TILE * sizeof(u64));
+  }
+
 private:
-  std::vector<Polynomial> polys_;
+  const std::vector<Polynomial> *polys_ = nullptr;
+  const u64 *tiled_ = nullptr;
+  u64 size_;
 };
 } // namespace HEVEC
\ No newline at end of file
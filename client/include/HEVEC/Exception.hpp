@@ -24,6 +24,17 @@ public:
   explicit InvalidRankException() : std::runtime_error("Invalid stack") {}
 };
 
+class InvalidSlotException : public std::runtime_error {
+public:
+  explicit InvalidSlotException() : std::runtime_error("Invalid slot") {}
+};
+
+class InvalidBatchSizeException : public std::runtime_error {
+public:
+  explicit InvalidBatchSizeException()
+      : std::runtime_error("Invalid batch size") {}
+};
+
 class SameDataReferenceException : public std::runtime_error {
 public:
   explicit SameDataReferenceException()
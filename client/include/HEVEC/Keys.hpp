@@ -4,47 +4,95 @@
 
 #include "Const.hpp"
 #include "MLWESwitchingKey.hpp"
+#include "Polynomial.hpp"
 #include "SwitchingKey.hpp"
 
 namespace HEVEC {
 
+// The key sets below keep every key in one slab, in key order, so the keys
+// sit next to each other in memory and are allocated (and freed) at once.
+// The keys view the slab: reassigning one writes into it, and a key moved
+// out of the set owns a copy.
+
 class AutedModPackKeys {
 public:
-  AutedModPackKeys(u64 rank)
-      : keys_(rank, std::vector<SwitchingKey>(DEGREE / rank)) {}
+  AutedModPackKeys(u64 rank, bool implicitA = false)
+      : slab_(allocateWords(rank * (DEGREE / rank) *
+                            SwitchingKey::getWordCount(implicitA))),
+        keys_(rank) {
+    u64 *next = slab_.get();
+    for (u64 i = 0; i < rank; ++i) {
+      keys_[i].reserve(DEGREE / rank);
+      for (u64 j = 0; j < DEGREE / rank; ++j) {
+        keys_[i].emplace_back(implicitA, next);
+        next += SwitchingKey::getWordCount(implicitA);
+      }
+    }
+  }
+  AutedModPackKeys(const AutedModPackKeys &) = delete;
+  AutedModPackKeys &operator=(const AutedModPackKeys &) = delete;
+  AutedModPackKeys(AutedModPackKeys &&) noexcept = default;
+  AutedModPackKeys &operator=(AutedModPackKeys &&) noexcept = default;
+
   std::vector<std::vector<SwitchingKey>> &getKeys() { return keys_; }
   const std::vector<std::vector<SwitchingKey>> &getKeys() const {
     return keys_;
   }
 
 private:
+  AlignedWords slab_;
   std::vector<std::vector<SwitchingKey>> keys_;
 };
 
 class AutedModPackMLWEKeys {
 public:
-  AutedModPackMLWEKeys(u64 rank) : keys_(rank) {
+  AutedModPackMLWEKeys(u64 rank, bool implicitA = false)
+      : slab_(allocateWords(rank * (DEGREE / rank) *
+                            MLWESwitchingKey::getWordCount(rank, implicitA))),
+        keys_(rank) {
+    u64 *next = slab_.get();
     for (u64 i = 0; i < rank; ++i) {
-      for (u64 j = 0; j < DEGREE / rank; ++j)
-        keys_[i].emplace_back(rank);
+      keys_[i].reserve(DEGREE / rank);
+      for (u64 j = 0; j < DEGREE / rank; ++j) {
+        keys_[i].emplace_back(rank, implicitA, next);
+        next += MLWESwitchingKey::getWordCount(rank, implicitA);
+      }
     }
   }
+  AutedModPackMLWEKeys(const AutedModPackMLWEKeys &) = delete;
+  AutedModPackMLWEKeys &operator=(const AutedModPackMLWEKeys &) = delete;
+  AutedModPackMLWEKeys(AutedModPackMLWEKeys &&) noexcept = default;
+  AutedModPackMLWEKeys &operator=(AutedModPackMLWEKeys &&) noexcept = default;
+
   std::vector<std::vector<MLWESwitchingKey>> &getKeys() { return keys_; }
   const std::vector<std::vector<MLWESwitchingKey>> &getKeys() const {
     return keys_;
   }
 
 private:
+  AlignedWords slab_;
   std::vector<std::vector<MLWESwitchingKey>> keys_;
 };
 
 class InvAutKeys {
 public:
-  InvAutKeys(u64 rank) : keys_(rank) {}
+  InvAutKeys(u64 rank, bool implicitA = false)
+      : slab_(allocateWords(rank * SwitchingKey::getWordCount(implicitA))) {
+    const u64 words = SwitchingKey::getWordCount(implicitA);
+    keys_.reserve(rank);
+    for (u64 i = 0; i < rank; ++i)
+      keys_.emplace_back(implicitA, slab_.get() + i * words);
+  }
+  InvAutKeys(const InvAutKeys &) = delete;
+  InvAutKeys &operator=(const InvAutKeys &) = delete;
+  InvAutKeys(InvAutKeys &&) noexcept = default;
+  InvAutKeys &operator=(InvAutKeys &&) noexcept = default;
+
   std::vector<SwitchingKey> &getKeys() { return keys_; }
   const std::vector<SwitchingKey> &getKeys() const { return keys_; }
 
 private:
+  AlignedWords slab_;
   std::vector<SwitchingKey> keys_;
 };
 
@@ -4,16 +4,28 @@
 
 #include "Const.hpp"
 #include "Polynomial.hpp"
+#include "Random.hpp"
 
 namespace HEVEC {
 class MLWESwitchingKey {
 public:
-  MLWESwitchingKey(u64 rank) : rank_(rank), stack_(DEGREE / rank) {
-    for (u64 i = 0; i < 2 * stack_; ++i) {
-      polys_.emplace_back(rank_, MOD_Q);
-      polys_.emplace_back(rank_, MOD_P);
-    }
-  };
+  // An implicit key is built without its A parts; they are expanded from the
+  // seed wherever the key is used. The parts live in one slab, at storage
+  // (getWordCount(rank, implicitA) words) if given.
+  MLWESwitchingKey(u64 rank, bool implicitA = false, u64 *storage = nullptr)
+      : rank_(rank), stack_(DEGREE / rank),
+        polys_(getShapes(rank, implicitA), storage) {};
+  // A copy of other in storage.
+  MLWESwitchingKey(const MLWESwitchingKey &other, u64 *storage)
+      : rank_(other.rank_), stack_(other.stack_),
+        polys_(other.polys_, storage), seed_(other.seed_) {}
+
+  MLWESwitchingKey(const MLWESwitchingKey &other) = default;
+  MLWESwitchingKey(MLWESwitchingKey &&other) noexcept = default;
+
+  static u64 getWordCount(u64 rank, bool implicitA) {
+    return PolynomialArray::getWordCount(getShapes(rank, implicitA));
+  }
 
   Polynomial &getPolyAModQ(u64 idx) { return polys_[idx * 4]; }
   Polynomial &getPolyAModP(u64 idx) { return polys_[idx * 4 + 1]; }
@@ -24,13 +36,63 @@ public:
   const Polynomial &getPolyBModQ(u64 idx) const { return polys_[idx * 4 + 2]; }
   const Polynomial &getPolyBModP(u64 idx) const { return polys_[idx * 4 + 3]; }
 
+  // Returns the A part, expanding it into scratch for an implicit key.
+  const Polynomial &getPolyAModQ(u64 idx, Polynomial &scratch) const {
+    return isImplicit() ? expand(scratch, idx, MOD_Q) : getPolyAModQ(idx);
+  }
+  const Polynomial &getPolyAModP(u64 idx, Polynomial &scratch) const {
+    return isImplicit() ? expand(scratch, idx, MOD_P) : getPolyAModP(idx);
+  }
+
   u64 getRank() const { return rank_; }
   u64 getStack() const { return stack_; }
   u64 getDegree() const { return DEGREE; }
 
+  // AQ, AP, BQ, BP for each stack index in turn, in wire order.
+  PolynomialArray &getPolys() { return polys_; }
+  const PolynomialArray &getPolys() const { return polys_; }
+
+  bool isSeeded() const { return !seed_.empty(); }
+  bool isImplicit() const { return polys_[0].getDegree() == 0; }
+  const u8 *getSeed() const { return seed_.data(); }
+  void setSeed(const u8 *seed) { seed_.assign(seed, seed + SEED_SIZE); }
+
+  // Fills the A parts, in NTT form, from the seed. Each stack index uses its
+  // own stream of the seed. They stay in the slab unless the key is
+  // implicit.
+  void expandPolyA() {
+    for (u64 i = 0; i < stack_; ++i) {
+      expand(polys_[i * 4], i, MOD_Q);
+      expand(polys_[i * 4 + 1], i, MOD_P);
+    }
+  }
+
 private:
+  static std::vector<PolynomialArray::Shape> getShapes(u64 rank,
+                                                       bool implicitA) {
+    const u64 degreeA = implicitA ? 0 : rank;
+    std::vector<PolynomialArray::Shape> shapes;
+    shapes.reserve(4 * (DEGREE / rank));
+    for (u64 i = 0; i < DEGREE / rank; ++i) {
+      shapes.push_back({degreeA, MOD_Q});
+      shapes.push_back({degreeA, MOD_P});
+      shapes.push_back({rank, MOD_Q});
+      shapes.push_back({rank, MOD_P});
+    }
+    return shapes;
+  }
+
+  const Polynomial &expand(Polynomial &res, u64 idx, u64 mod) const {
+    if (res.getDegree() != rank_ || res.getMod() != mod)
+      res = Polynomial(rank_, mod);
+    Random::sampleUniformWithSeed(res, seed_.data(), idx);
+    res.setIsNTT(true);
+    return res;
+  }
+
   const u64 rank_;
   const u64 stack_;
-  std::vector<Polynomial> polys_;
+  PolynomialArray polys_;
+  std::vector<u8> seed_;
 };
-} // namespace HEVEC
\ No newline at end of file
+} // namespace HEVEC
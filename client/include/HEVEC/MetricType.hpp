@@ -8,4 +8,19 @@ enum class MetricType : u8 {
   L2 = 1,
   COSINE = 2,
 };
-} // namespace HEVEC
\ No newline at end of file
+
+// log2 of the scales a collection encodes queries and keys at. Plaintext
+// queries need less precision, so the key side gets the remaining bits.
+struct MetricScales {
+  double logQueryScale;
+  double logKeyScale;
+};
+
+inline MetricScales getMetricScales(MetricType metricType,
+                                    bool isQueryEncrypt) {
+  if (metricType == MetricType::IP)
+    return isQueryEncrypt ? MetricScales{22.0, 22.0} : MetricScales{16.0, 27.0};
+  return isQueryEncrypt ? MetricScales{26.25, 26.25}
+                        : MetricScales{20.0, 32.5};
+}
+} // namespace HEVEC
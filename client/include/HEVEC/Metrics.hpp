@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Type.hpp"
+
+namespace HEVEC {
+
+// Label name/value pairs, rendered in the order given.
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+class Counter {
+public:
+  void inc(u64 n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+  u64 get() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<u64> value_{0};
+};
+
+class Gauge {
+public:
+  void set(double value) { value_.store(value, std::memory_order_relaxed); }
+  void add(double delta) { value_.fetch_add(delta, std::memory_order_relaxed); }
+  double get() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<double> value_{0.0};
+};
+
+// Log-linear buckets in the manner of HdrHistogram: every power of two above
+// unit is split into SUB_BUCKETS equal steps, so a bucket bound is never more
+// than 1 / SUB_BUCKETS above the values it holds. observe() only does
+// relaxed atomic adds.
+class Histogram {
+public:
+  static constexpr u64 SUB_BUCKETS = 4;
+  static constexpr u64 OCTAVES = 36;
+  // Bucket 0 holds values up to unit; the last one everything past the top
+  // octave.
+  static constexpr u64 BUCKET_COUNT = OCTAVES * SUB_BUCKETS + 2;
+
+  explicit Histogram(double unit) : unit_(unit) {}
+
+  void observe(double value);
+
+  double getUnit() const { return unit_; }
+  // Upper bound of bucket index; infinite for the last one.
+  double getUpperBound(u64 index) const;
+  u64 getBucketCount(u64 index) const {
+    return buckets_[index].load(std::memory_order_relaxed);
+  }
+  u64 getCount() const { return count_.load(std::memory_order_relaxed); }
+  double getSum() const { return sum_.load(std::memory_order_relaxed); }
+
+private:
+  const double unit_;
+  std::array<std::atomic<u64>, BUCKET_COUNT> buckets_{};
+  std::atomic<u64> count_{0};
+  std::atomic<double> sum_{0.0};
+};
+
+// Named metric families in the Prometheus text format. Creating or removing
+// a series takes a lock; updating one never does, so hot paths keep the
+// returned pointer and update it directly.
+class MetricsRegistry {
+public:
+  std::shared_ptr<Counter> counter(const std::string &name,
+                                   const std::string &help,
+                                   const MetricLabels &labels = {});
+  std::shared_ptr<Gauge> gauge(const std::string &name,
+                               const std::string &help,
+                               const MetricLabels &labels = {});
+  // unit is the upper bound of the first bucket, e.g. 1e-6 for seconds.
+  std::shared_ptr<Histogram> histogram(const std::string &name,
+                                       const std::string &help,
+                                       const MetricLabels &labels,
+                                       double unit);
+
+  // Unlinks every series carrying label=value. Holders of a removed series
+  // can keep updating it; it is just no longer rendered.
+  void removeSeries(const std::string &label, const std::string &value);
+
+  std::string render() const;
+
+private:
+  enum class Type { Counter, Gauge, Histogram };
+
+  struct Series {
+    MetricLabels labels;
+    std::shared_ptr<Counter> counter;
+    std::shared_ptr<Gauge> gauge;
+    std::shared_ptr<Histogram> histogram;
+  };
+
+  struct Family {
+    Type type;
+    std::string help;
+    std::map<std::string, Series> series;
+  };
+
+  Series &getSeries(const std::string &name, const std::string &help,
+                    Type type, const MetricLabels &labels);
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Family> families_;
+};
+
+} // namespace HEVEC
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <vector>
+
+#include "Type.hpp"
+
+namespace HEVEC {
+
+// A NUMA node the process may run on, with the CPUs of its affinity mask
+// that belong to it.
+struct NumaNode {
+  u64 id;
+  std::vector<int> cpus;
+};
+
+// The nodes of the host, read from sysfs once. A single node holding every
+// allowed CPU if the host has one, sysfs is missing, or HEVEC_NUMA=off.
+const std::vector<NumaNode> &getNumaNodes();
+
+// Makes node (an index into getNumaNodes()) the preferred home of the whole
+// pages in [data, data + bytes), moving those already touched. Best effort:
+// a no-op on a single node or where the kernel refuses.
+void bindToNumaNode(const void *data, u64 bytes, u64 node);
+
+} // namespace HEVEC
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "Const.hpp"
+#include "Memory.hpp"
+#include "Polynomial.hpp"
+
+namespace HEVEC {
+
+// Encoded PIR payloads indexed by database position. Rows are allocated in
+// slabs of ROWS_PER_SLAB (2 MB, one huge page) when the first of them is
+// set, so memory follows the number of inserted payloads instead of the PIR
+// capacity. A compact store keeps the raw payload bytes and leaves encoding
+// and NTT to the PIR evaluation.
+//
+// The slab table is sized for the capacity up front and a set row stays in
+// place, so rows below a count published by the writer can be read while
+// later rows are being set.
+class PIRDatabase {
+public:
+  explicit PIRDatabase(u64 capacity, bool isCompact = false);
+
+  void setRow(u64 index, Polynomial &&row);
+  void setRow(u64 index, const unsigned char *payload);
+
+  const Polynomial &getRow(u64 index) const {
+    return *slabs_[index / ROWS_PER_SLAB]->rows[index % ROWS_PER_SLAB];
+  }
+  void getRow(Polynomial &res, u64 index) const;
+
+  static void expandPayload(Polynomial &res, const unsigned char *payload);
+
+  u64 getCapacity() const { return capacity_; }
+  bool getIsCompact() const { return isCompact_; }
+  // Bytes held by stored rows.
+  u64 getMemoryBytes() const { return numSlabs_ * getSlabWords() * sizeof(u64); }
+
+private:
+  static constexpr u64 ROWS_PER_SLAB = 64;
+
+  struct Slab {
+    AlignedWords words;
+    // Views into words, set with their rows; empty in a compact store.
+    std::unique_ptr<Polynomial> rows[ROWS_PER_SLAB];
+  };
+
+  u64 getSlabWords() const {
+    return ROWS_PER_SLAB *
+           (isCompact_ ? PIR_PAYLOAD_SIZE / sizeof(u64) : DEGREE);
+  }
+  Slab &reserveSlab(u64 index);
+
+  const u64 capacity_;
+  const bool isCompact_;
+  // One entry per ROWS_PER_SLAB rows of the capacity; never resized.
+  std::vector<std::unique_ptr<Slab>> slabs_;
+  u64 numSlabs_ = 0;
+};
+
+// HEVEC_PIR_STORE=compact: collections keep compact PIR stores, with raw
+// payload bytes per row that are encoded when a PIR query is evaluated.
+bool useCompactPIRStore();
+} // namespace HEVEC
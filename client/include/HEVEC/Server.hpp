@@ -1,10 +1,14 @@
 #pragma once
 
+#include <memory>
+#include <vector>
+
 #include "Ciphertext.hpp"
 #include "Const.hpp"
 #include "HEval.hpp"
 #include "Keys.hpp"
 #include "MLWECiphertext.hpp"
+#include "PackedCiphertext.hpp"
 #include "Polynomial.hpp"
 #include "SwitchingKey.hpp"
 
@@ -13,38 +17,104 @@ namespace HEVEC {
 class CachedQuery {
 public:
   CachedQuery(u64 rank) : rank_(rank), ctxts_(rank) {}
+  // A copy of other placed on NUMA node node, for scans run there.
+  CachedQuery(const CachedQuery &other, u64 node);
 
+  // Empty once tiled.
   std::vector<Ciphertext> &getCtxts() { return ctxts_; }
   const std::vector<Ciphertext> &getCtxts() const { return ctxts_; }
 
+  CiphertextSpan getSpan() const {
+    return tiled_ ? CiphertextSpan(tiled_.get(), rank_)
+                  : CiphertextSpan(ctxts_);
+  }
+  // Moves the ciphertexts into the scan layout; Server::cacheQuery does this
+  // once it has built them. reset() brings back zeroed ciphertexts.
+  void tile();
+  void reset();
+
 private:
   const u64 rank_;
   std::vector<Ciphertext> ctxts_;
+  std::shared_ptr<const u64> tiled_;
 };
 
 class CachedKeys {
 public:
   CachedKeys(u64 rank) : rank_(rank), ctxts_(rank) {}
-
+  // A full block in the scan layout, packed or not, in memory that storage
+  // keeps alive (see BlockFile).
+  CachedKeys(u64 rank, const u64 *tiled, std::shared_ptr<const void> storage,
+             bool packed = false)
+      : rank_(rank), tiled_(tiled), storage_(std::move(storage)),
+        packed_(packed), is_mapped_(true) {}
+
+  // Empty for a tiled block.
   std::vector<Ciphertext> &getCtxts() { return ctxts_; }
   const std::vector<Ciphertext> &getCtxts() const { return ctxts_; }
 
+  bool isTiled() const { return tiled_ != nullptr; }
+  // Tiled in memory the block does not own, such as a file mapping.
+  bool isMapped() const { return is_mapped_; }
+  // Tiled with bit-packed coefficients.
+  bool isPacked() const { return packed_; }
+  CiphertextSpan getSpan() const {
+    return tiled_ ? CiphertextSpan(tiled_, rank_, packed_)
+                  : CiphertextSpan(ctxts_);
+  }
+  // Moves the ciphertexts of a full block into the scan layout, which block
+  // scans read, bit-packing them if packed. Server::cacheKeys does this for
+  // the blocks it builds; a tiled block is converted to the other packing.
+  void tile(bool packed = false);
+  // Brings back zeroed ciphertexts in place of a tiled block.
+  void reset();
+  // Starts reading a mapped block that is not resident into memory, without
+  // waiting for it. Does nothing for other blocks.
+  void prefetch() const;
+  // Moves a tiled block held on the heap to NUMA node node. Mapped blocks
+  // are left where the thread that pages them in puts them.
+  void bindToNode(u64 node) const;
+
+  // Mod-QP key switching sums of a block that is still being filled through
+  // Server::appendToCache. Empty for blocks built by Server::cacheKeys.
+  std::vector<SwitchingKey> &getPendingSums() { return pendingSums_; }
+  const std::vector<SwitchingKey> &getPendingSums() const {
+    return pendingSums_;
+  }
+  void releasePendingSums() { std::vector<SwitchingKey>().swap(pendingSums_); }
+
 private:
   const u64 rank_;
   std::vector<Ciphertext> ctxts_;
+  std::vector<SwitchingKey> pendingSums_;
+  const u64 *tiled_ = nullptr;
+  std::shared_ptr<const void> storage_;
+  bool packed_ = false;
+  bool is_mapped_ = false;
 };
 
 class CachedPlaintextQuery {
 public:
   CachedPlaintextQuery(u64 rank)
       : rank_(rank), polys_(rank, Polynomial(DEGREE, MOD_Q)) {}
+  CachedPlaintextQuery(const CachedPlaintextQuery &other, u64 node);
 
+  // Empty once tiled.
   std::vector<Polynomial> &getPolys() { return polys_; }
   const std::vector<Polynomial> &getPolys() const { return polys_; }
 
+  PolynomialSpan getSpan() const {
+    return tiled_ ? PolynomialSpan(tiled_.get(), rank_)
+                  : PolynomialSpan(polys_);
+  }
+  // As for CachedQuery.
+  void tile();
+  void reset();
+
 private:
   const u64 rank_;
   std::vector<Polynomial> polys_;
+  std::shared_ptr<const u64> tiled_;
 };
 
 class Server {
@@ -56,19 +126,53 @@ public:
   void cacheQuery(CachedQuery &res, const MLWECiphertext &query);
   void cacheQuery(CachedPlaintextQuery &res, const Polynomial &query);
   void cacheKeys(CachedKeys &res, const std::vector<MLWECiphertext> &keys);
+  void appendToCache(CachedKeys &res, u64 slot, const MLWECiphertext &key);
+  void appendToCache(CachedKeys &res, u64 slot,
+                     const std::vector<MLWECiphertext> &keys);
   void innerProduct(Ciphertext &res, const CachedQuery &cachedQuery,
                     const CachedKeys &cachedKey);
   void innerProduct(Ciphertext &res, const CachedPlaintextQuery &cachedQuery,
                     const CachedKeys &cachedKey);
+  // One pass over cachedKey for all queries; res[q] answers cachedQueries[q].
+  void innerProduct(std::vector<Ciphertext> &res,
+                    const std::vector<CachedQuery> &cachedQueries,
+                    const CachedKeys &cachedKey);
+  void innerProduct(std::vector<Ciphertext> &res,
+                    const std::vector<CachedPlaintextQuery> &cachedQueries,
+                    const CachedKeys &cachedKey);
+  // The two halves of the encrypted innerProduct, for callers that time
+  // them apart: the extended (A, B, C) sum over the block, then
+  // relinearization back to (A, B).
+  void multSum(Ciphertext &res, const CachedQuery &cachedQuery,
+               const CachedKeys &cachedKey);
+  void multSum(std::vector<Ciphertext> &res,
+               const std::vector<CachedQuery> &cachedQueries,
+               const CachedKeys &cachedKey);
+  // Uses the copy of the relinearization key on the NUMA node of the
+  // caller's TaskNode, if there are several nodes.
+  void relin(Ciphertext &res, const Ciphertext &op);
+  void modSwitch(PackedCiphertext &res, const Ciphertext &score);
 
 private:
+  void butterflyExponents(std::vector<u64> &res, u64 slot);
+  void spreadAdd(Polynomial &res, const Polynomial &op,
+                 const Polynomial &monomial);
+
   const u64 logRank_;
   const u64 rank_;
   const u64 stack_;
 
   HEval eval_;
 
+  // spreadIndex*_[t] is the rank-point NTT slot holding X^stack evaluated at
+  // the t-th DEGREE-point NTT slot.
+  std::vector<u64> spreadIndexQ_;
+  std::vector<u64> spreadIndexP_;
+
   const SwitchingKey &relinKey_;
+  // relinKey_ copied onto each NUMA node; empty with a single node.
+  std::vector<AlignedWords> nodeRelinStorage_;
+  std::vector<SwitchingKey> nodeRelinKeys_;
   const AutedModPackKeys &autedModPackKeys_;
   const AutedModPackMLWEKeys &autedModPackMLWEKeys_;
 };
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Type.hpp"
+
+namespace HEVEC {
+
+// Threads the process should compute on: HEVEC_THREADS if set, otherwise
+// the CPUs in its affinity mask, capped by its cgroup CPU quota.
+u64 detectThreadCount();
+
+// Work-stealing pool behind parallelFor. Each worker runs the tasks it
+// pushed itself newest first (a nested loop stays on the thread that
+// entered it, with its data hot) and, when it runs out, steals the oldest
+// task of another worker. Tasks pushed by threads outside the pool go to a
+// shared queue. One process-wide pool serves all requests, so concurrent
+// loops share the cores instead of each starting a team of its own.
+//
+// On a host with several NUMA nodes the workers are spread over the nodes
+// and pinned to their CPUs. Loops run under a TaskNode scope queue their
+// tasks on that node, where only its workers take them.
+class TaskPool {
+public:
+  using Task = std::function<void()>;
+
+  // numThreads counts the threads that enter loops as well as the workers:
+  // the pool starts numThreads - 1 of them.
+  explicit TaskPool(u64 numThreads);
+  ~TaskPool();
+
+  TaskPool(const TaskPool &) = delete;
+  TaskPool &operator=(const TaskPool &) = delete;
+
+  // The process-wide pool, of detectThreadCount() threads.
+  static TaskPool &get();
+
+  u64 getNumThreads() const { return workers_.size() + 1; }
+  // NUMA nodes the workers are spread over; 1 without NUMA, or with fewer
+  // workers than nodes.
+  u64 getNumNodes() const { return nodes_.size(); }
+  // Workers pinned to node.
+  u64 getNodeThreads(u64 node) const { return nodes_[node]->threads; }
+  // Whether the caller is one of the workers of node.
+  bool isWorkerOn(u64 node) const;
+
+  // Queues task on the calling worker, or on the shared queue.
+  void push(Task task);
+  // Queues task for the workers of node.
+  void push(Task task, u64 node);
+
+private:
+  struct Worker {
+    u64 node = 0;
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    std::thread thread;
+  };
+  struct Node {
+    u64 threads = 0;
+    std::vector<int> cpus; // to pin workers to, empty with a single node
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    std::atomic<u64> queued{0};
+  };
+
+  bool pop(u64 self, Task &task);
+  void run(u64 self);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::unique_ptr<Node>> nodes_;
+  std::mutex shared_mutex_;
+  std::deque<Task> shared_;
+
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  std::atomic<u64> queued_{0};
+  bool stop_ = false;
+};
+
+// Caps the threads, the caller included, that parallelFor calls made on this
+// thread may use while it lives. Loops nested in a loop split the budget of
+// that loop among its runners. Without one, a loop may use the whole pool.
+class TaskBudget {
+public:
+  explicit TaskBudget(u64 threads);
+  ~TaskBudget();
+
+  TaskBudget(const TaskBudget &) = delete;
+  TaskBudget &operator=(const TaskBudget &) = delete;
+
+  static u64 current();
+
+private:
+  u64 previous_;
+};
+
+// Pins parallelFor calls made on this thread while it lives to the workers
+// of NUMA node node, so a scan of memory placed there stays local. Loops
+// nested in them inherit the node. No effect with a single node.
+class TaskNode {
+public:
+  explicit TaskNode(u64 node);
+  ~TaskNode();
+
+  TaskNode(const TaskNode &) = delete;
+  TaskNode &operator=(const TaskNode &) = delete;
+
+  // The node of the innermost TaskNode, or 0 without one.
+  static u64 current();
+
+private:
+  i64 previous_;
+};
+
+// Runs body(begin, end) over consecutive chunks of [0, count) on up to
+// TaskBudget::current() threads, the caller among them, and returns once all
+// of them have run. Threads claim chunks as they go, so uneven iterations
+// even out. The first exception thrown by body is rethrown here, after the
+// chunks already claimed have finished; later chunks are skipped. Under a
+// TaskNode the threads are the workers of that node; a caller from another
+// node only waits for them.
+void parallelForRange(u64 count, const std::function<void(u64, u64)> &body);
+
+// Runs body(node) once for each node of the pool, on a worker of that node
+// under TaskNode(node), with the caller's budget split among the nodes by
+// their thread counts. Returns once all have run, rethrowing the first
+// exception. With a single node, runs body(0) on the caller.
+void parallelForNodes(const std::function<void(u64)> &body);
+
+// Runs body(i) for every i in [0, count), as parallelForRange.
+template <typename Body> void parallelFor(u64 count, Body &&body) {
+  parallelForRange(count, [&](u64 begin, u64 end) {
+    for (u64 i = begin; i < end; ++i)
+      body(i);
+  });
+}
+
+// Runs body(i, j) for every i in [0, rows) and j in [0, cols).
+template <typename Body> void parallelFor(u64 rows, u64 cols, Body &&body) {
+  parallelForRange(rows * cols, [&](u64 begin, u64 end) {
+    for (u64 k = begin; k < end; ++k)
+      body(k / cols, k % cols);
+  });
+}
+
+} // namespace HEVEC
@@ -1450,6 +1450,7 @@ public:
             InstanceMethod("terminate", &HEVECClientWrap::Terminate),
             InstanceMethod("insert", &HEVECClientWrap::Insert),
             InstanceMethod("query", &HEVECClientWrap::Query),
+            InstanceMethod("queryBatch", &HEVECClientWrap::QueryBatch),
             InstanceMethod("queryAndTopK", &HEVECClientWrap::QueryAndTopK),
             InstanceMethod("queryAndTopKWithScores",
                            &HEVECClientWrap::QueryAndTopKWithScores),
@@ -1547,6 +1548,26 @@ private:
     return arr;
   }
 
+  Napi::Value QueryBatch(const Napi::CallbackInfo &info) {
+    if (info.Length() < 2) {
+      Napi::TypeError::New(info.Env(), "queryBatch(collectionName, queryVecs)")
+          .ThrowAsJavaScriptException();
+      return info.Env().Undefined();
+    }
+    std::string name = info[0].As<Napi::String>().Utf8Value();
+    auto matrix = RequireFloatMatrix(info.Env(), info[1], "queryVecs");
+    auto results = client_->queryBatch(name, matrix);
+    Napi::Array outer = Napi::Array::New(info.Env(), results.size());
+    for (size_t q = 0; q < results.size(); ++q) {
+      Napi::Array arr = Napi::Array::New(info.Env(), results[q].size());
+      for (size_t i = 0; i < results[q].size(); ++i) {
+        arr.Set(i, Napi::Number::New(info.Env(), results[q][i]));
+      }
+      outer.Set(q, arr);
+    }
+    return outer;
+  }
+
   void QueryAndTopK(const Napi::CallbackInfo &info) {
     if (info.Length() < 3) {
       Napi::TypeError::New(info.Env(),
@@ -163,6 +163,10 @@ export class HEVECClient {
     payloads: string[],
   ): void;
   query(collection: string, queryVector: ArrayLike<number>): number[];
+  queryBatch(
+    collection: string,
+    queryVectors: ArrayLike<ArrayLike<number>>,
+  ): number[][];
   queryAndTopK(result: TopK, collection: string, queryVector: ArrayLike<number>): void;
   queryAndTopKWithScores(
     collection: string,
@@ -0,0 +1,103 @@
+#include "HEVEC/BlockFile.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include "HEVEC/Const.hpp"
+
+namespace HEVEC {
+
+namespace {
+
+std::runtime_error blockFileError(const std::string &path,
+                                  const std::string &what) {
+  return std::runtime_error("Block file " + path + ": " + what + ": " +
+                            std::strerror(errno));
+}
+
+void writeAll(int fd, const u64 *data, u64 size, u64 offset,
+              const std::string &path) {
+  const auto *bytes = reinterpret_cast<const unsigned char *>(data);
+  while (size > 0) {
+    const ssize_t n = ::pwrite(fd, bytes, size, static_cast<off_t>(offset));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      throw blockFileError(path, "write failed");
+    }
+    bytes += n;
+    size -= static_cast<u64>(n);
+    offset += static_cast<u64>(n);
+  }
+}
+
+u64 pageAligned(u64 bytes) {
+  static const u64 PAGE_SIZE = ::sysconf(_SC_PAGESIZE);
+  return (bytes + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+}
+
+} // namespace
+
+BlockFile::BlockFile(const std::string &path, u64 rank, bool packed)
+    : path_(path), rank_(rank), packed_(packed),
+      data_bytes_(CiphertextSpan::getTiledWords(rank, packed) * sizeof(u64)),
+      block_bytes_(pageAligned(data_bytes_)) {
+  // A new inode rather than a truncated one: blocks mapped from an earlier
+  // file of the same collection stay readable.
+  ::unlink(path.c_str());
+  fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd_ < 0)
+    throw blockFileError(path, "cannot create");
+}
+
+BlockFile::~BlockFile() { ::close(fd_); }
+
+std::shared_ptr<const CachedKeys> BlockFile::append(const CachedKeys &block) {
+  const CiphertextSpan span = block.getSpan();
+  if (span.size() != rank_)
+    throw std::runtime_error("Block file " + path_ + ": not a full block");
+  for (const Ciphertext &ctxt : block.getCtxts()) {
+    if (ctxt.getIsExtended() || !ctxt.getIsNTT())
+      throw std::runtime_error("Block file " + path_ +
+                               ": block is not in NTT form");
+  }
+
+  // Blocks are whole multiples of the page size, so each maps on its own.
+  // They are stored in the scan layout; a block not already in it, with the
+  // file's packing, is gathered one tile at a time.
+  const u64 offset = num_blocks_ * block_bytes_;
+  if (span.isTiled() && span.isPacked() == packed_) {
+    writeAll(fd_, span.getData(), data_bytes_, offset, path_);
+  } else {
+    const u64 tile_words = data_bytes_ / N_SCAN_TILES / sizeof(u64);
+    std::vector<u64> tile(tile_words);
+    for (u64 t = 0; t < N_SCAN_TILES; ++t) {
+      span.copyTile(t, tile.data(), packed_);
+      writeAll(fd_, tile.data(), tile_words * sizeof(u64),
+               offset + t * tile_words * sizeof(u64), path_);
+    }
+  }
+  // The padding reads as zeros.
+  if (block_bytes_ > data_bytes_ &&
+      ::ftruncate(fd_, static_cast<off_t>(offset + block_bytes_)) != 0)
+    throw blockFileError(path_, "write failed");
+
+  void *map = ::mmap(nullptr, block_bytes_, PROT_READ, MAP_SHARED, fd_,
+                     static_cast<off_t>(offset));
+  if (map == MAP_FAILED)
+    throw blockFileError(path_, "mmap failed");
+  ++num_blocks_;
+
+  const u64 bytes = block_bytes_;
+  std::shared_ptr<const void> storage(
+      map, [bytes](const void *p) { ::munmap(const_cast<void *>(p), bytes); });
+  return std::make_shared<const CachedKeys>(
+      rank_, static_cast<const u64 *>(map), std::move(storage), packed_);
+}
+
+} // namespace HEVEC
@@ -11,7 +11,6 @@
 #include <cstring>
 #include <fstream>
 #include <functional>
-#include <iomanip>
 #include <iostream>
 #include <limits>
 #include <memory>
@@ -28,9 +27,14 @@
 #include "HEVEC/Ciphertext.hpp"
 #include "HEVEC/Client.hpp"
 #include "HEVEC/Const.hpp"
+#include "HEVEC/Log.hpp"
 #include "HEVEC/MLWECiphertext.hpp"
+#include "HEVEC/MLWESwitchingKey.hpp"
 #include "HEVEC/Message.hpp"
 #include "HEVEC/MetricType.hpp"
+#include "HEVEC/PackedCiphertext.hpp"
+#include "HEVEC/Random.hpp"
+#include "HEVEC/SwitchingKey.hpp"
 #include "HEVEC/TopK.hpp"
 
 namespace HEVEC {
@@ -39,26 +43,19 @@ namespace {
 
 namespace http = boost::beast::http;
 
-void logToFile(const std::string &message) {
-  const char *log_path_env = std::getenv("HEVEC_CLIENT_LOG_PATH");
-  if (log_path_env) {
-    std::ofstream log_file(log_path_env, std::ios::app);
-    if (log_file.is_open()) {
-      auto now = std::chrono::system_clock::now();
-      auto time_t = std::chrono::system_clock::to_time_t(now);
-      auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                    now.time_since_epoch()) %
-                1000;
-
-      log_file << "["
-               << std::put_time(std::localtime(&time_t), "%Y-%m-%d %H:%M:%S");
-      log_file << "." << std::setfill('0') << std::setw(3) << ms.count()
-               << "] ";
-      log_file << message << std::endl;
-      log_file.close();
-    }
-  }
-}
+// Queries sent per /collections/query_batch request by queryBatch.
+constexpr u64 QUERY_BATCH_SIZE = 16;
+
+// Compact responses keep this many bits below the output scale, which puts
+// the mod-switch rounding noise near 2^-14 in score units. PIR results only
+// need to separate the 2-bit payload digits.
+constexpr u64 RESPONSE_PRECISION_BITS = 18;
+constexpr u64 PIR_RESPONSE_BITS = 16;
+
+#define LOG_DEBUG(message)                                                     \
+  HEVEC_LOG(getClientLogger(), LogLevel::Debug, message)
+#define LOG_INFO(message) HEVEC_LOG(getClientLogger(), LogLevel::Info, message)
+#define LOG_WARN(message) HEVEC_LOG(getClientLogger(), LogLevel::Warn, message)
 
 void handleOpenSslErrors() {
   ERR_print_errors_fp(stderr);
@@ -225,6 +222,23 @@ inline void appendBinary(std::vector<uint8_t> &out, const void *data,
   out.insert(out.end(), ptr, ptr + len);
 }
 
+// Seeded switching keys are sent as the seed of their A parts followed by B.
+void appendSeededKey(std::vector<uint8_t> &out, const SwitchingKey &key) {
+  appendBinary(out, key.getSeed(), SEED_SIZE);
+  appendBinary(out, key.getPolyBModQ().getData(), DEGREE * sizeof(u64));
+  appendBinary(out, key.getPolyBModP().getData(), DEGREE * sizeof(u64));
+}
+
+void appendSeededKey(std::vector<uint8_t> &out, const MLWESwitchingKey &key) {
+  appendBinary(out, key.getSeed(), SEED_SIZE);
+  for (u64 k = 0; k < key.getStack(); ++k) {
+    appendBinary(out, key.getPolyBModQ(k).getData(),
+                 key.getRank() * sizeof(u64));
+    appendBinary(out, key.getPolyBModP(k).getData(),
+                 key.getRank() * sizeof(u64));
+  }
+}
+
 std::string vectorToString(const std::vector<uint8_t> &data) {
   return std::string(data.begin(), data.end());
 }
@@ -253,6 +267,9 @@ struct HEVECClient::CollectionContext {
 
   bool isQueryEncrypt;
 
+  // Width scores are switched down to when compact responses are enabled.
+  u64 responseBits;
+
   CollectionContext(u64 dim, MetricType mt, bool is_encrypt)
       : dimension(dim), log_rank(static_cast<u64>(std::ceil(std::log2(dim)))),
         rank(1ULL << log_rank), stack(DEGREE / rank), metric_type(mt),
@@ -260,24 +277,13 @@ struct HEVECClient::CollectionContext {
         pirClient(std::make_unique<Client>(PIR_LOG_RANK)),
         autedModPackKeys(rank), autedModPackMLWEKeys(rank),
         pirInvAutKeys(PIR_RANK), isQueryEncrypt(is_encrypt) {
-    if (metric_type == MetricType::IP) {
-      if (is_encrypt) {
-        queryScale = std::pow(2.0, 22);
-        keyScale = std::pow(2.0, 22);
-      } else {
-        queryScale = std::pow(2.0, 16);
-        keyScale = std::pow(2.0, 27);
-      }
-    } else if (metric_type == MetricType::COSINE) {
-      if (is_encrypt) {
-        queryScale = std::pow(2.0, 26.25);
-        keyScale = std::pow(2.0, 26.25);
-      } else {
-        queryScale = std::pow(2.0, 20);
-        keyScale = std::pow(2.0, 32.5);
-      }
-    }
+    const MetricScales scales = getMetricScales(metric_type, is_encrypt);
+    queryScale = std::pow(2.0, scales.logQueryScale);
+    keyScale = std::pow(2.0, scales.logKeyScale);
     outputScale = queryScale * keyScale;
+    responseBits = static_cast<u64>(std::ceil(
+                       std::log2(static_cast<double>(MOD_Q) / outputScale))) +
+                   RESPONSE_PRECISION_BITS;
   }
 };
 
@@ -299,7 +305,7 @@ HEVECClient::HEVECClient(const std::string &host, const std::string &port)
 
   if (!sec_key_path.empty()) {
     if (secKey_.load(sec_key_path)) {
-      logToFile("Loaded secret key from " + sec_key_path);
+      LOG_INFO("Loaded secret key from " + sec_key_path);
       secKeyGenerated_ = true;
     }
   }
@@ -310,18 +316,23 @@ HEVECClient::HEVECClient(const std::string &host, const std::string &port)
 
   if (!aes_key_path.empty()) {
     if (loadAesKey(aes_key_path, aesKey_)) {
-      logToFile("Loaded AES key from " + aes_key_path);
+      LOG_INFO("Loaded AES key from " + aes_key_path);
       aesKeyGenerated_ = true;
     }
   }
 
+  const char *compact_env = std::getenv("HEVEC_COMPACT_RESPONSE");
+  compactResponses_ = compact_env && std::string(compact_env) == "1";
+  const char *trace_env = std::getenv("HEVEC_TRACE_REQUESTS");
+  traceRequests_ = trace_env && std::string(trace_env) == "1";
+
   if (!aesKeyGenerated_) {
     generateAesKey(aesKey_);
     aesKeyGenerated_ = true;
-    logToFile("Generated new AES key.");
+    LOG_INFO("Generated new AES key.");
     if (!aes_key_path.empty()) {
       if (saveAesKey(aes_key_path, aesKey_)) {
-        logToFile("Saved new AES key to " + aes_key_path);
+        LOG_INFO("Saved new AES key to " + aes_key_path);
       } else {
         std::cerr << "Failed to save AES key to " << aes_key_path << std::endl;
       }
@@ -366,15 +377,18 @@ HEVECClient::performPost(const std::string &target, std::vector<uint8_t> &&body,
   if (close) {
     req.set(http::field::connection, "close");
   }
+  if (traceRequests_) {
+    req.set("X-HEVEC-Trace", "1");
+  }
   req.body() = std::move(body);
   req.prepare_payload();
 
-  http::write(stream_, req);
+  bytesSent_ += http::write(stream_, req);
 
   http::response_parser<HttpResponse::body_type> parser;
   parser.body_limit(static_cast<std::uint64_t>(max_body_size_));
   try {
-    http::read(stream_, buffer_, parser);
+    bytesReceived_ += http::read(stream_, buffer_, parser);
   } catch (const boost::system::system_error &err) {
     closeStream();
     throw std::runtime_error(std::string("HTTP POST ") + target +
@@ -383,6 +397,12 @@ HEVECClient::performPost(const std::string &target, std::vector<uint8_t> &&body,
   HttpResponse res = parser.release();
   buffer_.consume(buffer_.size());
 
+  auto timing = res.find("Server-Timing");
+  if (timing != res.end()) {
+    lastServerTiming_ = std::string(timing->value());
+    LOG_DEBUG("Server-Timing " + target + ": " + lastServerTiming_);
+  }
+
   if (close || res.need_eof()) {
     closeStream();
   }
@@ -406,12 +426,12 @@ HEVECClient::HttpResponse HEVECClient::performDelete(const std::string &target)
   req.prepare_payload();
   req.content_length(0);
 
-  http::write(stream_, req);
+  bytesSent_ += http::write(stream_, req);
 
   http::response_parser<HttpResponse::body_type> parser;
   parser.body_limit(static_cast<std::uint64_t>(max_body_size_));
   try {
-    http::read(stream_, buffer_, parser);
+    bytesReceived_ += http::read(stream_, buffer_, parser);
   } catch (const boost::system::system_error &err) {
     closeStream();
     throw std::runtime_error(std::string("HTTP DELETE ") + target +
@@ -433,6 +453,57 @@ HEVECClient::HttpResponse HEVECClient::performDelete(const std::string &target)
   return res;
 }
 
+void HEVECClient::appendQuery(std::vector<uint8_t> &body,
+                              CollectionContext &ctx, const Message &msg) {
+  if (!ctx.isQueryEncrypt) {
+    Polynomial query(ctx.rank, MOD_Q);
+    ctx.client->encodeQuery(query, msg, ctx.queryScale);
+    appendBinary(body, query.getData(), ctx.rank * sizeof(u64));
+    return;
+  }
+  // Seeded query: the server expands A from the seed, only B is sent.
+  u8 seed[SEED_SIZE];
+  Random::getRandomSeed(seed);
+  MLWECiphertext query(ctx.rank);
+  ctx.client->encryptQuery(query, msg, secKey_, ctx.queryScale, seed);
+  appendBinary(body, seed, SEED_SIZE);
+  appendBinary(body, query.getB().getData(), ctx.rank * sizeof(u64));
+}
+
+void HEVECClient::decryptScores(std::vector<Message> &res,
+                                CollectionContext &ctx,
+                                const HttpResponse &response, u64 count) {
+  res.clear();
+  res.reserve(count);
+  for (u64 i = 0; i < count; ++i)
+    res.emplace_back(DEGREE);
+
+  BinaryReader reader(response.body());
+  if (compactResponses_) {
+    std::vector<PackedCiphertext> ret(count,
+                                      PackedCiphertext(ctx.responseBits));
+    for (u64 i = 0; i < count; ++i) {
+      if (!reader.readBytes(ret[i].getWords().data(),
+                            ret[i].getWords().size() * sizeof(u64))) {
+        throw std::runtime_error("Malformed query response from server");
+      }
+    }
+    ctx.client->decryptScore(res, ret, secKey_, ctx.outputScale);
+    return;
+  }
+
+  std::vector<Ciphertext> ret(count);
+  for (u64 i = 0; i < count; ++i) {
+    if (!reader.readBytes(ret[i].getA().getData(), DEGREE * sizeof(u64)) ||
+        !reader.readBytes(ret[i].getB().getData(), DEGREE * sizeof(u64))) {
+      throw std::runtime_error("Malformed query response from server");
+    }
+    ret[i].getA().setIsNTT(true);
+    ret[i].getB().setIsNTT(true);
+  }
+  ctx.client->decryptScore(res, ret, secKey_, ctx.outputScale);
+}
+
 u64 HEVECClient::setupCollection(const std::string &collectionName, u64 dimension,
                                const std::string &metric_type_str,
                                bool is_query_encrypt) {
@@ -475,9 +546,9 @@ u64 HEVECClient::setupCollection(const std::string &collectionName, u64 dimensio
           server_dimension, server_metric_type, is_query_encrypt);
     }
     db_sizes_[collectionName] = server_db_size;
-    logToFile("Collection '" + collectionName +
-              "' ready on server with size " +
-              std::to_string(server_db_size) + ". Setup complete.");
+    LOG_INFO("Collection '" + collectionName +
+             "' ready on server with size " +
+             std::to_string(server_db_size) + ". Setup complete.");
     return server_db_size;
   }
 
@@ -500,7 +571,7 @@ u64 HEVECClient::setupCollection(const std::string &collectionName, u64 dimensio
     if (sec_key_path_env) {
       std::string sec_key_path(sec_key_path_env);
       if (secKey_.save(sec_key_path)) {
-        logToFile("Saved new secret key to " + sec_key_path);
+        LOG_INFO("Saved new secret key to " + sec_key_path);
       } else {
         std::cerr << "Failed to save secret key to " << sec_key_path
                   << std::endl;
@@ -514,7 +585,7 @@ u64 HEVECClient::setupCollection(const std::string &collectionName, u64 dimensio
   ctx->pirClient->genInvAutKeys(ctx->pirInvAutKeys.getKeys(), secKey_,
                                 PIR_RANK);
 
-  logToFile("Collection '" + collectionName + "' is new. Sending keys...");
+  LOG_INFO("Collection '" + collectionName + "' is new. Sending keys...");
 
   std::vector<uint8_t> key_body;
   appendBinary(key_body, collectionHash);
@@ -523,59 +594,20 @@ u64 HEVECClient::setupCollection(const std::string &collectionName, u64 dimensio
   has_keys = 1;
   appendBinary(key_body, has_keys);
 
-  appendBinary(key_body, ctx->relinKey.getPolyAModQ().getData(),
-               DEGREE * sizeof(u64));
-  appendBinary(key_body, ctx->relinKey.getPolyAModP().getData(),
-               DEGREE * sizeof(u64));
-  appendBinary(key_body, ctx->relinKey.getPolyBModQ().getData(),
-               DEGREE * sizeof(u64));
-  appendBinary(key_body, ctx->relinKey.getPolyBModP().getData(),
-               DEGREE * sizeof(u64));
-
+  appendSeededKey(key_body, ctx->relinKey);
   for (u64 i = 0; i < ctx->rank; ++i) {
-    for (u64 j = 0; j < ctx->stack; ++j) {
-      auto &key = ctx->autedModPackKeys.getKeys()[i][j];
-      appendBinary(key_body, key.getPolyAModQ().getData(),
-                   DEGREE * sizeof(u64));
-      appendBinary(key_body, key.getPolyAModP().getData(),
-                   DEGREE * sizeof(u64));
-      appendBinary(key_body, key.getPolyBModQ().getData(),
-                   DEGREE * sizeof(u64));
-      appendBinary(key_body, key.getPolyBModP().getData(),
-                   DEGREE * sizeof(u64));
-    }
+    for (u64 j = 0; j < ctx->stack; ++j)
+      appendSeededKey(key_body, ctx->autedModPackKeys.getKeys()[i][j]);
   }
-
   for (u64 i = 0; i < ctx->rank; ++i) {
-    for (u64 j = 0; j < ctx->stack; ++j) {
-      auto &key = ctx->autedModPackMLWEKeys.getKeys()[i][j];
-      for (u64 k = 0; k < ctx->stack; ++k) {
-        appendBinary(key_body, key.getPolyAModQ(k).getData(),
-                     ctx->rank * sizeof(u64));
-        appendBinary(key_body, key.getPolyAModP(k).getData(),
-                     ctx->rank * sizeof(u64));
-        appendBinary(key_body, key.getPolyBModQ(k).getData(),
-                     ctx->rank * sizeof(u64));
-        appendBinary(key_body, key.getPolyBModP(k).getData(),
-                     ctx->rank * sizeof(u64));
-      }
-    }
-  }
-
-  for (u64 i = 0; i < PIR_RANK; ++i) {
-    auto &key = ctx->pirInvAutKeys.getKeys()[i];
-    appendBinary(key_body, key.getPolyAModQ().getData(),
-                 DEGREE * sizeof(u64));
-    appendBinary(key_body, key.getPolyAModP().getData(),
-                 DEGREE * sizeof(u64));
-    appendBinary(key_body, key.getPolyBModQ().getData(),
-                 DEGREE * sizeof(u64));
-    appendBinary(key_body, key.getPolyBModP().getData(),
-                 DEGREE * sizeof(u64));
+    for (u64 j = 0; j < ctx->stack; ++j)
+      appendSeededKey(key_body, ctx->autedModPackMLWEKeys.getKeys()[i][j]);
   }
+  for (u64 i = 0; i < PIR_RANK; ++i)
+    appendSeededKey(key_body, ctx->pirInvAutKeys.getKeys()[i]);
 
   auto final_response =
-      performPost("/collections/setup", std::move(key_body));
+      performPost("/collections/setup_seeded", std::move(key_body));
   BinaryReader final_reader(final_response.body());
 
   uint8_t final_status = 0;
@@ -601,7 +633,7 @@ u64 HEVECClient::setupCollection(const std::string &collectionName, u64 dimensio
   }
 
   db_sizes_[collectionName] = final_db_size;
-  logToFile("Collection '" + collectionName + "' registered on server.");
+  LOG_INFO("Collection '" + collectionName + "' registered on server.");
 
   return final_db_size;
 }
@@ -626,7 +658,7 @@ void HEVECClient::dropCollection(const std::string &collectionName) {
   collections_.erase(collectionName);
   db_sizes_.erase(collectionName);
 
-  logToFile("Dropped collection '" + collectionName + "'");
+  LOG_INFO("Dropped collection '" + collectionName + "'");
 }
 
 
@@ -661,8 +693,8 @@ void HEVECClient::insert(const std::string &collectionName,
 
   std::vector<uint8_t> body;
   body.reserve(sizeof(collectionHash) + sizeof(num_to_insert) +
-               num_to_insert * (ctx->stack * ctx->rank * sizeof(u64) +
-                                ctx->rank * sizeof(u64) + PIR_PAYLOAD_SIZE));
+               num_to_insert * (SEED_SIZE + ctx->rank * sizeof(u64) +
+                                PIR_PAYLOAD_SIZE));
   appendBinary(body, collectionHash);
   appendBinary(body, num_to_insert);
 
@@ -675,13 +707,13 @@ void HEVECClient::insert(const std::string &collectionName,
     for (u64 k = 0; k < vec.size(); ++k)
       msg[k] = vec[k];
 
+    // Only the seed of A is sent; the server expands it on receipt.
+    u8 seed[SEED_SIZE];
+    Random::getRandomSeed(seed);
     MLWECiphertext key_to_send(ctx->rank);
-    ctx->client->encryptKey(key_to_send, msg, secKey_, ctx->keyScale);
+    ctx->client->encryptKey(key_to_send, msg, secKey_, ctx->keyScale, seed);
 
-    for (u64 k = 0; k < ctx->stack; ++k) {
-      appendBinary(body, key_to_send.getA(k).getData(),
-                   ctx->rank * sizeof(u64));
-    }
+    appendBinary(body, seed, SEED_SIZE);
     appendBinary(body, key_to_send.getB().getData(),
                  ctx->rank * sizeof(u64));
 
@@ -690,15 +722,15 @@ void HEVECClient::insert(const std::string &collectionName,
     appendBinary(body, aes_payload.data(), PIR_PAYLOAD_SIZE);
   }
 
-  performPost("/collections/insert", std::move(body));
+  performPost("/collections/insert_seeded", std::move(body));
 
   db_sizes_.at(collectionName) += num_to_insert;
   auto whole_end = std::chrono::high_resolution_clock::now();
   auto whole_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
       whole_end - whole_start);
-  logToFile("Sent " + std::to_string(num_to_insert) +
-            " keys to server. Total time: " +
-            std::to_string(whole_duration.count()) + "ms");
+  LOG_INFO("Sent " + std::to_string(num_to_insert) +
+           " keys to server. Total time: " +
+           std::to_string(whole_duration.count()) + "ms");
 }
 
 
@@ -733,60 +765,36 @@ std::vector<float> HEVECClient::query(const std::string &collectionName,
 
   auto start_enc = std::chrono::high_resolution_clock::now();
 
-  if (ctx->isQueryEncrypt) {
-    MLWECiphertext query(ctx->rank);
-    ctx->client->encryptQuery(query, msg, secKey_, ctx->queryScale);
-
-    for (u64 i = 0; i < ctx->stack; ++i) {
-      appendBinary(request_body, query.getA(i).getData(),
-                   ctx->rank * sizeof(u64));
-    }
-    appendBinary(request_body, query.getB().getData(),
-                 ctx->rank * sizeof(u64));
-  } else {
-    Polynomial query(ctx->rank, MOD_Q);
-    ctx->client->encodeQuery(query, msg, ctx->queryScale);
-    appendBinary(request_body, query.getData(), ctx->rank * sizeof(u64));
-  }
+  appendQuery(request_body, *ctx, msg);
 
   auto end_enc = std::chrono::high_resolution_clock::now();
   auto duration_enc = std::chrono::duration_cast<std::chrono::milliseconds>(
       end_enc - start_enc);
-  logToFile("Encrypt/Encode query: " + std::to_string(duration_enc.count()) +
+  LOG_DEBUG("Encrypt/Encode query: " + std::to_string(duration_enc.count()) +
             "ms");
 
+  if (compactResponses_)
+    appendBinary(request_body, ctx->responseBits);
+
   auto start_rt = std::chrono::high_resolution_clock::now();
   const char *endpoint =
-      ctx->isQueryEncrypt ? "/collections/query" : "/collections/query_ptxt";
+      ctx->isQueryEncrypt ? "/collections/query_seeded"
+                          : "/collections/query_ptxt";
   auto response = performPost(endpoint, std::move(request_body));
   auto end_rt = std::chrono::high_resolution_clock::now();
   auto duration_rt = std::chrono::duration_cast<std::chrono::milliseconds>(
       end_rt - start_rt);
 
-  std::vector<Ciphertext> ret(iter);
-  std::vector<Message> dmsg;
-  dmsg.reserve(iter);
-  for (u64 j = 0; j < iter; ++j)
-    dmsg.emplace_back(DEGREE);
-
-  BinaryReader reader(response.body());
-  for (u64 i = 0; i < iter; ++i) {
-    if (!reader.readBytes(ret[i].getA().getData(), DEGREE * sizeof(u64)) ||
-        !reader.readBytes(ret[i].getB().getData(), DEGREE * sizeof(u64))) {
-      throw std::runtime_error("Malformed query response from server");
-    }
-    ret[i].getA().setIsNTT(true);
-    ret[i].getB().setIsNTT(true);
-  }
-  logToFile("Query round trip: " + std::to_string(duration_rt.count()) +
+  LOG_DEBUG("Query round trip: " + std::to_string(duration_rt.count()) +
             "ms");
 
+  std::vector<Message> dmsg;
   auto start_dec = std::chrono::high_resolution_clock::now();
-  ctx->client->decryptScore(dmsg, ret, secKey_, ctx->outputScale);
+  decryptScores(dmsg, *ctx, response, iter);
   auto end_dec = std::chrono::high_resolution_clock::now();
   auto duration_dec = std::chrono::duration_cast<std::chrono::milliseconds>(
       end_dec - start_dec);
-  logToFile("Decrypt score: " + std::to_string(duration_dec.count()) + "ms");
+  LOG_DEBUG("Decrypt score: " + std::to_string(duration_dec.count()) + "ms");
 
   std::vector<float> results;
   results.reserve(db_sizes_.at(collectionName));
@@ -801,12 +809,87 @@ std::vector<float> HEVECClient::query(const std::string &collectionName,
   auto whole_end = std::chrono::high_resolution_clock::now();
   auto whole_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
       whole_end - whole_start);
-  logToFile("Total query time: " + std::to_string(whole_duration.count()) +
-            "ms");
+  LOG_INFO("Total query time: " + std::to_string(whole_duration.count()) +
+           "ms");
   return results;
 }
 
 
+std::vector<std::vector<float>>
+HEVECClient::queryBatch(const std::string &collectionName,
+                        const std::vector<std::vector<float>> &query_vecs) {
+  if (query_vecs.empty())
+    return {};
+  if (!collections_.count(collectionName)) {
+    u64 dimension = query_vecs[0].size();
+    setupCollection(collectionName, dimension, "COSINE", true);
+  }
+  auto &ctx = collections_.at(collectionName);
+  const u64 db_size = db_sizes_.at(collectionName);
+  if (db_size == 0) {
+    throw std::logic_error("DB in collection " + collectionName +
+                           " is empty. Call insert first.");
+  }
+  for (const auto &query_vec : query_vecs) {
+    if (query_vec.size() > ctx->rank) {
+      throw std::invalid_argument(
+          "Query dimension " + std::to_string(query_vec.size()) +
+          " exceeds collection capacity " + std::to_string(ctx->rank));
+    }
+  }
+
+  auto whole_start = std::chrono::high_resolution_clock::now();
+
+  u64 collectionHash = std::hash<std::string>{}(collectionName);
+  const u64 iter = (db_size + DEGREE - 1) / DEGREE;
+  const char *endpoint = ctx->isQueryEncrypt
+                             ? "/collections/query_batch_seeded"
+                             : "/collections/query_ptxt_batch";
+
+  std::vector<std::vector<float>> results(query_vecs.size());
+  for (u64 first = 0; first < query_vecs.size(); first += QUERY_BATCH_SIZE) {
+    const u64 count =
+        std::min<u64>(QUERY_BATCH_SIZE, query_vecs.size() - first);
+
+    std::vector<uint8_t> request_body;
+    appendBinary(request_body, collectionHash);
+    appendBinary(request_body, count);
+
+    for (u64 q = first; q < first + count; ++q) {
+      Message msg(ctx->rank);
+      for (u64 j = 0; j < query_vecs[q].size(); ++j)
+        msg[j] = query_vecs[q][j];
+
+      appendQuery(request_body, *ctx, msg);
+    }
+
+    if (compactResponses_)
+      appendBinary(request_body, ctx->responseBits);
+
+    auto response = performPost(endpoint, std::move(request_body));
+
+    // The response holds iter score ciphertexts per query, grouped by query.
+    std::vector<Message> dmsg;
+    decryptScores(dmsg, *ctx, response, count * iter);
+
+    for (u64 q = 0; q < count; ++q) {
+      auto &scores = results[first + q];
+      scores.reserve(db_size);
+      for (u64 j = 0; j < iter; ++j) {
+        for (u64 k = 0; k < DEGREE && j * DEGREE + k < db_size; ++k)
+          scores.push_back(dmsg[q * iter + j][k]);
+      }
+    }
+  }
+
+  auto whole_end = std::chrono::high_resolution_clock::now();
+  auto whole_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+      whole_end - whole_start);
+  LOG_INFO("Total batch query time for " + std::to_string(query_vecs.size()) +
+           " queries: " + std::to_string(whole_duration.count()) + "ms");
+  return results;
+}
+
 void HEVECClient::queryAndTopK(TopK &res, const std::string &collectionName,
                              const std::vector<float> &query_vec) {
   if (!collections_.count(collectionName)) {
@@ -841,59 +924,36 @@ void HEVECClient::queryAndTopK(TopK &res, const std::string &collectionName,
 
   auto start_enc = std::chrono::high_resolution_clock::now();
 
-  if (ctx->isQueryEncrypt) {
-    MLWECiphertext query(ctx->rank);
-    ctx->client->encryptQuery(query, msg, secKey_, ctx->queryScale);
-    for (u64 i = 0; i < ctx->stack; ++i) {
-      appendBinary(request_body, query.getA(i).getData(),
-                   ctx->rank * sizeof(u64));
-    }
-    appendBinary(request_body, query.getB().getData(),
-                 ctx->rank * sizeof(u64));
-  } else {
-    Polynomial query(ctx->rank, MOD_Q);
-    ctx->client->encodeQuery(query, msg, ctx->queryScale);
-    appendBinary(request_body, query.getData(), ctx->rank * sizeof(u64));
-  }
+  appendQuery(request_body, *ctx, msg);
 
   auto end_enc = std::chrono::high_resolution_clock::now();
   auto duration_enc = std::chrono::duration_cast<std::chrono::milliseconds>(
       end_enc - start_enc);
-  logToFile("Encrypt/Encode query: " + std::to_string(duration_enc.count()) +
+  LOG_DEBUG("Encrypt/Encode query: " + std::to_string(duration_enc.count()) +
             "ms");
 
+  if (compactResponses_)
+    appendBinary(request_body, ctx->responseBits);
+
   const char *endpoint =
-      ctx->isQueryEncrypt ? "/collections/query" : "/collections/query_ptxt";
+      ctx->isQueryEncrypt ? "/collections/query_seeded"
+                          : "/collections/query_ptxt";
   auto start_rt = std::chrono::high_resolution_clock::now();
   auto response = performPost(endpoint, std::move(request_body));
   auto end_rt = std::chrono::high_resolution_clock::now();
   auto duration_rt = std::chrono::duration_cast<std::chrono::milliseconds>(
       end_rt - start_rt);
 
-  std::vector<Ciphertext> ret(iter);
-  BinaryReader reader(response.body());
-  for (u64 i = 0; i < iter; ++i) {
-    if (!reader.readBytes(ret[i].getA().getData(), DEGREE * sizeof(u64)) ||
-        !reader.readBytes(ret[i].getB().getData(), DEGREE * sizeof(u64))) {
-      throw std::runtime_error("Malformed query response from server");
-    }
-    ret[i].getA().setIsNTT(true);
-    ret[i].getB().setIsNTT(true);
-  }
-  logToFile("Query round trip: " + std::to_string(duration_rt.count()) +
+  LOG_DEBUG("Query round trip: " + std::to_string(duration_rt.count()) +
             "ms");
 
   std::vector<Message> dmsg;
-  dmsg.reserve(iter);
-  for (u64 j = 0; j < iter; ++j)
-    dmsg.emplace_back(DEGREE);
-
   auto start_decrypt = std::chrono::high_resolution_clock::now();
-  ctx->client->decryptScore(dmsg, ret, secKey_, ctx->outputScale);
+  decryptScores(dmsg, *ctx, response, iter);
   auto end_decrypt = std::chrono::high_resolution_clock::now();
   auto duration_decrypt = std::chrono::duration_cast<std::chrono::milliseconds>(
       end_decrypt - start_decrypt);
-  logToFile("Decrypt score: " + std::to_string(duration_decrypt.count()) +
+  LOG_DEBUG("Decrypt score: " + std::to_string(duration_decrypt.count()) +
             "ms");
 
   auto start_topk = std::chrono::high_resolution_clock::now();
@@ -931,14 +991,14 @@ void HEVECClient::queryAndTopK(TopK &res, const std::string &collectionName,
   auto end_topk = std::chrono::high_resolution_clock::now();
   auto duration_topk = std::chrono::duration_cast<std::chrono::milliseconds>(
       end_topk - start_topk);
-  logToFile("Top-K calculation: " + std::to_string(duration_topk.count()) +
+  LOG_DEBUG("Top-K calculation: " + std::to_string(duration_topk.count()) +
             "ms");
 
   auto whole_end = std::chrono::high_resolution_clock::now();
   auto whole_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
       whole_end - whole_start);
-  logToFile("Total queryAndTopK time: " +
-            std::to_string(whole_duration.count()) + "ms");
+  LOG_INFO("Total queryAndTopK time: " +
+           std::to_string(whole_duration.count()) + "ms");
 }
 
 
@@ -978,59 +1038,36 @@ void HEVECClient::queryAndTopKWithScores(std::vector<std::pair<u64, float>> &res
 
   auto start_enc = std::chrono::high_resolution_clock::now();
 
-  if (ctx->isQueryEncrypt) {
-    MLWECiphertext query(ctx->rank);
-    ctx->client->encryptQuery(query, msg, secKey_, ctx->queryScale);
-    for (u64 i = 0; i < ctx->stack; ++i) {
-      appendBinary(request_body, query.getA(i).getData(),
-                   ctx->rank * sizeof(u64));
-    }
-    appendBinary(request_body, query.getB().getData(),
-                 ctx->rank * sizeof(u64));
-  } else {
-    Polynomial query(ctx->rank, MOD_Q);
-    ctx->client->encodeQuery(query, msg, ctx->queryScale);
-    appendBinary(request_body, query.getData(), ctx->rank * sizeof(u64));
-  }
+  appendQuery(request_body, *ctx, msg);
 
   auto end_enc = std::chrono::high_resolution_clock::now();
   auto duration_enc = std::chrono::duration_cast<std::chrono::milliseconds>(
       end_enc - start_enc);
-  logToFile("Encrypt/Encode query: " + std::to_string(duration_enc.count()) +
+  LOG_DEBUG("Encrypt/Encode query: " + std::to_string(duration_enc.count()) +
             "ms");
 
+  if (compactResponses_)
+    appendBinary(request_body, ctx->responseBits);
+
   const char *endpoint =
-      ctx->isQueryEncrypt ? "/collections/query" : "/collections/query_ptxt";
+      ctx->isQueryEncrypt ? "/collections/query_seeded"
+                          : "/collections/query_ptxt";
   auto start_rt = std::chrono::high_resolution_clock::now();
   auto response = performPost(endpoint, std::move(request_body));
   auto end_rt = std::chrono::high_resolution_clock::now();
   auto duration_rt = std::chrono::duration_cast<std::chrono::milliseconds>(
       end_rt - start_rt);
 
-  std::vector<Ciphertext> ret(iter);
-  BinaryReader reader(response.body());
-  for (u64 i = 0; i < iter; ++i) {
-    if (!reader.readBytes(ret[i].getA().getData(), DEGREE * sizeof(u64)) ||
-        !reader.readBytes(ret[i].getB().getData(), DEGREE * sizeof(u64))) {
-      throw std::runtime_error("Malformed query response from server");
-    }
-    ret[i].getA().setIsNTT(true);
-    ret[i].getB().setIsNTT(true);
-  }
-  logToFile("Query round trip: " + std::to_string(duration_rt.count()) +
+  LOG_DEBUG("Query round trip: " + std::to_string(duration_rt.count()) +
             "ms");
 
   std::vector<Message> dmsg;
-  dmsg.reserve(iter);
-  for (u64 j = 0; j < iter; ++j)
-    dmsg.emplace_back(DEGREE);
-
   auto start_decrypt = std::chrono::high_resolution_clock::now();
-  ctx->client->decryptScore(dmsg, ret, secKey_, ctx->outputScale);
+  decryptScores(dmsg, *ctx, response, iter);
   auto end_decrypt = std::chrono::high_resolution_clock::now();
   auto duration_decrypt = std::chrono::duration_cast<std::chrono::milliseconds>(
       end_decrypt - start_decrypt);
-  logToFile("Decrypt score: " + std::to_string(duration_decrypt.count()) +
+  LOG_DEBUG("Decrypt score: " + std::to_string(duration_decrypt.count()) +
             "ms");
 
   auto start_topk = std::chrono::high_resolution_clock::now();
@@ -1077,14 +1114,14 @@ void HEVECClient::queryAndTopKWithScores(std::vector<std::pair<u64, float>> &res
   auto end_topk = std::chrono::high_resolution_clock::now();
   auto duration_topk = std::chrono::duration_cast<std::chrono::milliseconds>(
       end_topk - start_topk);
-  logToFile("Top-K calculation: " + std::to_string(duration_topk.count()) +
+  LOG_DEBUG("Top-K calculation: " + std::to_string(duration_topk.count()) +
             "ms");
 
   auto whole_end = std::chrono::high_resolution_clock::now();
   auto whole_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
       whole_end - whole_start);
-  logToFile("Total queryAndTopKWithScores time: " +
-            std::to_string(whole_duration.count()) + "ms");
+  LOG_INFO("Total queryAndTopKWithScores time: " +
+           std::to_string(whole_duration.count()) + "ms");
 }
 
 
@@ -1195,32 +1232,48 @@ std::string HEVECClient::retrievePIR(const std::string &collectionName,
   u64 row = index / PIR_RANK;
   u64 col = index % PIR_RANK;
 
-  ctx->pirClient->encryptPIR(firstDim, row, secKey_, first_scale);
-  ctx->pirClient->encryptPIR(secondDim, col, secKey_, second_scale);
+  u8 firstSeed[SEED_SIZE], secondSeed[SEED_SIZE];
+  Random::getRandomSeed(firstSeed);
+  Random::getRandomSeed(secondSeed);
+  ctx->pirClient->encryptPIR(firstDim, row, secKey_, first_scale, firstSeed);
+  ctx->pirClient->encryptPIR(secondDim, col, secKey_, second_scale,
+                             secondSeed);
 
   std::vector<uint8_t> body;
   appendBinary(body, collectionHash);
-  appendBinary(body, firstDim.getA().getData(), DEGREE * sizeof(u64));
+  appendBinary(body, firstSeed, SEED_SIZE);
   appendBinary(body, firstDim.getB().getData(), DEGREE * sizeof(u64));
-  appendBinary(body, secondDim.getA().getData(), DEGREE * sizeof(u64));
+  appendBinary(body, secondSeed, SEED_SIZE);
   appendBinary(body, secondDim.getB().getData(), DEGREE * sizeof(u64));
+  if (compactResponses_)
+    appendBinary(body, PIR_RESPONSE_BITS);
 
-  auto response = performPost("/collections/pir_retrieve", std::move(body));
-
-  if (response.body().size() != 2 * DEGREE * sizeof(u64)) {
-    throw std::runtime_error("Malformed PIR retrieve response from server");
-  }
-
-  BinaryReader reader(response.body());
-  Ciphertext result;
-  reader.readBytes(result.getA().getData(), DEGREE * sizeof(u64));
-  reader.readBytes(result.getB().getData(), DEGREE * sizeof(u64));
-  result.getA().setIsNTT(true);
-  result.getB().setIsNTT(true);
+  auto response =
+      performPost("/collections/pir_retrieve_seeded", std::move(body));
 
   Message dmsg(DEGREE);
   const double doubleScale = std::pow(2.0, PIR_FIRST_SCALE + PIR_SECOND_SCALE);
-  ctx->pirClient->decrypt(dmsg, result, secKey_, doubleScale);
+  if (compactResponses_) {
+    PackedCiphertext result(PIR_RESPONSE_BITS);
+    if (response.body().size() != result.getWords().size() * sizeof(u64)) {
+      throw std::runtime_error("Malformed PIR retrieve response from server");
+    }
+    std::memcpy(result.getWords().data(), response.body().data(),
+                response.body().size());
+    ctx->pirClient->decrypt(dmsg, result, secKey_, doubleScale);
+  } else {
+    if (response.body().size() != 2 * DEGREE * sizeof(u64)) {
+      throw std::runtime_error("Malformed PIR retrieve response from server");
+    }
+
+    BinaryReader reader(response.body());
+    Ciphertext result;
+    reader.readBytes(result.getA().getData(), DEGREE * sizeof(u64));
+    reader.readBytes(result.getB().getData(), DEGREE * sizeof(u64));
+    result.getA().setIsNTT(true);
+    result.getB().setIsNTT(true);
+    ctx->pirClient->decrypt(dmsg, result, secKey_, doubleScale);
+  }
 
   unsigned char aes_payload[PIR_PAYLOAD_SIZE];
   ctx->pirClient->decodePIRPayload(aes_payload, dmsg);
@@ -1,5 +1,6 @@
 #include "HEVEC/HEval.hpp"
 
+#include <algorithm>
 #include <cstring>
 #include <immintrin.h>
 #include <map>
@@ -11,25 +12,57 @@
 #include "hexl/ntt/ntt.hpp"
 #include "hexl/number-theory/number-theory.hpp"
 
-#ifndef HEVEC_DISABLE_OPENMP
-#include <omp.h>
-#endif
-
 #include "HEVEC/MLWESwitchingKey.hpp"
 #include "HEVEC/Ciphertext.hpp"
 #include "HEVEC/Const.hpp"
 #include "HEVEC/Exception.hpp"
+#include "HEVEC/PackedCiphertext.hpp"
 #include "HEVEC/Polynomial.hpp"
 #include "HEVEC/SwitchingKey.hpp"
+#include "HEVEC/TaskPool.hpp"
+#include "HEVEC/Trace.hpp"
 
 namespace HEVEC {
 
-HEval::HEval(u64 logRank) : logRank_(logRank), rank_(1ULL << logRank) {
-#ifndef HEVEC_DISABLE_OPENMP
-  omp_set_max_active_levels(1);
-  omp_set_num_threads(N_THREAD);
-#endif
+namespace {
+// Queries sharing one pass over a key block. The accumulators of a tile stay
+// within a 48 KiB per-thread working set.
+constexpr u64 BATCH_TILE = 8;
+
+// Reduces sums of products of residues once per coefficient. A product of two
+// residues below 2^55 fits in 110 bits, so a 128-bit accumulator holds 2^18
+// of them before it can overflow. The optional scale is folded in here.
+class LazyReducer {
+public:
+  LazyReducer(u64 mod, u64 scale)
+      : mod_(mod), barr_((static_cast<u128>(1) << 64) / mod),
+        scale_(scale % mod),
+        highScale_(intel::hexl::MultiplyMod(
+            static_cast<u64>((static_cast<u128>(1) << 64) % mod), scale_,
+            mod)) {}
+
+  void addTo(u64 *res, const u128 *acc, u64 size) const {
+    for (u64 i = 0; i < size; ++i) {
+      const u64 high = intel::hexl::BarrettReduce64(
+          static_cast<u64>(acc[i] >> 64), mod_, barr_);
+      const u64 low =
+          intel::hexl::BarrettReduce64(static_cast<u64>(acc[i]), mod_, barr_);
+      const u64 sum = intel::hexl::AddUIntMod(
+          intel::hexl::MultiplyMod(high, highScale_, mod_),
+          intel::hexl::MultiplyMod(low, scale_, mod_), mod_);
+      res[i] = intel::hexl::AddUIntMod(res[i], sum, mod_);
+    }
+  }
 
+private:
+  const u64 mod_;
+  const u64 barr_;
+  const u64 scale_;
+  const u64 highScale_;
+};
+} // namespace
+
+HEval::HEval(u64 logRank) : logRank_(logRank), rank_(1ULL << logRank) {
   ntts_[rank_ + MOD_Q] = intel::hexl::NTT(rank_, MOD_Q);
   ntts_[rank_ + MOD_P] = intel::hexl::NTT(rank_, MOD_P);
   ntts_[DEGREE + MOD_Q] = intel::hexl::NTT(DEGREE, MOD_Q);
@@ -116,8 +149,7 @@ void HEval::shift(Polynomial &res, const Polynomial &op, u64 exponent,
 
   const u64 stack = op.getDegree() / rank;
 
-#pragma omp parallel for
-  for (u64 i = 0; i < rank; ++i) {
+  parallelFor(rank, [&](u64 i) {
     u64 idx = (exponent + i) & (2 * rank - 1);
     if (idx < rank)
       for (u64 j = 0; j < stack; ++j)
@@ -126,7 +158,7 @@ void HEval::shift(Polynomial &res, const Polynomial &op, u64 exponent,
       for (u64 j = 0; j < stack; ++j)
         res[(idx - rank) * stack + j] =
             op[i * stack + j] ? (op.getMod() - op[i * stack + j]) : 0;
-  }
+  });
   res.setIsNTT(false);
 }
 
@@ -166,8 +198,7 @@ void HEval::normMod(Polynomial &res, const Polynomial &op) {
                     : intel::hexl::BarrettReduce64(op.getMod(), res.getMod(),
                                                    barr_[res.getMod()]));
 
-#pragma omp parallel for
-  for (u64 i = 0; i < op.getDegree(); ++i) {
+  parallelFor(op.getDegree(), [&](u64 i) {
     u64 temp = op[i];
     if (temp > halfMod)
       temp += diff;
@@ -175,7 +206,7 @@ void HEval::normMod(Polynomial &res, const Polynomial &op) {
       temp =
           intel::hexl::BarrettReduce64(temp, res.getMod(), barr_[res.getMod()]);
     res[i] = temp;
-  }
+  });
   res.setIsNTT(false);
 }
 
@@ -184,9 +215,9 @@ void HEval::extract(Polynomial &res, const Polynomial &op) {
     throw InvalidNTTStateException();
   const u64 stack = op.getDegree() / res.getDegree();
 
-#pragma omp parallel for
-  for (u64 i = 0; i < res.getDegree(); ++i)
+  parallelFor(res.getDegree(), [&](u64 i) {
     res[i] = op[(i + 1) * stack - 1];
+  });
   res.setIsNTT(false);
 }
 
@@ -216,54 +247,49 @@ void HEval::intt(Polynomial &res, const Polynomial &op, u64 inputModFactor,
 
 void HEval::add(MLWECiphertext &res, const MLWECiphertext &op1,
                 const MLWECiphertext &op2) {
-#pragma omp parallel for
-  for (u64 i = 0; i < op1.getStack() + 1; ++i) {
+  parallelFor(op1.getStack() + 1, [&](u64 i) {
     if (i < op1.getStack())
       add(res.getA(i), op1.getA(i), op2.getA(i));
     else
       add(res.getB(), op1.getB(), op2.getB());
-  }
+  });
 }
 
 void HEval::sub(MLWECiphertext &res, const MLWECiphertext &op1,
                 const MLWECiphertext &op2) {
-#pragma omp parallel for
-  for (u64 i = 0; i < op1.getStack() + 1; ++i) {
+  parallelFor(op1.getStack() + 1, [&](u64 i) {
     if (i < op1.getStack())
       sub(res.getA(i), op1.getA(i), op2.getA(i));
     else
       sub(res.getB(), op1.getB(), op2.getB());
-  }
+  });
 }
 
 void HEval::mult(MLWECiphertext &res, const MLWECiphertext &op1, u64 op2) {
-#pragma omp parallel for
-  for (u64 i = 0; i < op1.getStack() + 1; ++i) {
+  parallelFor(op1.getStack() + 1, [&](u64 i) {
     if (i < op1.getStack())
       mult(res.getA(i), op1.getA(i), op2);
     else
       mult(res.getB(), op1.getB(), op2);
-  }
+  });
 }
 
 void HEval::shift(MLWECiphertext &res, const MLWECiphertext &op, u64 exponent) {
-#pragma omp parallel for
-  for (u64 i = 0; i < op.getStack() + 1; ++i) {
+  parallelFor(op.getStack() + 1, [&](u64 i) {
     if (i < op.getStack())
       shift(res.getA(i), op.getA(i), exponent, op.getRank());
     else
       shift(res.getB(), op.getB(), exponent, op.getRank());
-  }
+  });
 }
 
 void HEval::aut(MLWECiphertext &res, const MLWECiphertext &op, u64 exponent) {
-#pragma omp parallel for
-  for (u64 i = 0; i < op.getStack() + 1; ++i) {
+  parallelFor(op.getStack() + 1, [&](u64 i) {
     if (i < op.getStack())
       aut(res.getA(i), op.getA(i), exponent, op.getRank());
     else
       aut(res.getB(), op.getB(), exponent, op.getRank());
-  }
+  });
 }
 
 void HEval::aut(Ciphertext &res, const MLWECiphertext &op,
@@ -277,14 +303,13 @@ void HEval::aut(Ciphertext &res, const MLWECiphertext &op,
 
   res.setIsNTT(false);
 
-#pragma omp parallel for
-  for (u64 j = 0; j < op.getRank(); ++j) {
+  parallelFor(op.getRank(), [&](u64 j) {
     u64 idx = (j * exponent) & (2 * op.getRank() - 1);
     if (idx < op.getRank())
       res.getB()[idx * stack] = op.getB()[j];
     else
       res.getB()[idx * stack - op.getDegree()] = MOD_Q - op.getB()[j];
-  }
+  });
   { // i = 0
     aut(temp, op.getA(0), exponent, op.getRank());
     normMod(tempModP, temp);
@@ -292,15 +317,16 @@ void HEval::aut(Ciphertext &res, const MLWECiphertext &op,
     ntt(temp, temp);
     ntt(tempModP, tempModP);
 
-#pragma omp parallel for
-    for (u64 j = 0; j < stack; ++j) {
-      mult(multed.getPolyAModQ(j), temp, autedModPackKeys[0].getPolyAModQ(j));
+    parallelFor(stack, [&](u64 j) {
+      Polynomial keyAQ(0, MOD_Q), keyAP(0, MOD_P);
+      mult(multed.getPolyAModQ(j), temp,
+           autedModPackKeys[0].getPolyAModQ(j, keyAQ));
       mult(multed.getPolyBModQ(j), temp, autedModPackKeys[0].getPolyBModQ(j));
       mult(multed.getPolyAModP(j), tempModP,
-           autedModPackKeys[0].getPolyAModP(j));
+           autedModPackKeys[0].getPolyAModP(j, keyAP));
       mult(multed.getPolyBModP(j), tempModP,
            autedModPackKeys[0].getPolyBModP(j));
-    }
+    });
   }
   for (u64 i = 1; i < stack; ++i) {
     aut(temp, op.getA(i), exponent, op.getRank());
@@ -309,22 +335,21 @@ void HEval::aut(Ciphertext &res, const MLWECiphertext &op,
     ntt(temp, temp);
     ntt(tempModP, tempModP);
 
-#pragma omp parallel for
-    for (u64 j = 0; j < stack; ++j) {
-      Polynomial tempQ(op.getRank(), MOD_Q), tempP(op.getRank(), MOD_P);
-      mult(tempQ, temp, autedModPackKeys[i].getPolyAModQ(j));
+    parallelFor(stack, [&](u64 j) {
+      Polynomial tempQ(op.getRank(), MOD_Q), tempP(op.getRank(), MOD_P),
+          keyAQ(0, MOD_Q), keyAP(0, MOD_P);
+      mult(tempQ, temp, autedModPackKeys[i].getPolyAModQ(j, keyAQ));
       add(multed.getPolyAModQ(j), multed.getPolyAModQ(j), tempQ);
       mult(tempQ, temp, autedModPackKeys[i].getPolyBModQ(j));
       add(multed.getPolyBModQ(j), multed.getPolyBModQ(j), tempQ);
-      mult(tempP, tempModP, autedModPackKeys[i].getPolyAModP(j));
+      mult(tempP, tempModP, autedModPackKeys[i].getPolyAModP(j, keyAP));
       add(multed.getPolyAModP(j), multed.getPolyAModP(j), tempP);
       mult(tempP, tempModP, autedModPackKeys[i].getPolyBModP(j));
       add(multed.getPolyBModP(j), multed.getPolyBModP(j), tempP);
-    }
+    });
   }
 
-#pragma omp parallel for
-  for (u64 i = 0; i < stack; ++i) {
+  parallelFor(stack, [&](u64 i) {
     Polynomial tempQ(op.getRank(), MOD_Q);
     intt(multed.getPolyAModP(i), multed.getPolyAModP(i));
     normMod(tempQ, multed.getPolyAModP(i));
@@ -337,14 +362,13 @@ void HEval::aut(Ciphertext &res, const MLWECiphertext &op,
     intt(multed.getPolyBModQ(i), multed.getPolyBModQ(i));
     sub(multed.getPolyBModQ(i), multed.getPolyBModQ(i), tempQ);
     mult(multed.getPolyBModQ(i), multed.getPolyBModQ(i), INVERSE_P_MOD_Q);
-  }
-#pragma omp parallel for
-  for (u64 i = 0; i < multed.getRank(); ++i) {
+  });
+  parallelFor(multed.getRank(), [&](u64 i) {
     for (u64 j = 0; j < multed.getStack(); ++j) {
       res.getA()[i * stack + j] = multed.getPolyAModQ(j)[i];
       res.getB()[i * stack + j] += multed.getPolyBModQ(j)[i];
     }
-  }
+  });
 
   ntt(res.getA(), res.getA());
   ntt(res.getB(), res.getB());
@@ -416,6 +440,7 @@ void HEval::aut(Ciphertext &res, const Ciphertext &op,
 
 void HEval::relin(Ciphertext &res, const Ciphertext &op,
                   const SwitchingKey &relinKey) {
+  HEVEC_TRACE_SPAN("HEval.relin");
   if (!op.getIsExtended())
     throw InvalidExtendedStateException();
   keySwitch(res, op, relinKey);
@@ -427,37 +452,36 @@ void HEval::modPack(Ciphertext &res, const std::vector<MLWECiphertext> &op,
 
   res.setIsNTT(false);
 
-#pragma omp parallel for
-  for (u64 i = 0; i < getRank(); ++i) {
+  parallelFor(getRank(), [&](u64 i) {
     for (u64 j = 0; j < stack; ++j)
       res.getB()[i * stack + j] = op[j].getB()[i];
-  }
+  });
   Polynomial tempQ(DEGREE, MOD_Q), tempP(DEGREE, MOD_P),
       tempModQ(DEGREE, MOD_Q), tempModP(DEGREE, MOD_P),
       polyAModQ(DEGREE, MOD_Q), polyAModP(DEGREE, MOD_P),
-      polyBModQ(DEGREE, MOD_Q), polyBModP(DEGREE, MOD_P);
+      polyBModQ(DEGREE, MOD_Q), polyBModP(DEGREE, MOD_P), keyAQ(0, MOD_Q),
+      keyAP(0, MOD_P);
   polyAModQ.setIsNTT(true);
   polyAModP.setIsNTT(true);
   polyBModQ.setIsNTT(true);
   polyBModP.setIsNTT(true);
   for (u64 i = 0; i < stack; ++i) {
-#pragma omp parallel for
-    for (u64 j = 0; j < getRank(); ++j) {
+    parallelFor(getRank(), [&](u64 j) {
       for (u64 k = 0; k < stack; ++k)
         tempModQ[j * stack + k] = op[k].getA(i)[j];
-    }
+    });
     tempModQ.setIsNTT(false);
     normMod(tempModP, tempModQ);
 
     ntt(tempModQ, tempModQ);
     ntt(tempModP, tempModP);
 
-    mult(tempQ, tempModQ, modPackKeys[i].getPolyAModQ());
+    mult(tempQ, tempModQ, modPackKeys[i].getPolyAModQ(keyAQ));
     add(polyAModQ, polyAModQ, tempQ);
     mult(tempQ, tempModQ, modPackKeys[i].getPolyBModQ());
     add(polyBModQ, polyBModQ, tempQ);
 
-    mult(tempP, tempModP, modPackKeys[i].getPolyAModP());
+    mult(tempP, tempModP, modPackKeys[i].getPolyAModP(keyAP));
     add(polyAModP, polyAModP, tempP);
     mult(tempP, tempModP, modPackKeys[i].getPolyBModP());
     add(polyBModP, polyBModP, tempP);
@@ -483,11 +507,10 @@ void HEval::modPack(Polynomial &res, const std::vector<Polynomial> &op) {
 
   res.setIsNTT(false);
 
-#pragma omp parallel for
-  for (u64 i = 0; i < getRank(); ++i) {
+  parallelFor(getRank(), [&](u64 i) {
     for (u64 j = 0; j < stack; ++j)
       res[i * stack + j] = op[j][i];
-  }
+  });
   ntt(res, res);
 }
 
@@ -507,145 +530,263 @@ void HEval::intt(Ciphertext &res, const Ciphertext &op, u64 inputModFactor,
   intt(res.getB(), op.getB(), inputModFactor, outputModFactor);
 }
 
-void HEval::multithreadMultSum(Ciphertext &res,
-                               const std::vector<Ciphertext> &op1,
-                               const std::vector<Ciphertext> &op2) {
-  if (!op1[0].getIsNTT() || !op2[0].getIsNTT())
+void HEval::modSwitch(PackedCiphertext &res, const Ciphertext &op) {
+  HEVEC_TRACE_SPAN("HEval.modSwitch");
+  if (op.getIsExtended())
+    throw InvalidExtendedStateException();
+  Ciphertext coeffs;
+  if (op.getIsNTT()) {
+    intt(coeffs, op);
+  } else {
+    coeffs = op;
+  }
+
+  // round(c * 2^bits / MOD_Q) through a 64-bit fixed-point ratio; the
+  // truncated ratio moves a result by at most one unit.
+  const u64 bits = res.getBits();
+  const u64 mask = (1ULL << bits) - 1;
+  const u64 ratio = (static_cast<u128>(1) << (64 + bits)) / MOD_Q;
+  std::vector<u64> &words = res.getWords();
+  std::fill(words.begin(), words.end(), 0);
+
+  const u64 *polys[2] = {coeffs.getA().getData(), coeffs.getB().getData()};
+  u64 bitPos = 0;
+  for (const u64 *poly : polys) {
+    for (u64 i = 0; i < DEGREE; ++i, bitPos += bits) {
+      const u64 value =
+          static_cast<u64>((static_cast<u128>(poly[i]) * ratio +
+                            (static_cast<u128>(1) << 63)) >>
+                           64) &
+          mask;
+      const u64 word = bitPos >> 6, offset = bitPos & 63;
+      words[word] |= value << offset;
+      if (offset + bits > 64)
+        words[word + 1] |= value >> (64 - offset);
+    }
+  }
+}
+
+void HEval::modSwitch(Ciphertext &res, const PackedCiphertext &op) {
+  HEVEC_TRACE_SPAN("HEval.modSwitch");
+  if (res.getIsExtended())
+    throw InvalidExtendedStateException();
+  const u64 bits = op.getBits();
+  const u64 mask = (1ULL << bits) - 1;
+  const std::vector<u64> &words = op.getWords();
+
+  u64 *polys[2] = {res.getA().getData(), res.getB().getData()};
+  u64 bitPos = 0;
+  for (u64 *poly : polys) {
+    for (u64 i = 0; i < DEGREE; ++i, bitPos += bits) {
+      const u64 word = bitPos >> 6, offset = bitPos & 63;
+      u64 value = words[word] >> offset;
+      if (offset + bits > 64)
+        value |= words[word + 1] << (64 - offset);
+      value &= mask;
+      poly[i] = static_cast<u64>(
+          (static_cast<u128>(value) * MOD_Q + (1ULL << (bits - 1))) >> bits);
+    }
+  }
+  res.setIsNTT(false);
+}
+
+void HEval::multithreadMultSum(Ciphertext &res, CiphertextSpan op1,
+                               CiphertextSpan op2, u64 scale) {
+  HEVEC_TRACE_SPAN("HEval.multithreadMultSum");
+  if (!op1.getIsNTT() || !op2.getIsNTT())
     throw InvalidNTTStateException();
-  constexpr u64 DEGREE_PER_THREAD = DEGREE / N_THREAD;
+  constexpr u64 DEGREE_PER_TILE = SCAN_TILE;
 
   const u64 gap = op1.size() / op2.size();
+  const LazyReducer reducer(MOD_Q, scale);
 
-  Polynomial temp(op1[0].getDegree(), MOD_Q);
-#pragma omp parallel for
-  for (u64 i = 0; i < N_THREAD; ++i) {
+  parallelFor(N_SCAN_TILES, [&](u64 i) {
+    const u64 offset = DEGREE_PER_TILE * i;
+    u128 accA[DEGREE_PER_TILE] = {}, accB[DEGREE_PER_TILE] = {},
+         accC[DEGREE_PER_TILE] = {};
+    u64 tiles[4][DEGREE_PER_TILE];
     for (u64 j = 0; j < op2.size(); ++j) {
-      intel::hexl::EltwiseMultMod(
-          temp.getData() + DEGREE_PER_THREAD * i,
-          op1[j * gap].getA().getData() + DEGREE_PER_THREAD * i,
-          op2[j].getA().getData() + DEGREE_PER_THREAD * i, DEGREE_PER_THREAD,
-          MOD_Q, 1);
-      intel::hexl::EltwiseAddMod(res.getA().getData() + DEGREE_PER_THREAD * i,
-                                 res.getA().getData() + DEGREE_PER_THREAD * i,
-                                 temp.getData() + DEGREE_PER_THREAD * i,
-                                 DEGREE_PER_THREAD, MOD_Q);
-      intel::hexl::EltwiseMultMod(
-          temp.getData() + DEGREE_PER_THREAD * i,
-          op1[j * gap].getA().getData() + DEGREE_PER_THREAD * i,
-          op2[j].getB().getData() + DEGREE_PER_THREAD * i, DEGREE_PER_THREAD,
-          MOD_Q, 1);
-      intel::hexl::EltwiseAddMod(res.getB().getData() + DEGREE_PER_THREAD * i,
-                                 res.getB().getData() + DEGREE_PER_THREAD * i,
-                                 temp.getData() + DEGREE_PER_THREAD * i,
-                                 DEGREE_PER_THREAD, MOD_Q);
-      intel::hexl::EltwiseMultMod(
-          temp.getData() + DEGREE_PER_THREAD * i,
-          op1[j * gap].getB().getData() + DEGREE_PER_THREAD * i,
-          op2[j].getA().getData() + DEGREE_PER_THREAD * i, DEGREE_PER_THREAD,
-          MOD_Q, 1);
-      intel::hexl::EltwiseAddMod(res.getB().getData() + DEGREE_PER_THREAD * i,
-                                 res.getB().getData() + DEGREE_PER_THREAD * i,
-                                 temp.getData() + DEGREE_PER_THREAD * i,
-                                 DEGREE_PER_THREAD, MOD_Q);
-      intel::hexl::EltwiseMultMod(
-          temp.getData() + DEGREE_PER_THREAD * i,
-          op1[j * gap].getB().getData() + DEGREE_PER_THREAD * i,
-          op2[j].getB().getData() + DEGREE_PER_THREAD * i, DEGREE_PER_THREAD,
-          MOD_Q, 1);
-      intel::hexl::EltwiseAddMod(res.getC().getData() + DEGREE_PER_THREAD * i,
-                                 res.getC().getData() + DEGREE_PER_THREAD * i,
-                                 temp.getData() + DEGREE_PER_THREAD * i,
-                                 DEGREE_PER_THREAD, MOD_Q);
+      const u64 *a1 = op1.loadA(j * gap, offset, tiles[0]);
+      const u64 *b1 = op1.loadB(j * gap, offset, tiles[1]);
+      const u64 *a2 = op2.loadA(j, offset, tiles[2]);
+      const u64 *b2 = op2.loadB(j, offset, tiles[3]);
+      for (u64 k = 0; k < DEGREE_PER_TILE; ++k) {
+        accA[k] += static_cast<u128>(a1[k]) * a2[k];
+        accB[k] += static_cast<u128>(a1[k]) * b2[k] +
+                   static_cast<u128>(b1[k]) * a2[k];
+        accC[k] += static_cast<u128>(b1[k]) * b2[k];
+      }
     }
-  }
+    reducer.addTo(res.getA().getData() + offset, accA, DEGREE_PER_TILE);
+    reducer.addTo(res.getB().getData() + offset, accB, DEGREE_PER_TILE);
+    reducer.addTo(res.getC().getData() + offset, accC, DEGREE_PER_TILE);
+  });
   res.setIsNTT(true);
 }
 
-void HEval::multithreadMultSum(Ciphertext &res,
-                               const std::vector<Ciphertext> &op1,
-                               const std::vector<Polynomial> &op2) {
-  if (!op1[0].getIsNTT() || !op2[0].getIsNTT())
+void HEval::multithreadMultSum(Ciphertext &res, CiphertextSpan op1,
+                               PolynomialSpan op2, u64 scale) {
+  HEVEC_TRACE_SPAN("HEval.multithreadMultSum");
+  if (!op1.getIsNTT() || !op2.getIsNTT())
     throw InvalidNTTStateException();
-  constexpr u64 DEGREE_PER_THREAD = DEGREE / N_THREAD;
+  constexpr u64 DEGREE_PER_TILE = SCAN_TILE;
   const u64 gap = op1.size() / op2.size();
+  const LazyReducer reducer(MOD_Q, scale);
 
-  Polynomial temp(op1[0].getDegree(), MOD_Q);
-#pragma omp parallel for
-  for (u64 i = 0; i < N_THREAD; ++i) {
+  parallelFor(N_SCAN_TILES, [&](u64 i) {
+    const u64 offset = DEGREE_PER_TILE * i;
+    u128 accA[DEGREE_PER_TILE] = {}, accB[DEGREE_PER_TILE] = {};
+    u64 tiles[2][DEGREE_PER_TILE];
     for (u64 j = 0; j < op2.size(); ++j) {
-      intel::hexl::EltwiseMultMod(temp.getData() + DEGREE_PER_THREAD * i,
-                                  op1[j * gap].getA().getData() +
-                                      DEGREE_PER_THREAD * i,
-                                  op2[j].getData() + DEGREE_PER_THREAD * i,
-                                  DEGREE_PER_THREAD, MOD_Q, 1);
-      intel::hexl::EltwiseAddMod(res.getA().getData() + DEGREE_PER_THREAD * i,
-                                 res.getA().getData() + DEGREE_PER_THREAD * i,
-                                 temp.getData() + DEGREE_PER_THREAD * i,
-                                 DEGREE_PER_THREAD, MOD_Q);
-      intel::hexl::EltwiseMultMod(temp.getData() + DEGREE_PER_THREAD * i,
-                                  op1[j * gap].getB().getData() +
-                                      DEGREE_PER_THREAD * i,
-                                  op2[j].getData() + DEGREE_PER_THREAD * i,
-                                  DEGREE_PER_THREAD, MOD_Q, 1);
-      intel::hexl::EltwiseAddMod(res.getB().getData() + DEGREE_PER_THREAD * i,
-                                 res.getB().getData() + DEGREE_PER_THREAD * i,
-                                 temp.getData() + DEGREE_PER_THREAD * i,
-                                 DEGREE_PER_THREAD, MOD_Q);
+      const u64 *a1 = op1.loadA(j * gap, offset, tiles[0]);
+      const u64 *b1 = op1.loadB(j * gap, offset, tiles[1]);
+      const u64 *p2 = op2.get(j, offset);
+      for (u64 k = 0; k < DEGREE_PER_TILE; ++k) {
+        accA[k] += static_cast<u128>(a1[k]) * p2[k];
+        accB[k] += static_cast<u128>(b1[k]) * p2[k];
+      }
     }
-  }
+    reducer.addTo(res.getA().getData() + offset, accA, DEGREE_PER_TILE);
+    reducer.addTo(res.getB().getData() + offset, accB, DEGREE_PER_TILE);
+  });
   res.setIsNTT(true);
 }
 
+void HEval::multithreadMultSum(
+    std::vector<Ciphertext> &res,
+    const std::vector<CiphertextSpan> &op1, CiphertextSpan op2, u64 scale) {
+  HEVEC_TRACE_SPAN("HEval.multithreadMultSum");
+  if (op1.empty() || res.size() != op1.size())
+    throw InvalidBatchSizeException();
+  for (const CiphertextSpan &query : op1)
+    if (!query.getIsNTT())
+      throw InvalidNTTStateException();
+  if (!op2.getIsNTT())
+    throw InvalidNTTStateException();
+  constexpr u64 DEGREE_PER_TILE = SCAN_TILE;
+
+  const u64 gap = op1[0].size() / op2.size();
+  const LazyReducer reducer(MOD_Q, scale);
+
+  parallelFor(N_SCAN_TILES, [&](u64 i) {
+    const u64 offset = DEGREE_PER_TILE * i;
+    u128 accA[BATCH_TILE][DEGREE_PER_TILE], accB[BATCH_TILE][DEGREE_PER_TILE],
+        accC[BATCH_TILE][DEGREE_PER_TILE];
+    u64 tiles[4][DEGREE_PER_TILE];
+    for (u64 q0 = 0; q0 < op1.size(); q0 += BATCH_TILE) {
+      const u64 tile = std::min<u64>(BATCH_TILE, op1.size() - q0);
+      std::memset(accA, 0, sizeof(accA));
+      std::memset(accB, 0, sizeof(accB));
+      std::memset(accC, 0, sizeof(accC));
+      for (u64 j = 0; j < op2.size(); ++j) {
+        const u64 *a2 = op2.loadA(j, offset, tiles[2]);
+        const u64 *b2 = op2.loadB(j, offset, tiles[3]);
+        for (u64 q = 0; q < tile; ++q) {
+          const u64 *a1 = op1[q0 + q].loadA(j * gap, offset, tiles[0]);
+          const u64 *b1 = op1[q0 + q].loadB(j * gap, offset, tiles[1]);
+          for (u64 k = 0; k < DEGREE_PER_TILE; ++k) {
+            accA[q][k] += static_cast<u128>(a1[k]) * a2[k];
+            accB[q][k] += static_cast<u128>(a1[k]) * b2[k] +
+                          static_cast<u128>(b1[k]) * a2[k];
+            accC[q][k] += static_cast<u128>(b1[k]) * b2[k];
+          }
+        }
+      }
+      for (u64 q = 0; q < tile; ++q) {
+        Ciphertext &out = res[q0 + q];
+        reducer.addTo(out.getA().getData() + offset, accA[q],
+                      DEGREE_PER_TILE);
+        reducer.addTo(out.getB().getData() + offset, accB[q],
+                      DEGREE_PER_TILE);
+        reducer.addTo(out.getC().getData() + offset, accC[q],
+                      DEGREE_PER_TILE);
+      }
+    }
+  });
+  for (auto &out : res)
+    out.setIsNTT(true);
+}
+
+void HEval::multithreadMultSum(
+    std::vector<Ciphertext> &res, CiphertextSpan op1,
+    const std::vector<PolynomialSpan> &op2, u64 scale) {
+  HEVEC_TRACE_SPAN("HEval.multithreadMultSum");
+  if (op2.empty() || res.size() != op2.size())
+    throw InvalidBatchSizeException();
+  if (!op1.getIsNTT())
+    throw InvalidNTTStateException();
+  for (const PolynomialSpan &query : op2)
+    if (!query.getIsNTT())
+      throw InvalidNTTStateException();
+  constexpr u64 DEGREE_PER_TILE = SCAN_TILE;
+
+  const u64 terms = op2[0].size();
+  const u64 gap = op1.size() / terms;
+  const LazyReducer reducer(MOD_Q, scale);
+
+  parallelFor(N_SCAN_TILES, [&](u64 i) {
+    const u64 offset = DEGREE_PER_TILE * i;
+    u128 accA[BATCH_TILE][DEGREE_PER_TILE],
+        accB[BATCH_TILE][DEGREE_PER_TILE];
+    u64 tiles[2][DEGREE_PER_TILE];
+    for (u64 q0 = 0; q0 < op2.size(); q0 += BATCH_TILE) {
+      const u64 tile = std::min<u64>(BATCH_TILE, op2.size() - q0);
+      std::memset(accA, 0, sizeof(accA));
+      std::memset(accB, 0, sizeof(accB));
+      for (u64 j = 0; j < terms; ++j) {
+        const u64 *a1 = op1.loadA(j * gap, offset, tiles[0]);
+        const u64 *b1 = op1.loadB(j * gap, offset, tiles[1]);
+        for (u64 q = 0; q < tile; ++q) {
+          const u64 *p2 = op2[q0 + q].get(j, offset);
+          for (u64 k = 0; k < DEGREE_PER_TILE; ++k) {
+            accA[q][k] += static_cast<u128>(a1[k]) * p2[k];
+            accB[q][k] += static_cast<u128>(b1[k]) * p2[k];
+          }
+        }
+      }
+      for (u64 q = 0; q < tile; ++q) {
+        Ciphertext &out = res[q0 + q];
+        reducer.addTo(out.getA().getData() + offset, accA[q],
+                      DEGREE_PER_TILE);
+        reducer.addTo(out.getB().getData() + offset, accB[q],
+                      DEGREE_PER_TILE);
+      }
+    }
+  });
+  for (auto &out : res)
+    out.setIsNTT(true);
+}
+
 void HEval::bitRevedMultithreadMultSum(Ciphertext &res,
                                        const std::vector<Ciphertext> &op1,
                                        const std::vector<Ciphertext> &op2) {
+  HEVEC_TRACE_SPAN("HEval.bitRevedMultithreadMultSum");
   if (!op1[0].getIsNTT() || !op2[0].getIsNTT())
     throw InvalidNTTStateException();
-  constexpr u64 DEGREE_PER_THREAD = DEGREE / N_THREAD;
+  constexpr u64 DEGREE_PER_TILE = DEGREE / N_SCAN_TILES;
+  const LazyReducer reducer(MOD_Q, 1);
 
-  Polynomial temp(op1[0].getA().getDegree(), MOD_Q);
-#pragma omp parallel for
-  for (u64 i = 0; i < N_THREAD; ++i) {
+  parallelFor(N_SCAN_TILES, [&](u64 i) {
+    const u64 offset = DEGREE_PER_TILE * i;
+    u128 accA[DEGREE_PER_TILE] = {}, accB[DEGREE_PER_TILE] = {},
+         accC[DEGREE_PER_TILE] = {};
     for (u64 j = 0; j < rank_; ++j) {
       const u64 bitRev = getBitRev(j, rank_);
-      intel::hexl::EltwiseMultMod(
-          temp.getData() + DEGREE_PER_THREAD * i,
-          op1[bitRev].getA().getData() + DEGREE_PER_THREAD * i,
-          op2[j].getA().getData() + DEGREE_PER_THREAD * i, DEGREE_PER_THREAD,
-          MOD_Q, 1);
-      intel::hexl::EltwiseAddMod(res.getA().getData() + DEGREE_PER_THREAD * i,
-                                 res.getA().getData() + DEGREE_PER_THREAD * i,
-                                 temp.getData() + DEGREE_PER_THREAD * i,
-                                 DEGREE_PER_THREAD, MOD_Q);
-      intel::hexl::EltwiseMultMod(
-          temp.getData() + DEGREE_PER_THREAD * i,
-          op1[bitRev].getA().getData() + DEGREE_PER_THREAD * i,
-          op2[j].getB().getData() + DEGREE_PER_THREAD * i, DEGREE_PER_THREAD,
-          MOD_Q, 1);
-      intel::hexl::EltwiseAddMod(res.getB().getData() + DEGREE_PER_THREAD * i,
-                                 res.getB().getData() + DEGREE_PER_THREAD * i,
-                                 temp.getData() + DEGREE_PER_THREAD * i,
-                                 DEGREE_PER_THREAD, MOD_Q);
-      intel::hexl::EltwiseMultMod(
-          temp.getData() + DEGREE_PER_THREAD * i,
-          op1[bitRev].getB().getData() + DEGREE_PER_THREAD * i,
-          op2[j].getA().getData() + DEGREE_PER_THREAD * i, DEGREE_PER_THREAD,
-          MOD_Q, 1);
-      intel::hexl::EltwiseAddMod(res.getB().getData() + DEGREE_PER_THREAD * i,
-                                 res.getB().getData() + DEGREE_PER_THREAD * i,
-                                 temp.getData() + DEGREE_PER_THREAD * i,
-                                 DEGREE_PER_THREAD, MOD_Q);
-      intel::hexl::EltwiseMultMod(
-          temp.getData() + DEGREE_PER_THREAD * i,
-          op1[bitRev].getB().getData() + DEGREE_PER_THREAD * i,
-          op2[j].getB().getData() + DEGREE_PER_THREAD * i, DEGREE_PER_THREAD,
-          MOD_Q, 1);
-      intel::hexl::EltwiseAddMod(res.getC().getData() + DEGREE_PER_THREAD * i,
-                                 res.getC().getData() + DEGREE_PER_THREAD * i,
-                                 temp.getData() + DEGREE_PER_THREAD * i,
-                                 DEGREE_PER_THREAD, MOD_Q);
+      const u64 *a1 = op1[bitRev].getA().getData() + offset;
+      const u64 *b1 = op1[bitRev].getB().getData() + offset;
+      const u64 *a2 = op2[j].getA().getData() + offset;
+      const u64 *b2 = op2[j].getB().getData() + offset;
+      for (u64 k = 0; k < DEGREE_PER_TILE; ++k) {
+        accA[k] += static_cast<u128>(a1[k]) * a2[k];
+        accB[k] += static_cast<u128>(a1[k]) * b2[k] +
+                   static_cast<u128>(b1[k]) * a2[k];
+        accC[k] += static_cast<u128>(b1[k]) * b2[k];
+      }
     }
-  }
+    reducer.addTo(res.getA().getData() + offset, accA, DEGREE_PER_TILE);
+    reducer.addTo(res.getB().getData() + offset, accB, DEGREE_PER_TILE);
+    reducer.addTo(res.getC().getData() + offset, accC, DEGREE_PER_TILE);
+  });
   res.setIsNTT(true);
 }
 
@@ -655,20 +796,21 @@ void HEval::keySwitch(Ciphertext &res, const Ciphertext &op,
                       const SwitchingKey &swtKey) {
   Polynomial tempModQ(op.getDegree(), MOD_Q), tempModP(op.getDegree(), MOD_P),
       polyAModQ(op.getDegree(), MOD_Q), polyAModP(op.getDegree(), MOD_P),
-      polyBModQ(op.getDegree(), MOD_Q), polyBModP(op.getDegree(), MOD_P);
+      polyBModQ(op.getDegree(), MOD_Q), polyBModP(op.getDegree(), MOD_P),
+      keyAQ(0, MOD_Q), keyAP(0, MOD_P);
   if (op.getIsNTT()) {
     intt(tempModQ, op.getA());
     normMod(tempModP, tempModQ);
-    mult(polyAModQ, op.getA(), swtKey.getPolyAModQ());
+    mult(polyAModQ, op.getA(), swtKey.getPolyAModQ(keyAQ));
     mult(polyBModQ, op.getA(), swtKey.getPolyBModQ());
   } else {
     ntt(tempModQ, op.getA());
     normMod(tempModP, op.getA());
-    mult(polyAModQ, tempModQ, swtKey.getPolyAModQ());
+    mult(polyAModQ, tempModQ, swtKey.getPolyAModQ(keyAQ));
     mult(polyBModQ, tempModQ, swtKey.getPolyBModQ());
   }
   ntt(tempModP, tempModP);
-  mult(polyAModP, tempModP, swtKey.getPolyAModP());
+  mult(polyAModP, tempModP, swtKey.getPolyAModP(keyAP));
   mult(polyBModP, tempModP, swtKey.getPolyBModP());
   intt(polyAModP, polyAModP);
   normMod(tempModQ, polyAModP);
@@ -696,4 +838,4 @@ void HEval::keySwitch(Ciphertext &res, const Ciphertext &op,
   }
 }
 
-} // namespace HEVEC
+} // namespace HEVEC
\ No newline at end of file
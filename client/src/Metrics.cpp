@@ -0,0 +1,201 @@
+#include "HEVEC/Metrics.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iterator>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace HEVEC {
+
+namespace {
+
+std::string escapeLabelValue(const std::string &value) {
+  std::string res;
+  res.reserve(value.size());
+  for (char c : value) {
+    if (c == '\\' || c == '"')
+      res.push_back('\\');
+    if (c == '\n') {
+      res += "\\n";
+      continue;
+    }
+    res.push_back(c);
+  }
+  return res;
+}
+
+// {a="x",b="y"} with extra appended last, or "" when there are no labels.
+std::string formatLabels(const MetricLabels &labels,
+                         const std::pair<std::string, std::string> *extra =
+                             nullptr) {
+  if (labels.empty() && !extra)
+    return "";
+  std::string res = "{";
+  bool first = true;
+  auto append = [&](const std::string &name, const std::string &value) {
+    if (!first)
+      res.push_back(',');
+    first = false;
+    res += name + "=\"" + escapeLabelValue(value) + "\"";
+  };
+  for (const auto &[name, value] : labels)
+    append(name, value);
+  if (extra)
+    append(extra->first, extra->second);
+  res.push_back('}');
+  return res;
+}
+
+std::string formatValue(double value) {
+  if (std::isinf(value))
+    return value > 0 ? "+Inf" : "-Inf";
+  std::ostringstream out;
+  out << std::setprecision(std::numeric_limits<double>::max_digits10) << value;
+  return out.str();
+}
+
+} // namespace
+
+void Histogram::observe(double value) {
+  const double scaled = value / unit_;
+  u64 index = 0;
+  if (scaled > 1.0) {
+    // scaled = mantissa * 2^exponent with mantissa in [0.5, 1).
+    int exponent = 0;
+    const double mantissa = std::frexp(scaled, &exponent);
+    const u64 octave = static_cast<u64>(exponent - 1);
+    if (octave >= OCTAVES) {
+      index = BUCKET_COUNT - 1;
+    } else {
+      // Sub-bucket of 2^octave * (1 + s / SUB_BUCKETS), upper bound
+      // inclusive.
+      const double step = (mantissa * 2.0 - 1.0) * SUB_BUCKETS;
+      // An exact power of two closes the previous octave.
+      index = octave * SUB_BUCKETS + static_cast<u64>(std::ceil(step));
+    }
+  }
+  buckets_[index].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+double Histogram::getUpperBound(u64 index) const {
+  if (index == 0)
+    return unit_;
+  if (index >= BUCKET_COUNT - 1)
+    return std::numeric_limits<double>::infinity();
+  const u64 octave = (index - 1) / SUB_BUCKETS;
+  const u64 sub = (index - 1) % SUB_BUCKETS + 1;
+  return unit_ * std::ldexp(1.0 + static_cast<double>(sub) / SUB_BUCKETS,
+                            static_cast<int>(octave));
+}
+
+MetricsRegistry::Series &
+MetricsRegistry::getSeries(const std::string &name, const std::string &help,
+                           Type type, const MetricLabels &labels) {
+  auto [it, inserted] = families_.try_emplace(name, Family{type, help, {}});
+  if (!inserted && it->second.type != type)
+    throw std::logic_error("Metric " + name + " registered with two types");
+  Series &series = it->second.series[formatLabels(labels)];
+  series.labels = labels;
+  return series;
+}
+
+std::shared_ptr<Counter> MetricsRegistry::counter(const std::string &name,
+                                                  const std::string &help,
+                                                  const MetricLabels &labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Series &series = getSeries(name, help, Type::Counter, labels);
+  if (!series.counter)
+    series.counter = std::make_shared<Counter>();
+  return series.counter;
+}
+
+std::shared_ptr<Gauge> MetricsRegistry::gauge(const std::string &name,
+                                              const std::string &help,
+                                              const MetricLabels &labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Series &series = getSeries(name, help, Type::Gauge, labels);
+  if (!series.gauge)
+    series.gauge = std::make_shared<Gauge>();
+  return series.gauge;
+}
+
+std::shared_ptr<Histogram>
+MetricsRegistry::histogram(const std::string &name, const std::string &help,
+                           const MetricLabels &labels, double unit) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Series &series = getSeries(name, help, Type::Histogram, labels);
+  if (!series.histogram)
+    series.histogram = std::make_shared<Histogram>(unit);
+  return series.histogram;
+}
+
+void MetricsRegistry::removeSeries(const std::string &label,
+                                   const std::string &value) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto &[name, family] : families_) {
+    for (auto it = family.series.begin(); it != family.series.end();) {
+      bool matches = false;
+      for (const auto &[labelName, labelValue] : it->second.labels)
+        matches |= labelName == label && labelValue == value;
+      it = matches ? family.series.erase(it) : std::next(it);
+    }
+  }
+}
+
+std::string MetricsRegistry::render() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::string out;
+  for (const auto &[name, family] : families_) {
+    if (family.series.empty())
+      continue;
+    out += "# HELP " + name + " " + family.help + "\n";
+    out += "# TYPE " + name + " " +
+           (family.type == Type::Counter ? "counter"
+            : family.type == Type::Gauge ? "gauge"
+                                         : "histogram") +
+           "\n";
+    for (const auto &[labelText, series] : family.series) {
+      if (family.type == Type::Counter) {
+        out += name + labelText + " " + std::to_string(series.counter->get()) +
+               "\n";
+        continue;
+      }
+      if (family.type == Type::Gauge) {
+        out += name + labelText + " " + formatValue(series.gauge->get()) +
+               "\n";
+        continue;
+      }
+
+      // Buckets past the highest non-empty one add nothing but +Inf.
+      const Histogram &hist = *series.histogram;
+      u64 last = 0;
+      for (u64 i = 0; i < Histogram::BUCKET_COUNT - 1; ++i)
+        if (hist.getBucketCount(i))
+          last = i;
+      u64 cumulative = 0;
+      for (u64 i = 0; i <= last; ++i) {
+        cumulative += hist.getBucketCount(i);
+        const std::pair<std::string, std::string> le{
+            "le", formatValue(hist.getUpperBound(i))};
+        out += name + "_bucket" + formatLabels(series.labels, &le) + " " +
+               std::to_string(cumulative) + "\n";
+      }
+      // Read count once so +Inf and _count agree even while observing.
+      const u64 count = std::max(hist.getCount(), cumulative);
+      const std::pair<std::string, std::string> inf{"le", "+Inf"};
+      out += name + "_bucket" + formatLabels(series.labels, &inf) + " " +
+             std::to_string(count) + "\n";
+      out += name + "_sum" + labelText + " " + formatValue(hist.getSum()) +
+             "\n";
+      out += name + "_count" + labelText + " " + std::to_string(count) + "\n";
+    }
+  }
+  return out;
+}
+
+} // namespace HEVEC
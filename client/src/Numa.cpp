@@ -0,0 +1,142 @@
+#include "HEVEC/Numa.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+namespace HEVEC {
+
+namespace {
+
+#ifdef __linux__
+
+// CPUs of a sysfs cpulist such as "0-3,8-11".
+std::vector<int> parseCPUList(const std::string &list) {
+  std::vector<int> cpus;
+  size_t pos = 0;
+  while (pos < list.size()) {
+    size_t end = list.find(',', pos);
+    if (end == std::string::npos)
+      end = list.size();
+    const std::string range = list.substr(pos, end - pos);
+    const size_t dash = range.find('-');
+    try {
+      const int first = std::stoi(range.substr(0, dash));
+      const int last =
+          dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+      for (int cpu = first; cpu <= last; ++cpu)
+        cpus.push_back(cpu);
+    } catch (const std::exception &) {
+    }
+    pos = end + 1;
+  }
+  return cpus;
+}
+
+std::vector<NumaNode> detectNumaNodes() {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+      CPU_SET(cpu, &allowed);
+  }
+
+  std::vector<NumaNode> nodes;
+  const char *numa_env = std::getenv("HEVEC_NUMA");
+  if (!numa_env || std::strcmp(numa_env, "off") != 0) {
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(
+             "/sys/devices/system/node", ec)) {
+      const std::string name = entry.path().filename().string();
+      if (name.rfind("node", 0) != 0 ||
+          name.find_first_not_of("0123456789", 4) != std::string::npos ||
+          name.size() == 4)
+        continue;
+      std::ifstream in(entry.path() / "cpulist");
+      std::string list;
+      if (!(in >> list))
+        continue;
+      NumaNode node{std::stoull(name.substr(4)), {}};
+      for (const int cpu : parseCPUList(list))
+        if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+          node.cpus.push_back(cpu);
+      if (!node.cpus.empty())
+        nodes.push_back(std::move(node));
+    }
+  }
+  if (nodes.size() > 1) {
+    std::sort(nodes.begin(), nodes.end(),
+              [](const NumaNode &a, const NumaNode &b) { return a.id < b.id; });
+    return nodes;
+  }
+
+  NumaNode all{nodes.empty() ? 0 : nodes[0].id, {}};
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    if (CPU_ISSET(cpu, &allowed))
+      all.cpus.push_back(cpu);
+  return {all};
+}
+
+#else
+
+// No sysfs or affinity masks to read: a single node with every CPU.
+std::vector<NumaNode> detectNumaNodes() {
+  NumaNode all{0, {}};
+  const int cpus = static_cast<int>(
+      std::max(std::thread::hardware_concurrency(), 1U));
+  for (int cpu = 0; cpu < cpus; ++cpu)
+    all.cpus.push_back(cpu);
+  return {all};
+}
+
+#endif
+
+} // namespace
+
+const std::vector<NumaNode> &getNumaNodes() {
+  static const std::vector<NumaNode> nodes = detectNumaNodes();
+  return nodes;
+}
+
+#ifdef __linux__
+
+void bindToNumaNode(const void *data, u64 bytes, u64 node) {
+  const auto &nodes = getNumaNodes();
+  if (nodes.size() < 2 || node >= nodes.size() || bytes == 0)
+    return;
+  static const std::uintptr_t PAGE_MASK = ::sysconf(_SC_PAGESIZE) - 1;
+  const auto begin = reinterpret_cast<std::uintptr_t>(data);
+  const std::uintptr_t start = (begin + PAGE_MASK) & ~PAGE_MASK;
+  const std::uintptr_t end = (begin + bytes) & ~PAGE_MASK;
+  if (end <= start)
+    return;
+
+  // Called through syscall(), so the build does not need libnuma.
+  constexpr u64 MASK_BITS = 8 * sizeof(unsigned long);
+  const u64 id = nodes[node].id;
+  std::vector<unsigned long> mask(id / MASK_BITS + 1, 0);
+  mask[id / MASK_BITS] = 1UL << (id % MASK_BITS);
+  ::syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, mask.data(),
+            mask.size() * MASK_BITS + 1, MPOL_MF_MOVE);
+}
+
+#else
+
+// Only ever a single node here.
+void bindToNumaNode(const void *, u64, u64) {}
+
+#endif
+
+} // namespace HEVEC
@@ -0,0 +1,131 @@
+#include "HEVEC/Trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+
+namespace HEVEC {
+
+namespace {
+
+const auto TRACE_EPOCH = std::chrono::steady_clock::now();
+
+std::atomic<u64> next_thread_id{1};
+
+// Microseconds with nanosecond digits, as Chrome trace timestamps expect.
+std::string formatMicros(u64 ns) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%llu.%03llu",
+                static_cast<unsigned long long>(ns / 1000),
+                static_cast<unsigned long long>(ns % 1000));
+  return buf;
+}
+
+} // namespace
+
+void RequestTrace::addSpan(const char *name, u64 startNs, u64 endNs) {
+  if (spans_.size() < MAX_SPANS)
+    spans_.push_back({name, startNs, endNs - startNs, Tracer::getThreadId()});
+}
+
+std::string RequestTrace::formatServerTiming() const {
+  std::vector<std::pair<const char *, u64>> totals;
+  for (const TraceSpan &span : spans_) {
+    auto it = totals.begin();
+    while (it != totals.end() && std::string_view(it->first) != span.name)
+      ++it;
+    if (it == totals.end())
+      totals.emplace_back(span.name, span.duration_ns);
+    else
+      it->second += span.duration_ns;
+  }
+
+  std::string res;
+  char buf[32];
+  for (const auto &[name, ns] : totals) {
+    if (!res.empty())
+      res += ", ";
+    std::snprintf(buf, sizeof(buf), "%.3f", static_cast<double>(ns) / 1e6);
+    res += std::string(name) + ";dur=" + buf;
+  }
+  return res;
+}
+
+Tracer::Tracer() {
+  const char *rate_env = std::getenv("HEVEC_TRACE_SAMPLE_RATE");
+  const double rate = rate_env ? std::atof(rate_env) : 0.0;
+  if (rate > 0.0)
+    sample_every_ = static_cast<u64>(std::llround(1.0 / std::min(rate, 1.0)));
+}
+
+Tracer &Tracer::get() {
+  static Tracer tracer;
+  return tracer;
+}
+
+std::shared_ptr<RequestTrace> Tracer::startRequest(bool force) {
+  // Every sample_every_-th request, so the overhead is predictable.
+  const bool sampled =
+      sample_every_ != 0 &&
+      requests_.fetch_add(1, std::memory_order_relaxed) % sample_every_ == 0;
+  if (!sampled && !force)
+    return nullptr;
+  return std::make_shared<RequestTrace>(
+      next_id_.fetch_add(1, std::memory_order_relaxed));
+}
+
+void Tracer::finishRequest(const RequestTrace &trace) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const TraceSpan &span : trace.getSpans())
+    kept_.push_back({span, trace.getId(), trace.getCollection()});
+  while (kept_.size() > MAX_KEPT_SPANS)
+    kept_.pop_front();
+}
+
+std::string Tracer::dumpChromeTrace() const {
+  std::string res = "{\"traceEvents\":[";
+  std::lock_guard<std::mutex> lock(mutex_);
+  bool first = true;
+  for (const KeptSpan &kept : kept_) {
+    if (!first)
+      res += ',';
+    first = false;
+    res += "{\"name\":\"" + std::string(kept.span.name) +
+           "\",\"cat\":\"hevec\",\"ph\":\"X\",\"ts\":" +
+           formatMicros(kept.span.start_ns) +
+           ",\"dur\":" + formatMicros(kept.span.duration_ns) +
+           ",\"pid\":1,\"tid\":" + std::to_string(kept.span.thread_id) +
+           ",\"args\":{\"request\":" + std::to_string(kept.request) +
+           ",\"collection\":\"" + std::to_string(kept.collection) + "\"}}";
+  }
+  res += "],\"displayTimeUnit\":\"ms\"}";
+  return res;
+}
+
+u64 Tracer::nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - TRACE_EPOCH)
+      .count();
+}
+
+u64 Tracer::getThreadId() {
+  thread_local const u64 id = next_thread_id.fetch_add(1);
+  return id;
+}
+
+void Tracer::setCollection(u64 collectionHash) {
+  if (current_)
+    current_->setCollection(collectionHash);
+}
+
+TraceBinding::TraceBinding(RequestTrace *trace)
+    : previous_(Tracer::current_) {
+  Tracer::current_ = trace;
+}
+
+TraceBinding::~TraceBinding() { Tracer::current_ = previous_; }
+
+} // namespace HEVEC
@@ -0,0 +1,232 @@
+#include "HEVEC/WriteAheadLog.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace HEVEC {
+
+namespace {
+
+// Record header: payload size, then a checksum of the payload.
+constexpr u64 HEADER_SIZE = 2 * sizeof(u64);
+
+std::runtime_error walError(const std::string &path, const std::string &what) {
+  return std::runtime_error("WAL " + path + ": " + what + ": " +
+                            std::strerror(errno));
+}
+
+// FNV-1a over 64-bit words, enough to tell a torn record from a whole one.
+u64 checksum(const u8 *data, u64 size) {
+  constexpr u64 PRIME = 0x100000001b3ULL;
+  u64 hash = 0xcbf29ce484222325ULL ^ size;
+  u64 i = 0;
+  for (; i + sizeof(u64) <= size; i += sizeof(u64)) {
+    u64 word;
+    std::memcpy(&word, data + i, sizeof(word));
+    hash = (hash ^ word) * PRIME;
+  }
+  for (; i < size; ++i)
+    hash = (hash ^ data[i]) * PRIME;
+  return hash;
+}
+
+// fdatasync where there is one; elsewhere (macOS) fsync.
+int syncData(int fd) {
+#ifdef __linux__
+  return ::fdatasync(fd);
+#else
+  return ::fsync(fd);
+#endif
+}
+
+} // namespace
+
+WriteAheadLog::WriteAheadLog(const std::string &path,
+                             WALDurability durability,
+                             std::chrono::milliseconds syncInterval)
+    : path_(path), durability_(durability), sync_interval_(syncInterval) {
+  fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd_ < 0)
+    throw walError(path, "cannot open");
+  struct stat st;
+  if (::fstat(fd_, &st) != 0) {
+    const auto error = walError(path, "cannot stat");
+    ::close(fd_);
+    throw error;
+  }
+  file_size_ = static_cast<u64>(st.st_size);
+  if (durability_ != WALDurability::None)
+    syncer_ = std::thread([this]() { run(); });
+}
+
+WriteAheadLog::~WriteAheadLog() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  if (syncer_.joinable())
+    syncer_.join();
+  if (durability_ != WALDurability::None)
+    syncData(fd_);
+  ::close(fd_);
+}
+
+u64 WriteAheadLog::append(const std::vector<u8> &record) {
+  u64 header[2] = {record.size(), checksum(record.data(), record.size())};
+  iovec parts[2] = {{header, HEADER_SIZE},
+                    {const_cast<u8 *>(record.data()), record.size()}};
+  const u64 total = HEADER_SIZE + record.size();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  u64 done = 0;
+  while (done < total) {
+    // Skip what an earlier short write already covered.
+    iovec remaining[2];
+    int count = 0;
+    u64 skip = done;
+    for (const iovec &part : parts) {
+      if (skip >= part.iov_len) {
+        skip -= part.iov_len;
+        continue;
+      }
+      remaining[count++] = {static_cast<u8 *>(part.iov_base) + skip,
+                            part.iov_len - skip};
+      skip = 0;
+    }
+    const ssize_t n = ::writev(fd_, remaining, count);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      // Cut off the partial record so later appends stay replayable.
+      const auto error = walError(path_, "append failed");
+      if (::ftruncate(fd_, static_cast<off_t>(file_size_)) != 0)
+        sync_error_ = errno;
+      throw error;
+    }
+    done += static_cast<u64>(n);
+  }
+  file_size_ += total;
+  written_ += total;
+  const u64 lsn = written_;
+  lock.unlock();
+  if (durability_ == WALDurability::Request)
+    wake_.notify_one();
+  return lsn;
+}
+
+void WriteAheadLog::waitDurable(u64 lsn) {
+  if (durability_ != WALDurability::Request)
+    return;
+  std::unique_lock<std::mutex> lock(mutex_);
+  synced_cv_.wait(lock, [&]() { return synced_ >= lsn || sync_error_; });
+  if (synced_ < lsn) {
+    errno = sync_error_;
+    throw walError(path_, "fsync failed");
+  }
+}
+
+void WriteAheadLog::reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (::ftruncate(fd_, 0) != 0 || syncData(fd_) != 0)
+    throw walError(path_, "truncate failed");
+  file_size_ = 0;
+  // The snapshot made every record so far durable.
+  synced_ = written_;
+  synced_cv_.notify_all();
+}
+
+u64 WriteAheadLog::getSyncCount() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return syncs_;
+}
+
+void WriteAheadLog::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_) {
+    if (durability_ == WALDurability::Batch)
+      wake_.wait_for(lock, sync_interval_, [&]() { return stop_; });
+    else
+      wake_.wait(lock, [&]() {
+        return stop_ || (written_ > synced_ && !sync_error_);
+      });
+    // After a failed fsync the state of the file is unknown (the kernel may
+    // have dropped the dirty pages), so the log stops promising durability.
+    if (written_ <= synced_ || sync_error_)
+      continue;
+
+    // Everything written until now goes out in this fsync, however many
+    // appends that was.
+    const u64 target = written_;
+    lock.unlock();
+    const int rc = syncData(fd_);
+    const int error = rc != 0 ? errno : 0;
+    lock.lock();
+    if (error) {
+      sync_error_ = error;
+    } else {
+      synced_ = std::max(synced_, target);
+      ++syncs_;
+    }
+    synced_cv_.notify_all();
+  }
+}
+
+void WriteAheadLog::replay(const std::string &path,
+                           const std::function<void(const u8 *, u64)> &fn) {
+  const int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno == ENOENT)
+      return;
+    throw walError(path, "cannot open");
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw walError(path, "cannot stat");
+  }
+  const u64 size = static_cast<u64>(st.st_size);
+  if (size == 0) {
+    ::close(fd);
+    return;
+  }
+  void *map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    ::close(fd);
+    throw walError(path, "mmap failed");
+  }
+  ::madvise(map, size, MADV_SEQUENTIAL);
+  const u8 *data = static_cast<const u8 *>(map);
+
+  u64 pos = 0;
+  try {
+    while (size - pos >= HEADER_SIZE) {
+      u64 header[2];
+      std::memcpy(header, data + pos, HEADER_SIZE);
+      if (header[0] > size - pos - HEADER_SIZE ||
+          checksum(data + pos + HEADER_SIZE, header[0]) != header[1])
+        break;
+      fn(data + pos + HEADER_SIZE, header[0]);
+      pos += HEADER_SIZE + header[0];
+    }
+  } catch (...) {
+    ::munmap(map, size);
+    ::close(fd);
+    throw;
+  }
+  ::munmap(map, size);
+  if (pos < size && ::ftruncate(fd, static_cast<off_t>(pos)) != 0) {
+    ::close(fd);
+    throw walError(path, "cannot truncate torn tail");
+  }
+  ::close(fd);
+}
+
+} // namespace HEVEC
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "HEVEC/Type.hpp"
+
+namespace HEVEC {
+
+// The operations hevec_loadgen drives, over either transport. The HTTP and
+// TCP client headers cannot share a translation unit, so the TCP wrapper
+// lives in LoadClientTCP.cpp.
+class LoadClient {
+public:
+  virtual ~LoadClient() = default;
+
+  virtual u64 setupCollection(const std::string &collectionName, u64 dimension,
+                              const std::string &metricType,
+                              bool isQueryEncrypt) = 0;
+  virtual void dropCollection(const std::string &collectionName) = 0;
+  virtual void insert(const std::string &collectionName,
+                      const std::vector<std::vector<float>> &db,
+                      const std::vector<std::string> &payloads) = 0;
+  virtual std::vector<float> query(const std::string &collectionName,
+                                   const std::vector<float> &queryVec) = 0;
+  virtual std::string retrieve(const std::string &collectionName,
+                               u64 index) = 0;
+  virtual std::string retrievePIR(const std::string &collectionName,
+                                  u64 index) = 0;
+
+  // Bytes on the wire so far, or false when the transport does not count them.
+  virtual bool getWireBytes(u64 &sent, u64 &received) const = 0;
+};
+
+std::unique_ptr<LoadClient> makeHttpLoadClient(const std::string &host,
+                                               const std::string &port);
+// Serves HTTP on port from a detached thread for the rest of the process.
+void startHttpServer(unsigned short port, std::size_t ioThreads,
+                     std::size_t computeThreads);
+
+#ifdef HEVEC_ENABLE_TCP
+std::unique_ptr<LoadClient> makeTcpLoadClient(const std::string &host,
+                                              const std::string &port);
+void startTcpServer(unsigned short port);
+#endif
+
+} // namespace HEVEC
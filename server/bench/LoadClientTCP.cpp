@@ -0,0 +1,62 @@
+#include "LoadClient.hpp"
+
+#include <thread>
+
+#include "HEVEC/HEVECClientTCP.hpp"
+#include "HEVEC/HEVECServerTCP.hpp"
+
+namespace HEVEC {
+
+namespace {
+
+class TcpLoadClient : public LoadClient {
+public:
+  TcpLoadClient(const std::string &host, const std::string &port)
+      : client_(host, port) {}
+
+  u64 setupCollection(const std::string &collectionName, u64 dimension,
+                      const std::string &metricType,
+                      bool isQueryEncrypt) override {
+    return client_.setupCollection(collectionName, dimension, metricType,
+                                   isQueryEncrypt);
+  }
+  void dropCollection(const std::string &collectionName) override {
+    client_.dropCollection(collectionName);
+  }
+  void insert(const std::string &collectionName,
+              const std::vector<std::vector<float>> &db,
+              const std::vector<std::string> &payloads) override {
+    client_.insert(collectionName, db, payloads);
+  }
+  std::vector<float> query(const std::string &collectionName,
+                           const std::vector<float> &queryVec) override {
+    return client_.query(collectionName, queryVec);
+  }
+  std::string retrieve(const std::string &collectionName, u64 index) override {
+    return client_.retrieve(collectionName, index);
+  }
+  std::string retrievePIR(const std::string &collectionName,
+                          u64 index) override {
+    return client_.retrievePIR(collectionName, index);
+  }
+  // The TCP protocol writes fields one by one and keeps no byte count.
+  bool getWireBytes(u64 &, u64 &) const override { return false; }
+
+private:
+  HEVECClientTCP client_;
+};
+
+} // namespace
+
+std::unique_ptr<LoadClient> makeTcpLoadClient(const std::string &host,
+                                              const std::string &port) {
+  return std::make_unique<TcpLoadClient>(host, port);
+}
+
+void startTcpServer(unsigned short port) {
+  // Never destroyed: the server runs until the process exits.
+  auto *server = new HEVECServerTCP(port);
+  std::thread([server] { server->run(); }).detach();
+}
+
+} // namespace HEVEC
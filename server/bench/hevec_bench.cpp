@@ -0,0 +1,486 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "HEVEC/Ciphertext.hpp"
+#include "HEVEC/Client.hpp"
+#include "HEVEC/Const.hpp"
+#include "HEVEC/HEval.hpp"
+#include "HEVEC/Keys.hpp"
+#include "HEVEC/MLWECiphertext.hpp"
+#include "HEVEC/MLWESwitchingKey.hpp"
+#include "HEVEC/Message.hpp"
+#include "HEVEC/PIRDatabase.hpp"
+#include "HEVEC/PIRServer.hpp"
+#include "HEVEC/Polynomial.hpp"
+#include "HEVEC/Random.hpp"
+#include "HEVEC/SecretKey.hpp"
+#include "HEVEC/Server.hpp"
+#include "HEVEC/SwitchingKey.hpp"
+#include "HEVEC/TaskPool.hpp"
+
+using namespace HEVEC;
+
+namespace {
+
+constexpr int64_t MIN_LOG_RANK = 5;
+constexpr int64_t MAX_LOG_RANK = 12;
+// Populated PIR rows, capped so the database stays around 128 MB.
+constexpr u64 PIR_BENCH_ROWS = 4096;
+// Score ciphertexts decrypted per decryptScore call.
+constexpr u64 DECRYPT_BATCH = 16;
+
+void fillRandom(Polynomial &poly, bool isNTT) {
+  Random::sampleUniform(poly);
+  poly.setIsNTT(isNTT);
+}
+
+void fillRandom(Ciphertext &ctxt, bool isNTT) {
+  fillRandom(ctxt.getA(), isNTT);
+  fillRandom(ctxt.getB(), isNTT);
+  if (ctxt.getIsExtended())
+    fillRandom(ctxt.getC(), isNTT);
+}
+
+void fillRandom(MLWECiphertext &ctxt) {
+  for (u64 i = 0; i < ctxt.getStack(); ++i)
+    fillRandom(ctxt.getA(i), false);
+  fillRandom(ctxt.getB(), false);
+}
+
+void fillRandom(SwitchingKey &key) {
+  u8 seed[SEED_SIZE];
+  Random::getRandomSeed(seed);
+  key.setSeed(seed);
+  key.expandPolyA();
+  fillRandom(key.getPolyBModQ(), true);
+  fillRandom(key.getPolyBModP(), true);
+}
+
+void fillRandom(MLWESwitchingKey &key) {
+  u8 seed[SEED_SIZE];
+  Random::getRandomSeed(seed);
+  key.setSeed(seed);
+  key.expandPolyA();
+  for (u64 k = 0; k < key.getStack(); ++k) {
+    fillRandom(key.getPolyBModQ(k), true);
+    fillRandom(key.getPolyBModP(k), true);
+  }
+}
+
+// Switching keys for one log-rank. Kernel cost does not depend on key
+// values, so the server-side benchmarks use uniform random keys of the right
+// shape; only the Client benchmarks generate real ones. One log-rank is kept
+// at a time since the keys take about 1 GB.
+struct RankFixture {
+  explicit RankFixture(u64 logRank)
+      : logRank(logRank), rank(1ULL << logRank), stack(DEGREE >> logRank),
+        autedModPackKeys(rank), autedModPackMLWEKeys(rank), invAutKeys(rank) {
+    fillRandom(relinKey);
+    parallelFor(rank, stack, [&](u64 i, u64 j) {
+      fillRandom(autedModPackKeys.getKeys()[i][j]);
+      fillRandom(autedModPackMLWEKeys.getKeys()[i][j]);
+    });
+    parallelFor(rank, [&](u64 i) { fillRandom(invAutKeys.getKeys()[i]); });
+  }
+
+  const u64 logRank;
+  const u64 rank;
+  const u64 stack;
+  SwitchingKey relinKey;
+  AutedModPackKeys autedModPackKeys;
+  AutedModPackMLWEKeys autedModPackMLWEKeys;
+  InvAutKeys invAutKeys;
+};
+
+const RankFixture &getFixture(u64 logRank) {
+  static std::unique_ptr<RankFixture> fixture;
+  if (!fixture || fixture->logRank != logRank) {
+    fixture.reset();
+    fixture = std::make_unique<RankFixture>(logRank);
+  }
+  return *fixture;
+}
+
+u64 getLogRank(const benchmark::State &state) {
+  return static_cast<u64>(state.range(0));
+}
+
+// Threads the timed loop may use; benchmarks hold a TaskBudget of this many
+// around it.
+u64 getThreads(const benchmark::State &state) {
+  return static_cast<u64>(state.range(1));
+}
+
+void rankThreadArgs(benchmark::internal::Benchmark *b) {
+  b->ArgNames({"log_rank", "threads"})
+      ->ArgsProduct({benchmark::CreateDenseRange(MIN_LOG_RANK, MAX_LOG_RANK, 1),
+                     {1, 8, static_cast<int64_t>(detectThreadCount())}})
+      ->UseRealTime()
+      ->Unit(benchmark::kMicrosecond);
+}
+
+// ---------- HEval ----------
+
+void BM_HEvalNTT(benchmark::State &state) {
+  const u64 rank = 1ULL << getLogRank(state);
+  HEval eval(getLogRank(state));
+  Polynomial op(rank, MOD_Q), res(rank, MOD_Q);
+  fillRandom(op, false);
+  TaskBudget budget(getThreads(state));
+  for (auto _ : state) {
+    eval.ntt(res, op);
+    benchmark::DoNotOptimize(res.getData());
+  }
+}
+
+void BM_HEvalINTT(benchmark::State &state) {
+  const u64 rank = 1ULL << getLogRank(state);
+  HEval eval(getLogRank(state));
+  Polynomial op(rank, MOD_Q), res(rank, MOD_Q);
+  fillRandom(op, true);
+  TaskBudget budget(getThreads(state));
+  for (auto _ : state) {
+    eval.intt(res, op);
+    benchmark::DoNotOptimize(res.getData());
+  }
+}
+
+void BM_HEvalAut(benchmark::State &state) {
+  const u64 rank = 1ULL << getLogRank(state);
+  HEval eval(getLogRank(state));
+  Polynomial op(rank, MOD_Q), res(rank, MOD_Q);
+  fillRandom(op, false);
+  TaskBudget budget(getThreads(state));
+  for (auto _ : state) {
+    eval.aut(res, op, 3, rank);
+    benchmark::DoNotOptimize(res.getData());
+  }
+}
+
+void BM_HEvalNormMod(benchmark::State &state) {
+  HEval eval(getLogRank(state));
+  Polynomial op(DEGREE, MOD_Q), res(DEGREE, MOD_P);
+  fillRandom(op, false);
+  TaskBudget budget(getThreads(state));
+  for (auto _ : state) {
+    eval.normMod(res, op);
+    benchmark::DoNotOptimize(res.getData());
+  }
+}
+
+void BM_HEvalRelin(benchmark::State &state) {
+  const RankFixture &fixture = getFixture(getLogRank(state));
+  HEval eval(getLogRank(state));
+  Ciphertext op(true), res;
+  fillRandom(op, true);
+  TaskBudget budget(getThreads(state));
+  for (auto _ : state) {
+    eval.relin(res, op, fixture.relinKey);
+    benchmark::DoNotOptimize(res.getA().getData());
+  }
+}
+
+void BM_HEvalModPack(benchmark::State &state) {
+  const RankFixture &fixture = getFixture(getLogRank(state));
+  HEval eval(getLogRank(state));
+  std::vector<MLWECiphertext> op;
+  for (u64 i = 0; i < fixture.stack; ++i)
+    fillRandom(op.emplace_back(fixture.rank));
+  Ciphertext res;
+  TaskBudget budget(getThreads(state));
+  for (auto _ : state) {
+    eval.modPack(res, op, fixture.autedModPackKeys.getKeys()[0]);
+    benchmark::DoNotOptimize(res.getA().getData());
+  }
+}
+
+void BM_HEvalMultithreadMultSum(benchmark::State &state) {
+  const u64 rank = 1ULL << getLogRank(state);
+  HEval eval(getLogRank(state));
+  std::vector<Ciphertext> op1(rank), op2(rank);
+  for (u64 i = 0; i < rank; ++i) {
+    fillRandom(op1[i], true);
+    fillRandom(op2[i], true);
+  }
+  Ciphertext res(true);
+  TaskBudget budget(getThreads(state));
+  for (auto _ : state) {
+    std::memset(res.getA().getData(), 0, DEGREE * sizeof(u64));
+    std::memset(res.getB().getData(), 0, DEGREE * sizeof(u64));
+    std::memset(res.getC().getData(), 0, DEGREE * sizeof(u64));
+    eval.multithreadMultSum(res, op1, op2, rank);
+    benchmark::DoNotOptimize(res.getA().getData());
+  }
+}
+
+// The same sum over operands in the scan layout, as block scans run it,
+// with the keys bit-packed if packed.
+void multSumTiled(benchmark::State &state, bool packed) {
+  const u64 rank = 1ULL << getLogRank(state);
+  HEval eval(getLogRank(state));
+  CachedQuery op1(rank);
+  CachedKeys op2(rank);
+  for (u64 i = 0; i < rank; ++i) {
+    fillRandom(op1.getCtxts()[i], true);
+    fillRandom(op2.getCtxts()[i], true);
+  }
+  op1.tile();
+  op2.tile(packed);
+  Ciphertext res(true);
+  TaskBudget budget(getThreads(state));
+  for (auto _ : state) {
+    std::memset(res.getA().getData(), 0, DEGREE * sizeof(u64));
+    std::memset(res.getB().getData(), 0, DEGREE * sizeof(u64));
+    std::memset(res.getC().getData(), 0, DEGREE * sizeof(u64));
+    eval.multithreadMultSum(res, op1.getSpan(), op2.getSpan(), rank);
+    benchmark::DoNotOptimize(res.getA().getData());
+  }
+  state.SetBytesProcessed(
+      state.iterations() *
+      CiphertextSpan::getTiledWords(rank, packed) * sizeof(u64));
+}
+
+void BM_HEvalMultithreadMultSumTiled(benchmark::State &state) {
+  multSumTiled(state, false);
+}
+
+void BM_HEvalMultithreadMultSumPacked(benchmark::State &state) {
+  multSumTiled(state, true);
+}
+
+// ---------- Server ----------
+
+void BM_ServerCacheQuery(benchmark::State &state) {
+  const RankFixture &fixture = getFixture(getLogRank(state));
+  Server server(fixture.logRank, fixture.relinKey, fixture.autedModPackKeys,
+                fixture.autedModPackMLWEKeys);
+  MLWECiphertext query(fixture.rank);
+  fillRandom(query);
+  CachedQuery res(fixture.rank);
+  TaskBudget budget(getThreads(state));
+  for (auto _ : state) {
+    server.cacheQuery(res, query);
+    benchmark::DoNotOptimize(res.getSpan().getA(0, 0));
+  }
+}
+
+void BM_ServerCacheKeys(benchmark::State &state) {
+  const RankFixture &fixture = getFixture(getLogRank(state));
+  Server server(fixture.logRank, fixture.relinKey, fixture.autedModPackKeys,
+                fixture.autedModPackMLWEKeys);
+  std::vector<MLWECiphertext> keys;
+  keys.reserve(DEGREE);
+  for (u64 i = 0; i < DEGREE; ++i)
+    fillRandom(keys.emplace_back(fixture.rank));
+  TaskBudget budget(getThreads(state));
+  for (auto _ : state) {
+    CachedKeys res(fixture.rank);
+    server.cacheKeys(res, keys);
+    benchmark::DoNotOptimize(res.getSpan().getA(0, 0));
+  }
+  state.SetItemsProcessed(state.iterations() * DEGREE);
+}
+
+void BM_ServerInnerProduct(benchmark::State &state) {
+  const RankFixture &fixture = getFixture(getLogRank(state));
+  Server server(fixture.logRank, fixture.relinKey, fixture.autedModPackKeys,
+                fixture.autedModPackMLWEKeys);
+  CachedQuery query(fixture.rank);
+  CachedKeys keys(fixture.rank);
+  for (u64 i = 0; i < fixture.rank; ++i) {
+    fillRandom(query.getCtxts()[i], true);
+    fillRandom(keys.getCtxts()[i], true);
+  }
+  // As cacheQuery and cacheKeys leave them.
+  query.tile();
+  keys.tile();
+  Ciphertext res;
+  TaskBudget budget(getThreads(state));
+  for (auto _ : state) {
+    server.innerProduct(res, query, keys);
+    benchmark::DoNotOptimize(res.getA().getData());
+  }
+  state.SetItemsProcessed(state.iterations() * DEGREE);
+}
+
+// ---------- PIRServer ----------
+
+void BM_PIRServerDecompose(benchmark::State &state) {
+  const RankFixture &fixture = getFixture(getLogRank(state));
+  PIRServer pirServer(fixture.logRank, fixture.relinKey, fixture.invAutKeys);
+  Ciphertext query;
+  fillRandom(query, false);
+  std::vector<Ciphertext> res(fixture.rank);
+  TaskBudget budget(getThreads(state));
+  for (auto _ : state) {
+    pirServer.decompose(res, query);
+    benchmark::DoNotOptimize(res.data());
+  }
+}
+
+void BM_PIRServerInvButterfly(benchmark::State &state) {
+  const RankFixture &fixture = getFixture(getLogRank(state));
+  PIRServer pirServer(fixture.logRank, fixture.relinKey, fixture.invAutKeys);
+  std::vector<Ciphertext> op(fixture.rank);
+  for (Ciphertext &ctxt : op)
+    fillRandom(ctxt, false);
+  TaskBudget budget(getThreads(state));
+  for (auto _ : state) {
+    pirServer.invButterfly(op);
+    benchmark::DoNotOptimize(op.data());
+    // invButterfly leaves op in NTT form; its cost does not depend on the
+    // coefficients, so the output is fed back in.
+    state.PauseTiming();
+    for (Ciphertext &ctxt : op)
+      ctxt.setIsNTT(false);
+    state.ResumeTiming();
+  }
+}
+
+void BM_PIRServerPIR(benchmark::State &state) {
+  const RankFixture &fixture = getFixture(getLogRank(state));
+  PIRServer pirServer(fixture.logRank, fixture.relinKey, fixture.invAutKeys);
+  const u64 rows = std::min(fixture.rank * fixture.rank, PIR_BENCH_ROWS);
+  PIRDatabase db(fixture.rank * fixture.rank);
+  for (u64 i = 0; i < rows; ++i) {
+    Polynomial row(DEGREE, MOD_Q);
+    fillRandom(row, true);
+    db.setRow(i, std::move(row));
+  }
+  Ciphertext firstDim, secondDim, res;
+  fillRandom(firstDim, false);
+  fillRandom(secondDim, false);
+  TaskBudget budget(getThreads(state));
+  for (auto _ : state) {
+    pirServer.pir(res, firstDim, secondDim, db, rows);
+    benchmark::DoNotOptimize(res.getA().getData());
+  }
+  state.counters["rows"] = static_cast<double>(rows);
+}
+
+// ---------- Client ----------
+
+void BM_ClientGenRelinKey(benchmark::State &state) {
+  Client client(getLogRank(state));
+  SecretKey secKey;
+  client.genSecKey(secKey);
+  std::unique_ptr<SwitchingKey> res;
+  TaskBudget budget(getThreads(state));
+  for (auto _ : state) {
+    // Key generation expects freshly constructed keys.
+    state.PauseTiming();
+    res = std::make_unique<SwitchingKey>();
+    state.ResumeTiming();
+    client.genRelinKey(*res, secKey);
+  }
+}
+
+void BM_ClientGenAutedModPackKeys(benchmark::State &state) {
+  Client client(getLogRank(state));
+  SecretKey secKey;
+  client.genSecKey(secKey);
+  std::unique_ptr<AutedModPackKeys> res;
+  TaskBudget budget(getThreads(state));
+  for (auto _ : state) {
+    state.PauseTiming();
+    res = std::make_unique<AutedModPackKeys>(client.getRank());
+    state.ResumeTiming();
+    client.genAutedModPackKeys(*res, secKey);
+  }
+}
+
+void BM_ClientGenInvAutedModPackKeys(benchmark::State &state) {
+  Client client(getLogRank(state));
+  SecretKey secKey;
+  client.genSecKey(secKey);
+  std::unique_ptr<AutedModPackMLWEKeys> res;
+  TaskBudget budget(getThreads(state));
+  for (auto _ : state) {
+    state.PauseTiming();
+    res = std::make_unique<AutedModPackMLWEKeys>(client.getRank());
+    state.ResumeTiming();
+    client.genInvAutedModPackKeys(*res, secKey);
+  }
+}
+
+void BM_ClientEncryptQuery(benchmark::State &state) {
+  Client client(getLogRank(state));
+  SecretKey secKey;
+  client.genSecKey(secKey);
+  Message msg(client.getRank());
+  for (u64 i = 0; i < client.getRank(); ++i)
+    msg[i] = 1.0 / static_cast<double>(i + 1);
+  MLWECiphertext res(client.getRank());
+  u8 seed[SEED_SIZE];
+  Random::getRandomSeed(seed);
+  TaskBudget budget(getThreads(state));
+  for (auto _ : state) {
+    client.encryptQuery(res, msg, secKey, std::pow(2.0, LOG_SCALE), seed);
+    benchmark::DoNotOptimize(res.getB().getData());
+  }
+}
+
+void BM_ClientDecryptScore(benchmark::State &state) {
+  Client client(getLogRank(state));
+  SecretKey secKey;
+  client.genSecKey(secKey);
+  std::vector<Ciphertext> score(DECRYPT_BATCH);
+  for (Ciphertext &ctxt : score)
+    fillRandom(ctxt, false);
+  std::vector<Message> msg(DECRYPT_BATCH, Message(DEGREE));
+  TaskBudget budget(getThreads(state));
+  for (auto _ : state) {
+    client.decryptScore(msg, score, secKey, std::pow(2.0, 2 * LOG_SCALE));
+    benchmark::DoNotOptimize(msg.data());
+  }
+  state.SetItemsProcessed(state.iterations() * DECRYPT_BATCH * DEGREE);
+}
+
+} // namespace
+
+BENCHMARK(BM_HEvalNTT)->Apply(rankThreadArgs);
+BENCHMARK(BM_HEvalINTT)->Apply(rankThreadArgs);
+BENCHMARK(BM_HEvalAut)->Apply(rankThreadArgs);
+BENCHMARK(BM_HEvalNormMod)->Apply(rankThreadArgs);
+BENCHMARK(BM_HEvalRelin)->Apply(rankThreadArgs);
+BENCHMARK(BM_HEvalModPack)->Apply(rankThreadArgs);
+BENCHMARK(BM_HEvalMultithreadMultSum)->Apply(rankThreadArgs);
+BENCHMARK(BM_HEvalMultithreadMultSumTiled)->Apply(rankThreadArgs);
+BENCHMARK(BM_HEvalMultithreadMultSumPacked)->Apply(rankThreadArgs);
+BENCHMARK(BM_ServerCacheQuery)->Apply(rankThreadArgs);
+BENCHMARK(BM_ServerCacheKeys)->Apply(rankThreadArgs);
+BENCHMARK(BM_ServerInnerProduct)->Apply(rankThreadArgs);
+BENCHMARK(BM_PIRServerDecompose)->Apply(rankThreadArgs);
+BENCHMARK(BM_PIRServerInvButterfly)->Apply(rankThreadArgs);
+BENCHMARK(BM_PIRServerPIR)->Apply(rankThreadArgs);
+BENCHMARK(BM_ClientGenRelinKey)->Apply(rankThreadArgs);
+BENCHMARK(BM_ClientGenAutedModPackKeys)->Apply(rankThreadArgs);
+BENCHMARK(BM_ClientGenInvAutedModPackKeys)->Apply(rankThreadArgs);
+BENCHMARK(BM_ClientEncryptQuery)->Apply(rankThreadArgs);
+BENCHMARK(BM_ClientDecryptScore)->Apply(rankThreadArgs);
+
+int main(int argc, char **argv) {
+  // Report JSON unless another format is requested, so runs can be compared
+  // against a stored baseline with tools/compare.py from google/benchmark.
+  std::vector<char *> args(argv, argv + argc);
+  bool hasFormat = false;
+  for (int i = 1; i < argc; ++i)
+    hasFormat |= std::string(argv[i]).rfind("--benchmark_format", 0) == 0;
+  static char jsonFormat[] = "--benchmark_format=json";
+  if (!hasFormat)
+    args.push_back(jsonFormat);
+
+  int count = static_cast<int>(args.size());
+  benchmark::Initialize(&count, args.data());
+  if (benchmark::ReportUnrecognizedArguments(count, args.data()))
+    return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
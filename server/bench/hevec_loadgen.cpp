@@ -0,0 +1,711 @@
+// Closed/open-loop load generator for the HEVEC HTTP and TCP servers.
+//
+//   hevec_loadgen --transport=http --size=4096 --dimension=128
+//       --mix=insert:1,query:8,query_ptxt:1,retrieve:1,pir:1
+//       --mode=open --rate=20 --duration=30
+//
+// By default a server is started in-process on --port, so a run needs
+// nothing but localhost. Pass --spawn-server=0 to drive a server that is
+// already running. In closed mode --concurrency workers issue requests
+// back to back; in open mode requests arrive at --rate per second and
+// latency is measured from the scheduled arrival, so a stalled server
+// shows up in the tail instead of slowing the arrivals down.
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "HEVEC/HEVECClient.hpp"
+#include "HEVEC/HEVECServer.hpp"
+#include "LoadClient.hpp"
+
+using namespace HEVEC;
+using Clock = std::chrono::steady_clock;
+
+namespace HEVEC {
+
+namespace {
+
+class HttpLoadClient : public LoadClient {
+public:
+  HttpLoadClient(const std::string &host, const std::string &port)
+      : client_(host, port) {}
+
+  u64 setupCollection(const std::string &collectionName, u64 dimension,
+                      const std::string &metricType,
+                      bool isQueryEncrypt) override {
+    return client_.setupCollection(collectionName, dimension, metricType,
+                                   isQueryEncrypt);
+  }
+  void dropCollection(const std::string &collectionName) override {
+    client_.dropCollection(collectionName);
+  }
+  void insert(const std::string &collectionName,
+              const std::vector<std::vector<float>> &db,
+              const std::vector<std::string> &payloads) override {
+    client_.insert(collectionName, db, payloads);
+  }
+  std::vector<float> query(const std::string &collectionName,
+                           const std::vector<float> &queryVec) override {
+    return client_.query(collectionName, queryVec);
+  }
+  std::string retrieve(const std::string &collectionName, u64 index) override {
+    return client_.retrieve(collectionName, index);
+  }
+  std::string retrievePIR(const std::string &collectionName,
+                          u64 index) override {
+    return client_.retrievePIR(collectionName, index);
+  }
+  bool getWireBytes(u64 &sent, u64 &received) const override {
+    sent = client_.getBytesSent();
+    received = client_.getBytesReceived();
+    return true;
+  }
+
+private:
+  HEVECClient client_;
+};
+
+} // namespace
+
+std::unique_ptr<LoadClient> makeHttpLoadClient(const std::string &host,
+                                               const std::string &port) {
+  return std::make_unique<HttpLoadClient>(host, port);
+}
+
+void startHttpServer(unsigned short port, std::size_t ioThreads,
+                     std::size_t computeThreads) {
+  // Never destroyed: the server runs until the process exits.
+  auto *server = new HEVECServer(port, ioThreads, computeThreads);
+  std::thread([server] { server->run(); }).detach();
+}
+
+} // namespace HEVEC
+
+namespace {
+
+enum class Op { Insert, Query, QueryPtxt, Retrieve, PIR, Count };
+constexpr std::size_t OP_COUNT = static_cast<std::size_t>(Op::Count);
+const char *const OP_NAMES[OP_COUNT] = {"insert", "query", "query_ptxt",
+                                        "retrieve", "pir"};
+
+struct Options {
+  std::string host = "127.0.0.1";
+  std::string port = "8123";
+  std::string transport = "http";
+  bool spawnServer = true;
+  std::size_t ioThreads = 1;
+  std::size_t computeThreads = 1;
+
+  u64 dimension = 128;
+  u64 size = 4096;
+  std::string metric = "COSINE";
+  u64 insertBatch = 1;
+
+  std::string mix = "insert:1,query:8,query_ptxt:1,retrieve:1,pir:1";
+  std::string mode = "closed";
+  std::size_t concurrency = 4;
+  double rate = 10.0;
+  double duration = 10.0;
+  double warmup = 2.0;
+
+  std::string collection = "hevec_loadgen";
+  std::string jsonPath;
+  bool keep = false;
+  u64 seed = 1;
+};
+
+void printUsage() {
+  std::cout
+      << "Usage: hevec_loadgen [--key=value ...]\n"
+         "  --host=127.0.0.1         server address\n"
+         "  --port=8123              server port\n"
+         "  --transport=http|tcp     client/server pair to drive\n"
+         "  --spawn-server=1         start a server in this process\n"
+         "  --io-threads=1           spawned HTTP server I/O threads\n"
+         "  --compute-threads=1      spawned HTTP server compute threads\n"
+         "  --dimension=128          vector dimension\n"
+         "  --size=4096              vectors inserted before the run\n"
+         "  --metric=COSINE          COSINE or IP\n"
+         "  --insert-batch=1         vectors per insert request\n"
+         "  --mix=insert:1,query:8,query_ptxt:1,retrieve:1,pir:1\n"
+         "                           relative weight of each operation\n"
+         "  --mode=closed|open       fixed concurrency or fixed arrival rate\n"
+         "  --concurrency=4          workers (closed) or pool size (open)\n"
+         "  --rate=10                arrivals per second (open)\n"
+         "  --duration=10            measured seconds\n"
+         "  --warmup=2               unmeasured seconds before the run\n"
+         "  --collection=hevec_loadgen  prefix of the synthetic collections\n"
+         "  --json=PATH              also write the report as JSON\n"
+         "  --keep=0                 keep the collections after the run\n"
+         "  --seed=1                 seed for vectors and operation choice\n";
+}
+
+bool parseBool(const std::string &value) {
+  return value.empty() || value == "1" || value == "true" || value == "on";
+}
+
+Options parseOptions(int argc, char **argv) {
+  Options opt;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "-h" || arg == "--help") {
+      printUsage();
+      std::exit(0);
+    }
+    if (arg.rfind("--", 0) != 0)
+      throw std::invalid_argument("Unexpected argument: " + arg);
+    auto eq = arg.find('=');
+    std::string key = arg.substr(2, eq == std::string::npos ? eq : eq - 2);
+    std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+    if (key == "host")
+      opt.host = value;
+    else if (key == "port")
+      opt.port = value;
+    else if (key == "transport")
+      opt.transport = value;
+    else if (key == "spawn-server")
+      opt.spawnServer = parseBool(value);
+    else if (key == "io-threads")
+      opt.ioThreads = std::stoul(value);
+    else if (key == "compute-threads")
+      opt.computeThreads = std::stoul(value);
+    else if (key == "dimension")
+      opt.dimension = std::stoull(value);
+    else if (key == "size")
+      opt.size = std::stoull(value);
+    else if (key == "metric")
+      opt.metric = value;
+    else if (key == "insert-batch")
+      opt.insertBatch = std::stoull(value);
+    else if (key == "mix")
+      opt.mix = value;
+    else if (key == "mode")
+      opt.mode = value;
+    else if (key == "concurrency")
+      opt.concurrency = std::stoul(value);
+    else if (key == "rate")
+      opt.rate = std::stod(value);
+    else if (key == "duration")
+      opt.duration = std::stod(value);
+    else if (key == "warmup")
+      opt.warmup = std::stod(value);
+    else if (key == "collection")
+      opt.collection = value;
+    else if (key == "json")
+      opt.jsonPath = value;
+    else if (key == "keep")
+      opt.keep = parseBool(value);
+    else if (key == "seed")
+      opt.seed = std::stoull(value);
+    else
+      throw std::invalid_argument("Unknown option --" + key);
+  }
+
+  if (opt.transport != "http" && opt.transport != "tcp")
+    throw std::invalid_argument("--transport must be http or tcp");
+  if (opt.mode != "closed" && opt.mode != "open")
+    throw std::invalid_argument("--mode must be closed or open");
+  if (opt.size == 0 || opt.concurrency == 0 || opt.insertBatch == 0)
+    throw std::invalid_argument(
+        "--size, --concurrency and --insert-batch must be > 0");
+  if (opt.mode == "open" && opt.rate <= 0.0)
+    throw std::invalid_argument("--rate must be > 0");
+  return opt;
+}
+
+std::vector<double> parseMix(const std::string &mix) {
+  std::vector<double> weights(OP_COUNT, 0.0);
+  std::stringstream ss(mix);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    auto colon = item.find(':');
+    std::string name = item.substr(0, colon);
+    double weight =
+        colon == std::string::npos ? 1.0 : std::stod(item.substr(colon + 1));
+    auto it = std::find(std::begin(OP_NAMES), std::end(OP_NAMES), name);
+    if (it == std::end(OP_NAMES))
+      throw std::invalid_argument("Unknown operation in --mix: " + name);
+    weights[it - std::begin(OP_NAMES)] = weight;
+  }
+  if (std::all_of(weights.begin(), weights.end(),
+                  [](double w) { return w <= 0.0; }))
+    throw std::invalid_argument("--mix has no operation with positive weight");
+  return weights;
+}
+
+std::unique_ptr<LoadClient> makeClient(const Options &opt) {
+  if (opt.transport == "http")
+    return makeHttpLoadClient(opt.host, opt.port);
+#ifdef HEVEC_ENABLE_TCP
+  return makeTcpLoadClient(opt.host, opt.port);
+#else
+  throw std::invalid_argument(
+      "--transport=tcp needs a build with BUILD_TCP_BACKEND=ON");
+#endif
+}
+
+// Retries until the spawned server accepts connections.
+std::unique_ptr<LoadClient> connectClient(const Options &opt) {
+  for (int attempt = 0;; ++attempt) {
+    try {
+      return makeClient(opt);
+    } catch (const std::invalid_argument &) {
+      throw;
+    } catch (const std::exception &) {
+      if (attempt == 50)
+        throw;
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+  }
+}
+
+std::vector<std::vector<float>> randomVectors(std::mt19937_64 &rng, u64 count,
+                                              u64 dimension) {
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  std::vector<std::vector<float>> vecs(count, std::vector<float>(dimension));
+  for (auto &vec : vecs) {
+    float norm = 0.0f;
+    for (auto &x : vec) {
+      x = dist(rng);
+      norm += x * x;
+    }
+    norm = std::sqrt(norm);
+    for (auto &x : vec)
+      x /= norm;
+  }
+  return vecs;
+}
+
+std::vector<std::string> randomPayloads(u64 count, u64 offset) {
+  std::vector<std::string> payloads(count);
+  for (u64 i = 0; i < count; ++i)
+    payloads[i] = "payload-" + std::to_string(offset + i);
+  return payloads;
+}
+
+struct Collections {
+  std::string encrypted; // query, retrieve, pir
+  std::string plaintext; // query_ptxt
+  std::string inserts;   // insert
+};
+
+void fillCollection(LoadClient &client, const std::string &name,
+                    const Options &opt, std::mt19937_64 &rng) {
+  constexpr u64 CHUNK = 1024;
+  for (u64 done = 0; done < opt.size; done += CHUNK) {
+    u64 count = std::min(CHUNK, opt.size - done);
+    client.insert(name, randomVectors(rng, count, opt.dimension),
+                  randomPayloads(count, done));
+  }
+}
+
+struct Sample {
+  double latencyUs;
+  bool ok;
+  u64 bytesSent;
+  u64 bytesReceived;
+};
+
+struct Worker {
+  std::unique_ptr<LoadClient> client;
+  std::mt19937_64 rng;
+  std::vector<Sample> samples[OP_COUNT];
+  u64 insertCount = 0;
+};
+
+class Driver {
+public:
+  Driver(const Options &opt, const Collections &collections,
+         const std::vector<double> &weights)
+      : opt_(opt), collections_(collections),
+        pick_(weights.begin(), weights.end()) {}
+
+  Op pick(std::mt19937_64 &rng) { return static_cast<Op>(pick_(rng)); }
+
+  // Runs op on worker's client and records it when record is set. start
+  // is the time the request was due, which may lie in the past.
+  void execute(Worker &worker, Op op, Clock::time_point start, bool record) {
+    u64 sentBefore = 0, receivedBefore = 0;
+    bool counted = worker.client->getWireBytes(sentBefore, receivedBefore);
+
+    bool ok = true;
+    try {
+      runOp(worker, op);
+    } catch (const std::exception &e) {
+      ok = false;
+      if (record && errorsReported_.fetch_add(1) < 5)
+        std::cerr << OP_NAMES[static_cast<std::size_t>(op)]
+                  << " failed: " << e.what() << std::endl;
+    }
+    auto end = Clock::now();
+    if (!record)
+      return;
+
+    Sample sample{std::chrono::duration<double, std::micro>(end - start)
+                      .count(),
+                  ok, 0, 0};
+    u64 sent = 0, received = 0;
+    if (counted && worker.client->getWireBytes(sent, received)) {
+      sample.bytesSent = sent - sentBefore;
+      sample.bytesReceived = received - receivedBefore;
+    }
+    worker.samples[static_cast<std::size_t>(op)].push_back(sample);
+  }
+
+private:
+  void runOp(Worker &worker, Op op) {
+    std::uniform_int_distribution<u64> index(0, opt_.size - 1);
+    switch (op) {
+    case Op::Insert: {
+      auto vecs = randomVectors(worker.rng, opt_.insertBatch, opt_.dimension);
+      worker.client->insert(collections_.inserts, vecs,
+                            randomPayloads(opt_.insertBatch,
+                                           worker.insertCount));
+      worker.insertCount += opt_.insertBatch;
+      break;
+    }
+    case Op::Query:
+      worker.client->query(collections_.encrypted,
+                           randomVectors(worker.rng, 1, opt_.dimension)[0]);
+      break;
+    case Op::QueryPtxt:
+      worker.client->query(collections_.plaintext,
+                           randomVectors(worker.rng, 1, opt_.dimension)[0]);
+      break;
+    case Op::Retrieve:
+      worker.client->retrieve(collections_.encrypted, index(worker.rng));
+      break;
+    case Op::PIR:
+      worker.client->retrievePIR(collections_.encrypted, index(worker.rng));
+      break;
+    case Op::Count:
+      break;
+    }
+  }
+
+  const Options &opt_;
+  const Collections &collections_;
+  std::discrete_distribution<std::size_t> pick_;
+  std::atomic<int> errorsReported_{0};
+};
+
+// Each worker issues its next request as soon as the previous one returns.
+void runClosed(Driver &driver, std::vector<Worker> &workers,
+               Clock::time_point measureStart, Clock::time_point end) {
+  std::vector<std::thread> threads;
+  for (auto &worker : workers) {
+    threads.emplace_back([&driver, &worker, measureStart, end] {
+      for (auto now = Clock::now(); now < end; now = Clock::now()) {
+        Op op = driver.pick(worker.rng);
+        driver.execute(worker, op, now, now >= measureStart);
+      }
+    });
+  }
+  for (auto &t : threads)
+    t.join();
+}
+
+// Arrivals are scheduled at a fixed rate regardless of how fast the server
+// answers; a request waiting for a free worker is charged for the wait.
+void runOpen(Driver &driver, std::vector<Worker> &workers, double rate,
+             Clock::time_point measureStart, Clock::time_point end) {
+  struct Arrival {
+    Op op;
+    Clock::time_point due;
+  };
+  std::deque<Arrival> queue;
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done = false;
+
+  std::vector<std::thread> threads;
+  for (auto &worker : workers) {
+    threads.emplace_back([&, measureStart] {
+      for (;;) {
+        Arrival arrival;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          cv.wait(lock, [&] { return done || !queue.empty(); });
+          if (queue.empty())
+            return;
+          arrival = queue.front();
+          queue.pop_front();
+        }
+        driver.execute(worker, arrival.op, arrival.due,
+                       arrival.due >= measureStart);
+      }
+    });
+  }
+
+  std::mt19937_64 rng(workers.size());
+  const auto interval = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(1.0 / rate));
+  for (auto due = Clock::now(); due < end; due += interval) {
+    std::this_thread::sleep_until(due);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      queue.push_back({driver.pick(rng), due});
+    }
+    cv.notify_one();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    done = true;
+  }
+  cv.notify_all();
+  for (auto &t : threads)
+    t.join();
+}
+
+struct OpReport {
+  std::string name;
+  u64 count = 0;
+  u64 errors = 0;
+  double throughput = 0.0;
+  double p50 = 0.0, p90 = 0.0, p99 = 0.0, p999 = 0.0, max = 0.0;
+  bool hasBytes = false;
+  double bytesSent = 0.0, bytesReceived = 0.0;
+};
+
+// Nearest-rank percentile of sorted latencies.
+double percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty())
+    return 0.0;
+  std::size_t rank = static_cast<std::size_t>(
+      std::ceil(p / 100.0 * static_cast<double>(sorted.size())));
+  return sorted[std::clamp<std::size_t>(rank, 1, sorted.size()) - 1];
+}
+
+std::vector<OpReport> summarize(const std::vector<Worker> &workers,
+                                double seconds, bool hasBytes) {
+  std::vector<OpReport> reports;
+  for (std::size_t i = 0; i < OP_COUNT; ++i) {
+    OpReport report;
+    report.name = OP_NAMES[i];
+    report.hasBytes = hasBytes;
+    std::vector<double> latencies;
+    u64 sent = 0, received = 0;
+    for (const auto &worker : workers) {
+      for (const auto &sample : worker.samples[i]) {
+        ++report.count;
+        if (!sample.ok) {
+          ++report.errors;
+          continue;
+        }
+        latencies.push_back(sample.latencyUs / 1000.0);
+        sent += sample.bytesSent;
+        received += sample.bytesReceived;
+      }
+    }
+    if (report.count == 0)
+      continue;
+    std::sort(latencies.begin(), latencies.end());
+    report.throughput = static_cast<double>(latencies.size()) / seconds;
+    report.p50 = percentile(latencies, 50.0);
+    report.p90 = percentile(latencies, 90.0);
+    report.p99 = percentile(latencies, 99.0);
+    report.p999 = percentile(latencies, 99.9);
+    report.max = latencies.empty() ? 0.0 : latencies.back();
+    if (!latencies.empty()) {
+      report.bytesSent = static_cast<double>(sent) / latencies.size();
+      report.bytesReceived = static_cast<double>(received) / latencies.size();
+    }
+    reports.push_back(report);
+  }
+  return reports;
+}
+
+void printReport(const std::vector<OpReport> &reports, const Options &opt) {
+  std::printf("\nmode=%s transport=%s size=%llu dimension=%llu "
+              "duration=%.1fs\n",
+              opt.mode.c_str(), opt.transport.c_str(),
+              static_cast<unsigned long long>(opt.size),
+              static_cast<unsigned long long>(opt.dimension), opt.duration);
+  std::printf("%-11s %8s %6s %9s %9s %9s %9s %9s %9s %11s %11s\n", "op",
+              "count", "errors", "ops/s", "p50 ms", "p90 ms", "p99 ms",
+              "p999 ms", "max ms", "sent B/op", "recv B/op");
+  for (const auto &r : reports) {
+    std::printf("%-11s %8llu %6llu %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f",
+                r.name.c_str(), static_cast<unsigned long long>(r.count),
+                static_cast<unsigned long long>(r.errors), r.throughput, r.p50,
+                r.p90, r.p99, r.p999, r.max);
+    if (r.hasBytes)
+      std::printf(" %11.0f %11.0f\n", r.bytesSent, r.bytesReceived);
+    else
+      std::printf(" %11s %11s\n", "-", "-");
+  }
+}
+
+void writeJson(const std::vector<OpReport> &reports, const Options &opt) {
+  std::ofstream out(opt.jsonPath);
+  if (!out)
+    throw std::runtime_error("Cannot open " + opt.jsonPath);
+  out << "{\n  \"mode\": \"" << opt.mode << "\",\n  \"transport\": \""
+      << opt.transport << "\",\n  \"size\": " << opt.size
+      << ",\n  \"dimension\": " << opt.dimension
+      << ",\n  \"duration_s\": " << opt.duration << ",\n  \"ops\": [";
+  for (std::size_t i = 0; i < reports.size(); ++i) {
+    const auto &r = reports[i];
+    out << (i ? ",\n" : "\n") << "    {\"op\": \"" << r.name
+        << "\", \"count\": " << r.count << ", \"errors\": " << r.errors
+        << ", \"ops_per_s\": " << r.throughput << ", \"p50_ms\": " << r.p50
+        << ", \"p90_ms\": " << r.p90 << ", \"p99_ms\": " << r.p99
+        << ", \"p999_ms\": " << r.p999 << ", \"max_ms\": " << r.max;
+    if (r.hasBytes)
+      out << ", \"bytes_sent_per_op\": " << r.bytesSent
+          << ", \"bytes_received_per_op\": " << r.bytesReceived;
+    out << "}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+// Every client in the process must use the same secret and AES keys, so
+// point them at files in a private temporary directory, removed again on
+// exit, unless the caller already chose paths.
+class SharedClientKeys {
+public:
+  SharedClientKeys() {
+    if (std::getenv("HEVEC_SEC_KEY_PATH") && std::getenv("HEVEC_AES_KEY_PATH"))
+      return;
+    std::string dir =
+        (std::filesystem::temp_directory_path() / "hevec_loadgen_XXXXXX")
+            .string();
+    if (!::mkdtemp(dir.data()))
+      throw std::runtime_error("Cannot create a key directory: " +
+                               std::string(std::strerror(errno)));
+    dir_ = dir;
+    setenv("HEVEC_SEC_KEY_PATH", (dir_ + "/sec.key").c_str(), 0);
+    setenv("HEVEC_AES_KEY_PATH", (dir_ + "/aes.key").c_str(), 0);
+  }
+  ~SharedClientKeys() {
+    std::error_code ec;
+    if (!dir_.empty())
+      std::filesystem::remove_all(dir_, ec);
+  }
+
+  SharedClientKeys(const SharedClientKeys &) = delete;
+  SharedClientKeys &operator=(const SharedClientKeys &) = delete;
+
+private:
+  std::string dir_;
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+  try {
+    Options opt = parseOptions(argc, argv);
+    std::vector<double> weights = parseMix(opt.mix);
+    const SharedClientKeys keys;
+
+    if (opt.spawnServer) {
+      unsigned short port = static_cast<unsigned short>(std::stoul(opt.port));
+      if (opt.transport == "http") {
+        startHttpServer(port, opt.ioThreads, opt.computeThreads);
+      } else {
+#ifdef HEVEC_ENABLE_TCP
+        startTcpServer(port);
+#endif
+      }
+    }
+
+    Collections collections{opt.collection + "_enc",
+                            opt.collection + "_ptxt",
+                            opt.collection + "_ins"};
+    auto setupClient = connectClient(opt);
+    std::mt19937_64 rng(opt.seed);
+
+    std::cout << "Preparing " << opt.size << " vectors of dimension "
+              << opt.dimension << "..." << std::endl;
+    bool needsEncrypted = weights[static_cast<std::size_t>(Op::Query)] > 0 ||
+                          weights[static_cast<std::size_t>(Op::Retrieve)] > 0 ||
+                          weights[static_cast<std::size_t>(Op::PIR)] > 0;
+    if (needsEncrypted &&
+        setupClient->setupCollection(collections.encrypted, opt.dimension,
+                                     opt.metric, true) < opt.size)
+      fillCollection(*setupClient, collections.encrypted, opt, rng);
+    if (weights[static_cast<std::size_t>(Op::QueryPtxt)] > 0 &&
+        setupClient->setupCollection(collections.plaintext, opt.dimension,
+                                     opt.metric, false) < opt.size)
+      fillCollection(*setupClient, collections.plaintext, opt, rng);
+    if (weights[static_cast<std::size_t>(Op::Insert)] > 0)
+      setupClient->setupCollection(collections.inserts, opt.dimension,
+                                   opt.metric, true);
+
+    // Workers attach to the collections the setup client created.
+    std::vector<Worker> workers(opt.concurrency);
+    for (std::size_t i = 0; i < workers.size(); ++i) {
+      workers[i].client = connectClient(opt);
+      workers[i].rng.seed(opt.seed + 1 + i);
+      if (needsEncrypted)
+        workers[i].client->setupCollection(collections.encrypted,
+                                           opt.dimension, opt.metric, true);
+      if (weights[static_cast<std::size_t>(Op::QueryPtxt)] > 0)
+        workers[i].client->setupCollection(collections.plaintext,
+                                           opt.dimension, opt.metric, false);
+      if (weights[static_cast<std::size_t>(Op::Insert)] > 0)
+        workers[i].client->setupCollection(collections.inserts, opt.dimension,
+                                           opt.metric, true);
+    }
+
+    Driver driver(opt, collections, weights);
+    auto start = Clock::now();
+    auto measureStart = start + std::chrono::duration_cast<Clock::duration>(
+                                    std::chrono::duration<double>(opt.warmup));
+    auto end = measureStart + std::chrono::duration_cast<Clock::duration>(
+                                  std::chrono::duration<double>(opt.duration));
+    std::cout << "Running " << opt.mode << " loop for " << opt.warmup
+              << "s warmup + " << opt.duration << "s..." << std::endl;
+    if (opt.mode == "closed")
+      runClosed(driver, workers, measureStart, end);
+    else
+      runOpen(driver, workers, opt.rate, measureStart, end);
+
+    // Open-loop requests still running at the deadline count towards the
+    // elapsed time they actually took.
+    double seconds =
+        std::chrono::duration<double>(std::max(Clock::now(), end) -
+                                      measureStart)
+            .count();
+    u64 sent = 0, received = 0;
+    auto reports = summarize(
+        workers, seconds, workers.front().client->getWireBytes(sent, received));
+    printReport(reports, opt);
+    if (!opt.jsonPath.empty())
+      writeJson(reports, opt);
+
+    workers.clear();
+    if (!opt.keep) {
+      if (needsEncrypted)
+        setupClient->dropCollection(collections.encrypted);
+      if (weights[static_cast<std::size_t>(Op::QueryPtxt)] > 0)
+        setupClient->dropCollection(collections.plaintext);
+      if (weights[static_cast<std::size_t>(Op::Insert)] > 0)
+        setupClient->dropCollection(collections.inserts);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "hevec_loadgen: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
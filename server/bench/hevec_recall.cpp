@@ -0,0 +1,604 @@
+// Recall-vs-latency benchmark over .fbin datasets (DEEP1M, BIGANN-style).
+//
+//   hevec_recall deep1M_base.fbin deep1M_query.fbin
+//       --gt=deep1M_groundtruth.ibin --n-db=100000 --n-query=1000 --k=10
+//
+// Base vectors are inserted through Client/Server in-process and every query
+// is answered on the encrypted and the plaintext-query path, timing each
+// stage of the pipeline and scoring the decrypted top-k against the ground
+// truth. With --port the same vectors also go through HEVECClient to a
+// running server, which adds the end-to-end latency and the transfer share.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "HEVEC/Ciphertext.hpp"
+#include "HEVEC/Client.hpp"
+#include "HEVEC/Const.hpp"
+#include "HEVEC/HEVECClient.hpp"
+#include "HEVEC/HEval.hpp"
+#include "HEVEC/Keys.hpp"
+#include "HEVEC/MLWECiphertext.hpp"
+#include "HEVEC/Message.hpp"
+#include "HEVEC/MetricType.hpp"
+#include "HEVEC/Polynomial.hpp"
+#include "HEVEC/SecretKey.hpp"
+#include "HEVEC/Server.hpp"
+#include "HEVEC/SwitchingKey.hpp"
+#include "HEVEC/TaskPool.hpp"
+
+using namespace HEVEC;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+  std::string basePath;
+  std::string queryPath;
+  std::string gtPath;
+  u64 nDb = 0;
+  u64 nQuery = 1000;
+  u64 k = 10;
+  std::string metric = "COSINE";
+  std::string path = "both";
+  std::string host = "127.0.0.1";
+  std::string port;
+  std::string jsonPath;
+};
+
+void printUsage() {
+  std::cout
+      << "Usage: hevec_recall <base.fbin> <query.fbin> [--key=value ...]\n"
+         "  --gt=PATH          .ibin ground truth for the full base set\n"
+         "  --n-db=0           base vectors to insert (0: all)\n"
+         "  --n-query=1000     queries to run\n"
+         "  --k=10             recall@k cut-off\n"
+         "  --metric=COSINE    COSINE or IP\n"
+         "  --path=both        encrypted, plaintext or both query paths\n"
+         "  --host=127.0.0.1   server for the HEVECClient run\n"
+         "  --port=PORT        also run through HEVECClient against it\n"
+         "  --json=PATH        also write the report as JSON\n";
+}
+
+Options parseOptions(int argc, char **argv) {
+  Options opt;
+  std::vector<std::string> positional;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "-h" || arg == "--help") {
+      printUsage();
+      std::exit(0);
+    }
+    if (arg.rfind("--", 0) != 0) {
+      positional.push_back(arg);
+      continue;
+    }
+    auto eq = arg.find('=');
+    if (eq == std::string::npos)
+      throw std::invalid_argument("Expected --key=value: " + arg);
+    std::string key = arg.substr(2, eq - 2);
+    std::string value = arg.substr(eq + 1);
+
+    if (key == "gt")
+      opt.gtPath = value;
+    else if (key == "n-db")
+      opt.nDb = std::stoull(value);
+    else if (key == "n-query")
+      opt.nQuery = std::stoull(value);
+    else if (key == "k")
+      opt.k = std::stoull(value);
+    else if (key == "metric")
+      opt.metric = value;
+    else if (key == "path")
+      opt.path = value;
+    else if (key == "host")
+      opt.host = value;
+    else if (key == "port")
+      opt.port = value;
+    else if (key == "json")
+      opt.jsonPath = value;
+    else
+      throw std::invalid_argument("Unknown option --" + key);
+  }
+  if (positional.size() != 2) {
+    printUsage();
+    std::exit(1);
+  }
+  opt.basePath = positional[0];
+  opt.queryPath = positional[1];
+
+  if (opt.metric != "COSINE" && opt.metric != "IP")
+    throw std::invalid_argument("--metric must be COSINE or IP");
+  if (opt.path != "both" && opt.path != "encrypted" && opt.path != "plaintext")
+    throw std::invalid_argument("--path must be encrypted, plaintext or both");
+  if (opt.k == 0 || opt.nQuery == 0)
+    throw std::invalid_argument("--k and --n-query must be > 0");
+  return opt;
+}
+
+struct Dataset {
+  u64 count = 0;
+  u64 dimension = 0;
+  std::vector<float> data; // row-major, count x dimension
+
+  const float *row(u64 i) const { return data.data() + i * dimension; }
+};
+
+// .fbin: u32 count, u32 dimension, count * dimension float32. Reads at most
+// limit rows (0: all) and reports the count in the header through total.
+Dataset loadFbin(const std::string &path, u64 limit, u64 &total) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    throw std::runtime_error("Cannot open " + path);
+  uint32_t header[2];
+  if (!in.read(reinterpret_cast<char *>(header), sizeof(header)))
+    throw std::runtime_error("Truncated header in " + path);
+  total = header[0];
+
+  Dataset ds;
+  ds.dimension = header[1];
+  ds.count = limit == 0 ? total : std::min<u64>(limit, total);
+  if (ds.dimension == 0 || ds.dimension > DEGREE)
+    throw std::runtime_error(path + ": dimension must be between 1 and " +
+                             std::to_string(DEGREE));
+  ds.data.resize(ds.count * ds.dimension);
+  if (!in.read(reinterpret_cast<char *>(ds.data.data()),
+               ds.data.size() * sizeof(float)))
+    throw std::runtime_error("Truncated data in " + path);
+  return ds;
+}
+
+// .ibin: u32 count, u32 k, count * k int32 neighbour ids.
+std::vector<std::vector<u64>> loadIbin(const std::string &path, u64 limit,
+                                       u64 &gtK) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    throw std::runtime_error("Cannot open " + path);
+  uint32_t header[2];
+  if (!in.read(reinterpret_cast<char *>(header), sizeof(header)))
+    throw std::runtime_error("Truncated header in " + path);
+  gtK = header[1];
+  const u64 count = std::min<u64>(limit, header[0]);
+
+  std::vector<std::vector<u64>> res(count);
+  std::vector<int32_t> ids(gtK);
+  for (u64 i = 0; i < count; ++i) {
+    if (!in.read(reinterpret_cast<char *>(ids.data()),
+                 ids.size() * sizeof(int32_t)))
+      throw std::runtime_error("Truncated data in " + path);
+    res[i].assign(ids.begin(), ids.end());
+  }
+  return res;
+}
+
+void normalizeRows(Dataset &ds) {
+  for (u64 i = 0; i < ds.count; ++i) {
+    float *v = ds.data.data() + i * ds.dimension;
+    float norm = 0.0f;
+    for (u64 j = 0; j < ds.dimension; ++j)
+      norm += v[j] * v[j];
+    norm = std::sqrt(norm);
+    if (norm > 0.0f)
+      for (u64 j = 0; j < ds.dimension; ++j)
+        v[j] /= norm;
+  }
+}
+
+std::vector<float> exactScores(const Dataset &base, const float *query) {
+  std::vector<float> scores(base.count);
+  parallelFor(base.count, [&](u64 i) {
+    const float *v = base.row(i);
+    float dot = 0.0f;
+    for (u64 j = 0; j < base.dimension; ++j)
+      dot += v[j] * query[j];
+    scores[i] = dot;
+  });
+  return scores;
+}
+
+struct QualityStats {
+  u64 queries = 0;
+  double recallAt1 = 0.0;
+  double recallAtK = 0.0;
+  double sumAbsError = 0.0;
+  double maxAbsError = 0.0;
+  u64 scoreCount = 0;
+
+  void add(const std::vector<float> &scores, const std::vector<u64> &top,
+           const std::vector<float> &exact, const std::vector<u64> &truth,
+           u64 k) {
+    ++queries;
+    if (!top.empty() && !truth.empty() && top[0] == truth[0])
+      recallAt1 += 1.0;
+    std::unordered_set<u64> expected(truth.begin(),
+                                     truth.begin() + std::min(k, truth.size()));
+    u64 hits = 0;
+    for (u64 idx : top)
+      hits += expected.count(idx);
+    recallAtK += static_cast<double>(hits) / static_cast<double>(k);
+
+    for (u64 i = 0; i < exact.size() && i < scores.size(); ++i) {
+      double err = std::abs(static_cast<double>(scores[i]) - exact[i]);
+      sumAbsError += err;
+      maxAbsError = std::max(maxAbsError, err);
+    }
+    scoreCount += std::min(exact.size(), scores.size());
+  }
+};
+
+struct StageStats {
+  std::string name;
+  std::vector<double> ms;
+
+  double mean() const {
+    return ms.empty() ? 0.0
+                      : std::accumulate(ms.begin(), ms.end(), 0.0) / ms.size();
+  }
+  double percentile(double p) const {
+    if (ms.empty())
+      return 0.0;
+    std::vector<double> sorted = ms;
+    std::sort(sorted.begin(), sorted.end());
+    std::size_t rank = static_cast<std::size_t>(
+        std::ceil(p / 100.0 * static_cast<double>(sorted.size())));
+    return sorted[std::clamp<std::size_t>(rank, 1, sorted.size()) - 1];
+  }
+};
+
+double elapsedMs(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+struct PathReport {
+  std::string name;
+  // Through HEVECClient: keygenMs then covers setupCollection, key upload
+  // included, and encryptKeysMs the whole insert.
+  bool remote = false;
+  QualityStats quality;
+  double keygenMs = 0.0;
+  double encryptKeysMs = 0.0;
+  double cacheKeysMs = 0.0;
+  std::vector<StageStats> stages;
+};
+
+// Runs every query through the same calls the HTTP server and client make,
+// with Server::innerProduct split into its scan and relinearization.
+PathReport runInProcess(const Options &opt, const Dataset &base,
+                        const Dataset &queries,
+                        const std::vector<std::vector<float>> &exact,
+                        const std::vector<std::vector<u64>> &truth,
+                        bool isQueryEncrypt) {
+  PathReport report;
+  report.name = isQueryEncrypt ? "encrypted" : "plaintext";
+
+  const MetricType metricType =
+      opt.metric == "IP" ? MetricType::IP : MetricType::COSINE;
+  const MetricScales scales = getMetricScales(metricType, isQueryEncrypt);
+  const double queryScale = std::pow(2.0, scales.logQueryScale);
+  const double keyScale = std::pow(2.0, scales.logKeyScale);
+  const double outputScale = queryScale * keyScale;
+
+  const u64 logRank =
+      static_cast<u64>(std::ceil(std::log2(static_cast<double>(base.dimension))));
+  const u64 rank = 1ULL << logRank;
+
+  auto start = Clock::now();
+  Client client(logRank);
+  SecretKey secKey;
+  SwitchingKey relinKey;
+  AutedModPackKeys autedModPackKeys(rank);
+  AutedModPackMLWEKeys autedModPackMLWEKeys(rank);
+  client.genSecKey(secKey);
+  client.genRelinKey(relinKey, secKey);
+  client.genAutedModPackKeys(autedModPackKeys, secKey);
+  client.genInvAutedModPackKeys(autedModPackMLWEKeys, secKey);
+  report.keygenMs = elapsedMs(start);
+
+  Server server(logRank, relinKey, autedModPackKeys, autedModPackMLWEKeys);
+  HEval eval(logRank);
+
+  // Full blocks go through cacheKeys, the tail through appendToCache, as on
+  // insert into an empty collection.
+  std::vector<CachedKeys> blocks;
+  blocks.reserve((base.count + DEGREE - 1) / DEGREE);
+  for (u64 offset = 0; offset < base.count; offset += DEGREE) {
+    const u64 count = std::min(DEGREE, base.count - offset);
+    std::vector<MLWECiphertext> keys;
+    keys.reserve(count);
+    start = Clock::now();
+    for (u64 i = 0; i < count; ++i) {
+      Message msg(rank);
+      const float *v = base.row(offset + i);
+      for (u64 j = 0; j < base.dimension; ++j)
+        msg[j] = v[j];
+      client.encryptKey(keys.emplace_back(rank), msg, secKey, keyScale);
+    }
+    report.encryptKeysMs += elapsedMs(start);
+
+    start = Clock::now();
+    CachedKeys &block = blocks.emplace_back(rank);
+    if (count == DEGREE)
+      server.cacheKeys(block, keys);
+    else
+      server.appendToCache(block, 0, keys);
+    report.cacheKeysMs += elapsedMs(start);
+  }
+
+  StageStats encrypt{"encrypt"}, cacheQuery{"cache_query"}, scan{"scan"},
+      relin{"relin"}, decrypt{"decrypt"}, topK{"top_k"}, total{"total"};
+  for (u64 q = 0; q < queries.count; ++q) {
+    Message msg(rank);
+    const float *v = queries.row(q);
+    for (u64 j = 0; j < queries.dimension; ++j)
+      msg[j] = v[j];
+
+    auto queryStart = Clock::now();
+    std::vector<Ciphertext> results(blocks.size());
+    if (isQueryEncrypt) {
+      start = Clock::now();
+      MLWECiphertext query(rank);
+      client.encryptQuery(query, msg, secKey, queryScale);
+      encrypt.ms.push_back(elapsedMs(start));
+
+      start = Clock::now();
+      CachedQuery cached(rank);
+      server.cacheQuery(cached, query);
+      cacheQuery.ms.push_back(elapsedMs(start));
+
+      std::vector<Ciphertext> extended(blocks.size(), Ciphertext(true));
+      start = Clock::now();
+      for (u64 b = 0; b < blocks.size(); ++b)
+        eval.multithreadMultSum(extended[b], cached.getSpan(),
+                                blocks[b].getSpan(), rank);
+      scan.ms.push_back(elapsedMs(start));
+
+      start = Clock::now();
+      for (u64 b = 0; b < blocks.size(); ++b)
+        eval.relin(results[b], extended[b], relinKey);
+      relin.ms.push_back(elapsedMs(start));
+    } else {
+      start = Clock::now();
+      Polynomial query(rank, MOD_Q);
+      client.encodeQuery(query, msg, queryScale);
+      encrypt.ms.push_back(elapsedMs(start));
+
+      start = Clock::now();
+      CachedPlaintextQuery cached(rank);
+      server.cacheQuery(cached, query);
+      cacheQuery.ms.push_back(elapsedMs(start));
+
+      start = Clock::now();
+      for (u64 b = 0; b < blocks.size(); ++b)
+        server.innerProduct(results[b], cached, blocks[b]);
+      scan.ms.push_back(elapsedMs(start));
+    }
+
+    start = Clock::now();
+    std::vector<Message> dmsg(results.size(), Message(DEGREE));
+    client.decryptScore(dmsg, results, secKey, outputScale);
+    std::vector<float> scores(base.count);
+    for (u64 i = 0; i < base.count; ++i)
+      scores[i] = static_cast<float>(dmsg[i / DEGREE][i % DEGREE]);
+    decrypt.ms.push_back(elapsedMs(start));
+
+    start = Clock::now();
+    auto top = HEVECClient::getTopKIndices(scores, opt.k);
+    topK.ms.push_back(elapsedMs(start));
+    total.ms.push_back(elapsedMs(queryStart));
+
+    report.quality.add(scores, top, exact[q], truth[q], opt.k);
+  }
+
+  report.stages = {encrypt, cacheQuery, scan};
+  if (isQueryEncrypt)
+    report.stages.push_back(relin);
+  report.stages.insert(report.stages.end(), {decrypt, topK, total});
+  return report;
+}
+
+// Inserts and queries through HEVECClient. transfer is what the round trip
+// adds on top of the in-process pipeline: serialization, the socket and
+// request handling in the server.
+PathReport runHttp(const Options &opt, const Dataset &base,
+                   const Dataset &queries,
+                   const std::vector<std::vector<float>> &exact,
+                   const std::vector<std::vector<u64>> &truth,
+                   bool isQueryEncrypt, const PathReport *inProcess) {
+  PathReport report;
+  report.name = std::string("http_") + (isQueryEncrypt ? "encrypted"
+                                                        : "plaintext");
+  report.remote = true;
+  HEVECClient client(opt.host, opt.port);
+  const std::string collection = "hevec_recall_" + report.name;
+  try {
+    client.dropCollection(collection);
+  } catch (const std::exception &) {
+  }
+
+  auto start = Clock::now();
+  client.setupCollection(collection, base.dimension, opt.metric,
+                         isQueryEncrypt);
+  report.keygenMs = elapsedMs(start);
+
+  start = Clock::now();
+  for (u64 offset = 0; offset < base.count; offset += DEGREE) {
+    const u64 count = std::min(DEGREE, base.count - offset);
+    std::vector<std::vector<float>> batch(count);
+    std::vector<std::string> payloads(count);
+    for (u64 i = 0; i < count; ++i) {
+      batch[i].assign(base.row(offset + i),
+                      base.row(offset + i) + base.dimension);
+      payloads[i] = "doc_" + std::to_string(offset + i);
+    }
+    client.insert(collection, batch, payloads);
+  }
+  report.encryptKeysMs = elapsedMs(start);
+
+  StageStats endToEnd{"end_to_end"}, topK{"top_k"};
+  for (u64 q = 0; q < queries.count; ++q) {
+    std::vector<float> query(queries.row(q),
+                             queries.row(q) + queries.dimension);
+    start = Clock::now();
+    auto scores = client.query(collection, query);
+    endToEnd.ms.push_back(elapsedMs(start));
+
+    start = Clock::now();
+    auto top = HEVECClient::getTopKIndices(scores, opt.k);
+    topK.ms.push_back(elapsedMs(start));
+
+    report.quality.add(scores, top, exact[q], truth[q], opt.k);
+  }
+  client.dropCollection(collection);
+
+  report.stages = {endToEnd, topK};
+  if (inProcess) {
+    double compute = 0.0;
+    for (const auto &stage : inProcess->stages)
+      if (stage.name != "top_k" && stage.name != "total")
+        compute += stage.mean();
+    StageStats transfer{"transfer"};
+    transfer.ms.push_back(std::max(0.0, endToEnd.mean() - compute));
+    report.stages.push_back(transfer);
+  }
+  return report;
+}
+
+void printReport(const PathReport &r, const Options &opt) {
+  const auto &q = r.quality;
+  std::printf("\n[%s] queries=%llu recall@1=%.4f recall@%llu=%.4f "
+              "mean|err|=%.3g max|err|=%.3g\n",
+              r.name.c_str(), static_cast<unsigned long long>(q.queries),
+              q.recallAt1 / q.queries, static_cast<unsigned long long>(opt.k),
+              q.recallAtK / q.queries,
+              q.scoreCount ? q.sumAbsError / q.scoreCount : 0.0,
+              q.maxAbsError);
+  if (r.remote)
+    std::printf("  setup: setupCollection %.0f ms, insert %.0f ms\n",
+                r.keygenMs, r.encryptKeysMs);
+  else
+    std::printf("  setup: keygen %.0f ms, encrypt keys %.0f ms, cache keys "
+                "%.0f ms\n",
+                r.keygenMs, r.encryptKeysMs, r.cacheKeysMs);
+  std::printf("  %-12s %10s %10s %10s\n", "stage", "mean ms", "p50 ms",
+              "p99 ms");
+  for (const auto &s : r.stages)
+    std::printf("  %-12s %10.3f %10.3f %10.3f\n", s.name.c_str(), s.mean(),
+                s.percentile(50.0), s.percentile(99.0));
+}
+
+void writeJson(const std::vector<PathReport> &reports, const Options &opt,
+               u64 nDb, u64 nQuery, u64 dimension) {
+  std::ofstream out(opt.jsonPath);
+  if (!out)
+    throw std::runtime_error("Cannot open " + opt.jsonPath);
+  out << "{\n  \"n_db\": " << nDb << ",\n  \"n_query\": " << nQuery
+      << ",\n  \"dimension\": " << dimension << ",\n  \"metric\": \""
+      << opt.metric << "\",\n  \"k\": " << opt.k << ",\n  \"paths\": [";
+  for (std::size_t i = 0; i < reports.size(); ++i) {
+    const auto &r = reports[i];
+    const auto &q = r.quality;
+    out << (i ? ",\n" : "\n") << "    {\"path\": \"" << r.name
+        << "\", \"recall_at_1\": " << q.recallAt1 / q.queries
+        << ", \"recall_at_k\": " << q.recallAtK / q.queries
+        << ", \"mean_abs_error\": "
+        << (q.scoreCount ? q.sumAbsError / q.scoreCount : 0.0)
+        << ", \"max_abs_error\": " << q.maxAbsError
+        << ", \"keygen_ms\": " << r.keygenMs
+        << ", \"encrypt_keys_ms\": " << r.encryptKeysMs
+        << ", \"cache_keys_ms\": " << r.cacheKeysMs << ", \"stages\": {";
+    for (std::size_t j = 0; j < r.stages.size(); ++j) {
+      const auto &s = r.stages[j];
+      out << (j ? ", " : "") << "\"" << s.name << "\": {\"mean_ms\": "
+          << s.mean() << ", \"p50_ms\": " << s.percentile(50.0)
+          << ", \"p99_ms\": " << s.percentile(99.0) << "}";
+    }
+    out << "}}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  try {
+    Options opt = parseOptions(argc, argv);
+
+    u64 baseTotal = 0, queryTotal = 0;
+    Dataset base = loadFbin(opt.basePath, opt.nDb, baseTotal);
+    Dataset queries = loadFbin(opt.queryPath, opt.nQuery, queryTotal);
+    if (base.dimension != queries.dimension)
+      throw std::runtime_error("Base and query dimensions differ");
+    if (opt.metric == "COSINE") {
+      normalizeRows(base);
+      normalizeRows(queries);
+    }
+    std::cout << "Loaded " << base.count << " base and " << queries.count
+              << " query vectors of dimension " << base.dimension
+              << std::endl;
+
+    std::vector<std::vector<float>> exact(queries.count);
+    std::vector<std::vector<u64>> truth(queries.count);
+    for (u64 q = 0; q < queries.count; ++q)
+      exact[q] = exactScores(base, queries.row(q));
+
+    // The ground-truth file ranks the whole base set, so it only applies
+    // when all of it is inserted; otherwise rank the exact scores.
+    bool useGtFile = !opt.gtPath.empty() && base.count == baseTotal;
+    if (!opt.gtPath.empty() && !useGtFile)
+      std::cout << "--n-db is below the base size; ranking exact scores "
+                   "instead of "
+                << opt.gtPath << std::endl;
+    if (useGtFile) {
+      u64 gtK = 0;
+      truth = loadIbin(opt.gtPath, queries.count, gtK);
+      if (truth.size() < queries.count)
+        throw std::runtime_error(opt.gtPath + " has fewer rows than queries");
+      if (gtK < opt.k)
+        throw std::runtime_error(opt.gtPath + " only ranks " +
+                                 std::to_string(gtK) + " neighbours");
+    } else {
+      for (u64 q = 0; q < queries.count; ++q) {
+        std::vector<float> scores = exact[q];
+        truth[q] = HEVECClient::getTopKIndices(scores, opt.k);
+      }
+    }
+
+    std::vector<bool> paths;
+    if (opt.path != "plaintext")
+      paths.push_back(true);
+    if (opt.path != "encrypted")
+      paths.push_back(false);
+
+    std::vector<PathReport> reports;
+    for (bool isQueryEncrypt : paths) {
+      reports.push_back(
+          runInProcess(opt, base, queries, exact, truth, isQueryEncrypt));
+      printReport(reports.back(), opt);
+      if (!opt.port.empty()) {
+        PathReport inProcess = reports.back();
+        reports.push_back(runHttp(opt, base, queries, exact, truth,
+                                  isQueryEncrypt, &inProcess));
+        printReport(reports.back(), opt);
+      }
+    }
+
+    if (!opt.jsonPath.empty())
+      writeJson(reports, opt, base.count, queries.count, base.dimension);
+  } catch (const std::exception &e) {
+    std::cerr << "hevec_recall: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
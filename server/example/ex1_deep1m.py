@@ -9,6 +9,7 @@ DEGREE = 4096
 
 N_DB = 1000000
 N_QUERY = 10000
+QUERY_BATCH = 16
 IS_QUERY_ENCRYPT = False
 
 def load_fbin(filepath: str) -> Tuple[np.ndarray, int, int]:
@@ -87,42 +88,46 @@ def main():
 
         k = 10
 
-        for i in range(min(N_QUERY, len(Q))):
-            if i > 0 and i % 100 == 0:
-                print(f"  -> Processed {i}/{min(N_QUERY, len(Q))} queries")
-            
-            query_vec = Q[i]
-            
-            # Get encrypted scores from HEVEC
-            all_scores = client.query(collection_name, query_vec)
-            
-            # Compute ground truth scores locally
-            query_norm = query_vec / np.linalg.norm(query_vec)
-            B_norm = B / np.linalg.norm(B, axis=1, keepdims=True)
-            gt_scores = np.dot(B_norm, query_norm)
-
-            # Measure error
-            for j in range(min(len(all_scores), len(gt_scores))):
-                error = abs(gt_scores[j] - all_scores[j])
-                all_errors.append(error)
-            
-            # Get top-k indices from ground truth and encrypted results
-            gt_top_k_indices = np.argsort(gt_scores)[-k:][::-1]
-            gt_max_idx = gt_top_k_indices[0]
-            
-            encrypted_top_k_indices = np.argsort(all_scores)[-k:][::-1]
-            
-            # Calculate recall and MRR
-            for j, idx in enumerate(encrypted_top_k_indices):
-                if idx == gt_max_idx:
-                    if j == 0:
-                        recall1 += 1
-                    if j < 5:
-                        recall5 += 1
-                    if j < 10:
-                        recall10 += 1
-                    mrr += 1.0 / (j + 1)
-                    break
+        n_queries = min(N_QUERY, len(Q))
+        B_norm = B / np.linalg.norm(B, axis=1, keepdims=True)
+
+        for start in range(0, n_queries, QUERY_BATCH):
+            if start > 0 and start % 1000 == 0:
+                print(f"  -> Processed {start}/{n_queries} queries")
+
+            query_batch = Q[start:min(start + QUERY_BATCH, n_queries)]
+
+            # Get encrypted scores from HEVEC; the server scans each block
+            # once for the whole batch
+            batch_scores = client.query_batch(collection_name, query_batch)
+
+            for query_vec, all_scores in zip(query_batch, batch_scores):
+                # Compute ground truth scores locally
+                query_norm = query_vec / np.linalg.norm(query_vec)
+                gt_scores = np.dot(B_norm, query_norm)
+
+                # Measure error
+                for j in range(min(len(all_scores), len(gt_scores))):
+                    error = abs(gt_scores[j] - all_scores[j])
+                    all_errors.append(error)
+
+                # Get top-k indices from ground truth and encrypted results
+                gt_top_k_indices = np.argsort(gt_scores)[-k:][::-1]
+                gt_max_idx = gt_top_k_indices[0]
+
+                encrypted_top_k_indices = np.argsort(all_scores)[-k:][::-1]
+
+                # Calculate recall and MRR
+                for j, idx in enumerate(encrypted_top_k_indices):
+                    if idx == gt_max_idx:
+                        if j == 0:
+                            recall1 += 1
+                        if j < 5:
+                            recall5 += 1
+                        if j < 10:
+                            recall10 += 1
+                        mrr += 1.0 / (j + 1)
+                        break
 
         n_queries_processed = min(N_QUERY, len(Q))
         
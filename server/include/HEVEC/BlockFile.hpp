@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "Server.hpp"
+#include "Type.hpp"
+
+namespace HEVEC {
+
+// Backing file for the full block caches of one collection. Each appended
+// block is written out and mapped back read-only, so its pages are cached
+// by the kernel and evicted under memory pressure instead of being held on
+// the heap; a collection can outgrow RAM at the cost of page-ins on scans.
+// Blocks are stored bit-packed if packed, which shrinks them by 54/64.
+class BlockFile {
+public:
+  // Creates the file, replacing any left at path.
+  BlockFile(const std::string &path, u64 rank, bool packed = false);
+  ~BlockFile();
+
+  BlockFile(const BlockFile &) = delete;
+  BlockFile &operator=(const BlockFile &) = delete;
+
+  // Writes a full, NTT-form block and returns it tiled, mapped from the
+  // file. The mapping outlives the BlockFile while the block is referenced.
+  std::shared_ptr<const CachedKeys> append(const CachedKeys &block);
+
+  u64 getBlockBytes() const { return block_bytes_; }
+
+private:
+  const std::string path_;
+  const u64 rank_;
+  const bool packed_;
+  const u64 data_bytes_;  // of the scan layout
+  const u64 block_bytes_; // data_bytes_ padded to whole pages
+  int fd_ = -1;
+  u64 num_blocks_ = 0;
+};
+
+} // namespace HEVEC
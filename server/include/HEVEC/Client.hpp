@@ -7,6 +7,7 @@
 #include "Keys.hpp"
 #include "MLWECiphertext.hpp"
 #include "Message.hpp"
+#include "PackedCiphertext.hpp"
 #include "Polynomial.hpp"
 #include "SecretKey.hpp"
 #include "SwitchingKey.hpp"
@@ -39,19 +40,32 @@ public:
                double scale);
   void decrypt(Message &res, const Ciphertext &ctxt, const SecretKey &secKey,
                double scale);
+  void decrypt(Message &res, const PackedCiphertext &ctxt,
+               const SecretKey &secKey, double scale);
 
   void encryptQuery(MLWECiphertext &res, const Message &msg,
                     const SecretKey &secKey, double scale);
+  // Seeded variants: A is expanded from seed (SEED_SIZE bytes), so only the
+  // seed and B have to be sent.
+  void encryptQuery(MLWECiphertext &res, const Message &msg,
+                    const SecretKey &secKey, double scale, const u8 *seed);
   void encodeQuery(Polynomial &res, const Message &msg, double scale);
   void encryptKey(MLWECiphertext &res, const Message &msg,
                   const SecretKey &secKey, double scale);
+  void encryptKey(MLWECiphertext &res, const Message &msg,
+                  const SecretKey &secKey, double scale, const u8 *seed);
   void encodeKey(Polynomial &res, const Message &msg, double scale);
   void decryptScore(std::vector<Message> &msg, std::vector<Ciphertext> &score,
                     const SecretKey &secKey, double scale);
+  void decryptScore(std::vector<Message> &msg,
+                    const std::vector<PackedCiphertext> &score,
+                    const SecretKey &secKey, double scale);
   void topKScore(TopK &res, const std::vector<Message> &msg);
 
   void encryptPIR(Ciphertext &res, u64 idx, const SecretKey &secKey,
                   double scale);
+  void encryptPIR(Ciphertext &res, u64 idx, const SecretKey &secKey,
+                  double scale, const u8 *seed);
 
   void encodePIRPayload(Polynomial &res, const unsigned char *payload);
   void decodePIRPayload(unsigned char *payload, const Message &dmsg);
@@ -62,6 +76,14 @@ public:
 private:
   void genSwtKey(SwitchingKey &res, const SecretKey &secKey,
                  const Polynomial &modifiedKey);
+  // Fills B for the A already held by res.
+  void genSwtKeyB(SwitchingKey &res, const SecretKey &secKey,
+                  const Polynomial &modifiedKey);
+  // Encrypts factor * ptxt (error included) under the A expanded from seed.
+  void encryptWithSeed(Ciphertext &res, const Polynomial &ptxt,
+                       const SecretKey &secKey, const u8 *seed, u64 factor);
+  void encryptWithSeed(MLWECiphertext &res, const Polynomial &ptxt,
+                       const SecretKey &secKey, const u8 *seed, u64 factor);
 
   const u64 invRank_;
 
@@ -4,7 +4,9 @@
 
 namespace HEVEC {
 
-constexpr int N_THREAD = 64;
+// Coefficient ranges the scan kernels split DEGREE into, one task each; the
+// task pool decides how many threads run them.
+constexpr u64 N_SCAN_TILES = 64;
 
 constexpr u64 LOG_DEGREE = 12;
 constexpr u64 HAMMING_WEIGHT = 2730;
@@ -13,6 +15,7 @@ constexpr double GAUSSIAN_ERROR_STDEV = 3.2;
 constexpr u64 MOD_Q = 18014398491918337;  // 54 bit
 constexpr u64 MOD_P = 36028797005856769; // 55 bit
 constexpr u64 INVERSE_P_MOD_Q = 995681451208133;
+constexpr u64 LOG_MOD_Q = 54;
 
 constexpr double LOG_SCALE = 26.25;
 
@@ -9,6 +9,7 @@
 #include <unordered_map>
 #include <vector>
 
+#include "Message.hpp"
 #include "MetricType.hpp"
 #include "SecretKey.hpp"
 #include "TopK.hpp"
@@ -42,6 +43,10 @@ public:
   std::vector<float> query(const std::string &collectionName,
                            const std::vector<float> &query_vec);
 
+  std::vector<std::vector<float>>
+  queryBatch(const std::string &collectionName,
+             const std::vector<std::vector<float>> &query_vecs);
+
   void queryAndTopK(TopK &res, const std::string &collectionName,
                     const std::vector<float> &query_vec);
 
@@ -56,6 +61,12 @@ public:
 
   std::string retrievePIR(const std::string &collectionName, u64 index);
 
+  // HTTP bytes, headers included, written to and read from the server.
+  u64 getBytesSent() const { return bytesSent_; }
+  u64 getBytesReceived() const { return bytesReceived_; }
+  // Server-Timing header of the last traced response, or "".
+  const std::string &getLastServerTiming() const { return lastServerTiming_; }
+
 private:
   struct CollectionContext;
   using HttpRequest = boost::beast::http::request<boost::beast::http::vector_body<uint8_t>>;
@@ -74,6 +85,10 @@ private:
                            std::vector<uint8_t> &&body,
                            bool close = false);
   HttpResponse performDelete(const std::string &target);
+  void appendQuery(std::vector<uint8_t> &body, CollectionContext &ctx,
+                   const Message &msg);
+  void decryptScores(std::vector<Message> &res, CollectionContext &ctx,
+                     const HttpResponse &response, u64 count);
 
   std::unordered_map<std::string, std::unique_ptr<CollectionContext>>
       collections_;
@@ -83,6 +98,16 @@ private:
 
   unsigned char aesKey_[AES_KEY_SIZE];
   bool aesKeyGenerated_ = false;
+
+  // HEVEC_COMPACT_RESPONSE=1 asks the server for mod-switched, bit-packed
+  // score and PIR ciphertexts.
+  bool compactResponses_ = false;
+  // HEVEC_TRACE_REQUESTS=1 asks the server to trace every request and return
+  // its spans in a Server-Timing header.
+  bool traceRequests_ = false;
+  std::string lastServerTiming_;
+  u64 bytesSent_ = 0;
+  u64 bytesReceived_ = 0;
   const std::size_t max_body_size_{std::numeric_limits<std::size_t>::max()};
 };
 
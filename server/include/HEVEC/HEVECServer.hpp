@@ -1,19 +1,35 @@
 #pragma once
 
+#include <atomic>
 #include <boost/asio.hpp>
 #include <boost/beast/http.hpp>
+#include <condition_variable>
+#include <cstddef>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
 
+#include "Metrics.hpp"
 #include "Type.hpp"
 
 namespace HEVEC {
 
 class HEVECServer {
 public:
-  explicit HEVECServer(unsigned short port);
+  // Sockets are served by ioThreads threads. Setup, insert, query and PIR
+  // requests run on a separate pool of computeThreads threads; once
+  // maxQueuedRequests of them are pending, further ones get 503.
+  explicit HEVECServer(unsigned short port, std::size_t ioThreads = 1,
+                       std::size_t computeThreads = 1,
+                       std::size_t maxQueuedRequests = 64);
+  ~HEVECServer();
   void run();
+  // Stops run() after the running requests finish and, when
+  // HEVEC_SNAPSHOT_DIR is set, snapshots every collection.
+  void stop();
 
 private:
   class Session;
@@ -31,22 +47,80 @@ private:
     bool should_close{false};
   };
 
+  struct EndpointMetrics {
+    std::shared_ptr<Counter> success;
+    std::shared_ptr<Counter> client_error;
+    std::shared_ptr<Counter> server_error;
+    std::shared_ptr<Histogram> duration;
+    std::shared_ptr<Histogram> request_bytes;
+    std::shared_ptr<Histogram> response_bytes;
+  };
+
   std::shared_ptr<CollectionData> findCollection(u64 collectionHash);
   std::shared_ptr<CollectionData> getCollectionOrThrow(u64 collectionHash);
 
   void doAccept();
+  bool isComputeRequest(const HttpRequest &req) const;
+  bool tryReserveCompute();
+  void releaseCompute();
   ResponseResult processRequest(HttpRequest &&req);
-  HttpResponse handleSetup(const HttpRequest &req);
-  HttpResponse handleInsert(const HttpRequest &req);
-  HttpResponse handleQuery(const HttpRequest &req, bool isEncrypted);
+  HttpResponse handleSetup(const HttpRequest &req, bool isSeeded);
+  HttpResponse handleInsert(const HttpRequest &req, bool isSeeded);
+  HttpResponse handleQuery(const HttpRequest &req, bool isEncrypted,
+                           bool isSeeded);
+  HttpResponse handleQueryBatch(const HttpRequest &req, bool isEncrypted,
+                                bool isSeeded);
   HttpResponse handleRetrieve(const HttpRequest &req);
-  HttpResponse handlePirRetrieve(const HttpRequest &req);
+  HttpResponse handlePirRetrieve(const HttpRequest &req, bool isSeeded);
+  HttpResponse handleMetrics(const HttpRequest &req);
+  HttpResponse handleSnapshot(const HttpRequest &req);
+
+  // Snapshots one collection, or every one when collectionHash is empty, to
+  // HEVEC_SNAPSHOT_DIR and returns how many were saved.
+  u64 saveSnapshots(std::optional<u64> collectionHash);
+  void saveCollection(const std::string &path, u64 collectionHash,
+                      CollectionData &ctx);
+  // saveCollection for a caller already holding the collection's insert_mtx.
+  void saveCollectionLocked(const std::string &path, u64 collectionHash,
+                            CollectionData &ctx);
+  // Called under the insert_mtx when an insert was logged but could not be
+  // applied: snapshots the collection so the log, and the record, can be
+  // dropped, or stops serving the collection if that fails.
+  void discardLoggedInsert(u64 collectionHash,
+                           const std::shared_ptr<CollectionData> &ctx);
+  void loadCollection(const std::string &path);
+  // Loads every snapshot in HEVEC_SNAPSHOT_DIR; unreadable ones are skipped.
+  void loadSnapshots();
+
+  EndpointMetrics &getEndpointMetrics(const HttpRequest &req);
+  void recordRequest(EndpointMetrics &metrics, unsigned status,
+                     std::size_t requestBytes, std::size_t responseBytes,
+                     double seconds);
+  void updateMemoryMetrics(CollectionData &ctx);
+  // Just the allocated bytes by page kind; cheap enough for every scrape.
+  void updateAllocatedMetrics(CollectionData &ctx);
+
+  const std::size_t io_threads_;
+  const std::size_t max_queued_requests_;
+  std::atomic<std::size_t> queued_requests_{0};
 
   boost::asio::io_context io_context_;
   boost::asio::ip::tcp::acceptor acceptor_;
+  boost::asio::thread_pool compute_pool_;
 
   std::unordered_map<u64, std::shared_ptr<CollectionData>> collections_;
+  // Hashes whose setup or drop is under way, also guarded by
+  // collections_mutex_.
+  std::unordered_set<u64> pending_hashes_;
+  std::condition_variable pending_done_;
   std::mutex collections_mutex_;
+
+  // Served at GET /metrics. endpoint_metrics_ is filled in the constructor
+  // and only read afterwards.
+  MetricsRegistry metrics_;
+  std::unordered_map<std::string, EndpointMetrics> endpoint_metrics_;
+  std::shared_ptr<Counter> rejected_requests_;
+  std::shared_ptr<Histogram> queue_wait_;
 };
 
 } // namespace HEVEC
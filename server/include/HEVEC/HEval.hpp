@@ -7,6 +7,7 @@
 #include "Ciphertext.hpp"
 #include "MLWECiphertext.hpp"
 #include "MLWESwitchingKey.hpp"
+#include "PackedCiphertext.hpp"
 #include "Polynomial.hpp"
 #include "SwitchingKey.hpp"
 
@@ -62,11 +63,26 @@ public:
            u64 outputModFactor = 1);
   void intt(Ciphertext &res, const Ciphertext &op, u64 inputModFactor = 4,
             u64 outputModFactor = 1);
-
-  void multithreadMultSum(Ciphertext &res, const std::vector<Ciphertext> &op1,
-                          const std::vector<Ciphertext> &op2);
-  void multithreadMultSum(Ciphertext &res, const std::vector<Ciphertext> &op1,
-                          const std::vector<Polynomial> &op2);
+  // Switches op from MOD_Q to 2^res.getBits() and packs it, and lifts a
+  // packed ciphertext back to MOD_Q in coefficient form.
+  void modSwitch(PackedCiphertext &res, const Ciphertext &op);
+  void modSwitch(Ciphertext &res, const PackedCiphertext &op);
+
+  // res += scale * sum_j op1[j * gap] * op2[j], reduced once per coefficient.
+  // Each thread sums one SCAN_TILE of coefficients, so operands in the scan
+  // layout are streamed contiguously.
+  void multithreadMultSum(Ciphertext &res, CiphertextSpan op1,
+                          CiphertextSpan op2, u64 scale = 1);
+  void multithreadMultSum(Ciphertext &res, CiphertextSpan op1,
+                          PolynomialSpan op2, u64 scale = 1);
+  // Batched forms for several queries against one key block: each slice of
+  // the shared operand is loaded once per tile of queries.
+  void multithreadMultSum(std::vector<Ciphertext> &res,
+                          const std::vector<CiphertextSpan> &op1,
+                          CiphertextSpan op2, u64 scale = 1);
+  void multithreadMultSum(std::vector<Ciphertext> &res, CiphertextSpan op1,
+                          const std::vector<PolynomialSpan> &op2,
+                          u64 scale = 1);
 
   void bitRevedMultithreadMultSum(Ciphertext &res,
                                   const std::vector<Ciphertext> &op1,
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+
+#include "Type.hpp"
+
+// Statements below this level are compiled out (0 = debug ... 4 = off).
+#ifndef HEVEC_LOG_MIN_LEVEL
+#define HEVEC_LOG_MIN_LEVEL 0
+#endif
+
+namespace HEVEC {
+
+enum class LogLevel : int { Debug = 0, Info, Warn, Error, Off };
+
+// Appends timestamped lines to a file from a background thread. write() copies
+// the message into a bounded lock-free queue and returns; when the queue is
+// full the message is dropped and counted. A logger whose path variable is
+// unset is disabled, and HEVEC_LOG then costs one relaxed load and a branch
+// without building the message.
+class Logger {
+public:
+  // Messages longer than this are truncated.
+  static constexpr u64 MAX_MESSAGE = 240;
+  static constexpr u64 QUEUE_SIZE = 1024;
+
+  // Logs to the file named by pathEnv at the level named by HEVEC_LOG_LEVEL
+  // (debug, info, warn, error or off; info by default).
+  explicit Logger(const char *pathEnv);
+  ~Logger();
+
+  Logger(const Logger &) = delete;
+  Logger &operator=(const Logger &) = delete;
+
+  bool isEnabled(LogLevel level) const {
+    return static_cast<int>(level) >= level_.load(std::memory_order_relaxed);
+  }
+  void write(LogLevel level, std::string_view message);
+  // Blocks until every message written before the call is in the file.
+  void flush();
+
+  u64 getDropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+  struct Slot {
+    std::atomic<u64> sequence;
+    std::int64_t time_ns;
+    LogLevel level;
+    u64 length;
+    char text[MAX_MESSAGE];
+  };
+
+  bool tryPop(Slot *&slot);
+  void run();
+
+  std::atomic<int> level_{static_cast<int>(LogLevel::Off)};
+  std::unique_ptr<Slot[]> slots_;
+  // Vyukov's bounded queue: producers claim head_, the writer owns tail_.
+  alignas(64) std::atomic<u64> head_{0};
+  alignas(64) u64 tail_ = 0;
+  std::atomic<u64> written_{0};
+  std::atomic<u64> dropped_{0};
+
+  std::FILE *file_ = nullptr;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable flushed_;
+  std::atomic<bool> idle_{false};
+  bool stop_ = false;
+  std::thread writer_;
+};
+
+Logger &getServerLogger(); // HEVEC_SERVER_LOG_PATH
+Logger &getClientLogger(); // HEVEC_CLIENT_LOG_PATH
+
+} // namespace HEVEC
+
+#define HEVEC_LOG(logger, level, message)                                      \
+  do {                                                                         \
+    if (static_cast<int>(level) >= HEVEC_LOG_MIN_LEVEL &&                      \
+        (logger).isEnabled(level))                                             \
+      (logger).write(level, message);                                          \
+  } while (0)
@@ -11,7 +11,8 @@ class MLWECiphertext {
 public:
   explicit MLWECiphertext(u64 rank)
       : rank_(rank), stack_(DEGREE / rank),
-        polys_(DEGREE / rank + 1, Polynomial(rank, MOD_Q)) {}
+        polys_(std::vector<PolynomialArray::Shape>(DEGREE / rank + 1,
+                                                   {rank, MOD_Q})) {}
 
   // Rule of Five: Explicitly defined
   MLWECiphertext(const MLWECiphertext &other)
@@ -49,9 +50,13 @@ public:
   u64 getStack() const { return stack_; }
   u64 getDegree() const { return DEGREE; }
 
+  // A_0, ..., A_{stack - 1}, B, rank words each.
+  PolynomialArray &getPolys() { return polys_; }
+  const PolynomialArray &getPolys() const { return polys_; }
+
 private:
   u64 rank_;
   u64 stack_;
-  std::vector<Polynomial> polys_;
+  PolynomialArray polys_;
 };
 } // namespace HEVEC
\ No newline at end of file
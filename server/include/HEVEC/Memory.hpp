@@ -0,0 +1,119 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+
+#include "Type.hpp"
+
+namespace HEVEC {
+
+// Alignment of polynomial slabs: a cache line, and an AVX-512 vector.
+constexpr u64 POLYNOMIAL_ALIGNMENT = 64;
+
+// Pages behind a slab: regular ones, regular ones the kernel was asked to
+// back with transparent huge pages, or huge pages from hugetlbfs.
+enum class PageKind { Small, TransparentHuge, Huge };
+constexpr u64 NUM_PAGE_KINDS = 3;
+
+// Bytes of slabs held by one owner, such as a collection, by page kind.
+class MemoryAccount {
+public:
+  u64 getBytes(PageKind kind) const {
+    return bytes_[static_cast<u64>(kind)].load(std::memory_order_relaxed);
+  }
+  void add(PageKind kind, u64 bytes) {
+    bytes_[static_cast<u64>(kind)].fetch_add(bytes, std::memory_order_relaxed);
+  }
+  void remove(PageKind kind, u64 bytes) {
+    bytes_[static_cast<u64>(kind)].fetch_sub(bytes, std::memory_order_relaxed);
+  }
+
+private:
+  std::array<std::atomic<u64>, NUM_PAGE_KINDS> bytes_{};
+};
+
+// Every slab of the process.
+MemoryAccount &getProcessMemory();
+
+// Charges the slabs allocated on this thread while it lives, and in the
+// parallelFor loops it starts, to account. A slab stays charged to the
+// account it was allocated under until it is freed, wherever that happens.
+class MemoryScope {
+public:
+  explicit MemoryScope(std::shared_ptr<MemoryAccount> account);
+  ~MemoryScope();
+
+  MemoryScope(const MemoryScope &) = delete;
+  MemoryScope &operator=(const MemoryScope &) = delete;
+
+  // The account of the innermost MemoryScope, or null.
+  static const std::shared_ptr<MemoryAccount> &current();
+
+private:
+  std::shared_ptr<MemoryAccount> previous_;
+};
+
+// Memory handed out by a WordAllocator: bytes from data, in pages of kind.
+struct WordSlab {
+  u64 *data = nullptr;
+  u64 bytes = 0;
+  PageKind kind = PageKind::Small;
+};
+
+// Source of the slabs behind allocateWords, and so of polynomials, keys and
+// block caches.
+class WordAllocator {
+public:
+  virtual ~WordAllocator() = default;
+  // At least count words at alignment, a power of two. Throws
+  // std::bad_alloc.
+  virtual WordSlab allocate(u64 count, u64 alignment) = 0;
+  virtual void deallocate(const WordSlab &slab) = 0;
+};
+
+// HEVEC_HUGE_PAGES: off (regular pages only), thp (default: slabs of 2 MB
+// and up are 2 MB-aligned mappings with MADV_HUGEPAGE) or hugetlb (such
+// slabs come from the hugetlbfs pool, in 1 GB or 2 MB pages, and fall back
+// to thp when the pool runs short).
+enum class HugePageMode { Off, Transparent, HugeTLB };
+HugePageMode getHugePageMode();
+
+// Backs large slabs with huge pages, so scans over keys and block caches
+// take fewer dTLB misses, and leaves smaller ones to aligned_alloc. A slab
+// is rounded up to whole hugetlbfs pages only when that wastes at most a
+// sixteenth of it; otherwise it takes the next smaller page size. Off Linux
+// every slab comes from aligned_alloc.
+class HugePageAllocator : public WordAllocator {
+public:
+  explicit HugePageAllocator(HugePageMode mode) : mode_(mode) {}
+
+  WordSlab allocate(u64 count, u64 alignment) override;
+  void deallocate(const WordSlab &slab) override;
+
+private:
+  const HugePageMode mode_;
+};
+
+// The allocator of allocateWords: a HugePageAllocator in the mode of
+// getHugePageMode(), unless another one was installed. Slabs go back to the
+// allocator that made them, so one can be installed at any time; it must
+// outlive them. Null reinstalls the default.
+WordAllocator &getWordAllocator();
+void setWordAllocator(WordAllocator *allocator);
+
+// Returns a slab to its allocator and uncharges it.
+struct AlignedFree {
+  WordAllocator *allocator = nullptr;
+  WordSlab slab;
+  std::shared_ptr<MemoryAccount> account;
+
+  void operator()(u64 *data) const;
+};
+using AlignedWords = std::unique_ptr<u64[], AlignedFree>;
+
+// Uninitialized words at alignment, from getWordAllocator(), charged to
+// MemoryScope::current() and getProcessMemory().
+AlignedWords allocateWords(u64 count, u64 alignment = POLYNOMIAL_ALIGNMENT);
+
+} // namespace HEVEC
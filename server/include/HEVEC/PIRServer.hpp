@@ -3,11 +3,22 @@
 #include "Ciphertext.hpp"
 #include "HEval.hpp"
 #include "Keys.hpp"
+#include "PackedCiphertext.hpp"
+#include "PIRDatabase.hpp"
 #include "Polynomial.hpp"
 #include "SwitchingKey.hpp"
 
 namespace HEVEC {
 
+// Seconds spent in each step of one PIRServer::pir call.
+struct PIRStageTimes {
+  double expandFirst = 0.0; // decompose and invButterfly of the first query
+  double firstDim = 0.0;
+  double expandSecond = 0.0;
+  double secondDim = 0.0;
+  double relin = 0.0;
+};
+
 class PIRServer {
 public:
   PIRServer(u64 logRank, const SwitchingKey &relinKey,
@@ -15,6 +26,10 @@ public:
 
   void pir(Ciphertext &res, const Ciphertext &queryFristDim,
            const Ciphertext &querySecondDim, const std::vector<Polynomial> &db);
+  void pir(Ciphertext &res, const Ciphertext &queryFirstDim,
+           const Ciphertext &querySecondDim, const PIRDatabase &db,
+           u64 numRows, PIRStageTimes *times = nullptr);
+  void modSwitch(PackedCiphertext &res, const Ciphertext &op);
 
   void decompose(std::vector<Ciphertext> &res, const Ciphertext &op);
   void invButterfly(std::vector<Ciphertext> &op);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+
+#include "Const.hpp"
+#include "Exception.hpp"
+
+namespace HEVEC {
+// A two-polynomial Ciphertext switched from MOD_Q down to 2^bits in
+// coefficient form. The 2 * DEGREE residues (A, then B) are packed LSB-first,
+// bits per coefficient, into 64-bit words.
+class PackedCiphertext {
+public:
+  PackedCiphertext(u64 bits) : bits_(bits) {
+    if (bits_ == 0 || bits_ >= LOG_MOD_Q)
+      throw InvalidModulusException();
+    words_.resize(getWordCount(bits_));
+  }
+
+  static u64 getWordCount(u64 bits) { return (2 * DEGREE * bits + 63) / 64; }
+
+  u64 getBits() const { return bits_; }
+  std::vector<u64> &getWords() { return words_; }
+  const std::vector<u64> &getWords() const { return words_; }
+
+private:
+  const u64 bits_;
+  std::vector<u64> words_;
+};
+} // namespace HEVEC
@@ -1,36 +1,245 @@
 #pragma once
 
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <utility>
 #include <vector>
 
+#include "Memory.hpp"
 #include "Type.hpp"
 
 namespace HEVEC {
 
+// Coefficients of one polynomial. It owns them, or views degree words that
+// belong to someone else (usually a PolynomialArray). Copies and moves of a
+// view own their words; assigning to a view writes through it, unless the
+// degree changes, which turns it into an owning polynomial.
 class Polynomial {
 public:
   explicit Polynomial(u64 degree, u64 mod)
-      : is_ntt_(false), mod_(mod), data_(degree, 0) {}
+      : is_ntt_(false), mod_(mod), degree_(degree),
+        owned_(allocateWords(degree)), data_(owned_.get()) {
+    if (degree_ > 0)
+      std::memset(data_, 0, degree_ * sizeof(u64));
+  }
+  // A view of degree words at data, which must outlive it.
+  Polynomial(u64 *data, u64 degree, u64 mod)
+      : is_ntt_(false), mod_(mod), degree_(degree), data_(data),
+        is_view_(true) {}
 
   // Rule of Five
-  Polynomial(const Polynomial &other) = default;
-  Polynomial(Polynomial &&other) noexcept = default;
-  Polynomial &operator=(const Polynomial &other) = default;
-  Polynomial &operator=(Polynomial &&other) noexcept = default;
+  Polynomial(const Polynomial &other)
+      : is_ntt_(other.is_ntt_), mod_(other.mod_), degree_(other.degree_),
+        owned_(copyWords(other.data_, other.degree_)), data_(owned_.get()) {}
+
+  Polynomial(Polynomial &&other) noexcept
+      : is_ntt_(other.is_ntt_), mod_(other.mod_), degree_(other.degree_) {
+    if (other.is_view_) {
+      owned_ = copyWords(other.data_, degree_);
+    } else {
+      owned_ = std::move(other.owned_);
+      other.degree_ = 0;
+      other.data_ = nullptr;
+    }
+    data_ = owned_.get();
+  }
+
+  Polynomial &operator=(const Polynomial &other) {
+    if (this != &other)
+      assign(other);
+    return *this;
+  }
+
+  Polynomial &operator=(Polynomial &&other) noexcept {
+    if (this == &other)
+      return *this;
+    if ((is_view_ && degree_ == other.degree_) || other.is_view_) {
+      assign(other);
+      return *this;
+    }
+    is_ntt_ = other.is_ntt_;
+    mod_ = other.mod_;
+    degree_ = other.degree_;
+    owned_ = std::move(other.owned_);
+    data_ = owned_.get();
+    is_view_ = false;
+    other.degree_ = 0;
+    other.data_ = nullptr;
+    return *this;
+  }
 
   void setIsNTT(bool is_ntt) { is_ntt_ = is_ntt; }
   bool getIsNTT() const { return is_ntt_; }
 
-  u64 *getData() { return data_.data(); }
-  const u64 *getData() const { return data_.data(); }
+  u64 *getData() { return data_; }
+  const u64 *getData() const { return data_; }
   u64 getMod() const { return mod_; }
-  u64 getDegree() const { return data_.size(); }
+  u64 getDegree() const { return degree_; }
+  bool isView() const { return is_view_; }
 
   u64 &operator[](u64 i) { return data_[i]; }
   const u64 &operator[](u64 i) const { return data_[i]; }
 
 private:
+  void assign(const Polynomial &other) {
+    is_ntt_ = other.is_ntt_;
+    mod_ = other.mod_;
+    if (is_view_ && degree_ == other.degree_) {
+      if (data_ != other.data_)
+        std::memcpy(data_, other.data_, degree_ * sizeof(u64));
+      return;
+    }
+    owned_ = copyWords(other.data_, other.degree_);
+    degree_ = other.degree_;
+    data_ = owned_.get();
+    is_view_ = false;
+  }
+
+  static AlignedWords copyWords(const u64 *data, u64 count) {
+    AlignedWords res = allocateWords(count);
+    if (count > 0)
+      std::memcpy(res.get(), data, count * sizeof(u64));
+    return res;
+  }
+
   bool is_ntt_;
   u64 mod_;
-  std::vector<u64> data_;
+  u64 degree_;
+  AlignedWords owned_;
+  u64 *data_;
+  bool is_view_ = false;
+};
+
+// Polynomials laid out back to back in one aligned slab, each a view into
+// it, so an object made of many small polynomials is one allocation, one
+// memcpy to copy, and one read off the wire. The slab is owned, or belongs
+// to the caller when the array is built over external storage (copies and
+// moves of such an array own theirs). A polynomial reassigned to another
+// degree leaves the slab and owns its words from then on.
+class PolynomialArray {
+public:
+  struct Shape {
+    u64 degree;
+    u64 mod;
+  };
+
+  PolynomialArray() = default;
+  // Zeroed polynomials of the given shapes, in getWordCount(shapes) words at
+  // storage, or in a slab of their own if storage is null.
+  explicit PolynomialArray(const std::vector<Shape> &shapes,
+                           u64 *storage = nullptr) {
+    words_ = getWordCount(shapes);
+    bind(storage);
+    if (words_ > 0)
+      std::memset(data_, 0, words_ * sizeof(u64));
+    polys_.reserve(shapes.size());
+    u64 offset = 0;
+    for (const Shape &shape : shapes) {
+      polys_.emplace_back(data_ + offset, shape.degree, shape.mod);
+      offset += shape.degree;
+    }
+  }
+
+  PolynomialArray(const PolynomialArray &other, u64 *storage = nullptr)
+      : words_(other.words_) {
+    bind(storage);
+    copyFrom(other);
+  }
+
+  PolynomialArray(PolynomialArray &&other) noexcept {
+    if (!other.slab_ && other.data_) {
+      // Over external storage: the storage stays with other.
+      words_ = other.words_;
+      bind(nullptr);
+      copyFrom(other);
+      return;
+    }
+    swap(other);
+  }
+
+  PolynomialArray &operator=(const PolynomialArray &other) {
+    if (this == &other)
+      return *this;
+    if (words_ == other.words_ && polys_.size() == other.polys_.size()) {
+      // Same layout: write through the views, no allocation.
+      for (u64 i = 0; i < polys_.size(); ++i)
+        polys_[i] = other.polys_[i];
+      return *this;
+    }
+    PolynomialArray copy(other);
+    swap(copy);
+    return *this;
+  }
+
+  PolynomialArray &operator=(PolynomialArray &&other) noexcept {
+    if (this == &other)
+      return *this;
+    if (!other.slab_ || (!slab_ && data_))
+      return *this = static_cast<const PolynomialArray &>(other);
+    swap(other);
+    return *this;
+  }
+
+  static u64 getWordCount(const std::vector<Shape> &shapes) {
+    u64 words = 0;
+    for (const Shape &shape : shapes)
+      words += shape.degree;
+    return words;
+  }
+
+  u64 size() const { return polys_.size(); }
+  Polynomial &operator[](u64 i) { return polys_[i]; }
+  const Polynomial &operator[](u64 i) const { return polys_[i]; }
+  std::vector<Polynomial>::iterator begin() { return polys_.begin(); }
+  std::vector<Polynomial>::iterator end() { return polys_.end(); }
+  std::vector<Polynomial>::const_iterator begin() const {
+    return polys_.begin();
+  }
+  std::vector<Polynomial>::const_iterator end() const { return polys_.end(); }
+
+  // The slab, in polynomial order. Polynomials that left it are not in it.
+  u64 *getData() { return data_; }
+  const u64 *getData() const { return data_; }
+  u64 getWordCount() const { return words_; }
+
+private:
+  void bind(u64 *storage) {
+    if (!storage) {
+      slab_ = allocateWords(words_);
+      storage = slab_.get();
+    }
+    data_ = storage;
+  }
+
+  // Copies other's slab in one go, then rebuilds the views over it. Its
+  // polynomials that left the slab are copied as owning ones.
+  void copyFrom(const PolynomialArray &other) {
+    if (words_ > 0)
+      std::memcpy(data_, other.data_, words_ * sizeof(u64));
+    polys_.reserve(other.polys_.size());
+    for (const Polynomial &poly : other.polys_) {
+      if (!poly.isView()) {
+        polys_.push_back(poly);
+        continue;
+      }
+      polys_.emplace_back(data_ + (poly.getData() - other.data_),
+                          poly.getDegree(), poly.getMod());
+      polys_.back().setIsNTT(poly.getIsNTT());
+    }
+  }
+
+  void swap(PolynomialArray &other) noexcept {
+    std::swap(slab_, other.slab_);
+    std::swap(data_, other.data_);
+    std::swap(words_, other.words_);
+    std::swap(polys_, other.polys_);
+  }
+
+  AlignedWords slab_;
+  u64 *data_ = nullptr;
+  u64 words_ = 0;
+  std::vector<Polynomial> polys_;
 };
-} // namespace HEVEC
\ No newline at end of file
+} // namespace HEVEC
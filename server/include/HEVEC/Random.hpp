@@ -3,6 +3,7 @@
 #include <cmath>
 #include <openssl/rand.h>
 
+#include "MLWECiphertext.hpp"
 #include "Polynomial.hpp"
 #include "Type.hpp"
 
@@ -16,7 +17,11 @@ public:
   static void getRandomSeed(u8 *seed);
 
   static void sampleUniform(Polynomial &res);
-  static void sampleUniformWithSeed(Polynomial &res, const u8 *seed);
+  static void sampleUniformWithSeed(Polynomial &res, const u8 *seed,
+                                    u64 stream = 0);
+  // Expands the A part of an MLWE ciphertext, laid out as Client::encrypt
+  // splits a DEGREE-coefficient A across the stack.
+  static void sampleUniformWithSeed(MLWECiphertext &res, const u8 *seed);
   static void sampleDiscreteGaussian(Polynomial &res);
   static void sampleDiscreteGaussian(Polynomial &res_q, Polynomial &res_p);
 };
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+#include "Ciphertext.hpp"
+#include "MLWESwitchingKey.hpp"
+#include "Polynomial.hpp"
+#include "SwitchingKey.hpp"
+#include "Type.hpp"
+
+namespace HEVEC {
+
+// Writes a snapshot to path.tmp and renames it over path on commit, so a
+// reader only ever sees a complete file. Every record starts on an 8-byte
+// boundary, letting a mapped file be read as u64 words in place.
+class SnapshotWriter {
+public:
+  explicit SnapshotWriter(const std::string &path);
+  // Removes the temporary file unless commit() succeeded.
+  ~SnapshotWriter();
+
+  SnapshotWriter(const SnapshotWriter &) = delete;
+  SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+  // Pads the record to a multiple of 8 bytes.
+  void writeBytes(const void *data, u64 size);
+  void write(u64 value) { writeBytes(&value, sizeof(value)); }
+  void write(const Polynomial &poly);
+  void write(const Ciphertext &ctxt);
+  // Same records as writing each ciphertext of the span.
+  void write(const CiphertextSpan &ctxts);
+  void write(const SwitchingKey &key);
+  void write(const MLWESwitchingKey &key);
+
+  // Flushes and fsyncs the file, then renames it into place.
+  void commit();
+
+  u64 getSize() const { return size_; }
+
+private:
+  std::string path_;
+  std::string tmp_path_;
+  std::FILE *file_ = nullptr;
+  u64 size_ = 0;
+  bool committed_ = false;
+};
+
+// Maps a snapshot read-only. Reads are bounds-checked and throw on a
+// truncated or malformed file; loaded objects copy out of the mapping, which
+// is released on destruction.
+class SnapshotReader {
+public:
+  explicit SnapshotReader(const std::string &path);
+  ~SnapshotReader();
+
+  SnapshotReader(const SnapshotReader &) = delete;
+  SnapshotReader &operator=(const SnapshotReader &) = delete;
+
+  // Points into the mapping; valid while the reader lives.
+  const void *readBytes(u64 size);
+  u64 readU64();
+  // Reshapes res to the stored degree and modulus.
+  void read(Polynomial &res);
+  void read(Ciphertext &res);
+  void read(SwitchingKey &res);
+  // res must have the stored rank.
+  void read(MLWESwitchingKey &res);
+
+  bool atEnd() const { return pos_ == size_; }
+
+private:
+  std::string path_;
+  const unsigned char *data_ = nullptr;
+  u64 size_ = 0;
+  u64 pos_ = 0;
+};
+
+} // namespace HEVEC
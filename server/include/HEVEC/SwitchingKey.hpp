@@ -1,29 +1,82 @@
 #pragma once
 
+#include <vector>
+
 #include "Const.hpp"
 #include "Polynomial.hpp"
+#include "Random.hpp"
 
 namespace HEVEC {
 
 class SwitchingKey {
 public:
-  SwitchingKey()
-      : polyAModQ_(DEGREE, MOD_Q), polyAModP_(DEGREE, MOD_P),
-        polyBModQ_(DEGREE, MOD_Q), polyBModP_(DEGREE, MOD_P) {};
-
-  Polynomial &getPolyAModQ() { return polyAModQ_; }
-  Polynomial &getPolyAModP() { return polyAModP_; }
-  Polynomial &getPolyBModQ() { return polyBModQ_; }
-  Polynomial &getPolyBModP() { return polyBModP_; }
-  const Polynomial &getPolyAModQ() const { return polyAModQ_; }
-  const Polynomial &getPolyAModP() const { return polyAModP_; }
-  const Polynomial &getPolyBModQ() const { return polyBModQ_; }
-  const Polynomial &getPolyBModP() const { return polyBModP_; }
+  // An implicit key is built without its A parts; they are expanded from the
+  // seed wherever the key is used. The parts live in one slab, at storage
+  // (getWordCount(implicitA) words) if given.
+  explicit SwitchingKey(bool implicitA = false, u64 *storage = nullptr)
+      : polys_(getShapes(implicitA), storage) {};
+  // A copy of other in storage.
+  SwitchingKey(const SwitchingKey &other, u64 *storage)
+      : polys_(other.polys_, storage), seed_(other.seed_) {}
+
+  SwitchingKey(const SwitchingKey &other) = default;
+  SwitchingKey(SwitchingKey &&other) noexcept = default;
+  SwitchingKey &operator=(const SwitchingKey &other) = default;
+  SwitchingKey &operator=(SwitchingKey &&other) noexcept = default;
+
+  static u64 getWordCount(bool implicitA) {
+    return PolynomialArray::getWordCount(getShapes(implicitA));
+  }
+
+  Polynomial &getPolyAModQ() { return polys_[0]; }
+  Polynomial &getPolyAModP() { return polys_[1]; }
+  Polynomial &getPolyBModQ() { return polys_[2]; }
+  Polynomial &getPolyBModP() { return polys_[3]; }
+  const Polynomial &getPolyAModQ() const { return polys_[0]; }
+  const Polynomial &getPolyAModP() const { return polys_[1]; }
+  const Polynomial &getPolyBModQ() const { return polys_[2]; }
+  const Polynomial &getPolyBModP() const { return polys_[3]; }
+
+  // AQ, AP, BQ, BP, in wire order.
+  PolynomialArray &getPolys() { return polys_; }
+  const PolynomialArray &getPolys() const { return polys_; }
+
+  // Returns the A part, expanding it into scratch for an implicit key.
+  const Polynomial &getPolyAModQ(Polynomial &scratch) const {
+    return isImplicit() ? expand(scratch, MOD_Q) : getPolyAModQ();
+  }
+  const Polynomial &getPolyAModP(Polynomial &scratch) const {
+    return isImplicit() ? expand(scratch, MOD_P) : getPolyAModP();
+  }
+
+  bool isSeeded() const { return !seed_.empty(); }
+  bool isImplicit() const { return polys_[0].getDegree() == 0; }
+  const u8 *getSeed() const { return seed_.data(); }
+  void setSeed(const u8 *seed) { seed_.assign(seed, seed + SEED_SIZE); }
+
+  // Fills the A parts, in NTT form, from the seed. They stay in the slab
+  // unless the key is implicit.
+  void expandPolyA() {
+    expand(polys_[0], MOD_Q);
+    expand(polys_[1], MOD_P);
+  }
 
 private:
-  Polynomial polyAModQ_;
-  Polynomial polyAModP_;
-  Polynomial polyBModQ_;
-  Polynomial polyBModP_;
+  static std::vector<PolynomialArray::Shape> getShapes(bool implicitA) {
+    const u64 degreeA = implicitA ? 0 : DEGREE;
+    return {{degreeA, MOD_Q}, {degreeA, MOD_P}, {DEGREE, MOD_Q},
+            {DEGREE, MOD_P}};
+  }
+
+  const Polynomial &expand(Polynomial &res, u64 mod) const {
+    if (res.getDegree() != DEGREE || res.getMod() != mod)
+      res = Polynomial(DEGREE, mod);
+    Random::sampleUniformWithSeed(res, seed_.data());
+    res.setIsNTT(true);
+    return res;
+  }
+
+  PolynomialArray polys_;
+  std::vector<u8> seed_;
 };
-} // namespace HEVEC
\ No newline at end of file
+} // namespace HEVEC
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Type.hpp"
+
+namespace HEVEC {
+
+struct TraceSpan {
+  const char *name; // a string literal
+  u64 start_ns;     // steady clock, from the tracer's epoch
+  u64 duration_ns;
+  u64 thread_id;
+};
+
+// Spans of one sampled request. A request hops between the I/O and compute
+// threads but only one of them works on it at a time, so spans are appended
+// without a lock.
+class RequestTrace {
+public:
+  static constexpr u64 MAX_SPANS = 4096;
+
+  explicit RequestTrace(u64 id) : id_(id) {}
+
+  u64 getId() const { return id_; }
+  u64 getCollection() const { return collection_; }
+  void setCollection(u64 collectionHash) { collection_ = collectionHash; }
+
+  void addSpan(const char *name, u64 startNs, u64 endNs);
+  const std::vector<TraceSpan> &getSpans() const { return spans_; }
+
+  // "name;dur=<ms>" per span name, durations summed, for Server-Timing.
+  std::string formatServerTiming() const;
+
+private:
+  const u64 id_;
+  u64 collection_ = 0;
+  std::vector<TraceSpan> spans_;
+};
+
+// Samples requests (HEVEC_TRACE_SAMPLE_RATE, 0 by default, or forced per
+// request) and keeps the spans of recently finished ones for a Chrome trace
+// dump. Unsampled requests carry no trace, and a span scope outside a sampled
+// request costs a thread-local load and a branch.
+class Tracer {
+public:
+  // Spans kept for dumping; the oldest requests are dropped first.
+  static constexpr u64 MAX_KEPT_SPANS = 1 << 16;
+
+  static Tracer &get();
+
+  // A new trace if this request is sampled or force is set, else null.
+  std::shared_ptr<RequestTrace> startRequest(bool force);
+  void finishRequest(const RequestTrace &trace);
+
+  // {"traceEvents": [...]} with one complete ("X") event per span, loadable
+  // in chrome://tracing or Perfetto.
+  std::string dumpChromeTrace() const;
+
+  static u64 nowNs();
+  // Small id of the calling thread, stable for its lifetime.
+  static u64 getThreadId();
+
+  // Current request of the calling thread, or null.
+  static RequestTrace *getCurrent() { return current_; }
+  // Tags the current request, if any, with a collection.
+  static void setCollection(u64 collectionHash);
+
+private:
+  friend class TraceBinding;
+
+  Tracer();
+
+  static inline thread_local RequestTrace *current_ = nullptr;
+
+  struct KeptSpan {
+    TraceSpan span;
+    u64 request;
+    u64 collection;
+  };
+
+  u64 sample_every_ = 0; // 0 disables sampling
+  std::atomic<u64> requests_{0};
+  std::atomic<u64> next_id_{1};
+
+  mutable std::mutex mutex_;
+  std::deque<KeptSpan> kept_;
+};
+
+// Makes trace the current request of this thread until destruction.
+class TraceBinding {
+public:
+  explicit TraceBinding(RequestTrace *trace);
+  ~TraceBinding();
+
+  TraceBinding(const TraceBinding &) = delete;
+  TraceBinding &operator=(const TraceBinding &) = delete;
+
+private:
+  RequestTrace *previous_;
+};
+
+// Records a span of the current request from construction to destruction.
+class TraceScope {
+public:
+  explicit TraceScope(const char *name)
+      : trace_(Tracer::getCurrent()), name_(name),
+        start_ns_(trace_ ? Tracer::nowNs() : 0) {}
+  ~TraceScope() {
+    if (trace_)
+      trace_->addSpan(name_, start_ns_, Tracer::nowNs());
+  }
+
+  TraceScope(const TraceScope &) = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+  RequestTrace *const trace_;
+  const char *const name_;
+  const u64 start_ns_;
+};
+
+} // namespace HEVEC
+
+#define HEVEC_TRACE_CONCAT_(a, b) a##b
+#define HEVEC_TRACE_CONCAT(a, b) HEVEC_TRACE_CONCAT_(a, b)
+#define HEVEC_TRACE_SPAN(name)                                                 \
+  ::HEVEC::TraceScope HEVEC_TRACE_CONCAT(trace_scope_, __LINE__)(name)
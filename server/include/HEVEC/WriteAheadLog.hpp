@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Type.hpp"
+
+namespace HEVEC {
+
+enum class WALDurability {
+  None,    // records reach the page cache; the OS decides when to flush
+  Batch,   // a background fsync every sync interval
+  Request, // waitDurable returns once the record is fsynced
+};
+
+// Append-only log of length-prefixed, checksummed records. Appends never
+// wait for the disk: a background thread fsyncs everything written so far
+// in one call, so concurrent appenders share one fsync (group commit), and
+// under Request durability their waitDurable calls return together.
+class WriteAheadLog {
+public:
+  WriteAheadLog(const std::string &path, WALDurability durability,
+                std::chrono::milliseconds syncInterval);
+  ~WriteAheadLog();
+
+  WriteAheadLog(const WriteAheadLog &) = delete;
+  WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+  // Writes one record and returns its sequence number for waitDurable.
+  u64 append(const std::vector<u8> &record);
+  // Blocks until the record numbered lsn is on disk; returns at once unless
+  // the durability is Request. Throws if the fsync failed.
+  void waitDurable(u64 lsn);
+  // Drops every record, once a snapshot holds them.
+  void reset();
+
+  u64 getSyncCount() const;
+
+  // Calls fn on each intact record of the log at path, in order. A torn or
+  // corrupt tail, left by a crash mid-append, is truncated away. A missing
+  // file has no records.
+  static void replay(const std::string &path,
+                     const std::function<void(const u8 *, u64)> &fn);
+
+private:
+  void run();
+
+  const std::string path_;
+  const WALDurability durability_;
+  const std::chrono::milliseconds sync_interval_;
+  int fd_ = -1;
+  u64 file_size_ = 0;
+
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable synced_cv_;
+  // Bytes ever appended and ever fsynced; they only grow, reset included.
+  u64 written_ = 0;
+  u64 synced_ = 0;
+  u64 syncs_ = 0;
+  int sync_error_ = 0;
+  bool stop_ = false;
+  std::thread syncer_;
+};
+
+} // namespace HEVEC
@@ -177,6 +177,11 @@ PYBIND11_MODULE(hevec_py, m) {
               const std::vector<HEVEC::MLWECiphertext> &keys) {
              self.cacheKeys(cache, keys);
            })
+      .def("append_to_cache",
+           [](HEVEC::Server &self, HEVEC::CachedKeys &cache, HEVEC::u64 slot,
+              const std::vector<HEVEC::MLWECiphertext> &keys) {
+             self.appendToCache(cache, slot, keys);
+           })
       .def("inner_product", [](HEVEC::Server &self, HEVEC::Ciphertext &res,
                                const HEVEC::CachedQuery &query_cache,
                                const HEVEC::CachedKeys &key_cache) {
@@ -306,6 +311,29 @@ PYBIND11_MODULE(hevec_py, m) {
             return py::cast(result_vec);
           },
           py::arg("collection_name"), py::arg("query_vec"))
+      .def(
+          "query_batch",
+          [](HEVEC::HEVECClient &self, const std::string &collectionName,
+             py::array_t<float, py::array::c_style | py::array::forcecast>
+                 query_vecs) {
+            if (query_vecs.ndim() != 2) {
+              throw std::runtime_error("Input queries must be a 2D array.");
+            }
+            std::vector<std::vector<float>> cpp_query_vecs(
+                query_vecs.shape(0));
+            for (ssize_t i = 0; i < query_vecs.shape(0); ++i) {
+              cpp_query_vecs[i].assign(query_vecs.data(i, 0),
+                                       query_vecs.data(i, 0) +
+                                           query_vecs.shape(1));
+            }
+            std::vector<std::vector<float>> result_vecs;
+            {
+              py::gil_scoped_release release;
+              result_vecs = self.queryBatch(collectionName, cpp_query_vecs);
+            }
+            return py::cast(result_vecs);
+          },
+          py::arg("collection_name"), py::arg("query_vecs"))
       .def(
           "query_and_top_k",
           [](HEVEC::HEVECClient &self, HEVEC::TopK &res,
@@ -371,7 +399,11 @@ PYBIND11_MODULE(hevec_py, m) {
 
   // HEVECServer bindings
   py::class_<HEVEC::HEVECServer>(m, "HEVECServer")
-      .def(py::init<unsigned short>(), py::arg("port"))
+      .def(py::init<unsigned short, std::size_t, std::size_t, std::size_t>(),
+           py::arg("port"), py::arg("io_threads") = 1,
+           py::arg("compute_threads") = 1, py::arg("max_queued_requests") = 64)
       .def("run", &HEVEC::HEVECServer::run,
+           py::call_guard<py::gil_scoped_release>())
+      .def("stop", &HEVEC::HEVECServer::stop,
            py::call_guard<py::gil_scoped_release>());
 }
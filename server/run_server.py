@@ -10,8 +10,12 @@ import hevec_py
 
 
 class HEVECServerRunner:
-    def __init__(self, port):
+    def __init__(self, port, io_threads=1, compute_threads=1,
+                 max_queued_requests=64):
         self.port = port
+        self.io_threads = io_threads
+        self.compute_threads = compute_threads
+        self.max_queued_requests = max_queued_requests
         self.server = None
         self.server_thread = None
         self.running = False
@@ -23,7 +27,9 @@ class HEVECServerRunner:
         
     def run_server(self):
         try:
-            self.server = hevec_py.HEVECServer(self.port)
+            self.server = hevec_py.HEVECServer(
+                self.port, self.io_threads, self.compute_threads,
+                self.max_queued_requests)
             print(f"HEVEC Server started on port {self.port}")
             self.server.run()
         except Exception as e:
@@ -53,6 +59,8 @@ class HEVECServerRunner:
         if self.running:
             self.running = False
             print("Stopping server...")
+            if self.server:
+                self.server.stop()
             
             if self.server_thread and self.server_thread.is_alive():
                 self.server_thread.join(timeout=2.0)
@@ -61,8 +69,10 @@ class HEVECServerRunner:
             sys.exit(0)
 
 
-def main(port: int):
-    server_runner = HEVECServerRunner(port)
+def main(port: int, io_threads: int = 1, compute_threads: int = 1,
+         max_queued_requests: int = 64):
+    server_runner = HEVECServerRunner(port, io_threads, compute_threads,
+                                      max_queued_requests)
     server_runner.start()
 
 
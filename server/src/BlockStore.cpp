@@ -0,0 +1,657 @@
+#include "HEVEC/BlockStore.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+#include "HEVEC/Const.hpp"
+#include "HEVEC/Memory.hpp"
+
+namespace HEVEC {
+
+namespace {
+
+constexpr unsigned RING_ENTRIES = 256;
+// Reads of one block are split so the device sees several at once.
+constexpr u64 MAX_CHUNKS_PER_READ = 16;
+constexpr u64 MIN_CHUNK_BYTES = 1 << 20;
+constexpr u64 DIRECT_IO_ALIGNMENT = 4096;
+// user_data of the no-op that wakes the reaper to stop.
+constexpr u64 STOP_USER_DATA = 0;
+
+#ifdef __linux__
+constexpr int MAP_PREFAULT = MAP_POPULATE;
+constexpr int OPEN_DIRECT = O_DIRECT;
+#else
+constexpr int MAP_PREFAULT = 0;
+constexpr int OPEN_DIRECT = 0;
+#endif
+
+std::runtime_error storeError(const std::string &path,
+                              const std::string &what, int error) {
+  return std::runtime_error("Block store " + path + ": " + what + ": " +
+                            std::strerror(error));
+}
+
+// From allocateWords, so resident blocks can sit on huge pages.
+std::shared_ptr<void> allocateBlock(u64 bytes) {
+  AlignedWords words = allocateWords(bytes / sizeof(u64), DIRECT_IO_ALIGNMENT);
+  AlignedFree free = words.get_deleter();
+  return std::shared_ptr<void>(words.release(), std::move(free));
+}
+
+void bump(const std::shared_ptr<Counter> &counter) {
+  if (counter)
+    counter->inc();
+}
+
+} // namespace
+
+#ifdef __linux__
+
+// Just enough of io_uring for reads: one submitter at a time (under the
+// store mutex) and one reaper thread.
+class BlockStore::Ring {
+public:
+  explicit Ring(unsigned entries) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if (fd_ < 0)
+      throw std::runtime_error(std::strerror(errno));
+    sq_entries_ = params.sq_entries;
+    cq_entries_ = params.cq_entries;
+
+    sq_ring_bytes_ = params.sq_off.array + params.sq_entries * sizeof(u32);
+    cq_ring_bytes_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single)
+      sq_ring_bytes_ = cq_ring_bytes_ =
+          std::max(sq_ring_bytes_, cq_ring_bytes_);
+    sq_ring_ = map(sq_ring_bytes_, IORING_OFF_SQ_RING);
+    cq_ring_ = single ? sq_ring_ : map(cq_ring_bytes_, IORING_OFF_CQ_RING);
+    sqes_bytes_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe *>(map(sqes_bytes_, IORING_OFF_SQES));
+    if (!sq_ring_ || !cq_ring_ || !sqes_) {
+      const int error = errno;
+      release();
+      throw std::runtime_error(std::strerror(error));
+    }
+
+    auto *sq = static_cast<unsigned char *>(sq_ring_);
+    sq_head_ = reinterpret_cast<u32 *>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<u32 *>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<u32 *>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<u32 *>(sq + params.sq_off.array);
+    auto *cq = static_cast<unsigned char *>(cq_ring_);
+    cq_head_ = reinterpret_cast<u32 *>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<u32 *>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<u32 *>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+  }
+
+  ~Ring() { release(); }
+
+  Ring(const Ring &) = delete;
+  Ring &operator=(const Ring &) = delete;
+
+  u64 getCompletionCapacity() const { return cq_entries_; }
+
+  // Pins buffers for IORING_OP_READ_FIXED. False if the kernel refuses,
+  // e.g. over RLIMIT_MEMLOCK.
+  bool registerBuffers(const std::vector<iovec> &buffers) {
+    return ::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS,
+                     buffers.data(),
+                     static_cast<unsigned>(buffers.size())) == 0;
+  }
+
+  // Queues a read of size bytes at offset of fd into data, from registered
+  // buffer bufIndex unless it is negative.
+  void pushRead(int fd, u64 offset, void *data, u64 size, int bufIndex,
+                u64 userData) {
+    io_uring_sqe sqe;
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = bufIndex >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe.fd = fd;
+    sqe.off = offset;
+    sqe.addr = reinterpret_cast<u64>(data);
+    sqe.len = static_cast<u32>(size);
+    sqe.buf_index =
+        static_cast<decltype(sqe.buf_index)>(std::max(bufIndex, 0));
+    sqe.user_data = userData;
+    push(sqe);
+  }
+
+  void pushNop(u64 userData) {
+    io_uring_sqe sqe;
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_NOP;
+    sqe.user_data = userData;
+    push(sqe);
+  }
+
+  void submit() {
+    while (to_submit_ > 0) {
+      const long n =
+          ::syscall(__NR_io_uring_enter, fd_, to_submit_, 0, 0, nullptr, 0);
+      if (n < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+          continue;
+        throw std::runtime_error(std::string("io_uring_enter: ") +
+                                 std::strerror(errno));
+      }
+      to_submit_ -= static_cast<u32>(n);
+    }
+  }
+
+  // Blocks until a completion is available.
+  void wait() {
+    while (::syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS,
+                     nullptr, 0) < 0 &&
+           errno == EINTR) {
+    }
+  }
+
+  // Calls fn(user_data, res) on each available completion.
+  template <typename Fn> void drain(Fn &&fn) {
+    u32 head = *cq_head_;
+    const u32 tail =
+        std::atomic_ref<u32>(*cq_tail_).load(std::memory_order_acquire);
+    for (; head != tail; ++head) {
+      const io_uring_cqe &cqe = cqes_[head & cq_mask_];
+      fn(cqe.user_data, cqe.res);
+    }
+    std::atomic_ref<u32>(*cq_head_).store(head, std::memory_order_release);
+  }
+
+private:
+  // Queues sqe, submitting what is queued first if the ring is full.
+  void push(const io_uring_sqe &sqe) {
+    u32 tail = *sq_tail_;
+    while (tail - std::atomic_ref<u32>(*sq_head_).load(
+                      std::memory_order_acquire) >=
+           sq_entries_)
+      submit();
+    const u32 slot = tail & sq_mask_;
+    sqes_[slot] = sqe;
+    sq_array_[slot] = slot;
+    std::atomic_ref<u32>(*sq_tail_).store(tail + 1, std::memory_order_release);
+    ++to_submit_;
+  }
+
+  void *map(u64 bytes, off_t offset) {
+    void *res = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd_, offset);
+    return res == MAP_FAILED ? nullptr : res;
+  }
+
+  void release() {
+    if (sqes_)
+      ::munmap(sqes_, sqes_bytes_);
+    if (cq_ring_ && cq_ring_ != sq_ring_)
+      ::munmap(cq_ring_, cq_ring_bytes_);
+    if (sq_ring_)
+      ::munmap(sq_ring_, sq_ring_bytes_);
+    if (fd_ >= 0)
+      ::close(fd_);
+  }
+
+  int fd_ = -1;
+  u32 sq_entries_ = 0;
+  u32 cq_entries_ = 0;
+  u64 sq_ring_bytes_ = 0;
+  u64 cq_ring_bytes_ = 0;
+  u64 sqes_bytes_ = 0;
+  void *sq_ring_ = nullptr;
+  void *cq_ring_ = nullptr;
+  io_uring_sqe *sqes_ = nullptr;
+  u32 *sq_head_ = nullptr;
+  u32 *sq_tail_ = nullptr;
+  u32 sq_mask_ = 0;
+  u32 *sq_array_ = nullptr;
+  u32 *cq_head_ = nullptr;
+  u32 *cq_tail_ = nullptr;
+  u32 cq_mask_ = 0;
+  io_uring_cqe *cqes_ = nullptr;
+  u32 to_submit_ = 0;
+};
+
+#else
+
+// No io_uring: a ring cannot be set up, so every read goes through pread.
+class BlockStore::Ring {
+public:
+  explicit Ring(unsigned) {
+    throw std::runtime_error("io_uring is only available on Linux");
+  }
+
+  u64 getCompletionCapacity() const { return 0; }
+  bool registerBuffers(const std::vector<iovec> &) { return false; }
+  void pushRead(int, u64, void *, u64, int, u64) {}
+  void pushNop(u64) {}
+  void submit() {}
+  void wait() {}
+  template <typename Fn> void drain(Fn &&) {}
+};
+
+#endif
+
+// Read buffers, shared with the blocks read into them so a buffer goes back
+// to the pool when the last such block is released.
+struct BlockStore::BufferPool
+    : std::enable_shared_from_this<BlockStore::BufferPool> {
+  BufferPool(u64 count, u64 bytes) : bytes(bytes) {
+    for (u64 i = 0; i < count; ++i) {
+      void *data = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_PREFAULT, -1, 0);
+      if (data == MAP_FAILED)
+        break;
+      buffers.push_back(data);
+      free.push_back(static_cast<int>(i));
+    }
+  }
+  ~BufferPool() {
+    for (void *data : buffers)
+      ::munmap(data, bytes);
+  }
+
+  // A free buffer and its index, or null.
+  std::shared_ptr<void> take(int &index) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (free.empty())
+      return nullptr;
+    index = free.back();
+    free.pop_back();
+    auto self = shared_from_this();
+    return std::shared_ptr<void>(buffers[index], [self, index](void *) {
+      std::lock_guard<std::mutex> lock(self->mutex);
+      self->free.push_back(index);
+    });
+  }
+
+  const u64 bytes;
+  std::vector<void *> buffers;
+  std::mutex mutex;
+  std::vector<int> free;
+  bool registered = false;
+};
+
+struct BlockStore::Load {
+  struct Chunk {
+    Load *load;
+    u64 offset; // within the block
+    u64 size;
+  };
+
+  u64 index = 0;
+  std::shared_ptr<void> storage;
+  int buffer = -1;       // registered buffer, or -1
+  bool promote = false;  // becomes resident once read
+  u64 pending = 0;       // chunk reads in flight
+  int error = 0;
+  bool done = false;
+  std::vector<Chunk> chunks;
+};
+
+BlockStore::BlockStore(const std::string &path, u64 rank, bool packed,
+                       u64 budgetBytes, BlockEviction eviction, u64 numBuffers,
+                       BlockStoreMetrics metrics)
+    : path_(path), rank_(rank), packed_(packed),
+      data_bytes_(CiphertextSpan::getTiledWords(rank, packed) * sizeof(u64)),
+      block_bytes_((data_bytes_ + DIRECT_IO_ALIGNMENT - 1) /
+                   DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT),
+      budget_bytes_(budgetBytes), eviction_(eviction),
+      metrics_(std::move(metrics)) {
+  // A new inode, like BlockFile, so blocks of an earlier store stay valid.
+  ::unlink(path.c_str());
+  fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd_ < 0)
+    throw storeError(path, "cannot create", errno);
+  // Cold reads bypass the page cache, which would otherwise hold a second
+  // copy of the blocks outside the budget. tmpfs and some others refuse.
+  read_fd_ = ::open(path.c_str(), O_RDONLY | OPEN_DIRECT | O_CLOEXEC);
+  if (read_fd_ < 0)
+    read_fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (read_fd_ < 0) {
+    const int error = errno;
+    ::close(fd_);
+    throw storeError(path, "cannot open", error);
+  }
+
+  pool_ = std::make_shared<BufferPool>(numBuffers, block_bytes_);
+  try {
+    ring_ = std::make_unique<Ring>(RING_ENTRIES);
+  } catch (const std::exception &) {
+    // io_uring disabled or unavailable: reads become synchronous.
+  }
+  if (ring_) {
+    std::vector<iovec> buffers;
+    for (void *data : pool_->buffers)
+      buffers.push_back({data, block_bytes_});
+    pool_->registered = !buffers.empty() && ring_->registerBuffers(buffers);
+    reaper_ = std::thread([this]() { reap(); });
+  }
+}
+
+BlockStore::~BlockStore() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    loaded_.wait(lock, [&]() { return loads_in_flight_ == 0; });
+    stop_ = true;
+    if (ring_) {
+      ring_->pushNop(STOP_USER_DATA);
+      ring_->submit();
+    }
+  }
+  if (reaper_.joinable())
+    reaper_.join();
+  ring_.reset();
+  ::close(read_fd_);
+  ::close(fd_);
+}
+
+u64 BlockStore::append(const CachedKeys &block) {
+  const CiphertextSpan span = block.getSpan();
+  if (span.size() != rank_)
+    throw std::runtime_error("Block store " + path_ + ": not a full block");
+  for (const Ciphertext &ctxt : block.getCtxts()) {
+    if (ctxt.getIsExtended() || !ctxt.getIsNTT())
+      throw std::runtime_error("Block store " + path_ +
+                               ": block is not in NTT form");
+  }
+
+  // The tiled copy, with the store's packing, is written out and, if
+  // admitted, kept as the resident block.
+  auto storage = allocateBlock(block_bytes_);
+  auto *tiled = static_cast<u64 *>(storage.get());
+  if (span.isTiled() && span.isPacked() == packed_) {
+    std::memcpy(tiled, span.getData(), data_bytes_);
+  } else {
+    const u64 tile_words = data_bytes_ / N_SCAN_TILES / sizeof(u64);
+    for (u64 t = 0; t < N_SCAN_TILES; ++t)
+      span.copyTile(t, tiled + t * tile_words, packed_);
+  }
+  std::memset(reinterpret_cast<unsigned char *>(tiled) + data_bytes_, 0,
+              block_bytes_ - data_bytes_);
+
+  u64 index;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    index = entries_.size();
+  }
+  const off_t offset = static_cast<off_t>(index * block_bytes_);
+  const auto *bytes = static_cast<const unsigned char *>(storage.get());
+  for (u64 done = 0; done < block_bytes_;) {
+    const ssize_t n = ::pwrite(fd_, bytes + done, block_bytes_ - done,
+                               offset + static_cast<off_t>(done));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      throw storeError(path_, "write failed", errno);
+    }
+    done += static_cast<u64>(n);
+  }
+#ifdef __linux__
+  // Reads of this block go around the page cache; do not keep it there.
+  ::sync_file_range(fd_, offset, static_cast<off_t>(block_bytes_),
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                        SYNC_FILE_RANGE_WAIT_AFTER);
+  ::posix_fadvise(fd_, offset, static_cast<off_t>(block_bytes_),
+                  POSIX_FADV_DONTNEED);
+#endif
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.emplace_back();
+  if (admit(index))
+    makeResident(index, makeBlock(std::move(storage)));
+  return index;
+}
+
+void BlockStore::prefetch(u64 index) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!ring_ || index >= entries_.size() || stop_)
+    return;
+  Entry &entry = entries_[index];
+  if (entry.resident || entry.load)
+    return;
+  startLoad(lock, index, false);
+}
+
+std::shared_ptr<const CachedKeys> BlockStore::acquire(u64 index) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (index >= entries_.size())
+    throw std::out_of_range("Block store " + path_ + ": no block " +
+                            std::to_string(index));
+  Entry &entry = entries_[index];
+  ++entry.scans;
+  if (entry.resident) {
+    if (eviction_ == BlockEviction::LRU)
+      lru_.splice(lru_.end(), lru_, entry.lru);
+    bump(metrics_.hits);
+    return entry.resident;
+  }
+
+  std::shared_ptr<Load> load = entry.load;
+  if (!load)
+    load = startLoad(lock, index, true);
+  loaded_.wait(lock, [&]() { return load->done; });
+  if (entry.load == load)
+    entry.load.reset();
+  if (load->error)
+    throw storeError(path_, "read failed", load->error);
+  if (entry.resident)
+    return entry.resident;
+  return makeBlock(load->storage);
+}
+
+u64 BlockStore::getResidentBytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return resident_bytes_;
+}
+
+std::shared_ptr<const CachedKeys>
+BlockStore::makeBlock(std::shared_ptr<void> storage) {
+  const auto *tiled = static_cast<const u64 *>(storage.get());
+  return std::make_shared<const CachedKeys>(rank_, tiled, std::move(storage),
+                                            packed_);
+}
+
+bool BlockStore::admit(u64 index) {
+  if (block_bytes_ > budget_bytes_)
+    return false;
+  while (resident_bytes_ + block_bytes_ > budget_bytes_) {
+    // Only reservations of reads in flight are left to make room from.
+    if (lru_.empty())
+      return false;
+    u64 victim = lru_.front();
+    if (eviction_ == BlockEviction::LFU) {
+      for (u64 i : lru_) {
+        if (entries_[i].scans < entries_[victim].scans)
+          victim = i;
+      }
+      if (entries_[victim].scans >= entries_[index].scans)
+        return false;
+    }
+    evict(victim);
+  }
+  resident_bytes_ += block_bytes_;
+  return true;
+}
+
+void BlockStore::makeResident(u64 index,
+                              std::shared_ptr<const CachedKeys> block) {
+  Entry &entry = entries_[index];
+  entry.resident = std::move(block);
+  entry.lru = lru_.insert(lru_.end(), index);
+  if (metrics_.resident_bytes)
+    metrics_.resident_bytes->set(static_cast<double>(resident_bytes_));
+}
+
+void BlockStore::evict(u64 index) {
+  Entry &entry = entries_[index];
+  entry.resident.reset();
+  lru_.erase(entry.lru);
+  resident_bytes_ -= block_bytes_;
+  bump(metrics_.evictions);
+  if (metrics_.resident_bytes)
+    metrics_.resident_bytes->set(static_cast<double>(resident_bytes_));
+}
+
+std::shared_ptr<BlockStore::Load>
+BlockStore::startLoad(std::unique_lock<std::mutex> &lock, u64 index,
+                      bool transient) {
+  auto load = std::make_shared<Load>();
+  load->index = index;
+  load->promote = admit(index);
+  if (load->promote) {
+    load->storage = allocateBlock(block_bytes_);
+  } else {
+    int buffer = -1;
+    load->storage = pool_->take(buffer);
+    if (!load->storage) {
+      // Reads that finished but were never acquired, e.g. the prefetch of
+      // a scan that failed, still hold their buffers.
+      for (Entry &entry : entries_) {
+        if (entry.load && entry.load->done && entry.load.use_count() == 1)
+          entry.load.reset();
+      }
+      load->storage = pool_->take(buffer);
+    }
+    if (load->storage) {
+      if (pool_->registered)
+        load->buffer = buffer;
+    } else if (transient) {
+      load->storage = allocateBlock(block_bytes_);
+    } else {
+      return nullptr;
+    }
+  }
+
+  const u64 chunk_bytes = std::min(
+      block_bytes_,
+      std::max(MIN_CHUNK_BYTES,
+               (block_bytes_ / MAX_CHUNKS_PER_READ + DIRECT_IO_ALIGNMENT - 1) /
+                   DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT));
+  for (u64 offset = 0; offset < block_bytes_; offset += chunk_bytes)
+    load->chunks.push_back(
+        {load.get(), offset, std::min(chunk_bytes, block_bytes_ - offset)});
+
+  const bool async =
+      ring_ && reads_in_flight_ + load->chunks.size() <=
+                   ring_->getCompletionCapacity();
+  if (!async && !transient) {
+    if (load->promote)
+      resident_bytes_ -= block_bytes_;
+    return nullptr;
+  }
+  entries_[index].load = load;
+  ++loads_in_flight_;
+
+  if (!async) {
+    // Other acquirers of this block wait on load->done meanwhile.
+    lock.unlock();
+    readSync(*load);
+    lock.lock();
+    finishLoad(load);
+    return load;
+  }
+
+  const u64 base = index * block_bytes_;
+  auto *data = static_cast<unsigned char *>(load->storage.get());
+  for (Load::Chunk &chunk : load->chunks)
+    ring_->pushRead(read_fd_, base + chunk.offset, data + chunk.offset,
+                    chunk.size, load->buffer, reinterpret_cast<u64>(&chunk));
+  load->pending = load->chunks.size();
+  reads_in_flight_ += load->chunks.size();
+  ring_->submit();
+  return load;
+}
+
+void BlockStore::readSync(Load &load) {
+  auto *data = static_cast<unsigned char *>(load.storage.get());
+  const off_t base = static_cast<off_t>(load.index * block_bytes_);
+  for (u64 done = 0; done < block_bytes_;) {
+    const ssize_t n = ::pread(read_fd_, data + done, block_bytes_ - done,
+                              base + static_cast<off_t>(done));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      load.error = n < 0 ? errno : EIO;
+      return;
+    }
+    done += static_cast<u64>(n);
+  }
+}
+
+void BlockStore::finishLoad(const std::shared_ptr<Load> &load) {
+  load->done = true;
+  --loads_in_flight_;
+  bump(metrics_.loads);
+  Entry &entry = entries_[load->index];
+  if (load->promote) {
+    if (load->error)
+      resident_bytes_ -= block_bytes_;
+    else
+      makeResident(load->index, makeBlock(load->storage));
+    // Acquirers find the resident block; waiting ones still hold the load.
+    if (entry.load == load)
+      entry.load.reset();
+  }
+  loaded_.notify_all();
+}
+
+void BlockStore::reap() {
+  bool stop = false;
+  while (!stop) {
+    ring_->wait();
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool resubmit = false;
+    ring_->drain([&](u64 userData, int res) {
+      if (userData == STOP_USER_DATA) {
+        stop = true;
+        return;
+      }
+      auto &chunk = *reinterpret_cast<Load::Chunk *>(userData);
+      Load &load = *chunk.load;
+      --reads_in_flight_;
+      if (res == -EAGAIN || res == -EINTR ||
+          (res > 0 && static_cast<u64>(res) < chunk.size)) {
+        // Retry, or read the rest of a short read.
+        const u64 n = res > 0 ? static_cast<u64>(res) : 0;
+        chunk.offset += n;
+        chunk.size -= n;
+        ring_->pushRead(
+            read_fd_, load.index * block_bytes_ + chunk.offset,
+            static_cast<unsigned char *>(load.storage.get()) + chunk.offset,
+            chunk.size, load.buffer, userData);
+        ++reads_in_flight_;
+        resubmit = true;
+        return;
+      }
+      if (res <= 0 && !load.error)
+        load.error = res < 0 ? -res : EIO;
+      if (--load.pending == 0) {
+        const std::shared_ptr<Load> owner = entries_[load.index].load;
+        finishLoad(owner);
+      }
+    });
+    if (resubmit)
+      ring_->submit();
+  }
+}
+
+} // namespace HEVEC
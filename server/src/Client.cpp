@@ -10,10 +10,12 @@
 #include "HEVEC/Ciphertext.hpp"
 #include "HEVEC/Const.hpp"
 #include "HEVEC/Message.hpp"
+#include "HEVEC/PIRDatabase.hpp"
 #include "HEVEC/Polynomial.hpp"
 #include "HEVEC/Random.hpp"
 #include "HEVEC/SecretKey.hpp"
 #include "HEVEC/SwitchingKey.hpp"
+#include "HEVEC/TaskPool.hpp"
 
 namespace HEVEC {
 
@@ -53,8 +55,11 @@ void Client::genInvAutKeys(std::vector<SwitchingKey> &res,
   const u64 stack = DEGREE / rank;
   const u64 step = 2 * DEGREE / rank;
 
-  res.clear();
-  res.resize(rank);
+  // Keys already there (e.g. those of an InvAutKeys) are overwritten in place.
+  if (res.size() != rank) {
+    res.clear();
+    res.resize(rank);
+  }
 
   Polynomial tempQ(DEGREE, MOD_Q), tempP(DEGREE, MOD_P);
 
@@ -137,26 +142,35 @@ void Client::genInvAutedModPackKeys(AutedModPackMLWEKeys &res,
               DEGREE);
     eval_.ntt(autedKey.getPolyP(), autedKey.getPolyP());
     for (u64 j = 0; j < stack; ++j) {
+      // A is seeded in the MLWE layout, so the server can expand it without
+      // the NTTs of the reshape. The full-degree A it encrypts under is
+      // gathered back from the stack.
+      MLWESwitchingKey &key = res.getKeys()[i][j];
+      u8 seed[SEED_SIZE];
+      Random::getRandomSeed(seed);
+      key.setSeed(seed);
+      key.expandPolyA();
+
       SwitchingKey swtKey;
+      Polynomial tempRankQ(getRank(), MOD_Q), tempRankP(getRank(), MOD_P);
+      swtKey.getPolyAModQ().setIsNTT(false);
+      swtKey.getPolyAModP().setIsNTT(false);
+      for (u64 k = 0; k < stack; ++k) {
+        eval_.intt(tempRankQ, key.getPolyAModQ(k));
+        eval_.intt(tempRankP, key.getPolyAModP(k));
+        for (u64 l = 0; l < getRank(); ++l) {
+          swtKey.getPolyAModQ()[l * stack + k] = tempRankQ[l];
+          swtKey.getPolyAModP()[l * stack + k] = tempRankP[l];
+        }
+      }
+      eval_.ntt(swtKey.getPolyAModQ(), swtKey.getPolyAModQ());
+      eval_.ntt(swtKey.getPolyAModP(), swtKey.getPolyAModP());
+
       modifiedKey.setIsNTT(false);
       for (u64 k = 0; k < getRank(); ++k)
         modifiedKey[stack * k] = inttedSecKey[(k + 1) * stack - 1 - j];
       eval_.ntt(temp, modifiedKey);
-      genSwtKey(swtKey, autedKey, temp);
-      eval_.intt(tempQ, swtKey.getPolyAModQ());
-      for (u64 k = 0; k < stack; ++k) {
-        for (u64 l = 0; l < getRank(); ++l)
-          res.getKeys()[i][j].getPolyAModQ(k)[l] = tempQ[l * stack + k];
-        eval_.ntt(res.getKeys()[i][j].getPolyAModQ(k),
-                  res.getKeys()[i][j].getPolyAModQ(k));
-      }
-      eval_.intt(tempP, swtKey.getPolyAModP());
-      for (u64 k = 0; k < stack; ++k) {
-        for (u64 l = 0; l < getRank(); ++l)
-          res.getKeys()[i][j].getPolyAModP(k)[l] = tempP[l * stack + k];
-        eval_.ntt(res.getKeys()[i][j].getPolyAModP(k),
-                  res.getKeys()[i][j].getPolyAModP(k));
-      }
+      genSwtKeyB(swtKey, autedKey, temp);
       eval_.intt(tempQ, swtKey.getPolyBModQ());
       for (u64 k = 0; k < stack; ++k) {
         for (u64 l = 0; l < getRank(); ++l)
@@ -237,6 +251,33 @@ void Client::encrypt(MLWECiphertext &res, const Message &msg,
   encrypt(res, ptxt, secKey);
 }
 
+void Client::encryptWithSeed(Ciphertext &res, const Polynomial &ptxt,
+                             const SecretKey &secKey, const u8 *seed,
+                             u64 factor) {
+  Polynomial as(DEGREE, MOD_Q), e(DEGREE, MOD_Q);
+
+  Random::sampleUniformWithSeed(res.getA(), seed);
+  res.getA().setIsNTT(false);
+  eval_.ntt(as, res.getA());
+  eval_.mult(as, as, secKey.getPolyQ());
+  eval_.intt(as, as);
+  Random::sampleDiscreteGaussian(e);
+  eval_.add(res.getB(), ptxt, e);
+  if (factor != 1)
+    eval_.mult(res.getB(), res.getB(), factor);
+  eval_.sub(res.getB(), res.getB(), as);
+}
+
+void Client::encryptWithSeed(MLWECiphertext &res, const Polynomial &ptxt,
+                             const SecretKey &secKey, const u8 *seed,
+                             u64 factor) {
+  Ciphertext temp;
+
+  encryptWithSeed(temp, ptxt, secKey, seed, factor);
+  eval_.extract(res.getB(), temp.getB());
+  Random::sampleUniformWithSeed(res, seed);
+}
+
 void Client::decrypt(Message &res, const Ciphertext &ctxt,
                      const SecretKey &secKey, double scale) {
   Polynomial temp(DEGREE, MOD_Q);
@@ -262,6 +303,13 @@ void Client::decrypt(Message &res, const Ciphertext &ctxt,
   decode(res, temp, scale);
 }
 
+void Client::decrypt(Message &res, const PackedCiphertext &ctxt,
+                     const SecretKey &secKey, double scale) {
+  Ciphertext lifted;
+  eval_.modSwitch(lifted, ctxt);
+  decrypt(res, lifted, secKey, scale);
+}
+
 void Client::encryptQuery(MLWECiphertext &res, const Message &msg,
                           const SecretKey &secKey, double scale) {
   Polynomial ptxt(DEGREE, MOD_Q), temp(DEGREE, MOD_Q);
@@ -272,6 +320,16 @@ void Client::encryptQuery(MLWECiphertext &res, const Message &msg,
   eval_.mult(res, res, invRank_);
 }
 
+void Client::encryptQuery(MLWECiphertext &res, const Message &msg,
+                          const SecretKey &secKey, double scale,
+                          const u8 *seed) {
+  Polynomial ptxt(DEGREE, MOD_Q), temp(DEGREE, MOD_Q);
+
+  encode(ptxt, msg, scale);
+  eval_.aut(temp, ptxt, 2 * getRank() - 1, getRank());
+  encryptWithSeed(res, temp, secKey, seed, invRank_);
+}
+
 void Client::encodeQuery(Polynomial &res, const Message &msg, double scale) {
   Polynomial temp(getRank(), MOD_Q);
 
@@ -289,6 +347,15 @@ void Client::encryptKey(MLWECiphertext &res, const Message &msg,
   eval_.mult(res, res, invRank_);
 }
 
+void Client::encryptKey(MLWECiphertext &res, const Message &msg,
+                        const SecretKey &secKey, double scale,
+                        const u8 *seed) {
+  Polynomial ptxt(DEGREE, MOD_Q);
+
+  encode(ptxt, msg, scale);
+  encryptWithSeed(res, ptxt, secKey, seed, invRank_);
+}
+
 void Client::encodeKey(Polynomial &res, const Message &msg, double scale) {
   encode(res, msg, scale);
   eval_.mult(res, res, invRank_);
@@ -297,9 +364,17 @@ void Client::encodeKey(Polynomial &res, const Message &msg, double scale) {
 void Client::decryptScore(std::vector<Message> &msg,
                           std::vector<Ciphertext> &score,
                           const SecretKey &secretKey, double scale) {
-#pragma omp parallel for
-  for (u64 i = 0; i < score.size(); ++i)
+  parallelFor(score.size(), [&](u64 i) {
     decrypt(msg[i], score[i], secretKey, scale);
+  });
+}
+
+void Client::decryptScore(std::vector<Message> &msg,
+                          const std::vector<PackedCiphertext> &score,
+                          const SecretKey &secKey, double scale) {
+  parallelFor(score.size(), [&](u64 i) {
+    decrypt(msg[i], score[i], secKey, scale);
+  });
 }
 
 void Client::topKScore(TopK &res, const std::vector<Message> &msg) {
@@ -335,19 +410,17 @@ void Client::encryptPIR(Ciphertext &res, u64 idx, const SecretKey &secKey,
   encrypt(res, ptxt, secKey);
 }
 
-void Client::encodePIRPayload(Polynomial &res, const unsigned char *payload) {
-  constexpr u64 payloadSize = DEGREE / 4;
+void Client::encryptPIR(Ciphertext &res, u64 idx, const SecretKey &secKey,
+                        double scale, const u8 *seed) {
+  Polynomial ptxt(DEGREE, MOD_Q);
 
-  res.setIsNTT(false);
-  // Each coefficient stores 2 bits
-  u64 coeff_idx = 0;
-  for (u64 byte_idx = 0; byte_idx < payloadSize; ++byte_idx) {
-    unsigned char byte = payload[byte_idx];
-    for (int bit_pair = 0; bit_pair < 4; ++bit_pair) {
-      u64 two_bits = (byte >> (bit_pair * 2)) & 3; // Extract 2 bits
-      res[coeff_idx++] = (two_bits > 1) ? (MOD_Q - two_bits + 1) : two_bits;
-    }
-  }
+  ptxt[idx] = scale;
+  eval_.mult(ptxt, ptxt, invRank_);
+  encryptWithSeed(res, ptxt, secKey, seed, 1);
+}
+
+void Client::encodePIRPayload(Polynomial &res, const unsigned char *payload) {
+  PIRDatabase::expandPayload(res, payload);
 
   // NTT the polynomial
   eval_.ntt(res, res);
@@ -392,12 +465,17 @@ void Client::decodePIRPayload(unsigned char *payload, const Message &dmsg) {
 
 void Client::genSwtKey(SwitchingKey &res, const SecretKey &secKey,
                        const Polynomial &modifiedKey) {
+  u8 seed[SEED_SIZE];
+  Random::getRandomSeed(seed);
+  res.setSeed(seed);
+  res.expandPolyA();
+  genSwtKeyB(res, secKey, modifiedKey);
+}
+
+void Client::genSwtKeyB(SwitchingKey &res, const SecretKey &secKey,
+                        const Polynomial &modifiedKey) {
   Polynomial tempModQ(DEGREE, MOD_Q), tempModP(DEGREE, MOD_P);
 
-  Random::sampleUniform(res.getPolyAModQ());
-  Random::sampleUniform(res.getPolyAModP());
-  eval_.ntt(res.getPolyAModQ(), res.getPolyAModQ());
-  eval_.ntt(res.getPolyAModP(), res.getPolyAModP());
   Random::sampleDiscreteGaussian(res.getPolyBModQ(), res.getPolyBModP());
   eval_.ntt(res.getPolyBModQ(), res.getPolyBModQ());
   eval_.ntt(res.getPolyBModP(), res.getPolyBModP());
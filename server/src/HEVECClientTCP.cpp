@@ -5,7 +5,6 @@
 #include <cmath>
 #include <fstream>
 #include <functional>
-#include <iomanip>
 #include <iostream>
 #include <memory>
 #include <openssl/aes.h>
@@ -22,6 +21,7 @@
 #include "HEVEC/Client.hpp"
 #include "HEVEC/Const.hpp"
 #include "HEVEC/HEVECOperation.hpp"
+#include "HEVEC/Log.hpp"
 #include "HEVEC/MLWECiphertext.hpp"
 #include "HEVEC/Message.hpp"
 #include "HEVEC/MetricType.hpp"
@@ -31,26 +31,10 @@ namespace HEVEC {
 
 namespace {
 
-void logToFile(const std::string &message) {
-  const char *log_path_env = std::getenv("HEVEC_CLIENT_LOG_PATH");
-  if (log_path_env) {
-    std::ofstream log_file(log_path_env, std::ios::app);
-    if (log_file.is_open()) {
-      auto now = std::chrono::system_clock::now();
-      auto time_t = std::chrono::system_clock::to_time_t(now);
-      auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                    now.time_since_epoch()) %
-                1000;
-
-      log_file << "["
-               << std::put_time(std::localtime(&time_t), "%Y-%m-%d %H:%M:%S");
-      log_file << "." << std::setfill('0') << std::setw(3) << ms.count()
-               << "] ";
-      log_file << message << std::endl;
-      log_file.close();
-    }
-  }
-}
+#define LOG_DEBUG(message)                                                     \
+  HEVEC_LOG(getClientLogger(), LogLevel::Debug, message)
+#define LOG_INFO(message) HEVEC_LOG(getClientLogger(), LogLevel::Info, message)
+#define LOG_WARN(message) HEVEC_LOG(getClientLogger(), LogLevel::Warn, message)
 
 void handleOpenSslErrors() {
   ERR_print_errors_fp(stderr);
@@ -211,23 +195,9 @@ struct HEVECClientTCP::CollectionContext {
         pirClient(std::make_unique<Client>(PIR_LOG_RANK)),
         autedModPackKeys(rank), autedModPackMLWEKeys(rank),
         pirInvAutKeys(PIR_RANK), isQueryEncrypt(is_encrypt) {
-    if (metric_type == MetricType::IP) {
-      if (is_encrypt) {
-        queryScale = std::pow(2.0, 22);
-        keyScale = std::pow(2.0, 22);
-      } else {
-        queryScale = std::pow(2.0, 16);
-        keyScale = std::pow(2.0, 27);
-      }
-    } else if (metric_type == MetricType::COSINE) {
-      if (is_encrypt) {
-        queryScale = std::pow(2.0, 26.25);
-        keyScale = std::pow(2.0, 26.25);
-      } else {
-        queryScale = std::pow(2.0, 20);
-        keyScale = std::pow(2.0, 32.5);
-      }
-    }
+    const MetricScales scales = getMetricScales(metric_type, is_encrypt);
+    queryScale = std::pow(2.0, scales.logQueryScale);
+    keyScale = std::pow(2.0, scales.logKeyScale);
     outputScale = queryScale * keyScale;
   }
 };
@@ -252,7 +222,7 @@ HEVECClientTCP::HEVECClientTCP(const std::string &host, const std::string &port)
 
   if (!sec_key_path.empty()) {
     if (secKey_.load(sec_key_path)) {
-      logToFile("Loaded secret key from " + sec_key_path);
+      LOG_INFO("Loaded secret key from " + sec_key_path);
       secKeyGenerated_ = true;
     }
   }
@@ -263,7 +233,7 @@ HEVECClientTCP::HEVECClientTCP(const std::string &host, const std::string &port)
 
   if (!aes_key_path.empty()) {
     if (loadAesKey(aes_key_path, aesKey_)) {
-      logToFile("Loaded AES key from " + aes_key_path);
+      LOG_INFO("Loaded AES key from " + aes_key_path);
       aesKeyGenerated_ = true;
     }
   }
@@ -271,10 +241,10 @@ HEVECClientTCP::HEVECClientTCP(const std::string &host, const std::string &port)
   if (!aesKeyGenerated_) {
     generateAesKey(aesKey_);
     aesKeyGenerated_ = true;
-    logToFile("Generated new AES key.");
+    LOG_INFO("Generated new AES key.");
     if (!aes_key_path.empty()) {
       if (saveAesKey(aes_key_path, aesKey_)) {
-        logToFile("Saved new AES key to " + aes_key_path);
+        LOG_INFO("Saved new AES key to " + aes_key_path);
       } else {
         std::cerr << "Failed to save AES key to " << aes_key_path << std::endl;
       }
@@ -333,9 +303,9 @@ u64 HEVECClientTCP::setupCollection(const std::string &collectionName, u64 dimen
           server_dimension, server_metric_type, is_query_encrypt);
     }
     db_sizes_[collectionName] = server_db_size;
-    logToFile("Collection '" + collectionName +
-                "' already exists on server with size " +
-                std::to_string(server_db_size) + ". Setup complete.");
+    LOG_INFO("Collection '" + collectionName +
+               "' already exists on server with size " +
+               std::to_string(server_db_size) + ". Setup complete.");
 
     return server_db_size;
   }
@@ -356,7 +326,7 @@ u64 HEVECClientTCP::setupCollection(const std::string &collectionName, u64 dimen
     if (sec_key_path_env) {
       std::string sec_key_path(sec_key_path_env);
       if (secKey_.save(sec_key_path)) {
-        logToFile("Saved new secret key to " + sec_key_path);
+        LOG_INFO("Saved new secret key to " + sec_key_path);
       } else {
         std::cerr << "Failed to save secret key to " << sec_key_path
                   << std::endl;
@@ -371,7 +341,7 @@ u64 HEVECClientTCP::setupCollection(const std::string &collectionName, u64 dimen
   ctx->pirClient->genInvAutKeys(ctx->pirInvAutKeys.getKeys(), secKey_,
                                 PIR_RANK);
 
-  logToFile("Collection '" + collectionName + "' is new. Sending keys...");
+  LOG_INFO("Collection '" + collectionName + "' is new. Sending keys...");
 
   asio::write(socket_, asio::buffer(ctx->relinKey.getPolyAModQ().getData(),
                                     DEGREE * sizeof(u64)));
@@ -473,7 +443,7 @@ void HEVECClientTCP::dropCollection(const std::string &collectionName) {
   collections_.erase(collectionName);
   db_sizes_.erase(collectionName);
 
-  logToFile("Dropped collection '" + collectionName + "'");
+  LOG_INFO("Dropped collection '" + collectionName + "'");
 }
 
 void HEVECClientTCP::insert(const std::string &collectionName,
@@ -538,9 +508,9 @@ void HEVECClientTCP::insert(const std::string &collectionName,
   auto whole_end = std::chrono::high_resolution_clock::now();
   auto whole_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
       whole_end - whole_start);
-  logToFile("Sent " + std::to_string(num_to_insert) +
-              " keys to server. Total time: " +
-              std::to_string(whole_duration.count()) + "ms");
+  LOG_INFO("Sent " + std::to_string(num_to_insert) +
+             " keys to server. Total time: " +
+             std::to_string(whole_duration.count()) + "ms");
 }
 
 std::vector<float> HEVECClientTCP::query(const std::string &collectionName,
@@ -596,7 +566,7 @@ std::vector<float> HEVECClientTCP::query(const std::string &collectionName,
   auto end = std::chrono::high_resolution_clock::now();
   auto duration =
       std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-  logToFile("Encrypt/Encode query: " + std::to_string(duration.count()) +
+  LOG_DEBUG("Encrypt/Encode query: " + std::to_string(duration.count()) +
               "ms");
 
   start = std::chrono::high_resolution_clock::now();
@@ -616,13 +586,13 @@ std::vector<float> HEVECClientTCP::query(const std::string &collectionName,
   }
   end = std::chrono::high_resolution_clock::now();
   duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-  logToFile("Query round trip: " + std::to_string(duration.count()) + "ms");
+  LOG_DEBUG("Query round trip: " + std::to_string(duration.count()) + "ms");
 
   start = std::chrono::high_resolution_clock::now();
   ctx->client->decryptScore(dmsg, ret, secKey_, ctx->outputScale);
   end = std::chrono::high_resolution_clock::now();
   duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-  logToFile("Decrypt score: " + std::to_string(duration.count()) + "ms");
+  LOG_DEBUG("Decrypt score: " + std::to_string(duration.count()) + "ms");
 
   std::vector<float> results;
   results.reserve(db_sizes_.at(collectionName));
@@ -637,8 +607,8 @@ std::vector<float> HEVECClientTCP::query(const std::string &collectionName,
   auto whole_end = std::chrono::high_resolution_clock::now();
   auto whole_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
       whole_end - whole_start);
-  logToFile("Total query time: " + std::to_string(whole_duration.count()) +
-              "ms");
+  LOG_INFO("Total query time: " + std::to_string(whole_duration.count()) +
+             "ms");
   return results;
 }
 
@@ -701,7 +671,7 @@ void HEVECClientTCP::queryAndTopK(TopK &res, const std::string &collectionName,
   auto end_enc = std::chrono::high_resolution_clock::now();
   auto duration_enc = std::chrono::duration_cast<std::chrono::milliseconds>(
       end_enc - start_enc);
-  logToFile("Encrypt/Encode query: " + std::to_string(duration_enc.count()) +
+  LOG_DEBUG("Encrypt/Encode query: " + std::to_string(duration_enc.count()) +
               "ms");
 
   auto start_rt = std::chrono::high_resolution_clock::now();
@@ -717,7 +687,7 @@ void HEVECClientTCP::queryAndTopK(TopK &res, const std::string &collectionName,
   auto end_rt = std::chrono::high_resolution_clock::now();
   auto duration_rt =
       std::chrono::duration_cast<std::chrono::milliseconds>(end_rt - start_rt);
-  logToFile("Query round trip: " + std::to_string(duration_rt.count()) +
+  LOG_DEBUG("Query round trip: " + std::to_string(duration_rt.count()) +
               "ms");
 
   // --- Decrypt all scores ---
@@ -733,7 +703,7 @@ void HEVECClientTCP::queryAndTopK(TopK &res, const std::string &collectionName,
   auto end_decrypt = std::chrono::high_resolution_clock::now();
   auto duration_decrypt = std::chrono::duration_cast<std::chrono::milliseconds>(
       end_decrypt - start_decrypt);
-  logToFile("Decrypt score: " + std::to_string(duration_decrypt.count()) +
+  LOG_DEBUG("Decrypt score: " + std::to_string(duration_decrypt.count()) +
               "ms");
 
   // --- Efficient Top-K using a min-heap ---
@@ -772,14 +742,14 @@ void HEVECClientTCP::queryAndTopK(TopK &res, const std::string &collectionName,
   auto end_topk = std::chrono::high_resolution_clock::now();
   auto duration_topk = std::chrono::duration_cast<std::chrono::milliseconds>(
       end_topk - start_topk);
-  logToFile("Top-K calculation: " + std::to_string(duration_topk.count()) +
+  LOG_DEBUG("Top-K calculation: " + std::to_string(duration_topk.count()) +
               "ms");
 
   auto whole_end = std::chrono::high_resolution_clock::now();
   auto whole_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
       whole_end - whole_start);
-  logToFile("Total queryAndTopK time: " +
-              std::to_string(whole_duration.count()) + "ms");
+  LOG_INFO("Total queryAndTopK time: " +
+             std::to_string(whole_duration.count()) + "ms");
 }
 
 void HEVECClientTCP::queryAndTopKWithScores(std::vector<std::pair<u64, float>> &res,
@@ -843,7 +813,7 @@ void HEVECClientTCP::queryAndTopKWithScores(std::vector<std::pair<u64, float>> &
   auto end_enc = std::chrono::high_resolution_clock::now();
   auto duration_enc = std::chrono::duration_cast<std::chrono::milliseconds>(
       end_enc - start_enc);
-  logToFile("Encrypt/Encode query: " + std::to_string(duration_enc.count()) +
+  LOG_DEBUG("Encrypt/Encode query: " + std::to_string(duration_enc.count()) +
               "ms");
 
   auto start_rt = std::chrono::high_resolution_clock::now();
@@ -859,7 +829,7 @@ void HEVECClientTCP::queryAndTopKWithScores(std::vector<std::pair<u64, float>> &
   auto end_rt = std::chrono::high_resolution_clock::now();
   auto duration_rt =
       std::chrono::duration_cast<std::chrono::milliseconds>(end_rt - start_rt);
-  logToFile("Query round trip: " + std::to_string(duration_rt.count()) +
+  LOG_DEBUG("Query round trip: " + std::to_string(duration_rt.count()) +
               "ms");
 
   // --- Decrypt all scores ---
@@ -873,7 +843,7 @@ void HEVECClientTCP::queryAndTopKWithScores(std::vector<std::pair<u64, float>> &
   auto end_decrypt = std::chrono::high_resolution_clock::now();
   auto duration_decrypt = std::chrono::duration_cast<std::chrono::milliseconds>(
       end_decrypt - start_decrypt);
-  logToFile("Decrypt score: " + std::to_string(duration_decrypt.count()) +
+  LOG_DEBUG("Decrypt score: " + std::to_string(duration_decrypt.count()) +
               "ms");
 
   // --- Efficient Top-K using a min-heap ---
@@ -923,14 +893,14 @@ void HEVECClientTCP::queryAndTopKWithScores(std::vector<std::pair<u64, float>> &
   auto end_topk = std::chrono::high_resolution_clock::now();
   auto duration_topk = std::chrono::duration_cast<std::chrono::milliseconds>(
       end_topk - start_topk);
-  logToFile("Top-K calculation: " + std::to_string(duration_topk.count()) +
+  LOG_DEBUG("Top-K calculation: " + std::to_string(duration_topk.count()) +
               "ms");
 
   auto whole_end = std::chrono::high_resolution_clock::now();
   auto whole_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
       whole_end - whole_start);
-  logToFile("Total queryAndTopKWithScores time: " +
-              std::to_string(whole_duration.count()) + "ms");
+  LOG_INFO("Total queryAndTopKWithScores time: " +
+             std::to_string(whole_duration.count()) + "ms");
 }
 
 std::vector<u64> HEVECClientTCP::getTopKIndices(const std::vector<float> &scores,
@@ -10,30 +10,46 @@
 #include <cmath>
 #include <cstdlib>
 #include <cstdint>
-#include <ctime>
 #include <cstring>
+#include <filesystem>
 #include <fstream>
-#include <iomanip>
+#include <iterator>
 #include <iostream>
 #include <limits>
 #include <optional>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <unistd.h>
 #include <vector>
 
+#include "HEVEC/BlockFile.hpp"
+#include "HEVEC/BlockStore.hpp"
 #include "HEVEC/Ciphertext.hpp"
 #include "HEVEC/Client.hpp"
 #include "HEVEC/Const.hpp"
 #include "HEVEC/Keys.hpp"
+#include "HEVEC/Log.hpp"
 #include "HEVEC/MLWECiphertext.hpp"
+#include "HEVEC/MLWESwitchingKey.hpp"
+#include "HEVEC/Memory.hpp"
 #include "HEVEC/MetricType.hpp"
+#include "HEVEC/Metrics.hpp"
+#include "HEVEC/PackedCiphertext.hpp"
+#include "HEVEC/PIRDatabase.hpp"
 #include "HEVEC/PIRServer.hpp"
+#include "HEVEC/Random.hpp"
 #include "HEVEC/Server.hpp"
+#include "HEVEC/SnapshotFile.hpp"
 #include "HEVEC/SwitchingKey.hpp"
+#include "HEVEC/TaskPool.hpp"
+#include "HEVEC/Trace.hpp"
+#include "HEVEC/WriteAheadLog.hpp"
 
 namespace HEVEC {
 namespace {
@@ -84,25 +100,108 @@ void appendBinary(std::vector<uint8_t> &out, const void *data,
   out.insert(out.end(), ptr, ptr + len);
 }
 
-void logToFile(const std::string &message) {
-  const char *log_path_env = std::getenv("HEVEC_SERVER_LOG_PATH");
-  if (log_path_env) {
-    std::ofstream log_file(log_path_env, std::ios::app);
-    if (log_file.is_open()) {
-      auto now = std::chrono::system_clock::now();
-      auto time_t = std::chrono::system_clock::to_time_t(now);
-      auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                    now.time_since_epoch()) %
-                1000;
+#define LOG_DEBUG(message)                                                     \
+  HEVEC_LOG(getServerLogger(), LogLevel::Debug, message)
+#define LOG_INFO(message) HEVEC_LOG(getServerLogger(), LogLevel::Info, message)
+#define LOG_WARN(message) HEVEC_LOG(getServerLogger(), LogLevel::Warn, message)
+
+// HEVEC_REQUEST_THREADS caps the threads one compute request computes on
+// (default: all of them). Requests on different compute threads share the
+// task pool, so a cap keeps one large request from crowding out the others.
+u64 getRequestThreads() {
+  const char *threads_env = std::getenv("HEVEC_REQUEST_THREADS");
+  if (threads_env && std::atoll(threads_env) > 0)
+    return static_cast<u64>(std::atoll(threads_env));
+  return TaskPool::get().getNumThreads();
+}
 
-      log_file << "["
-               << std::put_time(std::localtime(&time_t), "%Y-%m-%d %H:%M:%S");
-      log_file << "." << std::setfill('0') << std::setw(3) << ms.count()
-               << "] ";
-      log_file << message << std::endl;
-      log_file.close();
-    }
-  }
+// HEVEC_SNAPSHOT_DIR enables snapshots: collections are saved there as
+// <hash>.hvs on POST /admin/snapshot and on stop(), and loaded on startup.
+const char *getSnapshotDir() {
+  const char *dir_env = std::getenv("HEVEC_SNAPSHOT_DIR");
+  return dir_env && *dir_env ? dir_env : nullptr;
+}
+
+constexpr std::string_view SNAPSHOT_EXTENSION = ".hvs";
+constexpr char SNAPSHOT_MAGIC[8] = {'H', 'E', 'V', 'E', 'C', 'S', 'N', 'P'};
+constexpr u64 SNAPSHOT_VERSION = 1;
+
+std::string getSnapshotPath(const std::string &dir, u64 collectionHash) {
+  return dir + "/" + std::to_string(collectionHash) +
+         std::string(SNAPSHOT_EXTENSION);
+}
+
+// Inserts since the last snapshot of a collection are logged to <hash>.wal
+// next to it.
+std::string getWALPath(const std::string &dir, u64 collectionHash) {
+  return dir + "/" + std::to_string(collectionHash) + ".wal";
+}
+
+// HEVEC_WAL_SYNC picks when logged inserts reach the disk: none (left to the
+// OS), batch (an fsync every HEVEC_WAL_SYNC_INTERVAL_MS, 10 by default) or
+// request (an insert is answered once its record is fsynced).
+std::unique_ptr<WriteAheadLog> openWriteAheadLog(const std::string &dir,
+                                                 u64 collectionHash) {
+  const char *sync_env = std::getenv("HEVEC_WAL_SYNC");
+  const std::string sync = sync_env ? sync_env : "batch";
+  WALDurability durability = WALDurability::Batch;
+  if (sync == "none")
+    durability = WALDurability::None;
+  else if (sync == "request")
+    durability = WALDurability::Request;
+  const char *interval_env = std::getenv("HEVEC_WAL_SYNC_INTERVAL_MS");
+  const std::chrono::milliseconds interval(
+      interval_env ? std::max(std::atol(interval_env), 1L) : 10L);
+  return std::make_unique<WriteAheadLog>(getWALPath(dir, collectionHash),
+                                         durability, interval);
+}
+
+// HEVEC_BLOCK_CACHE_DIR moves full block caches out of the heap into
+// <hash>.blocks files there, mapped back read-only, so collections larger
+// than RAM are served from the page cache.
+const char *getBlockCacheDir() {
+  const char *dir_env = std::getenv("HEVEC_BLOCK_CACHE_DIR");
+  return dir_env && *dir_env ? dir_env : nullptr;
+}
+
+std::string getBlockFilePath(const std::string &dir, u64 collectionHash) {
+  return dir + "/" + std::to_string(collectionHash) + ".blocks";
+}
+
+// HEVEC_BLOCK_CACHE_BUDGET_MB switches the block file to a tiered store:
+// up to that much of each collection's full blocks stays resident, and the
+// rest is read back with io_uring when scanned.
+std::optional<u64> getBlockCacheBudget() {
+  const char *budget_env = std::getenv("HEVEC_BLOCK_CACHE_BUDGET_MB");
+  if (!budget_env || !*budget_env)
+    return std::nullopt;
+  return static_cast<u64>(std::max(std::atoll(budget_env), 0LL)) << 20;
+}
+
+// HEVEC_BLOCK_CACHE_EVICTION=lru|lfu (default lfu). Full scans visit every
+// block equally often, which LRU turns into a miss on every block once the
+// collection exceeds the budget; LFU keeps a fixed set resident.
+BlockEviction getBlockCacheEviction() {
+  const char *eviction_env = std::getenv("HEVEC_BLOCK_CACHE_EVICTION");
+  return eviction_env && std::string(eviction_env) == "lru"
+             ? BlockEviction::LRU
+             : BlockEviction::LFU;
+}
+
+// HEVEC_BLOCK_CACHE_BUFFERS: registered read buffers per collection
+// (default 2: the block being scanned and the one being read ahead).
+u64 getBlockCacheBuffers() {
+  const char *buffers_env = std::getenv("HEVEC_BLOCK_CACHE_BUFFERS");
+  return buffers_env ? static_cast<u64>(std::max(std::atoll(buffers_env), 1LL))
+                     : 2;
+}
+
+// HEVEC_BLOCK_CACHE_PACKED=1 keeps full blocks bit-packed, 54 bits per
+// coefficient, in memory and in block files. Scans unpack each tile as they
+// read it, trading a little compute for 16% less memory traffic.
+bool getBlockCachePacked() {
+  const char *packed_env = std::getenv("HEVEC_BLOCK_CACHE_PACKED");
+  return packed_env && std::string(packed_env) == "1";
 }
 
 constexpr u64 LOG_RANK = 7;
@@ -114,6 +213,146 @@ constexpr u64 PIR_RANK = 1ULL << PIR_LOG_RANK;
 constexpr std::size_t DEFAULT_MAX_BODY_SIZE =
     std::numeric_limits<std::size_t>::max();
 constexpr std::size_t STREAM_CHUNK_SIZE = 1ULL << 20; // 1 MiB chunks
+// Each cached query holds rank ciphertexts, so batches are capped to bound the
+// memory of one request.
+constexpr u64 MAX_QUERY_BATCH = 64;
+
+// Reads polys[first, first + count), which come back to back on the wire,
+// with one readBytes per run of them that is contiguous in the slab: a
+// single run unless some were reshaped.
+bool readPolys(BinaryReader &reader, PolynomialArray &polys, u64 first,
+               u64 count) {
+  const u64 end = first + count;
+  for (u64 i = first; i < end;) {
+    u64 *start = polys[i].getData();
+    u64 words = 0;
+    for (; i < end && polys[i].getData() == start + words; ++i)
+      words += polys[i].getDegree();
+    if (words > 0 && !reader.readBytes(start, words * sizeof(u64)))
+      return false;
+  }
+  return true;
+}
+
+// Reads an MLWE ciphertext sent in full, or as the seed of A followed by B.
+// A seeded ciphertext is left for the caller to expand into res.
+bool readMLWECiphertext(BinaryReader &reader, MLWECiphertext &res,
+                        u8 *seed) {
+  if (seed)
+    return reader.readBytes(seed, SEED_SIZE) &&
+           readPolys(reader, res.getPolys(), res.getStack(), 1);
+  return readPolys(reader, res.getPolys(), 0, res.getStack() + 1);
+}
+
+bool readCiphertext(BinaryReader &reader, Ciphertext &res, u8 *seed) {
+  if (seed)
+    return reader.readBytes(seed, SEED_SIZE) &&
+           readPolys(reader, res.getPolys(), 1, 1);
+  return readPolys(reader, res.getPolys(), 0, 2);
+}
+
+// Appends the keys and payloads of an insert, read from a request body or a
+// logged record. Returns an error message, or null on success.
+const char *readInsertItems(BinaryReader &reader, u64 count, u64 rank,
+                            bool isSeeded, std::vector<MLWECiphertext> &keys,
+                            std::vector<std::string> &payloads) {
+  const u64 base = keys.size();
+  std::vector<u8> seeds(isSeeded ? count * SEED_SIZE : 0);
+  keys.reserve(base + count);
+  payloads.reserve(payloads.size() + count);
+  for (u64 i = 0; i < count; ++i) {
+    MLWECiphertext &key = keys.emplace_back(rank);
+    if (!readMLWECiphertext(reader, key,
+                            isSeeded ? seeds.data() + i * SEED_SIZE
+                                     : nullptr))
+      return "Malformed key payload";
+
+    std::string &payload = payloads.emplace_back(PIR_PAYLOAD_SIZE, '\0');
+    if (!reader.readBytes(payload.data(), payload.size()))
+      return "Malformed payload data";
+  }
+
+  if (isSeeded) {
+    parallelFor(count, [&](u64 i) {
+      Random::sampleUniformWithSeed(keys[base + i],
+                                    seeds.data() + i * SEED_SIZE);
+    });
+  }
+  return nullptr;
+}
+
+// HEVEC_SWITCHING_KEY_A=implicit keeps only the seeds of seeded switching
+// keys and expands their A parts each time a key is used, trading compute for
+// about half of the resident key memory.
+bool useImplicitSwitchingKeyA() {
+  const char *key_env = std::getenv("HEVEC_SWITCHING_KEY_A");
+  return key_env && std::string(key_env) == "implicit";
+}
+
+// Reads a switching key sent in full, or as the seed of its A parts followed
+// by B. The A parts of a seeded key are left for the caller to expand.
+bool readSwitchingKey(BinaryReader &reader, SwitchingKey &res, bool isSeeded) {
+  if (isSeeded) {
+    u8 seed[SEED_SIZE];
+    if (!reader.readBytes(seed, SEED_SIZE))
+      return false;
+    res.setSeed(seed);
+  }
+  // An implicit key has no A words, so its B parts are the whole slab.
+  const bool skipA = isSeeded && !res.isImplicit();
+  if (!readPolys(reader, res.getPolys(), skipA ? 2 : 0, skipA ? 2 : 4))
+    return false;
+  for (Polynomial &poly : res.getPolys())
+    poly.setIsNTT(true);
+  return true;
+}
+
+bool readMLWESwitchingKey(BinaryReader &reader, MLWESwitchingKey &res,
+                          bool isSeeded) {
+  if (isSeeded) {
+    u8 seed[SEED_SIZE];
+    if (!reader.readBytes(seed, SEED_SIZE))
+      return false;
+    res.setSeed(seed);
+  }
+  PolynomialArray &polys = res.getPolys();
+  if (isSeeded && !res.isImplicit()) {
+    // B parts only, between the A parts the seed expands to.
+    for (u64 k = 0; k < res.getStack(); ++k) {
+      if (!readPolys(reader, polys, k * 4 + 2, 2))
+        return false;
+    }
+  } else if (!readPolys(reader, polys, 0, polys.size())) {
+    return false;
+  }
+  for (Polynomial &poly : polys)
+    poly.setIsNTT(true);
+  return true;
+}
+
+// Query and PIR requests may end with the bit width the client wants each
+// result ciphertext switched down to; 0 (or no trailer) keeps full NTT words.
+bool readResponseBits(BinaryReader &reader, u64 &bits) {
+  bits = 0;
+  if (reader.remaining() >= sizeof(u64))
+    reader.read(bits);
+  return bits < LOG_MOD_Q;
+}
+
+template <typename Evaluator>
+void appendResult(std::vector<uint8_t> &body, Evaluator &eval,
+                  const Ciphertext &res, u64 responseBits) {
+  HEVEC_TRACE_SPAN("appendResult");
+  if (responseBits == 0) {
+    appendBinary(body, res.getA().getData(), DEGREE * sizeof(u64));
+    appendBinary(body, res.getB().getData(), DEGREE * sizeof(u64));
+    return;
+  }
+  PackedCiphertext packed(responseBits);
+  eval.modSwitch(packed, res);
+  appendBinary(body, packed.getWords().data(),
+               packed.getWords().size() * sizeof(u64));
+}
 
 Response makeBinaryResponse(const Request &req, std::vector<uint8_t> &&body) {
   Response res{http::status::ok, req.version()};
@@ -140,21 +379,252 @@ Response makeTextResponse(const Request &req, http::status status,
   return makeTextResponse(req.version(), req.keep_alive(), status, message);
 }
 
+// Start of a span closed by traceSince; 0 outside a sampled request.
+u64 traceStart() { return Tracer::getCurrent() ? Tracer::nowNs() : 0; }
+
+void traceSince(const char *name, u64 startNs) {
+  if (RequestTrace *trace = Tracer::getCurrent())
+    trace->addSpan(name, startNs, Tracer::nowNs());
+}
+
+// First histogram bucket bounds: 1 us for latencies, 64 B for sizes.
+constexpr double SECONDS_UNIT = 1e-6;
+constexpr double BYTES_UNIT = 64;
+
+// Endpoints with their own request metrics; anything else counts as "other".
+constexpr std::string_view METRIC_ENDPOINTS[] = {
+    "/collections/setup",
+    "/collections/setup_seeded",
+    "/collections/insert",
+    "/collections/insert_seeded",
+    "/collections/query",
+    "/collections/query_seeded",
+    "/collections/query_ptxt",
+    "/collections/query_batch",
+    "/collections/query_batch_seeded",
+    "/collections/query_ptxt_batch",
+    "/collections/retrieve",
+    "/collections/pir_retrieve",
+    "/collections/pir_retrieve_seeded",
+    "/collections/{hash}",
+    "/terminate",
+    "/admin/snapshot",
+    "/metrics",
+    "/debug/trace",
+    "other",
+};
+
+// pages label of each PageKind.
+constexpr std::array<const char *, NUM_PAGE_KINDS> PAGE_KIND_NAMES = {
+    "small", "transparent_huge", "huge"};
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+// Copies of a query, or of a batch of them, for a scan on NUMA node node.
+template <typename Query> Query copyToNode(const Query &query, u64 node) {
+  return Query(query, node);
+}
+
+template <typename Query>
+std::vector<Query> copyToNode(const std::vector<Query> &queries, u64 node) {
+  std::vector<Query> res;
+  res.reserve(queries.size());
+  for (const Query &query : queries)
+    res.emplace_back(query, node);
+  return res;
+}
+
+u64 polyBytes(const Polynomial &poly) {
+  return poly.getDegree() * sizeof(u64);
+}
+
+u64 keyBytes(const SwitchingKey &key) {
+  return polyBytes(key.getPolyAModQ()) + polyBytes(key.getPolyAModP()) +
+         polyBytes(key.getPolyBModQ()) + polyBytes(key.getPolyBModP());
+}
+
+u64 keyBytes(const MLWESwitchingKey &key) {
+  u64 bytes = 0;
+  for (u64 k = 0; k < key.getStack(); ++k)
+    bytes += polyBytes(key.getPolyAModQ(k)) + polyBytes(key.getPolyAModP(k)) +
+             polyBytes(key.getPolyBModQ(k)) + polyBytes(key.getPolyBModP(k));
+  return bytes;
+}
+
+// Heap bytes of a block; a mapped block has none.
+u64 cacheBytes(const CachedKeys &block) {
+  u64 bytes = 0;
+  if (block.isTiled() && !block.isMapped())
+    bytes += CiphertextSpan::getTiledWords(block.getSpan().size(),
+                                           block.isPacked()) *
+             sizeof(u64);
+  for (const Ciphertext &ctxt : block.getCtxts()) {
+    bytes += polyBytes(ctxt.getA()) + polyBytes(ctxt.getB());
+    if (ctxt.getIsExtended())
+      bytes += polyBytes(ctxt.getC());
+  }
+  for (const SwitchingKey &sum : block.getPendingSums())
+    bytes += keyBytes(sum);
+  return bytes;
+}
+
+// Resident set size of the process, or 0 where /proc is not available.
+double residentBytes() {
+  std::ifstream statm("/proc/self/statm");
+  u64 pages = 0, resident = 0;
+  if (!(statm >> pages >> resident))
+    return 0.0;
+  return static_cast<double>(resident) *
+         static_cast<double>(sysconf(_SC_PAGESIZE));
+}
+
 } // namespace
 
+// Block caches visible to queries. Inserts publish a new snapshot as a whole;
+// queries keep the one they started with, so published blocks are immutable.
+struct BlockSnapshot {
+  // Empty when the collection has a block store, which holds the full
+  // blocks instead: block i at index stored_blocks[i]. An insert that fails
+  // after appending leaves entries no snapshot refers to.
+  std::vector<std::shared_ptr<const CachedKeys>> full_blocks;
+  std::vector<u64> stored_blocks;
+  std::shared_ptr<const CachedKeys> partial_block;
+  u64 db_size = 0;
+
+  u64 getNumFullBlocks() const {
+    return full_blocks.size() + stored_blocks.size();
+  }
+};
+
+// Series of one collection, labelled with its hash and removed on drop.
+struct CollectionMetrics {
+  CollectionMetrics(MetricsRegistry &registry, u64 collectionHash) {
+    const std::string hash = std::to_string(collectionHash);
+    auto timing = [&](const std::string &name, const std::string &help,
+                      MetricLabels labels) {
+      labels.insert(labels.begin(), {"collection", hash});
+      return registry.histogram(name, help, labels, SECONDS_UNIT);
+    };
+    auto memory = [&](const std::string &kind) {
+      return registry.gauge("hevec_collection_memory_bytes",
+                            "Bytes held by a collection, by kind.",
+                            {{"collection", hash}, {"kind", kind}});
+    };
+
+    const std::string cacheHelp = "Server::cacheQuery time per query.";
+    cache_query_encrypted = timing("hevec_cache_query_seconds", cacheHelp,
+                                   {{"query", "encrypted"}});
+    cache_query_plaintext = timing("hevec_cache_query_seconds", cacheHelp,
+                                   {{"query", "plaintext"}});
+
+    const std::string scanHelp =
+        "Inner-product scan of one key block, before relinearization.";
+    scan_encrypted = timing("hevec_inner_product_seconds", scanHelp,
+                            {{"query", "encrypted"}, {"mode", "single"}});
+    scan_plaintext = timing("hevec_inner_product_seconds", scanHelp,
+                            {{"query", "plaintext"}, {"mode", "single"}});
+    scan_batch_encrypted = timing("hevec_inner_product_seconds", scanHelp,
+                                  {{"query", "encrypted"}, {"mode", "batch"}});
+    scan_batch_plaintext = timing("hevec_inner_product_seconds", scanHelp,
+                                  {{"query", "plaintext"}, {"mode", "batch"}});
+
+    const std::string relinHelp =
+        "Relinearization of the scores of one key block.";
+    relin = timing("hevec_relin_seconds", relinHelp, {{"mode", "single"}});
+    relin_batch = timing("hevec_relin_seconds", relinHelp, {{"mode", "batch"}});
+
+    const std::string keysHelp = "Switching inserted keys into a block cache.";
+    cache_keys = timing("hevec_cache_keys_seconds", keysHelp,
+                        {{"op", "cache_keys"}});
+    append_to_cache = timing("hevec_cache_keys_seconds", keysHelp,
+                             {{"op", "append_to_cache"}});
+
+    const std::string pirHelp = "PIRServer::pir time by stage.";
+    pir_expand_first =
+        timing("hevec_pir_stage_seconds", pirHelp, {{"stage", "expand_first"}});
+    pir_first_dim =
+        timing("hevec_pir_stage_seconds", pirHelp, {{"stage", "first_dim"}});
+    pir_expand_second = timing("hevec_pir_stage_seconds", pirHelp,
+                               {{"stage", "expand_second"}});
+    pir_second_dim = timing("hevec_pir_stage_seconds", pirHelp,
+                            {{"stage", "second_dim"}});
+    pir_relin = timing("hevec_pir_stage_seconds", pirHelp, {{"stage", "relin"}});
+
+    vectors = registry.gauge("hevec_collection_vectors",
+                             "Vectors inserted into a collection.",
+                             {{"collection", hash}});
+    key_bytes = memory("keys");
+    cache_bytes = memory("block_caches");
+    mapped_cache_bytes = memory("mapped_block_caches");
+
+    auto blockStore = [&](const std::string &result) {
+      return registry.counter("hevec_block_store_acquires_total",
+                              "Full blocks requested from a block store.",
+                              {{"collection", hash}, {"result", result}});
+    };
+    block_store.hits = blockStore("resident");
+    block_store.loads = blockStore("loaded");
+    block_store.evictions = registry.counter(
+        "hevec_block_store_evictions_total",
+        "Resident blocks dropped from a block store.", {{"collection", hash}});
+    block_store.resident_bytes = memory("resident_block_caches");
+    payload_bytes = memory("payloads");
+    for (u64 kind = 0; kind < NUM_PAGE_KINDS; ++kind)
+      allocated_bytes[kind] = registry.gauge(
+          "hevec_collection_allocated_bytes",
+          "Bytes of slabs allocated for a collection, by page kind.",
+          {{"collection", hash}, {"pages", PAGE_KIND_NAMES[kind]}});
+
+    // Scan bandwidth per NUMA node is the rate of the bytes over the rate of
+    // the seconds' sum.
+    for (u64 node = 0; node < TaskPool::get().getNumNodes(); ++node) {
+      const std::string id = std::to_string(node);
+      node_scan_bytes.push_back(registry.counter(
+          "hevec_node_scan_bytes_total",
+          "Full block bytes scanned by the threads of a NUMA node.",
+          {{"collection", hash}, {"node", id}}));
+      node_scan.push_back(timing(
+          "hevec_node_scan_seconds",
+          "Scan of one full block on a NUMA node, relinearization included.",
+          {{"node", id}}));
+    }
+  }
+
+  std::shared_ptr<Histogram> cache_query_encrypted, cache_query_plaintext;
+  std::shared_ptr<Histogram> scan_encrypted, scan_plaintext;
+  std::shared_ptr<Histogram> scan_batch_encrypted, scan_batch_plaintext;
+  std::shared_ptr<Histogram> relin, relin_batch;
+  std::shared_ptr<Histogram> cache_keys, append_to_cache;
+  std::shared_ptr<Histogram> pir_expand_first, pir_first_dim,
+      pir_expand_second, pir_second_dim, pir_relin;
+  std::shared_ptr<Gauge> vectors, key_bytes, cache_bytes, mapped_cache_bytes,
+      payload_bytes;
+  BlockStoreMetrics block_store;
+  std::array<std::shared_ptr<Gauge>, NUM_PAGE_KINDS> allocated_bytes;
+  std::vector<std::shared_ptr<Counter>> node_scan_bytes;
+  std::vector<std::shared_ptr<Histogram>> node_scan;
+};
+
 struct HEVECServer::CollectionData {
-  std::mutex mtx;
+  // Serializes inserts. Readers never take it.
+  std::mutex insert_mtx;
+  // Guards payloads_ and pir_database_ while an insert appends to them. PIR
+  // queries read the rows below the published db_size without it.
+  std::shared_mutex payload_mtx;
+  // Slabs allocated for the collection; see MemoryScope.
+  const std::shared_ptr<MemoryAccount> memory;
   std::unique_ptr<Server> server;
   SwitchingKey relinKey;
   AutedModPackKeys autedModPackKeys;
   AutedModPackMLWEKeys autedModPackMLWEKeys;
 
   InvAutKeys pirInvAutKeys;
-  std::vector<Polynomial> pir_encoded_payloads_;
+  PIRDatabase pir_database_;
 
-  std::vector<CachedKeys> full_block_caches_;
-  std::vector<MLWECiphertext> partial_block_keys_;
-  std::unique_ptr<CachedKeys> partial_block_cache_;
   std::vector<std::string> payloads_;
 
   u64 log_rank;
@@ -162,25 +632,213 @@ struct HEVECServer::CollectionData {
   u64 stack;
   u64 dimension;
   MetricType metric_type;
-  u64 db_size = 0;
+
+  CollectionMetrics metrics;
+
+  // Set when HEVEC_SNAPSHOT_DIR is; logs the inserts since the last snapshot.
+  std::unique_ptr<WriteAheadLog> wal;
+  // Set under insert_mtx once the collection is dropped, or taken offline
+  // after a failed insert; inserts and saves skip it from then on.
+  bool dropped = false;
+  // Set when HEVEC_BLOCK_CACHE_DIR is; holds the full block caches, either
+  // mapped (block_file) or tiered (block_store, with a budget).
+  std::unique_ptr<BlockFile> block_file;
+  std::unique_ptr<BlockStore> block_store;
+  const bool packed_blocks = getBlockCachePacked();
+  // Full block i lives on NUMA node i % num_nodes.
+  const u64 num_nodes = TaskPool::get().getNumNodes();
 
   CollectionData(u64 d, MetricType mt, SwitchingKey &&rk,
                  AutedModPackKeys &&apk, AutedModPackMLWEKeys &&apmk,
-                 InvAutKeys &&piak)
-      : relinKey(std::move(rk)), autedModPackKeys(std::move(apk)),
+                 InvAutKeys &&piak, MetricsRegistry &registry,
+                 u64 collectionHash, std::shared_ptr<MemoryAccount> account)
+      : memory(std::move(account)), relinKey(std::move(rk)),
+        autedModPackKeys(std::move(apk)),
         autedModPackMLWEKeys(std::move(apmk)),
-        pirInvAutKeys(std::move(piak)), dimension(d), metric_type(mt),
-        pir_encoded_payloads_(PIR_RANK * PIR_RANK, Polynomial(DEGREE, MOD_Q)) {
+        pirInvAutKeys(std::move(piak)),
+        pir_database_(PIR_RANK * PIR_RANK, useCompactPIRStore()), dimension(d),
+        metric_type(mt), metrics(registry, collectionHash) {
     log_rank = static_cast<u64>(std::ceil(std::log2(dimension)));
     rank = 1ULL << log_rank;
     stack = DEGREE / rank;
-    for (u64 i = 0; i < PIR_RANK * PIR_RANK; ++i) {
-      pir_encoded_payloads_[i].setIsNTT(true);
-    }
-    partial_block_keys_.reserve(DEGREE);
     server = std::make_unique<Server>(log_rank, relinKey, autedModPackKeys,
                                       autedModPackMLWEKeys);
+    snapshot_ = std::make_shared<const BlockSnapshot>();
+    if (const char *dir = getBlockCacheDir()) {
+      std::filesystem::create_directories(dir);
+      const std::string path = getBlockFilePath(dir, collectionHash);
+      if (const auto budget = getBlockCacheBudget())
+        block_store = std::make_unique<BlockStore>(
+            path, rank, packed_blocks, *budget, getBlockCacheEviction(),
+            getBlockCacheBuffers(), metrics.block_store);
+      else
+        block_file = std::make_unique<BlockFile>(path, rank, packed_blocks);
+    }
+  }
+
+  std::shared_ptr<const BlockSnapshot> loadSnapshot() {
+    std::lock_guard<std::mutex> lock(snapshot_mtx_);
+    return snapshot_;
+  }
+
+  void publishSnapshot(std::shared_ptr<const BlockSnapshot> snapshot) {
+    std::lock_guard<std::mutex> lock(snapshot_mtx_);
+    snapshot_ = std::move(snapshot);
   }
+
+  // Adds a full block to next, moved to the block file or store if there
+  // is one.
+  void storeFullBlock(BlockSnapshot &next, std::shared_ptr<CachedKeys> block) {
+    if (block_store) {
+      next.stored_blocks.push_back(block_store->append(*block));
+    } else if (block_file) {
+      next.full_blocks.push_back(block_file->append(*block));
+    } else {
+      // Blocks filled by appendToCache or read from a snapshot are tiled
+      // here; cacheKeys tiles its own, unpacked.
+      block->tile(packed_blocks);
+      block->bindToNode(next.full_blocks.size() % num_nodes);
+      next.full_blocks.push_back(std::move(block));
+    }
+  }
+
+  // Full block i of snapshot, read back from the block store if needed.
+  std::shared_ptr<const CachedKeys> getFullBlock(const BlockSnapshot &snapshot,
+                                                 u64 i) {
+    return block_store ? block_store->acquire(snapshot.stored_blocks[i])
+                       : snapshot.full_blocks[i];
+  }
+
+  // Starts paging in full block i, if there is one, ahead of its scan.
+  void prefetchFullBlock(const BlockSnapshot &snapshot, u64 i) {
+    if (i >= snapshot.getNumFullBlocks())
+      return;
+    if (block_store)
+      block_store->prefetch(snapshot.stored_blocks[i]);
+    else
+      snapshot.full_blocks[i]->prefetch();
+  }
+
+  // Calls scan(q, i, block) for every full block i of snapshot, where q is
+  // query or a copy of it. Each NUMA node scans its own blocks in order on
+  // its threads (see parallelForNodes), with a copy of query made there,
+  // reading its next block ahead. Spans of node threads are not traced.
+  template <typename Query, typename Scan>
+  void scanFullBlocks(const BlockSnapshot &snapshot, const Query &query,
+                      Scan &&scan) {
+    const u64 num_full_blocks = snapshot.getNumFullBlocks();
+    parallelForNodes([&](u64 node) {
+      std::optional<Query> copy;
+      if (num_nodes > 1)
+        copy.emplace(copyToNode(query, node));
+      const Query &local = copy ? *copy : query;
+      prefetchFullBlock(snapshot, node);
+      for (u64 i = node; i < num_full_blocks; i += num_nodes) {
+        const auto block = getFullBlock(snapshot, i);
+        prefetchFullBlock(snapshot, i + num_nodes);
+        const auto start = std::chrono::steady_clock::now();
+        scan(local, i, *block);
+        metrics.node_scan[node]->observe(secondsSince(start));
+        metrics.node_scan_bytes[node]->inc(
+            CiphertextSpan::getTiledWords(rank, block->isPacked()) *
+            sizeof(u64));
+      }
+    });
+  }
+
+  // Switches keys into the block caches of next from row next.db_size on.
+  // Only the new keys are switched into a copy of the partial block cache;
+  // a fresh block that is filled at once goes through cacheKeys.
+  void appendKeys(BlockSnapshot &next, std::vector<MLWECiphertext> &keys) {
+    const u64 db_size = next.db_size;
+    const u64 num_keys = keys.size();
+    std::shared_ptr<CachedKeys> partial_block;
+    for (u64 i = 0; i < num_keys;) {
+      const u64 slot = (db_size + i) % DEGREE;
+      const u64 count = std::min(DEGREE - slot, num_keys - i);
+      std::vector<MLWECiphertext> block_keys(
+          std::make_move_iterator(keys.begin() + i),
+          std::make_move_iterator(keys.begin() + i + count));
+      i += count;
+
+      auto start = std::chrono::high_resolution_clock::now();
+      if (count == DEGREE) {
+        auto block = std::make_shared<CachedKeys>(rank);
+        server->cacheKeys(*block, block_keys);
+        storeFullBlock(next, std::move(block));
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            end - start);
+        metrics.cache_keys->observe(
+            std::chrono::duration<double>(end - start).count());
+        LOG_DEBUG("Cache full block: " + std::to_string(duration.count()) +
+                  "ms");
+        continue;
+      }
+
+      if (!partial_block) {
+        partial_block = next.partial_block
+                            ? std::make_shared<CachedKeys>(*next.partial_block)
+                            : std::make_shared<CachedKeys>(rank);
+      }
+      server->appendToCache(*partial_block, slot, block_keys);
+      auto end = std::chrono::high_resolution_clock::now();
+      auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+          end - start);
+      metrics.append_to_cache->observe(
+          std::chrono::duration<double>(end - start).count());
+      LOG_DEBUG("Append " + std::to_string(count) +
+                " keys to partial block: " + std::to_string(duration.count()) +
+                "ms");
+
+      if (slot + count == DEGREE) {
+        partial_block->releasePendingSums();
+        storeFullBlock(next, std::move(partial_block));
+        next.partial_block.reset();
+      } else {
+        next.partial_block = partial_block;
+      }
+    }
+    next.db_size = db_size + num_keys;
+  }
+
+  // Stores the payloads of rows db_size onward, PIR-encoded unless the PIR
+  // store is compact.
+  void appendPayloads(u64 db_size, std::vector<std::string> &payloads) {
+    std::vector<Polynomial> encoded;
+    if (!pir_database_.getIsCompact()) {
+      Client pirClient(PIR_LOG_RANK);
+      encoded.reserve(payloads.size());
+      for (const std::string &payload : payloads) {
+        pirClient.encodePIRPayload(
+            encoded.emplace_back(DEGREE, MOD_Q),
+            reinterpret_cast<const unsigned char *>(payload.data()));
+      }
+    }
+
+    std::unique_lock<std::shared_mutex> payload_lock(payload_mtx);
+    try {
+      for (u64 i = 0; i < payloads.size(); ++i) {
+        if (pir_database_.getIsCompact()) {
+          pir_database_.setRow(
+              db_size + i,
+              reinterpret_cast<const unsigned char *>(payloads[i].data()));
+        } else {
+          pir_database_.setRow(db_size + i, std::move(encoded[i]));
+        }
+        payloads_.push_back(std::move(payloads[i]));
+      }
+    } catch (...) {
+      // Rows past db_size are overwritten by the next insert; payloads_ is
+      // indexed by row, so it goes back to db_size.
+      payloads_.resize(db_size);
+      throw;
+    }
+  }
+
+private:
+  std::mutex snapshot_mtx_;
+  std::shared_ptr<const BlockSnapshot> snapshot_;
 };
 
 class HEVECServer::Session : public std::enable_shared_from_this<Session> {
@@ -202,6 +860,11 @@ private:
   std::shared_ptr<Response> response_;
   bool should_close_{false};
   const std::size_t max_body_size_{DEFAULT_MAX_BODY_SIZE};
+  // Set for sampled requests, from the parsed header until the response is
+  // written.
+  std::shared_ptr<RequestTrace> trace_;
+  u64 read_start_ns_{0};
+  u64 write_start_ns_{0};
 
   void doRead() {
     parser_ = std::make_unique<http::request_parser<http::empty_body>>();
@@ -225,6 +888,11 @@ private:
       return;
     }
 
+    trace_ = Tracer::get().startRequest(
+        parser_->get().count("X-HEVEC-Trace") != 0);
+    if (trace_)
+      read_start_ns_ = Tracer::nowNs();
+
     if (parser_->chunked()) {
       return sendImmediateError(http::status::not_implemented,
                                 "Chunked transfer encoding not supported");
@@ -337,13 +1005,61 @@ private:
     Request req{base_req.method(), base_req.target(), base_req.version()};
     req.base() = std::move(base_req.base());
     req.body() = std::move(body_buffer_);
+    if (trace_)
+      trace_->addSpan("read_body", read_start_ns_, Tracer::nowNs());
 
     dispatchRequest(std::move(req), version, keep_alive);
   }
 
   void dispatchRequest(Request &&req, unsigned version, bool keep_alive) {
+    if (!server_.isComputeRequest(req)) {
+      return writeResponse(handleRequest(std::move(req), version, keep_alive));
+    }
+    if (!server_.tryReserveCompute()) {
+      HEVECServer::ResponseResult result;
+      result.response =
+          makeTextResponse(version, keep_alive,
+                           http::status::service_unavailable,
+                           "Compute queue is full");
+      server_.rejected_requests_->inc();
+      server_.recordRequest(server_.getEndpointMetrics(req),
+                            result.response.result_int(), req.body().size(),
+                            result.response.body().size(), 0.0);
+      return writeResponse(std::move(result));
+    }
+
+    // The session stays idle until the response is posted back to its strand.
+    auto self = shared_from_this();
+    auto shared_req = std::make_shared<Request>(std::move(req));
+    const auto queued_at = std::chrono::steady_clock::now();
+    const u64 queued_ns = trace_ ? Tracer::nowNs() : 0;
+    boost::asio::post(
+        server_.compute_pool_,
+        [self, shared_req, version, keep_alive, queued_at, queued_ns]() {
+          self->server_.queue_wait_->observe(secondsSince(queued_at));
+          const TaskBudget budget(getRequestThreads());
+          if (self->trace_)
+            self->trace_->addSpan("queue", queued_ns, Tracer::nowNs());
+          auto result = std::make_shared<HEVECServer::ResponseResult>(
+              self->handleRequest(std::move(*shared_req), version,
+                                  keep_alive));
+          self->server_.releaseCompute();
+          boost::asio::post(self->socket_.get_executor(), [self, result]() {
+            self->writeResponse(std::move(*result));
+          });
+        });
+  }
+
+  HEVECServer::ResponseResult handleRequest(Request &&req, unsigned version,
+                                            bool keep_alive) {
+    auto &metrics = server_.getEndpointMetrics(req);
+    const std::size_t request_bytes = req.body().size();
+    const auto start = std::chrono::steady_clock::now();
+
     HEVECServer::ResponseResult result;
     try {
+      TraceBinding binding(trace_.get());
+      HEVEC_TRACE_SPAN("processRequest");
       result = server_.processRequest(std::move(req));
     } catch (const std::exception &ex) {
       std::cerr << "Exception while handling request: " << ex.what()
@@ -353,13 +1069,19 @@ private:
           "Internal server error");
       result.should_close = true;
     }
-
-    writeResponse(std::move(result));
+    if (trace_)
+      result.response.set("Server-Timing", trace_->formatServerTiming());
+    server_.recordRequest(metrics, result.response.result_int(),
+                          request_bytes, result.response.body().size(),
+                          secondsSince(start));
+    return result;
   }
 
   void writeResponse(HEVECServer::ResponseResult &&result) {
     should_close_ = result.should_close;
     response_ = std::make_shared<Response>(std::move(result.response));
+    if (trace_)
+      write_start_ns_ = Tracer::nowNs();
     auto self = shared_from_this();
     http::async_write(
         socket_, *response_,
@@ -387,6 +1109,12 @@ private:
   }
 
   void onWrite(boost::beast::error_code ec) {
+    // The write span only reaches the trace dump; Server-Timing was sent.
+    if (trace_) {
+      trace_->addSpan("write", write_start_ns_, Tracer::nowNs());
+      Tracer::get().finishRequest(*trace_);
+      trace_.reset();
+    }
     if (ec) {
       std::cerr << "HTTP write error: " << ec.message() << std::endl;
       return;
@@ -421,6 +1149,7 @@ HEVECServer::findCollection(u64 collectionHash) {
 
 std::shared_ptr<HEVECServer::CollectionData>
 HEVECServer::getCollectionOrThrow(u64 collectionHash) {
+  Tracer::setCollection(collectionHash);
   auto ctx = findCollection(collectionHash);
   if (!ctx) {
     throw std::runtime_error("Collection not found: " +
@@ -435,17 +1164,33 @@ HEVECServer::ResponseResult HEVECServer::processRequest(Request &&req) {
 
   if (req.method() == http::verb::post) {
     if (target == "/collections/setup") {
-      result.response = handleSetup(req);
+      result.response = handleSetup(req, false);
+    } else if (target == "/collections/setup_seeded") {
+      result.response = handleSetup(req, true);
     } else if (target == "/collections/insert") {
-      result.response = handleInsert(req);
+      result.response = handleInsert(req, false);
+    } else if (target == "/collections/insert_seeded") {
+      result.response = handleInsert(req, true);
     } else if (target == "/collections/query") {
-      result.response = handleQuery(req, true);
+      result.response = handleQuery(req, true, false);
+    } else if (target == "/collections/query_seeded") {
+      result.response = handleQuery(req, true, true);
     } else if (target == "/collections/query_ptxt") {
-      result.response = handleQuery(req, false);
+      result.response = handleQuery(req, false, false);
+    } else if (target == "/collections/query_batch") {
+      result.response = handleQueryBatch(req, true, false);
+    } else if (target == "/collections/query_batch_seeded") {
+      result.response = handleQueryBatch(req, true, true);
+    } else if (target == "/collections/query_ptxt_batch") {
+      result.response = handleQueryBatch(req, false, false);
     } else if (target == "/collections/retrieve") {
       result.response = handleRetrieve(req);
     } else if (target == "/collections/pir_retrieve") {
-      result.response = handlePirRetrieve(req);
+      result.response = handlePirRetrieve(req, false);
+    } else if (target == "/collections/pir_retrieve_seeded") {
+      result.response = handlePirRetrieve(req, true);
+    } else if (target == "/admin/snapshot") {
+      result.response = handleSnapshot(req);
     } else if (target == "/terminate") {
       result.response = makeTextResponse(req, http::status::ok, "terminated");
       result.should_close = true;
@@ -456,24 +1201,68 @@ HEVECServer::ResponseResult HEVECServer::processRequest(Request &&req) {
     return result;
   }
 
+  if (req.method() == http::verb::get && target == "/metrics") {
+    result.response = handleMetrics(req);
+    return result;
+  }
+  if (req.method() == http::verb::get && target == "/debug/trace") {
+    result.response = makeTextResponse(req, http::status::ok,
+                                       Tracer::get().dumpChromeTrace());
+    result.response.set(http::field::content_type, "application/json");
+    return result;
+  }
+
   if (req.method() == http::verb::delete_) {
     constexpr std::string_view prefix = "/collections/";
     if (target.rfind(prefix, 0) == 0) {
       auto hash_str = target.substr(prefix.size());
       try {
         u64 collectionHash = std::stoull(hash_str);
+        std::shared_ptr<CollectionData> ctx;
         {
-          std::lock_guard<std::mutex> lock(collections_mutex_);
+          // Waits out a setup of the hash; a later one waits for the drop.
+          std::unique_lock<std::mutex> lock(collections_mutex_);
+          pending_done_.wait(
+              lock, [&]() { return !pending_hashes_.count(collectionHash); });
           auto it = collections_.find(collectionHash);
           if (it != collections_.end()) {
+            ctx = std::move(it->second);
             collections_.erase(it);
-            logToFile("Collection " + std::to_string(collectionHash) +
-                        " dropped successfully.");
-          } else {
-            logToFile("Failed to drop collection " +
-                        std::to_string(collectionHash) + ": not found.");
+            pending_hashes_.insert(collectionHash);
           }
         }
+        if (ctx) {
+          {
+            // Saves still holding the collection skip it from here on, so
+            // none writes the removed files back.
+            std::lock_guard<std::mutex> lock(ctx->insert_mtx);
+            ctx->dropped = true;
+            if (const char *dir = getSnapshotDir()) {
+              std::error_code ec;
+              std::filesystem::remove(getSnapshotPath(dir, collectionHash),
+                                      ec);
+              std::filesystem::remove(getWALPath(dir, collectionHash), ec);
+            }
+            // Queries still scanning keep their mappings of the file.
+            if (const char *dir = getBlockCacheDir()) {
+              std::error_code ec;
+              std::filesystem::remove(getBlockFilePath(dir, collectionHash),
+                                      ec);
+            }
+          }
+          {
+            std::lock_guard<std::mutex> lock(collections_mutex_);
+            metrics_.removeSeries("collection",
+                                  std::to_string(collectionHash));
+            pending_hashes_.erase(collectionHash);
+          }
+          pending_done_.notify_all();
+          LOG_INFO("Collection " + std::to_string(collectionHash) +
+                   " dropped successfully.");
+        } else {
+          LOG_WARN("Failed to drop collection " +
+                   std::to_string(collectionHash) + ": not found.");
+        }
         result.response = makeTextResponse(req, http::status::ok, "dropped");
       } catch (const std::exception &) {
         result.response = makeTextResponse(req, http::status::bad_request,
@@ -489,7 +1278,8 @@ HEVECServer::ResponseResult HEVECServer::processRequest(Request &&req) {
   return result;
 }
 
-Response HEVECServer::handleSetup(const Request &req) {
+Response HEVECServer::handleSetup(const Request &req, bool isSeeded) {
+  HEVEC_TRACE_SPAN("HEVECServer.handleSetup");
   BinaryReader reader(req.body());
   u64 collectionHash = 0;
   u64 dimension = 0;
@@ -501,34 +1291,49 @@ Response HEVECServer::handleSetup(const Request &req) {
     return makeTextResponse(req, http::status::bad_request,
                             "Malformed setup request");
   }
+  Tracer::setCollection(collectionHash);
 
-  auto existing_ctx = findCollection(collectionHash);
-  if (existing_ctx) {
-    std::lock_guard<std::mutex> lock(existing_ctx->mtx);
+  auto reconnect = [&](CollectionData &existing) {
+    const u64 db_size = existing.loadSnapshot()->db_size;
     std::vector<uint8_t> body;
-    if (existing_ctx->dimension != dimension) {
+    if (existing.dimension != dimension) {
       uint8_t status = 2;
       appendBinary(body, status);
-      appendBinary(body, existing_ctx->dimension);
-      appendBinary(body, existing_ctx->metric_type);
-      appendBinary(body, existing_ctx->db_size);
+      appendBinary(body, existing.dimension);
+      appendBinary(body, existing.metric_type);
+      appendBinary(body, db_size);
       std::cerr << "Collection " << collectionHash
                 << " setup failed: Dimension mismatch. Got " << dimension
-                << ", expected " << existing_ctx->dimension << std::endl;
+                << ", expected " << existing.dimension << std::endl;
       return makeBinaryResponse(req, std::move(body));
     }
 
     uint8_t status = 0;
     appendBinary(body, status);
-    appendBinary(body, existing_ctx->dimension);
-    appendBinary(body, existing_ctx->metric_type);
-    appendBinary(body, existing_ctx->db_size);
+    appendBinary(body, existing.dimension);
+    appendBinary(body, existing.metric_type);
+    appendBinary(body, db_size);
 
-    logToFile("Collection " + std::to_string(collectionHash) +
-                " re-connected. DB size: " +
-                std::to_string(existing_ctx->db_size));
+    LOG_INFO("Collection " + std::to_string(collectionHash) +
+               " re-connected. DB size: " + std::to_string(db_size));
     return makeBinaryResponse(req, std::move(body));
+  };
+
+  // Setups of one hash run one at a time: a new collection's files are
+  // replaced below, so a second setup waits for the first and reconnects.
+  std::shared_ptr<CollectionData> existing_ctx;
+  {
+    std::unique_lock<std::mutex> lock(collections_mutex_);
+    pending_done_.wait(
+        lock, [&]() { return !pending_hashes_.count(collectionHash); });
+    auto it = collections_.find(collectionHash);
+    if (it != collections_.end())
+      existing_ctx = it->second;
+    else if (has_keys)
+      pending_hashes_.insert(collectionHash);
   }
+  if (existing_ctx)
+    return reconnect(*existing_ctx);
 
   if (!has_keys) {
     std::vector<uint8_t> body;
@@ -546,107 +1351,111 @@ Response HEVECServer::handleSetup(const Request &req) {
                             "Invalid dimension value");
   }
 
+  // Lets waiting requests of the hash go on, however this setup ends.
+  struct PendingSetup {
+    HEVECServer &server;
+    u64 hash;
+    ~PendingSetup() {
+      {
+        std::lock_guard<std::mutex> lock(server.collections_mutex_);
+        server.pending_hashes_.erase(hash);
+      }
+      server.pending_done_.notify_all();
+    }
+  } pending_setup{*this, collectionHash};
+
   u64 log_rank = static_cast<u64>(std::ceil(std::log2(dimension)));
   u64 rank = 1ULL << log_rank;
   u64 stack = DEGREE / rank;
 
-  SwitchingKey relinKey;
-  AutedModPackKeys autedModPackKeys(rank);
-  AutedModPackMLWEKeys autedModPackMLWEKeys(rank);
-  InvAutKeys pirInvAutKeys(PIR_RANK);
+  // Everything the collection allocates from here on is charged to it.
+  auto memory = std::make_shared<MemoryAccount>();
+  const MemoryScope memory_scope(memory);
+
+  // Seeded keys may stay implicit; keys sent in full always carry their A.
+  const bool implicitA = isSeeded && useImplicitSwitchingKeyA();
+  SwitchingKey relinKey(implicitA);
+  AutedModPackKeys autedModPackKeys(rank, implicitA);
+  AutedModPackMLWEKeys autedModPackMLWEKeys(rank, implicitA);
+  InvAutKeys pirInvAutKeys(PIR_RANK, implicitA);
 
   try {
-    if (!reader.readBytes(relinKey.getPolyAModQ().getData(),
-                          DEGREE * sizeof(u64)) ||
-        !reader.readBytes(relinKey.getPolyAModP().getData(),
-                          DEGREE * sizeof(u64)) ||
-        !reader.readBytes(relinKey.getPolyBModQ().getData(),
-                          DEGREE * sizeof(u64)) ||
-        !reader.readBytes(relinKey.getPolyBModP().getData(),
-                          DEGREE * sizeof(u64))) {
+    if (!readSwitchingKey(reader, relinKey, isSeeded)) {
       throw std::runtime_error("Malformed relin key payload");
     }
-    relinKey.getPolyAModQ().setIsNTT(true);
-    relinKey.getPolyAModP().setIsNTT(true);
-    relinKey.getPolyBModQ().setIsNTT(true);
-    relinKey.getPolyBModP().setIsNTT(true);
 
     for (u64 i = 0; i < rank; ++i) {
       for (u64 j = 0; j < stack; ++j) {
-        auto &key = autedModPackKeys.getKeys()[i][j];
-        if (!reader.readBytes(key.getPolyAModQ().getData(),
-                              DEGREE * sizeof(u64)) ||
-            !reader.readBytes(key.getPolyAModP().getData(),
-                              DEGREE * sizeof(u64)) ||
-            !reader.readBytes(key.getPolyBModQ().getData(),
-                              DEGREE * sizeof(u64)) ||
-            !reader.readBytes(key.getPolyBModP().getData(),
-                              DEGREE * sizeof(u64))) {
+        if (!readSwitchingKey(reader, autedModPackKeys.getKeys()[i][j],
+                              isSeeded)) {
           throw std::runtime_error("Malformed autedModPack key payload");
         }
-        key.getPolyAModQ().setIsNTT(true);
-        key.getPolyAModP().setIsNTT(true);
-        key.getPolyBModQ().setIsNTT(true);
-        key.getPolyBModP().setIsNTT(true);
       }
     }
 
     for (u64 i = 0; i < rank; ++i) {
       for (u64 j = 0; j < stack; ++j) {
-        auto &key = autedModPackMLWEKeys.getKeys()[i][j];
-        for (u64 k = 0; k < stack; ++k) {
-          if (!reader.readBytes(key.getPolyAModQ(k).getData(),
-                                rank * sizeof(u64)) ||
-              !reader.readBytes(key.getPolyAModP(k).getData(),
-                                rank * sizeof(u64)) ||
-              !reader.readBytes(key.getPolyBModQ(k).getData(),
-                                rank * sizeof(u64)) ||
-              !reader.readBytes(key.getPolyBModP(k).getData(),
-                                rank * sizeof(u64))) {
-            throw std::runtime_error(
-                "Malformed autedModPackMLWE key payload");
-          }
-          key.getPolyAModQ(k).setIsNTT(true);
-          key.getPolyAModP(k).setIsNTT(true);
-          key.getPolyBModQ(k).setIsNTT(true);
-          key.getPolyBModP(k).setIsNTT(true);
+        if (!readMLWESwitchingKey(reader, autedModPackMLWEKeys.getKeys()[i][j],
+                                  isSeeded)) {
+          throw std::runtime_error("Malformed autedModPackMLWE key payload");
         }
       }
     }
 
     for (u64 i = 0; i < PIR_RANK; ++i) {
-      auto &key = pirInvAutKeys.getKeys()[i];
-      if (!reader.readBytes(key.getPolyAModQ().getData(),
-                            DEGREE * sizeof(u64)) ||
-          !reader.readBytes(key.getPolyAModP().getData(),
-                            DEGREE * sizeof(u64)) ||
-          !reader.readBytes(key.getPolyBModQ().getData(),
-                            DEGREE * sizeof(u64)) ||
-          !reader.readBytes(key.getPolyBModP().getData(),
-                            DEGREE * sizeof(u64))) {
+      if (!readSwitchingKey(reader, pirInvAutKeys.getKeys()[i], isSeeded)) {
         throw std::runtime_error("Malformed PIR key payload");
       }
-      key.getPolyAModQ().setIsNTT(true);
-      key.getPolyAModP().setIsNTT(true);
-      key.getPolyBModQ().setIsNTT(true);
-      key.getPolyBModP().setIsNTT(true);
     }
   } catch (const std::exception &ex) {
     return makeTextResponse(req, http::status::bad_request, ex.what());
   }
 
+  if (isSeeded && !implicitA) {
+    relinKey.expandPolyA();
+    parallelFor(rank, stack, [&](u64 i, u64 j) {
+      autedModPackKeys.getKeys()[i][j].expandPolyA();
+      autedModPackMLWEKeys.getKeys()[i][j].expandPolyA();
+    });
+    parallelFor(PIR_RANK, [&](u64 i) {
+      pirInvAutKeys.getKeys()[i].expandPolyA();
+    });
+  }
+
   auto new_collection = std::make_shared<CollectionData>(
       dimension, metric_type, std::move(relinKey), std::move(autedModPackKeys),
-      std::move(autedModPackMLWEKeys), std::move(pirInvAutKeys));
+      std::move(autedModPackMLWEKeys), std::move(pirInvAutKeys), metrics_,
+      collectionHash, std::move(memory));
+  updateMemoryMetrics(*new_collection);
+
+  // Keys reach the disk only through a snapshot, so a new collection gets one
+  // right away for its log to be replayed onto.
+  if (const char *dir = getSnapshotDir()) {
+    try {
+      std::filesystem::create_directories(dir);
+      std::filesystem::remove(getWALPath(dir, collectionHash));
+      saveCollection(getSnapshotPath(dir, collectionHash), collectionHash,
+                     *new_collection);
+      new_collection->wal = openWriteAheadLog(dir, collectionHash);
+    } catch (const std::exception &ex) {
+      std::cerr << "Collection " << collectionHash
+                << " will not be persisted: " << ex.what() << std::endl;
+    }
+  }
 
   {
     std::lock_guard<std::mutex> lock(collections_mutex_);
-    collections_[collectionHash] = new_collection;
+    auto [it, inserted] =
+        collections_.try_emplace(collectionHash, new_collection);
+    if (!inserted)
+      existing_ctx = it->second;
   }
+  if (existing_ctx)
+    return reconnect(*existing_ctx);
 
-  logToFile("Collection " + std::to_string(collectionHash) +
-              " with dimension " + std::to_string(dimension) +
-              " set up.");
+  LOG_INFO("Collection " + std::to_string(collectionHash) +
+             " with dimension " + std::to_string(dimension) +
+             " set up.");
 
   std::vector<uint8_t> body;
   uint8_t status = 0;
@@ -658,7 +1467,8 @@ Response HEVECServer::handleSetup(const Request &req) {
   return makeBinaryResponse(req, std::move(body));
 }
 
-Response HEVECServer::handleInsert(const Request &req) {
+Response HEVECServer::handleInsert(const Request &req, bool isSeeded) {
+  HEVEC_TRACE_SPAN("HEVECServer.handleInsert");
   BinaryReader reader(req.body());
   u64 collectionHash = 0;
   u64 num_to_insert = 0;
@@ -669,82 +1479,94 @@ Response HEVECServer::handleInsert(const Request &req) {
   }
 
   auto ctx = getCollectionOrThrow(collectionHash);
-  std::lock_guard<std::mutex> lock(ctx->mtx);
-
-  Client pirClient(PIR_LOG_RANK);
-  auto whole_start = std::chrono::high_resolution_clock::now();
-
-  for (u64 i = 0; i < num_to_insert; ++i) {
-    MLWECiphertext new_key(ctx->rank);
-    for (u64 k = 0; k < ctx->stack; ++k) {
-      if (!reader.readBytes(new_key.getA(k).getData(),
-                            ctx->rank * sizeof(u64))) {
-        return makeTextResponse(req, http::status::bad_request,
-                                "Malformed key payload (A)");
-      }
-    }
-    if (!reader.readBytes(new_key.getB().getData(),
-                          ctx->rank * sizeof(u64))) {
-      return makeTextResponse(req, http::status::bad_request,
-                              "Malformed key payload (B)");
-    }
+  const MemoryScope memory_scope(ctx->memory);
+  std::unique_lock<std::mutex> lock(ctx->insert_mtx);
+  if (ctx->dropped) {
+    throw std::runtime_error("Collection not found: " +
+                             std::to_string(collectionHash));
+  }
+  auto snapshot = ctx->loadSnapshot();
+  const u64 db_size = snapshot->db_size;
 
-    std::string payload(PIR_PAYLOAD_SIZE, '\0');
-    if (!reader.readBytes(payload.data(), payload.size())) {
-      return makeTextResponse(req, http::status::bad_request,
-                              "Malformed payload data");
-    }
-    ctx->payloads_.push_back(payload);
+  if (num_to_insert > ctx->pir_database_.getCapacity() - db_size) {
+    return makeTextResponse(req, http::status::bad_request,
+                            "Insert exceeds PIR capacity");
+  }
 
-    const unsigned char *payload_data =
-        reinterpret_cast<const unsigned char *>(payload.data());
-    pirClient.encodePIRPayload(
-        ctx->pir_encoded_payloads_[ctx->db_size + i], payload_data);
+  auto whole_start = std::chrono::high_resolution_clock::now();
 
-    ctx->partial_block_keys_.push_back(std::move(new_key));
+  const u64 key_bytes =
+      (isSeeded ? SEED_SIZE : ctx->stack * ctx->rank * sizeof(u64)) +
+      ctx->rank * sizeof(u64) + PIR_PAYLOAD_SIZE;
+  if (num_to_insert > reader.remaining() / key_bytes) {
+    return makeTextResponse(req, http::status::bad_request,
+                            "Malformed key payload");
+  }
 
-    if (ctx->partial_block_keys_.size() == DEGREE) {
-      ctx->full_block_caches_.emplace_back(ctx->rank);
-      auto start = std::chrono::high_resolution_clock::now();
-      ctx->server->cacheKeys(ctx->full_block_caches_.back(),
-                             ctx->partial_block_keys_);
-      auto end = std::chrono::high_resolution_clock::now();
-      auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
-          end - start);
-      logToFile("Cache full block: " + std::to_string(duration.count()) +
-                "ms");
-      ctx->partial_block_keys_.clear();
-      ctx->partial_block_cache_.reset();
-    }
+  std::vector<MLWECiphertext> new_keys;
+  std::vector<std::string> new_payloads;
+  const std::size_t items_start = reader.pos;
+  const u64 parse_start = traceStart();
+  if (const char *error = readInsertItems(reader, num_to_insert, ctx->rank,
+                                          isSeeded, new_keys, new_payloads)) {
+    return makeTextResponse(req, http::status::bad_request, error);
+  }
+  traceSince("parse", parse_start);
+
+  // The record is the item section of the request as received. It is
+  // appended before any cache changes, so a failed append rejects the insert;
+  // if applying it fails instead, discardLoggedInsert takes it back out.
+  u64 wal_lsn = 0;
+  if (ctx->wal) {
+    const u64 wal_start = traceStart();
+    std::vector<uint8_t> record;
+    appendBinary(record, db_size);
+    appendBinary(record, num_to_insert);
+    appendBinary(record, static_cast<uint8_t>(isSeeded));
+    record.insert(record.end(), req.body().begin() + items_start,
+                  req.body().begin() + reader.pos);
+    wal_lsn = ctx->wal->append(record);
+    traceSince("wal_append", wal_start);
   }
 
-  if (!ctx->partial_block_keys_.empty()) {
-    ctx->partial_block_cache_ = std::make_unique<CachedKeys>(ctx->rank);
-    std::vector<MLWECiphertext> padded_block = ctx->partial_block_keys_;
-    padded_block.resize(DEGREE, MLWECiphertext(ctx->rank));
-    auto start = std::chrono::high_resolution_clock::now();
-    ctx->server->cacheKeys(*ctx->partial_block_cache_, padded_block);
-    auto end = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
-        end - start);
-    logToFile("Cache partial block: " + std::to_string(duration.count()) +
-              "ms");
+  // New blocks are built off to the side and published together below.
+  auto next = std::make_shared<BlockSnapshot>(*snapshot);
+  try {
+    ctx->appendKeys(*next, new_keys);
+    ctx->appendPayloads(db_size, new_payloads);
+  } catch (const std::exception &) {
+    // Still under the insert lock, so no later record follows this one.
+    if (ctx->wal)
+      discardLoggedInsert(collectionHash, ctx);
+    throw;
+  }
+  ctx->publishSnapshot(std::move(next));
+  lock.unlock();
+  updateMemoryMetrics(*ctx);
+
+  // Waiting outside the insert lock lets the next insert of this collection
+  // share the fsync.
+  if (ctx->wal) {
+    const u64 wal_start = traceStart();
+    ctx->wal->waitDurable(wal_lsn);
+    traceSince("wal_sync", wal_start);
   }
 
-  ctx->db_size += num_to_insert;
   auto whole_end = std::chrono::high_resolution_clock::now();
   auto whole_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
       whole_end - whole_start);
 
-  logToFile("Inserted " + std::to_string(num_to_insert) +
-            " items into collection " + std::to_string(collectionHash) +
-            ". Total DB size: " + std::to_string(ctx->db_size) +
-            ". Took: " + std::to_string(whole_duration.count()) + "ms");
+  LOG_INFO("Inserted " + std::to_string(num_to_insert) +
+           " items into collection " + std::to_string(collectionHash) +
+           ". Total DB size: " + std::to_string(db_size + num_to_insert) +
+           ". Took: " + std::to_string(whole_duration.count()) + "ms");
 
   return makeBinaryResponse(req, {});
 }
 
-Response HEVECServer::handleQuery(const Request &req, bool isEncrypted) {
+Response HEVECServer::handleQuery(const Request &req, bool isEncrypted,
+                                  bool isSeeded) {
+  HEVEC_TRACE_SPAN("HEVECServer.handleQuery");
   BinaryReader reader(req.body());
   u64 collectionHash = 0;
   if (!reader.read(collectionHash)) {
@@ -753,12 +1575,14 @@ Response HEVECServer::handleQuery(const Request &req, bool isEncrypted) {
   }
 
   auto ctx = getCollectionOrThrow(collectionHash);
-  std::lock_guard<std::mutex> lock(ctx->mtx);
+  const MemoryScope memory_scope(ctx->memory);
+  auto snapshot = ctx->loadSnapshot();
 
   auto whole_start = std::chrono::high_resolution_clock::now();
   std::vector<uint8_t> body;
+  u64 response_bits = 0;
 
-  if (ctx->db_size == 0) {
+  if (snapshot->db_size == 0) {
     return makeTextResponse(req, http::status::bad_request,
                             "Collection is empty");
   }
@@ -767,123 +1591,332 @@ Response HEVECServer::handleQuery(const Request &req, bool isEncrypted) {
     MLWECiphertext query(ctx->rank);
     CachedQuery queryCache(ctx->rank);
 
-    for (u64 i = 0; i < ctx->stack; ++i) {
-      if (!reader.readBytes(query.getA(i).getData(),
-                            ctx->rank * sizeof(u64))) {
-        return makeTextResponse(req, http::status::bad_request,
-                                "Malformed query payload (A)");
-      }
+    u8 seed[SEED_SIZE];
+    const u64 parse_start = traceStart();
+    if (!readMLWECiphertext(reader, query, isSeeded ? seed : nullptr)) {
+      return makeTextResponse(req, http::status::bad_request,
+                              "Malformed query payload");
     }
-    if (!reader.readBytes(query.getB().getData(),
-                           ctx->rank * sizeof(u64))) {
+    if (isSeeded)
+      Random::sampleUniformWithSeed(query, seed);
+    if (!readResponseBits(reader, response_bits)) {
       return makeTextResponse(req, http::status::bad_request,
-                              "Malformed query payload (B)");
+                              "Invalid response bit width");
     }
+    traceSince("parse", parse_start);
 
+    // Stored blocks are read one block ahead of the scan.
+    ctx->prefetchFullBlock(*snapshot, 0);
     auto start = std::chrono::high_resolution_clock::now();
     ctx->server->cacheQuery(queryCache, query);
     auto end = std::chrono::high_resolution_clock::now();
     auto duration =
         std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-    logToFile("Cache query: " + std::to_string(duration.count()) + "ms");
-
-    const u64 iter_full = ctx->full_block_caches_.size();
-    auto total_inner_product_duration = std::chrono::milliseconds(0);
-
-    for (u64 i = 0; i < iter_full; ++i) {
-      Ciphertext res;
-      start = std::chrono::high_resolution_clock::now();
-      ctx->server->innerProduct(res, queryCache, ctx->full_block_caches_[i]);
-      end = std::chrono::high_resolution_clock::now();
-      duration = std::chrono::duration_cast<std::chrono::milliseconds>(
-          end - start);
-      total_inner_product_duration += duration;
-
-      appendBinary(body, res.getA().getData(), DEGREE * sizeof(u64));
-      appendBinary(body, res.getB().getData(), DEGREE * sizeof(u64));
-    }
-
-    logToFile("Inner product for full blocks: " +
+    LOG_DEBUG("Cache query: " + std::to_string(duration.count()) + "ms");
+    ctx->metrics.cache_query_encrypted->observe(
+        std::chrono::duration<double>(end - start).count());
+
+    // Server::innerProduct split in two so each half gets its own histogram.
+    auto score = [&](Ciphertext &res, const CachedQuery &cachedQuery,
+                     const CachedKeys &block) {
+      Ciphertext extended(true);
+      auto scan_start = std::chrono::steady_clock::now();
+      ctx->server->multSum(extended, cachedQuery, block);
+      ctx->metrics.scan_encrypted->observe(secondsSince(scan_start));
+      auto relin_start = std::chrono::steady_clock::now();
+      ctx->server->relin(res, extended);
+      ctx->metrics.relin->observe(secondsSince(relin_start));
+    };
+
+    // Scored node by node, then answered in block order.
+    std::vector<Ciphertext> full_results(snapshot->getNumFullBlocks());
+    start = std::chrono::high_resolution_clock::now();
+    ctx->scanFullBlocks(*snapshot, queryCache,
+                        [&](const CachedQuery &cachedQuery, u64 i,
+                            const CachedKeys &block) {
+                          score(full_results[i], cachedQuery, block);
+                        });
+    auto total_inner_product_duration =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::high_resolution_clock::now() - start);
+    for (const Ciphertext &res : full_results)
+      appendResult(body, *ctx->server, res, response_bits);
+
+    LOG_DEBUG("Inner product for full blocks: " +
               std::to_string(total_inner_product_duration.count()) + "ms");
 
-    if (ctx->partial_block_cache_) {
+    if (snapshot->partial_block) {
       Ciphertext partial_res;
       auto start_partial = std::chrono::high_resolution_clock::now();
-      ctx->server->innerProduct(partial_res, queryCache,
-                                *ctx->partial_block_cache_);
+      score(partial_res, queryCache, *snapshot->partial_block);
       auto end_partial = std::chrono::high_resolution_clock::now();
       auto duration_partial =
           std::chrono::duration_cast<std::chrono::milliseconds>(
               end_partial - start_partial);
-      logToFile("Inner product for partial block: " +
+      LOG_DEBUG("Inner product for partial block: " +
                 std::to_string(duration_partial.count()) + "ms");
 
-      appendBinary(body, partial_res.getA().getData(), DEGREE * sizeof(u64));
-      appendBinary(body, partial_res.getB().getData(), DEGREE * sizeof(u64));
+      appendResult(body, *ctx->server, partial_res, response_bits);
     }
   } else {
     CachedPlaintextQuery queryCache(ctx->rank);
     Polynomial query(ctx->rank, MOD_Q);
+    const u64 parse_start = traceStart();
     if (!reader.readBytes(query.getData(), ctx->rank * sizeof(u64))) {
       return makeTextResponse(req, http::status::bad_request,
                               "Malformed plaintext query payload");
     }
+    if (!readResponseBits(reader, response_bits)) {
+      return makeTextResponse(req, http::status::bad_request,
+                              "Invalid response bit width");
+    }
     query.setIsNTT(true);
+    traceSince("parse", parse_start);
 
+    ctx->prefetchFullBlock(*snapshot, 0);
     auto start = std::chrono::high_resolution_clock::now();
     ctx->server->cacheQuery(queryCache, query);
     auto end = std::chrono::high_resolution_clock::now();
     auto duration =
         std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-    logToFile("Cache plaintext query: " + std::to_string(duration.count()) +
+    LOG_DEBUG("Cache plaintext query: " + std::to_string(duration.count()) +
               "ms");
+    ctx->metrics.cache_query_plaintext->observe(
+        std::chrono::duration<double>(end - start).count());
+
+    std::vector<Ciphertext> full_results(snapshot->getNumFullBlocks());
+    start = std::chrono::high_resolution_clock::now();
+    ctx->scanFullBlocks(
+        *snapshot, queryCache,
+        [&](const CachedPlaintextQuery &cachedQuery, u64 i,
+            const CachedKeys &block) {
+          auto scan_start = std::chrono::steady_clock::now();
+          ctx->server->innerProduct(full_results[i], cachedQuery, block);
+          ctx->metrics.scan_plaintext->observe(secondsSince(scan_start));
+        });
+    auto total_inner_product_duration =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::high_resolution_clock::now() - start);
+    for (const Ciphertext &res : full_results)
+      appendResult(body, *ctx->server, res, response_bits);
 
-    const u64 iter_full = ctx->full_block_caches_.size();
-    auto total_inner_product_duration = std::chrono::milliseconds(0);
-
-    for (u64 i = 0; i < iter_full; ++i) {
-      Ciphertext res;
-      start = std::chrono::high_resolution_clock::now();
-      ctx->server->innerProduct(res, queryCache, ctx->full_block_caches_[i]);
-      end = std::chrono::high_resolution_clock::now();
-      duration = std::chrono::duration_cast<std::chrono::milliseconds>(
-          end - start);
-      total_inner_product_duration += duration;
-
-      appendBinary(body, res.getA().getData(), DEGREE * sizeof(u64));
-      appendBinary(body, res.getB().getData(), DEGREE * sizeof(u64));
-    }
-
-    logToFile("Inner product for full blocks (plaintext): " +
+    LOG_DEBUG("Inner product for full blocks (plaintext): " +
               std::to_string(total_inner_product_duration.count()) + "ms");
 
-    if (ctx->partial_block_cache_) {
+    if (snapshot->partial_block) {
       Ciphertext partial_res;
       auto start_partial = std::chrono::high_resolution_clock::now();
       ctx->server->innerProduct(partial_res, queryCache,
-                                *ctx->partial_block_cache_);
+                                *snapshot->partial_block);
       auto end_partial = std::chrono::high_resolution_clock::now();
       auto duration_partial =
           std::chrono::duration_cast<std::chrono::milliseconds>(
               end_partial - start_partial);
-      logToFile("Inner product for partial block (plaintext): " +
+      ctx->metrics.scan_plaintext->observe(
+          std::chrono::duration<double>(end_partial - start_partial).count());
+      LOG_DEBUG("Inner product for partial block (plaintext): " +
                 std::to_string(duration_partial.count()) + "ms");
 
-      appendBinary(body, partial_res.getA().getData(), DEGREE * sizeof(u64));
-      appendBinary(body, partial_res.getB().getData(), DEGREE * sizeof(u64));
+      appendResult(body, *ctx->server, partial_res, response_bits);
+    }
+  }
+
+  auto whole_end = std::chrono::high_resolution_clock::now();
+  auto whole_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+      whole_end - whole_start);
+  LOG_INFO("Total query handling time: " +
+           std::to_string(whole_duration.count()) + "ms");
+
+  return makeBinaryResponse(req, std::move(body));
+}
+
+Response HEVECServer::handleQueryBatch(const Request &req, bool isEncrypted,
+                                       bool isSeeded) {
+  HEVEC_TRACE_SPAN("HEVECServer.handleQueryBatch");
+  BinaryReader reader(req.body());
+  u64 collectionHash = 0;
+  u64 num_queries = 0;
+  if (!reader.read(collectionHash) || !reader.read(num_queries)) {
+    return makeTextResponse(req, http::status::bad_request,
+                            "Malformed batch query request");
+  }
+
+  auto ctx = getCollectionOrThrow(collectionHash);
+  const MemoryScope memory_scope(ctx->memory);
+  auto snapshot = ctx->loadSnapshot();
+
+  if (snapshot->db_size == 0) {
+    return makeTextResponse(req, http::status::bad_request,
+                            "Collection is empty");
+  }
+
+  const u64 query_bytes =
+      !isEncrypted ? ctx->rank * sizeof(u64)
+      : isSeeded   ? SEED_SIZE + ctx->rank * sizeof(u64)
+                   : (ctx->stack + 1) * ctx->rank * sizeof(u64);
+  if (num_queries == 0 || num_queries > reader.remaining() / query_bytes) {
+    return makeTextResponse(req, http::status::bad_request,
+                            "Malformed batch query payload");
+  }
+  if (num_queries > MAX_QUERY_BATCH) {
+    return makeTextResponse(req, http::status::bad_request,
+                            "Too many queries in batch (max " +
+                                std::to_string(MAX_QUERY_BATCH) + ")");
+  }
+
+  auto whole_start = std::chrono::high_resolution_clock::now();
+
+  // Full blocks, node by node, then the partial one. Stored blocks are read
+  // one block ahead of the scan.
+  const u64 num_full_blocks = snapshot->getNumFullBlocks();
+  const u64 num_blocks = num_full_blocks + (snapshot->partial_block ? 1 : 0);
+  auto scanBlocks = [&](const auto &queries, auto &&scan) {
+    ctx->scanFullBlocks(*snapshot, queries, scan);
+    if (snapshot->partial_block)
+      scan(queries, num_full_blocks, *snapshot->partial_block);
+  };
+  ctx->prefetchFullBlock(*snapshot, 0);
+
+  // block_results[i][q] is the score ciphertext of query q on block i.
+  std::vector<std::vector<Ciphertext>> block_results(num_blocks);
+  u64 response_bits = 0;
+  std::chrono::milliseconds cache_duration(0), inner_product_duration(0);
+
+  if (isEncrypted) {
+    std::vector<MLWECiphertext> queries(num_queries,
+                                        MLWECiphertext(ctx->rank));
+    std::vector<u8> seeds(isSeeded ? num_queries * SEED_SIZE : 0);
+    const u64 parse_start = traceStart();
+    // The whole request is checked before any query is cached.
+    for (u64 q = 0; q < num_queries; ++q) {
+      if (!readMLWECiphertext(reader, queries[q],
+                              isSeeded ? seeds.data() + q * SEED_SIZE
+                                       : nullptr)) {
+        return makeTextResponse(req, http::status::bad_request,
+                                "Malformed batch query payload");
+      }
+    }
+    if (!readResponseBits(reader, response_bits)) {
+      return makeTextResponse(req, http::status::bad_request,
+                              "Invalid response bit width");
+    }
+    if (isSeeded) {
+      parallelFor(num_queries, [&](u64 q) {
+        Random::sampleUniformWithSeed(queries[q], seeds.data() + q * SEED_SIZE);
+      });
+    }
+    traceSince("parse", parse_start);
+
+    std::vector<CachedQuery> queryCaches;
+    queryCaches.reserve(num_queries);
+    for (u64 q = 0; q < num_queries; ++q) {
+      auto start = std::chrono::high_resolution_clock::now();
+      queryCaches.emplace_back(ctx->rank);
+      ctx->server->cacheQuery(queryCaches.back(), queries[q]);
+      auto elapsed = std::chrono::high_resolution_clock::now() - start;
+      cache_duration +=
+          std::chrono::duration_cast<std::chrono::milliseconds>(elapsed);
+      ctx->metrics.cache_query_encrypted->observe(
+          std::chrono::duration<double>(elapsed).count());
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    scanBlocks(queryCaches, [&](const std::vector<CachedQuery> &cachedQueries,
+                                u64 i, const CachedKeys &block) {
+      std::vector<Ciphertext> extended;
+      auto scan_start = std::chrono::steady_clock::now();
+      ctx->server->multSum(extended, cachedQueries, block);
+      ctx->metrics.scan_batch_encrypted->observe(secondsSince(scan_start));
+
+      auto relin_start = std::chrono::steady_clock::now();
+      const u64 relin_trace = traceStart();
+      block_results[i].assign(num_queries, Ciphertext());
+      {
+        // Spans from inside the loop would only cover this thread's share.
+        TraceBinding untraced(nullptr);
+        parallelFor(num_queries, [&](u64 q) {
+          ctx->server->relin(block_results[i][q], extended[q]);
+        });
+      }
+      traceSince("relin_batch", relin_trace);
+      ctx->metrics.relin_batch->observe(secondsSince(relin_start));
+    });
+    inner_product_duration =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::high_resolution_clock::now() - start);
+  } else {
+    std::vector<CachedPlaintextQuery> queryCaches;
+    std::vector<Polynomial> queries;
+    queries.reserve(num_queries);
+    const u64 parse_start = traceStart();
+    // The whole request is checked before any query is cached.
+    for (u64 q = 0; q < num_queries; ++q) {
+      Polynomial &query = queries.emplace_back(ctx->rank, MOD_Q);
+      if (!reader.readBytes(query.getData(), ctx->rank * sizeof(u64))) {
+        return makeTextResponse(req, http::status::bad_request,
+                                "Malformed batch query payload");
+      }
+      query.setIsNTT(true);
+    }
+    if (!readResponseBits(reader, response_bits)) {
+      return makeTextResponse(req, http::status::bad_request,
+                              "Invalid response bit width");
+    }
+    traceSince("parse", parse_start);
+
+    queryCaches.reserve(num_queries);
+    for (const Polynomial &query : queries) {
+      auto start = std::chrono::high_resolution_clock::now();
+      queryCaches.emplace_back(ctx->rank);
+      ctx->server->cacheQuery(queryCaches.back(), query);
+      auto elapsed = std::chrono::high_resolution_clock::now() - start;
+      cache_duration +=
+          std::chrono::duration_cast<std::chrono::milliseconds>(elapsed);
+      ctx->metrics.cache_query_plaintext->observe(
+          std::chrono::duration<double>(elapsed).count());
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    scanBlocks(queryCaches,
+               [&](const std::vector<CachedPlaintextQuery> &cachedQueries,
+                   u64 i, const CachedKeys &block) {
+                 auto scan_start = std::chrono::steady_clock::now();
+                 ctx->server->innerProduct(block_results[i], cachedQueries,
+                                           block);
+                 ctx->metrics.scan_batch_plaintext->observe(
+                     secondsSince(scan_start));
+               });
+    inner_product_duration =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::high_resolution_clock::now() - start);
+  }
+
+  std::vector<uint8_t> body;
+  body.reserve(num_queries * num_blocks *
+               (response_bits == 0
+                    ? 2 * DEGREE
+                    : PackedCiphertext::getWordCount(response_bits)) *
+               sizeof(u64));
+  for (u64 q = 0; q < num_queries; ++q) {
+    for (u64 i = 0; i < num_blocks; ++i) {
+      appendResult(body, *ctx->server, block_results[i][q], response_bits);
     }
   }
 
   auto whole_end = std::chrono::high_resolution_clock::now();
   auto whole_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
       whole_end - whole_start);
-  logToFile("Total query handling time: " +
-            std::to_string(whole_duration.count()) + "ms");
+  LOG_INFO("Batch of " + std::to_string(num_queries) +
+           " queries: cache " + std::to_string(cache_duration.count()) +
+           "ms, inner product " +
+           std::to_string(inner_product_duration.count()) + "ms, total " +
+           std::to_string(whole_duration.count()) + "ms");
 
   return makeBinaryResponse(req, std::move(body));
 }
 
 Response HEVECServer::handleRetrieve(const Request &req) {
+  HEVEC_TRACE_SPAN("HEVECServer.handleRetrieve");
   BinaryReader reader(req.body());
   u64 collectionHash = 0;
   u64 num_indices = 0;
@@ -894,7 +1927,8 @@ Response HEVECServer::handleRetrieve(const Request &req) {
   }
 
   auto ctx = getCollectionOrThrow(collectionHash);
-  std::lock_guard<std::mutex> lock(ctx->mtx);
+  const MemoryScope memory_scope(ctx->memory);
+  std::shared_lock<std::shared_mutex> lock(ctx->payload_mtx);
 
   std::vector<uint8_t> body;
   body.reserve(num_indices * PIR_PAYLOAD_SIZE);
@@ -906,7 +1940,7 @@ Response HEVECServer::handleRetrieve(const Request &req) {
       return makeTextResponse(req, http::status::bad_request,
                               "Malformed retrieve index");
     }
-    if (index < ctx->db_size) {
+    if (index < ctx->payloads_.size()) {
       appendBinary(body, ctx->payloads_[index].data(), PIR_PAYLOAD_SIZE);
     } else {
       appendBinary(body, empty_payload.data(), PIR_PAYLOAD_SIZE);
@@ -916,7 +1950,8 @@ Response HEVECServer::handleRetrieve(const Request &req) {
   return makeBinaryResponse(req, std::move(body));
 }
 
-Response HEVECServer::handlePirRetrieve(const Request &req) {
+Response HEVECServer::handlePirRetrieve(const Request &req, bool isSeeded) {
+  HEVEC_TRACE_SPAN("HEVECServer.handlePirRetrieve");
   BinaryReader reader(req.body());
   u64 collectionHash = 0;
   if (!reader.read(collectionHash)) {
@@ -925,47 +1960,580 @@ Response HEVECServer::handlePirRetrieve(const Request &req) {
   }
 
   auto ctx = getCollectionOrThrow(collectionHash);
-  std::lock_guard<std::mutex> lock(ctx->mtx);
+  const MemoryScope memory_scope(ctx->memory);
+  // Rows below the published size are never rewritten, so the evaluation
+  // reads them without holding up inserts.
+  const u64 db_size = ctx->loadSnapshot()->db_size;
 
-  if (ctx->db_size == 0) {
+  if (db_size == 0) {
     throw std::runtime_error("Database is empty");
   }
 
   const u64 pir_db_size = PIR_RANK * PIR_RANK;
-  if (ctx->db_size > pir_db_size) {
+  if (db_size > pir_db_size) {
     throw std::runtime_error("Database size exceeds PIR capacity");
   }
 
   Ciphertext firstDim;
   Ciphertext secondDim;
 
-  if (!reader.readBytes(firstDim.getA().getData(), DEGREE * sizeof(u64)) ||
-      !reader.readBytes(firstDim.getB().getData(), DEGREE * sizeof(u64)) ||
-      !reader.readBytes(secondDim.getA().getData(), DEGREE * sizeof(u64)) ||
-      !reader.readBytes(secondDim.getB().getData(), DEGREE * sizeof(u64))) {
+  u8 firstSeed[SEED_SIZE], secondSeed[SEED_SIZE];
+  const u64 parse_start = traceStart();
+  if (!readCiphertext(reader, firstDim, isSeeded ? firstSeed : nullptr) ||
+      !readCiphertext(reader, secondDim, isSeeded ? secondSeed : nullptr)) {
     return makeTextResponse(req, http::status::bad_request,
                             "Malformed PIR query payload");
   }
+  if (isSeeded) {
+    Random::sampleUniformWithSeed(firstDim.getA(), firstSeed);
+    Random::sampleUniformWithSeed(secondDim.getA(), secondSeed);
+  }
+  u64 response_bits = 0;
+  if (!readResponseBits(reader, response_bits)) {
+    return makeTextResponse(req, http::status::bad_request,
+                            "Invalid response bit width");
+  }
+  traceSince("parse", parse_start);
 
   PIRServer pirServer(PIR_LOG_RANK, ctx->relinKey, ctx->pirInvAutKeys);
   Ciphertext result;
-  pirServer.pir(result, firstDim, secondDim, ctx->pir_encoded_payloads_);
+  PIRStageTimes times;
+  pirServer.pir(result, firstDim, secondDim, ctx->pir_database_, db_size,
+                &times);
+  ctx->metrics.pir_expand_first->observe(times.expandFirst);
+  ctx->metrics.pir_first_dim->observe(times.firstDim);
+  ctx->metrics.pir_expand_second->observe(times.expandSecond);
+  ctx->metrics.pir_second_dim->observe(times.secondDim);
+  ctx->metrics.pir_relin->observe(times.relin);
 
   std::vector<uint8_t> body;
-  appendBinary(body, result.getA().getData(), DEGREE * sizeof(u64));
-  appendBinary(body, result.getB().getData(), DEGREE * sizeof(u64));
+  appendResult(body, pirServer, result, response_bits);
   return makeBinaryResponse(req, std::move(body));
 }
 
-HEVECServer::HEVECServer(unsigned short port)
-    : acceptor_(io_context_, tcp::endpoint(tcp::v4(), port)) {
+Response HEVECServer::handleSnapshot(const Request &req) {
+  const char *dir = getSnapshotDir();
+  if (!dir) {
+    return makeTextResponse(req, http::status::bad_request,
+                            "Snapshots are disabled; set HEVEC_SNAPSHOT_DIR");
+  }
+
+  // An empty body saves every collection, a collection hash just that one.
+  std::optional<u64> collectionHash;
+  if (!req.body().empty()) {
+    BinaryReader reader(req.body());
+    u64 hash = 0;
+    if (!reader.read(hash)) {
+      return makeTextResponse(req, http::status::bad_request,
+                              "Malformed snapshot request");
+    }
+    getCollectionOrThrow(hash);
+    collectionHash = hash;
+  }
+
+  const u64 saved = saveSnapshots(collectionHash);
+  return makeTextResponse(req, http::status::ok,
+                          "Saved " + std::to_string(saved) + " collections");
+}
+
+u64 HEVECServer::saveSnapshots(std::optional<u64> collectionHash) {
+  const std::string dir = getSnapshotDir();
+  std::filesystem::create_directories(dir);
+
+  std::vector<std::pair<u64, std::shared_ptr<CollectionData>>> collections;
+  {
+    std::lock_guard<std::mutex> lock(collections_mutex_);
+    for (const auto &[hash, ctx] : collections_)
+      if (!collectionHash || hash == *collectionHash)
+        collections.emplace_back(hash, ctx);
+  }
+  for (auto &[hash, ctx] : collections)
+    saveCollection(getSnapshotPath(dir, hash), hash, *ctx);
+  return collections.size();
+}
+
+// Layout: header, switching keys, full blocks, the partial block with its
+// pending sums, payloads and, unless the PIR store is compact, the encoded
+// PIR rows. Caches and rows are stored as computed, so loading runs no NTT or
+// key switching.
+void HEVECServer::saveCollection(const std::string &path, u64 collectionHash,
+                                 CollectionData &ctx) {
+  // Inserts are the only writers of the blocks, payloads and PIR store;
+  // queries keep running on the published blocks meanwhile.
+  std::lock_guard<std::mutex> lock(ctx.insert_mtx);
+  saveCollectionLocked(path, collectionHash, ctx);
+}
+
+void HEVECServer::saveCollectionLocked(const std::string &path,
+                                       u64 collectionHash,
+                                       CollectionData &ctx) {
+  HEVEC_TRACE_SPAN("HEVECServer.saveCollection");
+  const auto start = std::chrono::steady_clock::now();
+  if (ctx.dropped)
+    return;
+  auto snapshot = ctx.loadSnapshot();
+  const bool hasPIRRows = !ctx.pir_database_.getIsCompact();
+
+  SnapshotWriter out(path);
+  out.writeBytes(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  out.write(SNAPSHOT_VERSION);
+  out.write(DEGREE);
+  out.write(MOD_Q);
+  out.write(MOD_P);
+  out.write(collectionHash);
+  out.write(ctx.dimension);
+  out.write(static_cast<u64>(ctx.metric_type));
+  out.write(static_cast<u64>(ctx.relinKey.isImplicit()));
+  out.write(snapshot->db_size);
+  out.write(snapshot->getNumFullBlocks());
+  out.write(static_cast<u64>(snapshot->partial_block != nullptr));
+  out.write(static_cast<u64>(hasPIRRows));
+
+  out.write(ctx.relinKey);
+  for (const auto &keys : ctx.autedModPackKeys.getKeys())
+    for (const SwitchingKey &key : keys)
+      out.write(key);
+  for (const auto &keys : ctx.autedModPackMLWEKeys.getKeys())
+    for (const MLWESwitchingKey &key : keys)
+      out.write(key);
+  for (const SwitchingKey &key : ctx.pirInvAutKeys.getKeys())
+    out.write(key);
+
+  for (u64 b = 0; b < snapshot->getNumFullBlocks(); ++b) {
+    const auto block = ctx.getFullBlock(*snapshot, b);
+    ctx.prefetchFullBlock(*snapshot, b + 1);
+    out.write(block->getSpan());
+  }
+  if (snapshot->partial_block) {
+    for (const Ciphertext &ctxt : snapshot->partial_block->getCtxts())
+      out.write(ctxt);
+    out.write(snapshot->partial_block->getPendingSums().size());
+    for (const SwitchingKey &sum : snapshot->partial_block->getPendingSums())
+      out.write(sum);
+  }
+
+  for (u64 i = 0; i < snapshot->db_size; ++i)
+    out.writeBytes(ctx.payloads_[i].data(), PIR_PAYLOAD_SIZE);
+  if (hasPIRRows) {
+    for (u64 i = 0; i < snapshot->db_size; ++i)
+      out.write(ctx.pir_database_.getRow(i));
+  }
+  out.commit();
+  // The snapshot holds every logged insert now.
+  if (ctx.wal)
+    ctx.wal->reset();
+
+  LOG_INFO("Collection " + std::to_string(collectionHash) +
+           " saved to snapshot. DB size: " +
+           std::to_string(snapshot->db_size) + ", " +
+           std::to_string(out.getSize() >> 20) + " MiB. Took: " +
+           std::to_string(static_cast<u64>(secondsSince(start) * 1000)) +
+           "ms");
+}
+
+void HEVECServer::discardLoggedInsert(
+    u64 collectionHash, const std::shared_ptr<CollectionData> &ctx) {
+  // A snapshot holds every applied insert, so the log can be cleared.
+  try {
+    saveCollectionLocked(getSnapshotPath(getSnapshotDir(), collectionHash),
+                         collectionHash, *ctx);
+    return;
+  } catch (const std::exception &ex) {
+    std::cerr << "Collection " << collectionHash
+              << " taken offline: a failed insert stays logged and the "
+                 "snapshot to drop it failed: "
+              << ex.what() << std::endl;
+  }
+  // Answering later requests would hide that a restart replays the insert;
+  // inserts already holding the collection find it dropped.
+  ctx->dropped = true;
+  std::lock_guard<std::mutex> lock(collections_mutex_);
+  auto it = collections_.find(collectionHash);
+  if (it != collections_.end() && it->second == ctx) {
+    collections_.erase(it);
+    metrics_.removeSeries("collection", std::to_string(collectionHash));
+  }
+}
+
+void HEVECServer::loadCollection(const std::string &path) {
+  const auto start = std::chrono::steady_clock::now();
+  SnapshotReader in(path);
+  auto malformed = [&](const std::string &what) {
+    return std::runtime_error("Snapshot " + path + ": " + what);
+  };
+  if (std::memcmp(in.readBytes(sizeof(SNAPSHOT_MAGIC)), SNAPSHOT_MAGIC,
+                  sizeof(SNAPSHOT_MAGIC)) != 0 ||
+      in.readU64() != SNAPSHOT_VERSION)
+    throw malformed("unknown format");
+  if (in.readU64() != DEGREE || in.readU64() != MOD_Q ||
+      in.readU64() != MOD_P)
+    throw malformed("parameters differ from this build");
+
+  const u64 collectionHash = in.readU64();
+  const u64 dimension = in.readU64();
+  const auto metric_type = static_cast<MetricType>(in.readU64());
+  const bool implicitA = in.readU64() != 0;
+  const u64 db_size = in.readU64();
+  const u64 num_full_blocks = in.readU64();
+  const bool has_partial_block = in.readU64() != 0;
+  const bool has_pir_rows = in.readU64() != 0;
+  if (dimension == 0 || dimension > DEGREE || db_size > PIR_RANK * PIR_RANK ||
+      num_full_blocks != db_size / DEGREE ||
+      has_partial_block != (db_size % DEGREE != 0))
+    throw malformed("inconsistent header");
+
+  const u64 rank = 1ULL << static_cast<u64>(std::ceil(std::log2(dimension)));
+  auto memory = std::make_shared<MemoryAccount>();
+  const MemoryScope memory_scope(memory);
+  SwitchingKey relinKey(implicitA);
+  AutedModPackKeys autedModPackKeys(rank, implicitA);
+  AutedModPackMLWEKeys autedModPackMLWEKeys(rank, implicitA);
+  InvAutKeys pirInvAutKeys(PIR_RANK, implicitA);
+  in.read(relinKey);
+  for (auto &keys : autedModPackKeys.getKeys())
+    for (SwitchingKey &key : keys)
+      in.read(key);
+  for (auto &keys : autedModPackMLWEKeys.getKeys())
+    for (MLWESwitchingKey &key : keys)
+      in.read(key);
+  for (SwitchingKey &key : pirInvAutKeys.getKeys())
+    in.read(key);
+
+  auto ctx = std::make_shared<CollectionData>(
+      dimension, metric_type, std::move(relinKey), std::move(autedModPackKeys),
+      std::move(autedModPackMLWEKeys), std::move(pirInvAutKeys), metrics_,
+      collectionHash, std::move(memory));
+
+  auto blocks = std::make_shared<BlockSnapshot>();
+  for (u64 b = 0; b < num_full_blocks; ++b) {
+    auto block = std::make_shared<CachedKeys>(ctx->rank);
+    for (Ciphertext &ctxt : block->getCtxts())
+      in.read(ctxt);
+    ctx->storeFullBlock(*blocks, std::move(block));
+  }
+  if (has_partial_block) {
+    auto block = std::make_shared<CachedKeys>(ctx->rank);
+    for (Ciphertext &ctxt : block->getCtxts())
+      in.read(ctxt);
+    const u64 num_sums = in.readU64();
+    if (num_sums > DEGREE)
+      throw malformed("inconsistent partial block");
+    block->getPendingSums().resize(num_sums);
+    for (SwitchingKey &sum : block->getPendingSums())
+      in.read(sum);
+    blocks->partial_block = std::move(block);
+  }
+  blocks->db_size = db_size;
+
+  ctx->payloads_.reserve(db_size);
+  for (u64 i = 0; i < db_size; ++i) {
+    const char *payload =
+        static_cast<const char *>(in.readBytes(PIR_PAYLOAD_SIZE));
+    ctx->payloads_.emplace_back(payload, PIR_PAYLOAD_SIZE);
+  }
+  // The PIR store follows this server's HEVEC_PIR_STORE, which may differ
+  // from the one the snapshot was taken with.
+  Client pirClient(PIR_LOG_RANK);
+  for (u64 i = 0; i < db_size; ++i) {
+    const auto *payload =
+        reinterpret_cast<const unsigned char *>(ctx->payloads_[i].data());
+    if (ctx->pir_database_.getIsCompact()) {
+      if (has_pir_rows) {
+        Polynomial row(DEGREE, MOD_Q);
+        in.read(row);
+      }
+      ctx->pir_database_.setRow(i, payload);
+      continue;
+    }
+    Polynomial row(DEGREE, MOD_Q);
+    if (has_pir_rows)
+      in.read(row);
+    else
+      pirClient.encodePIRPayload(row, payload);
+    ctx->pir_database_.setRow(i, std::move(row));
+  }
+  if (!in.atEnd())
+    throw malformed("trailing data");
+
+  // Replays the inserts logged since the snapshot. Records are gathered
+  // until they fill whole blocks, which are then built by cacheKeys with all
+  // threads instead of one appendToCache per logged insert.
+  const std::string dir = std::filesystem::path(path).parent_path().string();
+  const std::string wal_path = getWALPath(dir, collectionHash);
+  std::vector<MLWECiphertext> pending_keys;
+  std::vector<std::string> pending_payloads;
+  auto applyPending = [&]() {
+    const u64 first = blocks->db_size;
+    ctx->appendKeys(*blocks, pending_keys);
+    ctx->appendPayloads(first, pending_payloads);
+    pending_keys.clear();
+    pending_payloads.clear();
+  };
+  WriteAheadLog::replay(wal_path, [&](const u8 *data, u64 size) {
+    const std::vector<uint8_t> record(data, data + size);
+    BinaryReader reader(record);
+    u64 first = 0;
+    u64 count = 0;
+    uint8_t isSeeded = 0;
+    if (!reader.read(first) || !reader.read(count) || !reader.read(isSeeded))
+      throw std::runtime_error("WAL " + wal_path + ": malformed record");
+    const u64 next_row = blocks->db_size + pending_keys.size();
+    // Written before the snapshot was taken but not yet truncated.
+    if (first + count <= next_row)
+      return;
+    if (first != next_row || first + count > ctx->pir_database_.getCapacity())
+      throw std::runtime_error("WAL " + wal_path +
+                               ": does not continue the snapshot");
+    if (const char *error = readInsertItems(reader, count, ctx->rank,
+                                            isSeeded, pending_keys,
+                                            pending_payloads))
+      throw std::runtime_error("WAL " + wal_path + ": " + error);
+    if (pending_keys.size() >= DEGREE)
+      applyPending();
+  });
+  applyPending();
+  const u64 replayed = blocks->db_size - db_size;
+  ctx->wal = openWriteAheadLog(dir, collectionHash);
+
+  ctx->publishSnapshot(std::move(blocks));
+  updateMemoryMetrics(*ctx);
+  {
+    std::lock_guard<std::mutex> lock(collections_mutex_);
+    collections_[collectionHash] = ctx;
+  }
+
+  LOG_INFO("Collection " + std::to_string(collectionHash) +
+           " loaded from snapshot. DB size: " + std::to_string(db_size) +
+           ", replayed from WAL: " + std::to_string(replayed) + ". Took: " +
+           std::to_string(static_cast<u64>(secondsSince(start) * 1000)) +
+           "ms");
+}
+
+void HEVECServer::loadSnapshots() {
+  const char *dir = getSnapshotDir();
+  if (!dir)
+    return;
+  std::error_code ec;
+  for (const auto &entry : std::filesystem::directory_iterator(dir, ec)) {
+    if (entry.path().extension() != SNAPSHOT_EXTENSION)
+      continue;
+    try {
+      loadCollection(entry.path().string());
+    } catch (const std::exception &ex) {
+      std::cerr << "Failed to load snapshot " << entry.path() << ": "
+                << ex.what() << std::endl;
+    }
+  }
+}
+
+HEVECServer::HEVECServer(unsigned short port, std::size_t ioThreads,
+                         std::size_t computeThreads,
+                         std::size_t maxQueuedRequests)
+    : io_threads_(std::max<std::size_t>(ioThreads, 1)),
+      max_queued_requests_(std::max<std::size_t>(maxQueuedRequests, 1)),
+      io_context_(static_cast<int>(io_threads_)),
+      acceptor_(io_context_, tcp::endpoint(tcp::v4(), port)),
+      compute_pool_(std::max<std::size_t>(computeThreads, 1)) {
+  for (std::string_view name : METRIC_ENDPOINTS) {
+    const std::string endpoint(name);
+    auto requests = [&](const std::string &code) {
+      return metrics_.counter("hevec_http_requests_total",
+                              "HTTP requests by endpoint and status class.",
+                              {{"endpoint", endpoint}, {"code", code}});
+    };
+    EndpointMetrics &metrics = endpoint_metrics_[endpoint];
+    metrics.success = requests("2xx");
+    metrics.client_error = requests("4xx");
+    metrics.server_error = requests("5xx");
+    metrics.duration = metrics_.histogram(
+        "hevec_http_request_duration_seconds",
+        "Time from a parsed request to its response, including queueing.",
+        {{"endpoint", endpoint}}, SECONDS_UNIT);
+    metrics.request_bytes =
+        metrics_.histogram("hevec_http_request_bytes", "Request body sizes.",
+                           {{"endpoint", endpoint}}, BYTES_UNIT);
+    metrics.response_bytes =
+        metrics_.histogram("hevec_http_response_bytes", "Response body sizes.",
+                           {{"endpoint", endpoint}}, BYTES_UNIT);
+  }
+  rejected_requests_ =
+      metrics_.counter("hevec_compute_rejected_total",
+                       "Compute requests refused with 503 on a full queue.");
+  queue_wait_ = metrics_.histogram(
+      "hevec_compute_queue_wait_seconds",
+      "Time a compute request waits for a compute thread.", {}, SECONDS_UNIT);
+  loadSnapshots();
   doAccept();
 }
 
-void HEVECServer::run() { io_context_.run(); }
+HEVECServer::~HEVECServer() {
+  io_context_.stop();
+  compute_pool_.join();
+}
+
+void HEVECServer::stop() {
+  io_context_.stop();
+  // Let running inserts finish so the snapshots include them.
+  compute_pool_.join();
+  if (!getSnapshotDir())
+    return;
+  try {
+    saveSnapshots(std::nullopt);
+  } catch (const std::exception &ex) {
+    std::cerr << "Snapshot on shutdown failed: " << ex.what() << std::endl;
+  }
+}
+
+void HEVECServer::run() {
+  std::vector<std::thread> threads;
+  threads.reserve(io_threads_ - 1);
+  for (std::size_t i = 1; i < io_threads_; ++i) {
+    threads.emplace_back([this]() { io_context_.run(); });
+  }
+  io_context_.run();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+bool HEVECServer::isComputeRequest(const Request &req) const {
+  if (req.method() != http::verb::post) {
+    return false;
+  }
+  const auto target = req.target();
+  return target == "/collections/setup" ||
+         target == "/collections/setup_seeded" ||
+         target == "/collections/insert" ||
+         target == "/collections/insert_seeded" ||
+         target == "/collections/query" ||
+         target == "/collections/query_seeded" ||
+         target == "/collections/query_ptxt" ||
+         target == "/collections/query_batch" ||
+         target == "/collections/query_batch_seeded" ||
+         target == "/collections/query_ptxt_batch" ||
+         target == "/collections/pir_retrieve" ||
+         target == "/collections/pir_retrieve_seeded" ||
+         target == "/admin/snapshot";
+}
+
+bool HEVECServer::tryReserveCompute() {
+  std::size_t queued = queued_requests_.load();
+  while (queued < max_queued_requests_) {
+    if (queued_requests_.compare_exchange_weak(queued, queued + 1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void HEVECServer::releaseCompute() { queued_requests_.fetch_sub(1); }
+
+HEVECServer::EndpointMetrics &
+HEVECServer::getEndpointMetrics(const Request &req) {
+  std::string endpoint(req.target());
+  if (req.method() == http::verb::delete_ &&
+      endpoint.rfind("/collections/", 0) == 0)
+    endpoint = "/collections/{hash}";
+  auto it = endpoint_metrics_.find(endpoint);
+  return it != endpoint_metrics_.end() ? it->second
+                                       : endpoint_metrics_.at("other");
+}
+
+void HEVECServer::recordRequest(EndpointMetrics &metrics, unsigned status,
+                                std::size_t requestBytes,
+                                std::size_t responseBytes, double seconds) {
+  if (status >= 500)
+    metrics.server_error->inc();
+  else if (status >= 400)
+    metrics.client_error->inc();
+  else
+    metrics.success->inc();
+  metrics.duration->observe(seconds);
+  metrics.request_bytes->observe(static_cast<double>(requestBytes));
+  metrics.response_bytes->observe(static_cast<double>(responseBytes));
+}
+
+void HEVECServer::updateMemoryMetrics(CollectionData &ctx) {
+  auto snapshot = ctx.loadSnapshot();
+
+  u64 key_bytes = keyBytes(ctx.relinKey);
+  for (const auto &keys : ctx.autedModPackKeys.getKeys())
+    for (const SwitchingKey &key : keys)
+      key_bytes += keyBytes(key);
+  for (const auto &keys : ctx.autedModPackMLWEKeys.getKeys())
+    for (const MLWESwitchingKey &key : keys)
+      key_bytes += keyBytes(key);
+  for (const SwitchingKey &key : ctx.pirInvAutKeys.getKeys())
+    key_bytes += keyBytes(key);
+
+  u64 cache_bytes = 0;
+  u64 mapped_cache_bytes = 0;
+  for (const auto &block : snapshot->full_blocks) {
+    cache_bytes += cacheBytes(*block);
+    if (block->isMapped())
+      mapped_cache_bytes +=
+          CiphertextSpan::getTiledWords(ctx.rank, block->isPacked()) *
+          sizeof(u64);
+  }
+  if (snapshot->partial_block)
+    cache_bytes += cacheBytes(*snapshot->partial_block);
+
+  u64 payload_bytes = 0;
+  {
+    std::shared_lock<std::shared_mutex> lock(ctx.payload_mtx);
+    payload_bytes = ctx.payloads_.size() * PIR_PAYLOAD_SIZE +
+                    ctx.pir_database_.getMemoryBytes();
+  }
+
+  ctx.metrics.vectors->set(static_cast<double>(snapshot->db_size));
+  ctx.metrics.key_bytes->set(static_cast<double>(key_bytes));
+  ctx.metrics.cache_bytes->set(static_cast<double>(cache_bytes));
+  ctx.metrics.mapped_cache_bytes->set(static_cast<double>(mapped_cache_bytes));
+  ctx.metrics.payload_bytes->set(static_cast<double>(payload_bytes));
+  updateAllocatedMetrics(ctx);
+}
+
+void HEVECServer::updateAllocatedMetrics(CollectionData &ctx) {
+  for (u64 kind = 0; kind < NUM_PAGE_KINDS; ++kind)
+    ctx.metrics.allocated_bytes[kind]->set(static_cast<double>(
+        ctx.memory->getBytes(static_cast<PageKind>(kind))));
+}
+
+Response HEVECServer::handleMetrics(const Request &req) {
+  std::size_t collections = 0;
+  {
+    std::lock_guard<std::mutex> lock(collections_mutex_);
+    collections = collections_.size();
+    for (auto &[hash, ctx] : collections_)
+      updateAllocatedMetrics(*ctx);
+  }
+  metrics_
+      .gauge("hevec_compute_queue_depth",
+             "Compute requests queued or running.")
+      ->set(static_cast<double>(queued_requests_.load()));
+  metrics_.gauge("hevec_collections", "Collections currently set up.")
+      ->set(static_cast<double>(collections));
+  metrics_
+      .gauge("hevec_process_resident_bytes",
+             "Resident set size of the server process.")
+      ->set(residentBytes());
+  for (u64 kind = 0; kind < NUM_PAGE_KINDS; ++kind)
+    metrics_
+        .gauge("hevec_allocated_bytes",
+               "Bytes of slabs allocated by the process, by page kind.",
+               {{"pages", PAGE_KIND_NAMES[kind]}})
+        ->set(static_cast<double>(
+            getProcessMemory().getBytes(static_cast<PageKind>(kind))));
+
+  Response res =
+      makeTextResponse(req, http::status::ok, metrics_.render());
+  res.set(http::field::content_type, "text/plain; version=0.0.4");
+  return res;
+}
 
 void HEVECServer::doAccept() {
   acceptor_.async_accept(
+      boost::asio::make_strand(io_context_),
       [this](boost::beast::error_code ec, tcp::socket socket) {
         if (!ec) {
           std::make_shared<Session>(std::move(socket), *this)->start();
@@ -3,13 +3,15 @@
 #include <asio/bind_executor.hpp>
 #include <asio/error_code.hpp>
 #include <asio/write.hpp>
+#include <algorithm>
 #include <chrono>
-#include <fstream>
-#include <iomanip>
+#include <cstdlib>
 #include <iostream>
+#include <iterator>
 #include <memory>
 #include <mutex>
 #include <stdexcept>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
@@ -18,8 +20,10 @@
 #include "HEVEC/Const.hpp"
 #include "HEVEC/HEVECOperation.hpp"
 #include "HEVEC/Keys.hpp"
+#include "HEVEC/Log.hpp"
 #include "HEVEC/MLWECiphertext.hpp"
 #include "HEVEC/MetricType.hpp"
+#include "HEVEC/PIRDatabase.hpp"
 #include "HEVEC/PIRServer.hpp"
 #include "HEVEC/Server.hpp"
 #include "HEVEC/SwitchingKey.hpp"
@@ -28,26 +32,10 @@ namespace HEVEC {
 
 namespace {
 
-void logToFile(const std::string &message) {
-  const char *log_path_env = std::getenv("HEVEC_SERVER_LOG_PATH");
-  if (log_path_env) {
-    std::ofstream log_file(log_path_env, std::ios::app);
-    if (log_file.is_open()) {
-      auto now = std::chrono::system_clock::now();
-      auto time_t = std::chrono::system_clock::to_time_t(now);
-      auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                    now.time_since_epoch()) %
-                1000;
-
-      log_file << "["
-               << std::put_time(std::localtime(&time_t), "%Y-%m-%d %H:%M:%S");
-      log_file << "." << std::setfill('0') << std::setw(3) << ms.count()
-               << "] ";
-      log_file << message << std::endl;
-      log_file.close();
-    }
-  }
-}
+#define LOG_DEBUG(message)                                                     \
+  HEVEC_LOG(getServerLogger(), LogLevel::Debug, message)
+#define LOG_INFO(message) HEVEC_LOG(getServerLogger(), LogLevel::Info, message)
+#define LOG_WARN(message) HEVEC_LOG(getServerLogger(), LogLevel::Warn, message)
 
 constexpr u64 LOG_RANK = 7;
 constexpr u64 RANK = 1ULL << LOG_RANK;
@@ -67,10 +55,9 @@ struct HEVECServerTCP::CollectionData {
 
   // PIR-specific
   InvAutKeys pirInvAutKeys;
-  std::vector<Polynomial> pir_encoded_payloads_;
+  PIRDatabase pir_database_;
 
   std::vector<CachedKeys> full_block_caches_;
-  std::vector<MLWECiphertext> partial_block_keys_;
   std::unique_ptr<CachedKeys> partial_block_cache_;
   std::vector<std::string> payloads_;
 
@@ -86,15 +73,11 @@ struct HEVECServerTCP::CollectionData {
                  InvAutKeys &&piak)
       : relinKey(std::move(rk)), autedModPackKeys(std::move(apk)),
         autedModPackMLWEKeys(std::move(apmk)), pirInvAutKeys(std::move(piak)),
-        dimension(d), metric_type(mt),
-        pir_encoded_payloads_(PIR_RANK * PIR_RANK, Polynomial(DEGREE, MOD_Q)) {
+        pir_database_(PIR_RANK * PIR_RANK, useCompactPIRStore()), dimension(d),
+        metric_type(mt) {
     log_rank = static_cast<u64>(std::ceil(std::log2(dimension)));
     rank = 1ULL << log_rank;
     stack = DEGREE / rank;
-    for (u64 i = 0; i < PIR_RANK * PIR_RANK; ++i) {
-      pir_encoded_payloads_[i].setIsNTT(true);
-    }
-    partial_block_keys_.reserve(DEGREE);
     server = std::make_unique<Server>(log_rank, relinKey, autedModPackKeys,
                                       autedModPackMLWEKeys);
   }
@@ -142,8 +125,8 @@ class HEVECServerTCP::Session : public std::enable_shared_from_this<Session> {
                     asio::buffer(&ctx->metric_type, sizeof(ctx->metric_type)));
         asio::write(sock_, asio::buffer(&ctx->db_size, sizeof(ctx->db_size)));
 
-        logToFile("Collection " + std::to_string(collectionHash) +
-                    " re-connected. DB size: " + std::to_string(ctx->db_size));
+        LOG_INFO("Collection " + std::to_string(collectionHash) +
+                   " re-connected. DB size: " + std::to_string(ctx->db_size));
         return;
       }
     }
@@ -258,8 +241,8 @@ class HEVECServerTCP::Session : public std::enable_shared_from_this<Session> {
       server_.collections_[collectionHash] = new_collection;
     }
 
-    logToFile("Collection " + std::to_string(collectionHash) +
-                " with dimension " + std::to_string(dimension) + " set up.");
+    LOG_INFO("Collection " + std::to_string(collectionHash) +
+               " with dimension " + std::to_string(dimension) + " set up.");
   }
 
   std::shared_ptr<CollectionData> getCollection(u64 collectionHash) {
@@ -279,13 +262,19 @@ class HEVECServerTCP::Session : public std::enable_shared_from_this<Session> {
 
     u64 num_to_insert;
     asio::read(sock_, asio::buffer(&num_to_insert, sizeof(num_to_insert)));
+    if (num_to_insert > ctx->pir_database_.getCapacity() - ctx->db_size)
+      throw std::runtime_error("Insert exceeds PIR capacity");
     auto whole_start = std::chrono::high_resolution_clock::now();
 
     // Create PIR encoder client if needed
     Client pirClient(PIR_LOG_RANK);
 
+    std::vector<MLWECiphertext> new_keys;
+    std::vector<std::string> new_payloads;
+    new_keys.reserve(num_to_insert);
+    new_payloads.reserve(num_to_insert);
     for (u64 i = 0; i < num_to_insert; ++i) {
-      MLWECiphertext new_key(ctx->rank);
+      MLWECiphertext &new_key = new_keys.emplace_back(ctx->rank);
       for (u64 k = 0; k < ctx->stack; ++k) {
         asio::read(sock_, asio::buffer(new_key.getA(k).getData(),
                                        ctx->rank * sizeof(u64)));
@@ -293,54 +282,77 @@ class HEVECServerTCP::Session : public std::enable_shared_from_this<Session> {
       asio::read(sock_, asio::buffer(new_key.getB().getData(),
                                      ctx->rank * sizeof(u64)));
 
-      std::string payload(1024, '\0');
+      std::string &payload = new_payloads.emplace_back(1024, '\0');
       asio::read(sock_, asio::buffer(&payload[0], 1024));
-      ctx->payloads_.push_back(payload);
+    }
 
+    // Payloads are stored only once the whole insert has been read, so a
+    // failed read leaves payloads_ matching db_size.
+    for (u64 i = 0; i < num_to_insert; ++i) {
       // Encode payload for PIR
       const unsigned char *payload_data =
-          reinterpret_cast<const unsigned char *>(payload.data());
-      pirClient.encodePIRPayload(ctx->pir_encoded_payloads_[ctx->db_size + i],
-                                 payload_data);
-
-      ctx->partial_block_keys_.push_back(std::move(new_key));
+          reinterpret_cast<const unsigned char *>(new_payloads[i].data());
+      if (ctx->pir_database_.getIsCompact()) {
+        ctx->pir_database_.setRow(ctx->db_size + i, payload_data);
+      } else {
+        Polynomial encoded(DEGREE, MOD_Q);
+        pirClient.encodePIRPayload(encoded, payload_data);
+        ctx->pir_database_.setRow(ctx->db_size + i, std::move(encoded));
+      }
+    }
+    ctx->payloads_.insert(ctx->payloads_.end(),
+                          std::make_move_iterator(new_payloads.begin()),
+                          std::make_move_iterator(new_payloads.end()));
+
+    // Only the new keys are switched into the partial block cache; a fresh
+    // block that is filled at once goes through cacheKeys.
+    for (u64 i = 0; i < num_to_insert;) {
+      const u64 slot = (ctx->db_size + i) % DEGREE;
+      const u64 count = std::min(DEGREE - slot, num_to_insert - i);
+      std::vector<MLWECiphertext> block_keys(
+          std::make_move_iterator(new_keys.begin() + i),
+          std::make_move_iterator(new_keys.begin() + i + count));
+      i += count;
 
-      if (ctx->partial_block_keys_.size() == DEGREE) {
+      auto start = std::chrono::high_resolution_clock::now();
+      if (count == DEGREE) {
         ctx->full_block_caches_.emplace_back(ctx->rank);
-        auto start = std::chrono::high_resolution_clock::now();
-        ctx->server->cacheKeys(ctx->full_block_caches_.back(),
-                               ctx->partial_block_keys_);
+        ctx->server->cacheKeys(ctx->full_block_caches_.back(), block_keys);
         auto end = std::chrono::high_resolution_clock::now();
         auto duration =
             std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-        logToFile("Cache full block: " + std::to_string(duration.count()) +
+        LOG_DEBUG("Cache full block: " + std::to_string(duration.count()) +
                     "ms");
-        ctx->partial_block_keys_.clear();
-        ctx->partial_block_cache_.reset();
+        continue;
       }
-    }
 
-    if (!ctx->partial_block_keys_.empty()) {
-      ctx->partial_block_cache_ = std::make_unique<CachedKeys>(ctx->rank);
-      std::vector<MLWECiphertext> padded_block = ctx->partial_block_keys_;
-      padded_block.resize(DEGREE, MLWECiphertext(ctx->rank));
-      auto start = std::chrono::high_resolution_clock::now();
-      ctx->server->cacheKeys(*ctx->partial_block_cache_, padded_block);
+      if (!ctx->partial_block_cache_)
+        ctx->partial_block_cache_ = std::make_unique<CachedKeys>(ctx->rank);
+      ctx->server->appendToCache(*ctx->partial_block_cache_, slot, block_keys);
       auto end = std::chrono::high_resolution_clock::now();
       auto duration =
           std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-      logToFile("Cache partial block: " + std::to_string(duration.count()) +
-                  "ms");
+      LOG_DEBUG("Append " + std::to_string(count) +
+                  " keys to partial block: " +
+                  std::to_string(duration.count()) + "ms");
+
+      if (slot + count == DEGREE) {
+        ctx->partial_block_cache_->releasePendingSums();
+        ctx->full_block_caches_.push_back(
+            std::move(*ctx->partial_block_cache_));
+        ctx->full_block_caches_.back().tile();
+        ctx->partial_block_cache_.reset();
+      }
     }
 
     auto whole_end = std::chrono::high_resolution_clock::now();
     auto whole_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
         whole_end - whole_start);
     ctx->db_size += num_to_insert;
-    logToFile("Inserted " + std::to_string(num_to_insert) +
-                " items into collection " + std::to_string(collectionHash) +
-                ". Total DB size: " + std::to_string(ctx->db_size) +
-                ". Took: " + std::to_string(whole_duration.count()) + "ms");
+    LOG_INFO("Inserted " + std::to_string(num_to_insert) +
+               " items into collection " + std::to_string(collectionHash) +
+               ". Total DB size: " + std::to_string(ctx->db_size) +
+               ". Took: " + std::to_string(whole_duration.count()) + "ms");
   }
 
   void handleQuery() {
@@ -364,7 +376,7 @@ class HEVECServerTCP::Session : public std::enable_shared_from_this<Session> {
     auto end = std::chrono::high_resolution_clock::now();
     auto duration =
         std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-    logToFile("Cache query: " + std::to_string(duration.count()) + "ms");
+    LOG_DEBUG("Cache query: " + std::to_string(duration.count()) + "ms");
 
     const u64 iter = ctx->full_block_caches_.size();
     auto total_inner_product_duration = std::chrono::milliseconds(0);
@@ -386,7 +398,7 @@ class HEVECServerTCP::Session : public std::enable_shared_from_this<Session> {
           asio::bind_executor(st, [](auto, size_t) {}));
     }
 
-    logToFile("Inner product for full blocks: " +
+    LOG_DEBUG("Inner product for full blocks: " +
                 std::to_string(total_inner_product_duration.count()) + "ms");
 
     if (ctx->partial_block_cache_) {
@@ -397,7 +409,7 @@ class HEVECServerTCP::Session : public std::enable_shared_from_this<Session> {
       end = std::chrono::high_resolution_clock::now();
       duration =
           std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-      logToFile("Inner product for partial block: " +
+      LOG_DEBUG("Inner product for partial block: " +
                   std::to_string(duration.count()) + "ms");
 
       asio::async_write(
@@ -412,8 +424,8 @@ class HEVECServerTCP::Session : public std::enable_shared_from_this<Session> {
     auto whole_end = std::chrono::high_resolution_clock::now();
     auto whole_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
         whole_end - whole_start);
-    logToFile("Total query handling time: " +
-                std::to_string(whole_duration.count()) + "ms");
+    LOG_INFO("Total query handling time: " +
+               std::to_string(whole_duration.count()) + "ms");
   }
 
   void handleQueryPtxt() {
@@ -434,7 +446,7 @@ class HEVECServerTCP::Session : public std::enable_shared_from_this<Session> {
     auto end = std::chrono::high_resolution_clock::now();
     auto duration =
         std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-    logToFile("Cache plaintext query: " + std::to_string(duration.count()) +
+    LOG_DEBUG("Cache plaintext query: " + std::to_string(duration.count()) +
                 "ms");
 
     const u64 iter = ctx->full_block_caches_.size();
@@ -457,7 +469,7 @@ class HEVECServerTCP::Session : public std::enable_shared_from_this<Session> {
           asio::bind_executor(st, [](auto, size_t) {}));
     }
 
-    logToFile("Inner product for full blocks (plaintext): " +
+    LOG_DEBUG("Inner product for full blocks (plaintext): " +
                 std::to_string(total_inner_product_duration.count()) + "ms");
 
     if (ctx->partial_block_cache_) {
@@ -468,7 +480,7 @@ class HEVECServerTCP::Session : public std::enable_shared_from_this<Session> {
       end = std::chrono::high_resolution_clock::now();
       duration =
           std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-      logToFile("Inner product for partial block (plaintext): " +
+      LOG_DEBUG("Inner product for partial block (plaintext): " +
                   std::to_string(duration.count()) + "ms");
 
       asio::async_write(
@@ -484,8 +496,8 @@ class HEVECServerTCP::Session : public std::enable_shared_from_this<Session> {
     auto whole_end = std::chrono::high_resolution_clock::now();
     auto whole_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
         whole_end - whole_start);
-    logToFile("Total plaintext query handling time: " +
-                std::to_string(whole_duration.count()) + "ms");
+    LOG_INFO("Total plaintext query handling time: " +
+               std::to_string(whole_duration.count()) + "ms");
   }
 
   void handleRetrieve() {
@@ -539,7 +551,8 @@ class HEVECServerTCP::Session : public std::enable_shared_from_this<Session> {
     // Perform PIR computation with shared relinKey and PIR-specific invAutKeys
     PIRServer pirServer(PIR_LOG_RANK, ctx->relinKey, ctx->pirInvAutKeys);
     Ciphertext result;
-    pirServer.pir(result, firstDim, secondDim, ctx->pir_encoded_payloads_);
+    pirServer.pir(result, firstDim, secondDim, ctx->pir_database_,
+                  ctx->db_size);
 
     // Send back encrypted result
     asio::write(sock_,
@@ -557,11 +570,11 @@ class HEVECServerTCP::Session : public std::enable_shared_from_this<Session> {
       auto it = server_.collections_.find(collectionHash);
       if (it != server_.collections_.end()) {
         server_.collections_.erase(it);
-        logToFile("Collection " + std::to_string(collectionHash) +
-                    " dropped successfully.");
+        LOG_INFO("Collection " + std::to_string(collectionHash) +
+                   " dropped successfully.");
       } else {
-        logToFile("Failed to drop collection " +
-                    std::to_string(collectionHash) + ": not found.");
+        LOG_WARN("Failed to drop collection " +
+                   std::to_string(collectionHash) + ": not found.");
       }
     }
   }
@@ -591,7 +604,7 @@ public:
         } else if (op == Operation::DROP_COLLECTION) {
           handleDropCollection();
         } else if (op == Operation::TERMINATE) {
-          logToFile("Terminate signal received. Closing session.");
+          LOG_INFO("Terminate signal received. Closing session.");
           break;
         } else {
           std::cerr << "Unknown operation received. Closing session."
@@ -0,0 +1,183 @@
+#include "HEVEC/Log.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+namespace HEVEC {
+
+namespace {
+
+// The writer wakes at least this often, so a missed notify only delays lines.
+constexpr auto IDLE_WAIT = std::chrono::milliseconds(50);
+
+LogLevel parseLevel(const char *name) {
+  if (!name)
+    return LogLevel::Info;
+  const std::string_view value(name);
+  if (value == "debug")
+    return LogLevel::Debug;
+  if (value == "warn")
+    return LogLevel::Warn;
+  if (value == "error")
+    return LogLevel::Error;
+  if (value == "off")
+    return LogLevel::Off;
+  return LogLevel::Info;
+}
+
+const char *getLevelName(LogLevel level) {
+  switch (level) {
+  case LogLevel::Debug:
+    return "DEBUG";
+  case LogLevel::Info:
+    return "INFO";
+  case LogLevel::Warn:
+    return "WARN";
+  default:
+    return "ERROR";
+  }
+}
+
+void writeLine(std::FILE *file, std::int64_t time_ns, LogLevel level,
+               const char *text, u64 length) {
+  const std::time_t seconds =
+      static_cast<std::time_t>(time_ns / 1'000'000'000);
+  const int ms = static_cast<int>(time_ns / 1'000'000 % 1000);
+  std::tm local{};
+  localtime_r(&seconds, &local);
+  char stamp[32];
+  std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+  std::fprintf(file, "[%s.%03d] %s %.*s\n", stamp, ms, getLevelName(level),
+               static_cast<int>(length), text);
+}
+
+std::int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+} // namespace
+
+Logger::Logger(const char *pathEnv) {
+  const char *path = std::getenv(pathEnv);
+  const LogLevel level = parseLevel(std::getenv("HEVEC_LOG_LEVEL"));
+  if (!path || level == LogLevel::Off)
+    return;
+  file_ = std::fopen(path, "a");
+  if (!file_)
+    return;
+
+  slots_ = std::make_unique<Slot[]>(QUEUE_SIZE);
+  for (u64 i = 0; i < QUEUE_SIZE; ++i)
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  level_.store(static_cast<int>(level), std::memory_order_relaxed);
+  writer_ = std::thread([this]() { run(); });
+}
+
+Logger::~Logger() {
+  if (!writer_.joinable())
+    return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_one();
+  writer_.join();
+  std::fclose(file_);
+}
+
+void Logger::write(LogLevel level, std::string_view message) {
+  const std::int64_t time_ns = nowNs();
+  u64 pos = head_.load(std::memory_order_relaxed);
+  Slot *slot = nullptr;
+  for (;;) {
+    slot = &slots_[pos % QUEUE_SIZE];
+    const u64 sequence = slot->sequence.load(std::memory_order_acquire);
+    if (sequence == pos) {
+      if (head_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed))
+        break;
+    } else if (sequence < pos) {
+      // The writer has not released this slot yet: the queue is full.
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      pos = head_.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot->time_ns = time_ns;
+  slot->level = level;
+  slot->length = std::min<u64>(message.size(), MAX_MESSAGE);
+  std::memcpy(slot->text, message.data(), slot->length);
+  if (message.size() > MAX_MESSAGE)
+    std::memcpy(slot->text + MAX_MESSAGE - 3, "...", 3);
+  slot->sequence.store(pos + 1, std::memory_order_release);
+
+  if (idle_.load(std::memory_order_relaxed))
+    wake_.notify_one();
+}
+
+void Logger::flush() {
+  if (!writer_.joinable())
+    return;
+  const u64 target = head_.load(std::memory_order_acquire);
+  std::unique_lock<std::mutex> lock(mutex_);
+  wake_.notify_one();
+  flushed_.wait(lock, [&]() {
+    return written_.load(std::memory_order_relaxed) >= target;
+  });
+}
+
+bool Logger::tryPop(Slot *&slot) {
+  slot = &slots_[tail_ % QUEUE_SIZE];
+  return slot->sequence.load(std::memory_order_acquire) == tail_ + 1;
+}
+
+void Logger::run() {
+  u64 reported_drops = 0;
+  for (;;) {
+    Slot *slot = nullptr;
+    while (tryPop(slot)) {
+      writeLine(file_, slot->time_ns, slot->level, slot->text, slot->length);
+      slot->sequence.store(tail_ + QUEUE_SIZE, std::memory_order_release);
+      ++tail_;
+    }
+    const u64 drops = dropped_.load(std::memory_order_relaxed);
+    if (drops != reported_drops) {
+      const std::string note = std::to_string(drops - reported_drops) +
+                               " log messages dropped (queue full)";
+      writeLine(file_, nowNs(), LogLevel::Warn, note.data(), note.size());
+      reported_drops = drops;
+    }
+    std::fflush(file_);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    written_.store(tail_, std::memory_order_relaxed);
+    flushed_.notify_all();
+    if (stop_ && head_.load(std::memory_order_acquire) == tail_)
+      return;
+    idle_.store(true, std::memory_order_relaxed);
+    wake_.wait_for(lock, IDLE_WAIT, [&]() {
+      return stop_ || head_.load(std::memory_order_relaxed) != tail_;
+    });
+    idle_.store(false, std::memory_order_relaxed);
+  }
+}
+
+Logger &getServerLogger() {
+  static Logger logger("HEVEC_SERVER_LOG_PATH");
+  return logger;
+}
+
+Logger &getClientLogger() {
+  static Logger logger("HEVEC_CLIENT_LOG_PATH");
+  return logger;
+}
+
+} // namespace HEVEC
@@ -0,0 +1,154 @@
+#include "HEVEC/Memory.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace HEVEC {
+
+namespace {
+
+thread_local std::shared_ptr<MemoryAccount> t_account;
+
+std::atomic<WordAllocator *> g_allocator{nullptr};
+
+u64 roundUp(u64 value, u64 multiple) {
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+#ifdef __linux__
+
+constexpr u64 HUGE_PAGE_BYTES = 2ULL << 20;
+constexpr u64 GIGANTIC_PAGE_BYTES = 1ULL << 30;
+// Rounding up to whole hugetlbfs pages may add 1/MAX_WASTE_SHARE of a slab.
+constexpr u64 MAX_WASTE_SHARE = 16;
+
+// An anonymous mapping of bytes, 2 MB-aligned so every whole 2 MB of it
+// can be a transparent huge page.
+WordSlab mapTransparent(u64 bytes) {
+  static const u64 PAGE_BYTES = static_cast<u64>(::sysconf(_SC_PAGESIZE));
+  bytes = roundUp(bytes, PAGE_BYTES);
+  const u64 reserved = bytes + HUGE_PAGE_BYTES;
+  void *map = ::mmap(nullptr, reserved, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED)
+    throw std::bad_alloc();
+  const auto begin = reinterpret_cast<std::uintptr_t>(map);
+  const std::uintptr_t start = roundUp(begin, HUGE_PAGE_BYTES);
+  if (start > begin)
+    ::munmap(map, start - begin);
+  if (begin + reserved > start + bytes)
+    ::munmap(reinterpret_cast<void *>(start + bytes),
+             begin + reserved - (start + bytes));
+  // Refused where THP is disabled; the slab then keeps regular pages.
+  ::madvise(reinterpret_cast<void *>(start), bytes, MADV_HUGEPAGE);
+  return {reinterpret_cast<u64 *>(start), bytes, PageKind::TransparentHuge};
+}
+
+// bytes from the hugetlbfs pool, or a null slab if it has too few pages of
+// a size that fits.
+WordSlab mapHuge(u64 bytes) {
+  for (const u64 page : {GIGANTIC_PAGE_BYTES, HUGE_PAGE_BYTES}) {
+    const u64 mapped = roundUp(bytes, page);
+    if (mapped - bytes > bytes / MAX_WASTE_SHARE)
+      continue;
+    const int pageShift = page == GIGANTIC_PAGE_BYTES ? 30 : 21;
+    void *map = ::mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                           (pageShift << MAP_HUGE_SHIFT),
+                       -1, 0);
+    if (map != MAP_FAILED)
+      return {static_cast<u64 *>(map), mapped, PageKind::Huge};
+  }
+  return {};
+}
+
+#endif
+
+} // namespace
+
+MemoryAccount &getProcessMemory() {
+  static MemoryAccount account;
+  return account;
+}
+
+MemoryScope::MemoryScope(std::shared_ptr<MemoryAccount> account)
+    : previous_(std::move(t_account)) {
+  t_account = std::move(account);
+}
+
+MemoryScope::~MemoryScope() { t_account = std::move(previous_); }
+
+const std::shared_ptr<MemoryAccount> &MemoryScope::current() {
+  return t_account;
+}
+
+HugePageMode getHugePageMode() {
+  const char *mode_env = std::getenv("HEVEC_HUGE_PAGES");
+  const std::string mode = mode_env ? mode_env : "thp";
+  if (mode == "off")
+    return HugePageMode::Off;
+  if (mode == "hugetlb")
+    return HugePageMode::HugeTLB;
+  return HugePageMode::Transparent;
+}
+
+WordSlab HugePageAllocator::allocate(u64 count, u64 alignment) {
+  const u64 bytes = roundUp(count * sizeof(u64), alignment);
+#ifdef __linux__
+  if (mode_ != HugePageMode::Off && bytes >= HUGE_PAGE_BYTES &&
+      alignment <= HUGE_PAGE_BYTES) {
+    if (mode_ == HugePageMode::HugeTLB) {
+      if (const WordSlab slab = mapHuge(bytes); slab.data)
+        return slab;
+    }
+    return mapTransparent(bytes);
+  }
+#endif
+  void *data = std::aligned_alloc(alignment, bytes);
+  if (!data)
+    throw std::bad_alloc();
+  return {static_cast<u64 *>(data), bytes, PageKind::Small};
+}
+
+void HugePageAllocator::deallocate(const WordSlab &slab) {
+  if (slab.kind == PageKind::Small)
+    std::free(slab.data);
+  else
+    ::munmap(slab.data, slab.bytes);
+}
+
+WordAllocator &getWordAllocator() {
+  if (WordAllocator *allocator = g_allocator.load(std::memory_order_acquire))
+    return *allocator;
+  static HugePageAllocator allocator(getHugePageMode());
+  return allocator;
+}
+
+void setWordAllocator(WordAllocator *allocator) {
+  g_allocator.store(allocator, std::memory_order_release);
+}
+
+void AlignedFree::operator()(u64 *) const {
+  getProcessMemory().remove(slab.kind, slab.bytes);
+  if (account)
+    account->remove(slab.kind, slab.bytes);
+  allocator->deallocate(slab);
+}
+
+AlignedWords allocateWords(u64 count, u64 alignment) {
+  if (count == 0)
+    return nullptr;
+  WordAllocator &allocator = getWordAllocator();
+  const WordSlab slab = allocator.allocate(count, alignment);
+  getProcessMemory().add(slab.kind, slab.bytes);
+  const auto &account = MemoryScope::current();
+  if (account)
+    account->add(slab.kind, slab.bytes);
+  return AlignedWords(slab.data, AlignedFree{&allocator, slab, account});
+}
+
+} // namespace HEVEC
@@ -0,0 +1,83 @@
+#include "HEVEC/PIRDatabase.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "HEVEC/Const.hpp"
+#include "HEVEC/Exception.hpp"
+#include "HEVEC/Memory.hpp"
+#include "HEVEC/Polynomial.hpp"
+
+namespace HEVEC {
+
+bool useCompactPIRStore() {
+  const char *store_env = std::getenv("HEVEC_PIR_STORE");
+  return store_env && std::string(store_env) == "compact";
+}
+
+PIRDatabase::PIRDatabase(u64 capacity, bool isCompact)
+    : capacity_(capacity), isCompact_(isCompact),
+      slabs_((capacity + ROWS_PER_SLAB - 1) / ROWS_PER_SLAB) {}
+
+PIRDatabase::Slab &PIRDatabase::reserveSlab(u64 index) {
+  if (index >= capacity_)
+    throw InvalidSlotException();
+  std::unique_ptr<Slab> &slab = slabs_[index / ROWS_PER_SLAB];
+  if (!slab) {
+    auto fresh = std::make_unique<Slab>();
+    fresh->words = allocateWords(getSlabWords());
+    slab = std::move(fresh);
+    ++numSlabs_;
+  }
+  return *slab;
+}
+
+void PIRDatabase::setRow(u64 index, Polynomial &&row) {
+  if (isCompact_ || !row.getIsNTT())
+    throw InvalidNTTStateException();
+  Slab &slab = reserveSlab(index);
+  std::unique_ptr<Polynomial> &view = slab.rows[index % ROWS_PER_SLAB];
+  if (!view) {
+    view = std::make_unique<Polynomial>(
+        slab.words.get() + index % ROWS_PER_SLAB * DEGREE, DEGREE, MOD_Q);
+  }
+  // Written through the view, unless row has another degree.
+  *view = std::move(row);
+}
+
+void PIRDatabase::setRow(u64 index, const unsigned char *payload) {
+  if (!isCompact_)
+    throw InvalidNTTStateException();
+  Slab &slab = reserveSlab(index);
+  std::memcpy(reinterpret_cast<unsigned char *>(slab.words.get()) +
+                  index % ROWS_PER_SLAB * PIR_PAYLOAD_SIZE,
+              payload, PIR_PAYLOAD_SIZE);
+}
+
+void PIRDatabase::getRow(Polynomial &res, u64 index) const {
+  if (isCompact_) {
+    const Slab &slab = *slabs_[index / ROWS_PER_SLAB];
+    expandPayload(res, reinterpret_cast<const unsigned char *>(
+                           slab.words.get()) +
+                           index % ROWS_PER_SLAB * PIR_PAYLOAD_SIZE);
+  } else {
+    res = getRow(index);
+  }
+}
+
+void PIRDatabase::expandPayload(Polynomial &res, const unsigned char *payload) {
+  res.setIsNTT(false);
+  // Each coefficient stores 2 bits
+  u64 coeff_idx = 0;
+  for (u64 byte_idx = 0; byte_idx < PIR_PAYLOAD_SIZE; ++byte_idx) {
+    unsigned char byte = payload[byte_idx];
+    for (int bit_pair = 0; bit_pair < 4; ++bit_pair) {
+      u64 two_bits = (byte >> (bit_pair * 2)) & 3; // Extract 2 bits
+      res[coeff_idx++] = (two_bits > 1) ? (MOD_Q - two_bits + 1) : two_bits;
+    }
+  }
+}
+} // namespace HEVEC
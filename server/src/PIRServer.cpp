@@ -1,12 +1,15 @@
 #include "HEVEC/PIRServer.hpp"
 
-#include <omp.h>
+#include <chrono>
 
 #include "HEVEC/Ciphertext.hpp"
 #include "HEVEC/Const.hpp"
 #include "HEVEC/HEval.hpp"
+#include "HEVEC/PIRDatabase.hpp"
 #include "HEVEC/Polynomial.hpp"
 #include "HEVEC/SwitchingKey.hpp"
+#include "HEVEC/TaskPool.hpp"
+#include "HEVEC/Trace.hpp"
 
 namespace HEVEC {
 
@@ -19,11 +22,11 @@ PIRServer::PIRServer(u64 logRank, const SwitchingKey &relinKey,
 void PIRServer::pir(Ciphertext &res, const Ciphertext &queryFirstDim,
                     const Ciphertext &querySecondDim,
                     const std::vector<Polynomial> &db) {
+  HEVEC_TRACE_SPAN("PIRServer.pir");
   std::vector<Ciphertext> decomposedQuery(rank_), firstDim(rank_);
   decompose(decomposedQuery, queryFirstDim);
   invButterfly(decomposedQuery);
-#pragma omp parallel for
-  for (u64 i = 0; i < rank_; ++i) {
+  parallelFor(rank_, [&](u64 i) {
     {
       const u64 j = 0;
       eval_.mult(firstDim[i], decomposedQuery[eval_.getBitRev(j, rank_)],
@@ -34,29 +37,88 @@ void PIRServer::pir(Ciphertext &res, const Ciphertext &queryFirstDim,
                  db[i + rank_ * j]);
       eval_.add(firstDim[i], firstDim[i], tempCtxts_[i]);
     }
-  }
+  });
+  decompose(decomposedQuery, querySecondDim);
+  invButterfly(decomposedQuery);
+  Ciphertext temp(true);
+  eval_.bitRevedMultithreadMultSum(temp, decomposedQuery, firstDim);
+  eval_.relin(res, temp, relinKey_);
+}
+
+// Rows from numRows on are zero and are skipped instead of multiplied; they
+// may be being set meanwhile.
+void PIRServer::pir(Ciphertext &res, const Ciphertext &queryFirstDim,
+                    const Ciphertext &querySecondDim, const PIRDatabase &db,
+                    u64 numRows, PIRStageTimes *times) {
+  HEVEC_TRACE_SPAN("PIRServer.pir");
+  auto start = std::chrono::steady_clock::now();
+  auto lap = [&](double PIRStageTimes::*stage) {
+    if (!times)
+      return;
+    auto now = std::chrono::steady_clock::now();
+    times->*stage = std::chrono::duration<double>(now - start).count();
+    start = now;
+  };
+
+  std::vector<Ciphertext> decomposedQuery(rank_), firstDim(rank_);
+  decompose(decomposedQuery, queryFirstDim);
+  invButterfly(decomposedQuery);
+  lap(&PIRStageTimes::expandFirst);
+  parallelFor(rank_, [&](u64 i) {
+    Polynomial row(DEGREE, MOD_Q);
+    bool isEmpty = true;
+    for (u64 j = 0; j < rank_; ++j) {
+      const u64 index = i + rank_ * j;
+      if (index >= numRows)
+        break;
+      const Polynomial *op = &row;
+      if (db.getIsCompact()) {
+        db.getRow(row, index);
+        eval_.ntt(row, row);
+      } else {
+        op = &db.getRow(index);
+      }
+      Ciphertext &dst = isEmpty ? firstDim[i] : tempCtxts_[i];
+      eval_.mult(dst, decomposedQuery[eval_.getBitRev(j, rank_)], *op);
+      if (!isEmpty)
+        eval_.add(firstDim[i], firstDim[i], tempCtxts_[i]);
+      isEmpty = false;
+    }
+    if (isEmpty)
+      firstDim[i].setIsNTT(true);
+  });
+  lap(&PIRStageTimes::firstDim);
   decompose(decomposedQuery, querySecondDim);
   invButterfly(decomposedQuery);
+  lap(&PIRStageTimes::expandSecond);
   Ciphertext temp(true);
   eval_.bitRevedMultithreadMultSum(temp, decomposedQuery, firstDim);
+  lap(&PIRStageTimes::secondDim);
   eval_.relin(res, temp, relinKey_);
+  lap(&PIRStageTimes::relin);
+}
+
+void PIRServer::modSwitch(PackedCiphertext &res, const Ciphertext &op) {
+  HEVEC_TRACE_SPAN("PIRServer.modSwitch");
+  eval_.modSwitch(res, op);
 }
 
 void PIRServer::decompose(std::vector<Ciphertext> &res, const Ciphertext &op) {
+  HEVEC_TRACE_SPAN("PIRServer.decompose");
   const u64 step = 2 * DEGREE / rank_;
 
   Polynomial tempModQ(DEGREE, MOD_Q), tempModP(DEGREE, MOD_P);
   eval_.ntt(tempModQ, op.getA());
   eval_.normMod(tempModP, op.getA());
   eval_.ntt(tempModP, tempModP);
-#pragma omp parallel for
-  for (u64 i = 0; i < rank_; ++i) {
+  parallelFor(rank_, [&](u64 i) {
+    Polynomial keyAQ(0, MOD_Q), keyAP(0, MOD_P);
     eval_.mult(tempKeys_[i].getPolyAModQ(), tempModQ,
-               invAutKeys_.getKeys()[i].getPolyAModQ());
+               invAutKeys_.getKeys()[i].getPolyAModQ(keyAQ));
     eval_.mult(tempKeys_[i].getPolyBModQ(), tempModQ,
                invAutKeys_.getKeys()[i].getPolyBModQ());
     eval_.mult(tempKeys_[i].getPolyAModP(), tempModP,
-               invAutKeys_.getKeys()[i].getPolyAModP());
+               invAutKeys_.getKeys()[i].getPolyAModP(keyAP));
     eval_.mult(tempKeys_[i].getPolyBModP(), tempModP,
                invAutKeys_.getKeys()[i].getPolyBModP());
 
@@ -76,28 +138,24 @@ void PIRServer::decompose(std::vector<Ciphertext> &res, const Ciphertext &op) {
     eval_.mad(tempCtxts_[i].getA(), tempCtxts_[i].getA(), INVERSE_P_MOD_Q,
               op.getB());
     eval_.aut(res[i].getB(), tempCtxts_[i].getA(), step * i + 1, DEGREE);
-  }
+  });
 }
 
 void PIRServer::invButterfly(std::vector<Ciphertext> &op) {
+  HEVEC_TRACE_SPAN("PIRServer.invButterfly");
   for (int i = logRank_ - 1; i >= 0; --i) {
     const u64 half = 1ULL << i;
     const u64 size = 2 * half;
     const u64 start = rank_ / size;
     const u64 step = DEGREE / half;
-#pragma omp parallel for collapse(2)
-    for (u64 j = 0; j < start; ++j) {
-      for (u64 k = 0; k < half; ++k) {
-        const u64 factor = start + step * k;
-        const u64 idx = size * j + k;
-        eval_.sub(tempCtxts_[idx], op[idx], op[idx + half]);
-        eval_.add(op[idx], op[idx], op[idx + half]);
-        eval_.shift(op[idx + half], tempCtxts_[idx], 2 * DEGREE - factor);
-      }
-    }
+    parallelFor(start, half, [&](u64 j, u64 k) {
+      const u64 factor = start + step * k;
+      const u64 idx = size * j + k;
+      eval_.sub(tempCtxts_[idx], op[idx], op[idx + half]);
+      eval_.add(op[idx], op[idx], op[idx + half]);
+      eval_.shift(op[idx + half], tempCtxts_[idx], 2 * DEGREE - factor);
+    });
   }
-#pragma omp parallel for
-  for (u64 i = 0; i < rank_; ++i)
-    eval_.ntt(op[i], op[i]);
+  parallelFor(rank_, [&](u64 i) { eval_.ntt(op[i], op[i]); });
 }
 } // namespace HEVEC
\ No newline at end of file
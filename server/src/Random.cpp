@@ -1,8 +1,10 @@
 #include "HEVEC/Random.hpp"
 
+#include <bit>
 #include <cstring>
 #include <iostream>
 #include <openssl/evp.h>
+#include <openssl/sha.h>
 #include <stdexcept>
 
 #include "hexl/eltwise/eltwise-reduce-mod.hpp"
@@ -10,6 +12,7 @@
 
 #include "HEVEC/Const.hpp"
 #include "HEVEC/Exception.hpp"
+#include "HEVEC/MLWECiphertext.hpp"
 #include "HEVEC/Polynomial.hpp"
 
 namespace HEVEC {
@@ -49,19 +52,56 @@ void Random::sampleUniform(Polynomial &res) {
                                 res.getMod(), res.getMod(), 1);
 }
 
-void Random::sampleUniformWithSeed(Polynomial &res, const u8 *seed) {
-  EVP_RAND *rand = EVP_RAND_fetch(nullptr, "CTR-DRBG", nullptr);
-  EVP_RAND_CTX *rctx = EVP_RAND_CTX_new(rand, nullptr);
-
-  EVP_RAND_instantiate(rctx, 256, 0, seed, SEED_SIZE, nullptr);
+void Random::sampleUniformWithSeed(Polynomial &res, const u8 *seed,
+                                   u64 stream) {
+  // AES-256-CTR keyed by SHA-512(seed || mod || stream), so the same seed
+  // always expands to the same polynomial while each modulus and stream gets
+  // an independent one. Words are masked to the bit length of the modulus
+  // and rejected when they fall outside it.
+  const u64 mod = res.getMod();
+  u8 input[SEED_SIZE + 2 * sizeof(u64)];
+  std::memcpy(input, seed, SEED_SIZE);
+  std::memcpy(input + SEED_SIZE, &mod, sizeof(mod));
+  std::memcpy(input + SEED_SIZE + sizeof(mod), &stream, sizeof(stream));
+  u8 keyIv[SHA512_DIGEST_LENGTH];
+  SHA512(input, sizeof(input), keyIv);
+
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+  if (!ctx || EVP_EncryptInit_ex(ctx, EVP_aes_256_ctr(), nullptr, keyIv,
+                                 keyIv + 32) != 1) {
+    EVP_CIPHER_CTX_free(ctx);
+    throw std::runtime_error("Seed expansion failed");
+  }
 
-  EVP_RAND_generate(rctx, reinterpret_cast<u8 *>(res.getData()),
-                    sizeof(u64) * res.getDegree(), 256, 0, nullptr, 0);
+  const u64 mask = std::bit_ceil(mod) - 1;
+  std::vector<u64> words(res.getDegree());
+  u64 filled = 0;
+  while (filled < res.getDegree()) {
+    const int len = static_cast<int>((res.getDegree() - filled) * sizeof(u64));
+    std::memset(words.data(), 0, len);
+    int outLen = 0;
+    auto *bytes = reinterpret_cast<u8 *>(words.data());
+    if (EVP_EncryptUpdate(ctx, bytes, &outLen, bytes, len) != 1) {
+      EVP_CIPHER_CTX_free(ctx);
+      throw std::runtime_error("Seed expansion failed");
+    }
+    for (int i = 0; i < len / static_cast<int>(sizeof(u64)); ++i) {
+      const u64 word = words[i] & mask;
+      if (word < mod)
+        res[filled++] = word;
+    }
+  }
+  EVP_CIPHER_CTX_free(ctx);
+}
 
-  EVP_RAND_CTX_free(rctx);
-  EVP_RAND_free(rand);
-  intel::hexl::EltwiseReduceMod(res.getData(), res.getData(), res.getDegree(),
-                                res.getMod(), res.getMod(), 1);
+void Random::sampleUniformWithSeed(MLWECiphertext &res, const u8 *seed) {
+  Polynomial full(DEGREE, MOD_Q);
+  sampleUniformWithSeed(full, seed);
+  for (u64 i = 0; i < res.getStack(); ++i) {
+    res.getA(i).setIsNTT(false);
+    for (u64 j = 0; j < res.getRank(); ++j)
+      res.getA(i)[j] = full[j * res.getStack() + i];
+  }
 }
 
 void Random::sampleDiscreteGaussian(Polynomial &res) {
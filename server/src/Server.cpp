@@ -1,37 +1,195 @@
 #include "HEVEC/Server.hpp"
 
+#include <algorithm>
+#include <cstdint>
 #include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <unordered_map>
 
 #include "HEVEC/Ciphertext.hpp"
 #include "HEVEC/Const.hpp"
+#include "HEVEC/Exception.hpp"
 #include "HEVEC/HEval.hpp"
 #include "HEVEC/MLWECiphertext.hpp"
 #include "HEVEC/MLWESwitchingKey.hpp"
+#include "HEVEC/Numa.hpp"
 #include "HEVEC/Polynomial.hpp"
 #include "HEVEC/Random.hpp"
 #include "HEVEC/SwitchingKey.hpp"
+#include "HEVEC/TaskPool.hpp"
+#include "HEVEC/Trace.hpp"
 
 namespace HEVEC {
 
+namespace {
+// Beyond this many distinct stack components per append, two full DEGREE-point
+// NTTs of the packed polynomial are cheaper than spreading each component.
+constexpr u64 MAX_SPREAD_COMPONENTS = 4;
+} // namespace
+
+namespace {
+std::shared_ptr<const u64> shareWords(AlignedWords words) {
+  AlignedFree free = words.get_deleter();
+  return std::shared_ptr<const u64>(words.release(), std::move(free));
+}
+
+// Words of the scan layout, N_SCAN_TILES tiles of tileWords, filled in
+// parallel by copyTile(t, ..., args).
+template <typename Span, typename... Args>
+std::shared_ptr<const u64> tileSpan(const Span &span, u64 tileWords,
+                                    Args... args) {
+  AlignedWords words = allocateWords(N_SCAN_TILES * tileWords);
+  u64 *tiled = words.get();
+  auto res = shareWords(std::move(words));
+  parallelFor(N_SCAN_TILES, [&](u64 t) {
+    span.copyTile(t, tiled + t * tileWords, args...);
+  });
+  return res;
+}
+
+// A copy of count words at data, bound to node before it is written.
+std::shared_ptr<const u64> copyToNode(const u64 *data, u64 count, u64 node) {
+  AlignedWords words = allocateWords(count);
+  u64 *copy = words.get();
+  auto res = shareWords(std::move(words));
+  bindToNumaNode(copy, count * sizeof(u64), node);
+  std::memcpy(copy, data, count * sizeof(u64));
+  return res;
+}
+} // namespace
+
+CachedQuery::CachedQuery(const CachedQuery &other, u64 node)
+    : rank_(other.rank_), ctxts_(other.ctxts_) {
+  if (other.tiled_)
+    tiled_ = copyToNode(other.tiled_.get(),
+                        CiphertextSpan::getTiledWords(rank_), node);
+}
+
+void CachedQuery::tile() {
+  if (tiled_)
+    return;
+  tiled_ = tileSpan(CiphertextSpan(ctxts_), 2 * rank_ * SCAN_TILE);
+  std::vector<Ciphertext>().swap(ctxts_);
+}
+
+void CachedQuery::reset() {
+  if (!tiled_)
+    return;
+  tiled_.reset();
+  ctxts_.resize(rank_);
+}
+
+CachedPlaintextQuery::CachedPlaintextQuery(const CachedPlaintextQuery &other,
+                                           u64 node)
+    : rank_(other.rank_), polys_(other.polys_) {
+  if (other.tiled_)
+    tiled_ = copyToNode(other.tiled_.get(), rank_ * DEGREE, node);
+}
+
+void CachedPlaintextQuery::tile() {
+  if (tiled_)
+    return;
+  tiled_ = tileSpan(PolynomialSpan(polys_), rank_ * SCAN_TILE);
+  std::vector<Polynomial>().swap(polys_);
+}
+
+void CachedPlaintextQuery::reset() {
+  if (!tiled_)
+    return;
+  tiled_.reset();
+  polys_.assign(rank_, Polynomial(DEGREE, MOD_Q));
+}
+
+void CachedKeys::tile(bool packed) {
+  if (tiled_ && packed_ == packed)
+    return;
+  // A tiled block is re-tiled from its current layout.
+  auto tiled = tileSpan(
+      getSpan(), 2 * rank_ * (packed ? PACKED_SCAN_TILE : SCAN_TILE), packed);
+  tiled_ = tiled.get();
+  storage_ = std::move(tiled);
+  packed_ = packed;
+  is_mapped_ = false;
+  std::vector<Ciphertext>().swap(ctxts_);
+}
+
+void CachedKeys::reset() {
+  if (!tiled_)
+    return;
+  tiled_ = nullptr;
+  storage_.reset();
+  packed_ = false;
+  is_mapped_ = false;
+  ctxts_.resize(rank_);
+}
+
+void CachedKeys::prefetch() const {
+  if (!is_mapped_)
+    return;
+  static const std::uintptr_t PAGE_MASK = ::sysconf(_SC_PAGESIZE) - 1;
+  const auto begin = reinterpret_cast<std::uintptr_t>(tiled_);
+  const std::uintptr_t start = begin & ~PAGE_MASK;
+  const u64 bytes =
+      CiphertextSpan::getTiledWords(rank_, packed_) * sizeof(u64) +
+      (begin - start);
+  ::madvise(reinterpret_cast<void *>(start), bytes, MADV_WILLNEED);
+}
+
+void CachedKeys::bindToNode(u64 node) const {
+  if (tiled_ && !is_mapped_)
+    bindToNumaNode(tiled_,
+                   CiphertextSpan::getTiledWords(rank_, packed_) * sizeof(u64),
+                   node);
+}
+
 Server::Server(u64 logRank, const SwitchingKey &relinKey,
                const AutedModPackKeys &autedModPackKeys,
                const AutedModPackMLWEKeys &autedModPackMLWEKeys)
     : logRank_(logRank), rank_(1ULL << logRank), stack_(DEGREE >> logRank),
-      eval_(logRank_), relinKey_(relinKey), autedModPackKeys_(autedModPackKeys),
-      autedModPackMLWEKeys_(autedModPackMLWEKeys) {}
+      eval_(logRank_), spreadIndexQ_(DEGREE), spreadIndexP_(DEGREE),
+      relinKey_(relinKey), autedModPackKeys_(autedModPackKeys),
+      autedModPackMLWEKeys_(autedModPackMLWEKeys) {
+  const u64 numNodes = TaskPool::get().getNumNodes();
+  if (numNodes > 1) {
+    const u64 words = SwitchingKey::getWordCount(relinKey_.isImplicit());
+    nodeRelinKeys_.reserve(numNodes);
+    for (u64 node = 0; node < numNodes; ++node) {
+      nodeRelinStorage_.push_back(allocateWords(words));
+      bindToNumaNode(nodeRelinStorage_.back().get(), words * sizeof(u64), node);
+      nodeRelinKeys_.emplace_back(relinKey_, nodeRelinStorage_.back().get());
+    }
+  }
+  if (rank_ < 2)
+    return;
+  for (const u64 mod : {MOD_Q, MOD_P}) {
+    std::vector<u64> &index = mod == MOD_Q ? spreadIndexQ_ : spreadIndexP_;
+    Polynomial monomial(DEGREE, mod), root(rank_, mod);
+    monomial[stack_] = 1;
+    root[1] = 1;
+    eval_.ntt(monomial, monomial);
+    eval_.ntt(root, root);
+
+    std::unordered_map<u64, u64> slots;
+    for (u64 i = 0; i < rank_; ++i)
+      slots[root[i]] = i;
+    for (u64 i = 0; i < DEGREE; ++i)
+      index[i] = slots.at(monomial[i]);
+  }
+}
 
 void Server::cacheQuery(CachedQuery &res, const MLWECiphertext &query) {
+  HEVEC_TRACE_SPAN("Server.cacheQuery");
+  res.reset();
   MLWESwitchingKey up(rank_);
 
-#pragma omp parallel for
-  for (u64 i = 0; i < stack_; ++i) {
+  parallelFor(stack_, [&](u64 i) {
     eval_.normMod(up.getPolyAModP(i), query.getA(i));
     eval_.ntt(up.getPolyAModQ(i), query.getA(i));
     eval_.ntt(up.getPolyAModP(i), up.getPolyAModP(i));
-  }
+  });
 
-#pragma omp parallel for
-  for (u64 i = 0; i < rank_; ++i) {
+  parallelFor(rank_, [&](u64 i) {
     const u64 exponent = 2 * i + 1;
     Ciphertext &ctxt = res.getCtxts()[eval_.getBitRev(i, rank_)];
 
@@ -41,32 +199,36 @@ void Server::cacheQuery(CachedQuery &res, const MLWECiphertext &query) {
 
     std::memset(ctxt.getB().getData(), 0, sizeof(u64) * DEGREE);
 
-#pragma omp parallel for
-    for (u64 j = 0; j < rank_; ++j)
+    parallelFor(rank_, [&](u64 j) {
       ctxt.getB()[j * stack_] = query.getB()[j];
-#pragma omp parallel for
-    for (u64 k = 0; k < stack_; ++k) {
+    });
+    parallelFor(stack_, [&](u64 k) {
+      Polynomial keyAQ(0, MOD_Q), keyAP(0, MOD_P);
       {
         u64 j = 0;
-        eval_.mult(multed.getPolyAModQ(k), up.getPolyAModQ(j),
-                   autedModPackMLWEKeys_.getKeys()[i][0].getPolyAModQ(k));
+        eval_.mult(
+            multed.getPolyAModQ(k), up.getPolyAModQ(j),
+            autedModPackMLWEKeys_.getKeys()[i][0].getPolyAModQ(k, keyAQ));
         eval_.mult(multed.getPolyBModQ(k), up.getPolyAModQ(j),
                    autedModPackMLWEKeys_.getKeys()[i][0].getPolyBModQ(k));
-        eval_.mult(multed.getPolyAModP(k), up.getPolyAModP(j),
-                   autedModPackMLWEKeys_.getKeys()[i][0].getPolyAModP(k));
+        eval_.mult(
+            multed.getPolyAModP(k), up.getPolyAModP(j),
+            autedModPackMLWEKeys_.getKeys()[i][0].getPolyAModP(k, keyAP));
         eval_.mult(multed.getPolyBModP(k), up.getPolyAModP(j),
                    autedModPackMLWEKeys_.getKeys()[i][0].getPolyBModP(k));
       }
       Polynomial tempQ(rank_, MOD_Q), tempP(rank_, MOD_P);
       for (u64 j = 1; j < stack_; ++j) {
-        eval_.mult(tempQ, up.getPolyAModQ(j),
-                   autedModPackMLWEKeys_.getKeys()[i][j].getPolyAModQ(k));
+        eval_.mult(
+            tempQ, up.getPolyAModQ(j),
+            autedModPackMLWEKeys_.getKeys()[i][j].getPolyAModQ(k, keyAQ));
         eval_.add(multed.getPolyAModQ(k), multed.getPolyAModQ(k), tempQ);
         eval_.mult(tempQ, up.getPolyAModQ(j),
                    autedModPackMLWEKeys_.getKeys()[i][j].getPolyBModQ(k));
         eval_.add(multed.getPolyBModQ(k), multed.getPolyBModQ(k), tempQ);
-        eval_.mult(tempP, up.getPolyAModP(j),
-                   autedModPackMLWEKeys_.getKeys()[i][j].getPolyAModP(k));
+        eval_.mult(
+            tempP, up.getPolyAModP(j),
+            autedModPackMLWEKeys_.getKeys()[i][j].getPolyAModP(k, keyAP));
         eval_.add(multed.getPolyAModP(k), multed.getPolyAModP(k), tempP);
         eval_.mult(tempP, up.getPolyAModP(j),
                    autedModPackMLWEKeys_.getKeys()[i][j].getPolyBModP(k));
@@ -85,39 +247,43 @@ void Server::cacheQuery(CachedQuery &res, const MLWECiphertext &query) {
       eval_.sub(multed.getPolyBModQ(k), multed.getPolyBModQ(k), tempQ);
       eval_.mult(multed.getPolyBModQ(k), multed.getPolyBModQ(k),
                  INVERSE_P_MOD_Q);
-    }
-#pragma omp parallel for
-    for (u64 j = 0; j < multed.getRank(); ++j) {
+    });
+    parallelFor(multed.getRank(), [&](u64 j) {
       for (u64 k = 0; k < multed.getStack(); ++k) {
         ctxt.getA()[j * stack_ + k] = multed.getPolyAModQ(k)[j];
         ctxt.getB()[j * stack_ + k] += multed.getPolyBModQ(k)[j];
         if (ctxt.getB()[j * stack_ + k] >= MOD_Q)
           ctxt.getB()[j * stack_ + k] -= MOD_Q;
       }
-    }
+    });
 
     Ciphertext temp;
     eval_.aut(temp.getA(), ctxt.getA(), exponent, DEGREE);
     eval_.aut(temp.getB(), ctxt.getB(), exponent, DEGREE);
     eval_.ntt(ctxt.getA(), temp.getA());
     eval_.ntt(ctxt.getB(), temp.getB());
-  }
+  });
+  res.tile();
 }
 
 void Server::cacheQuery(CachedPlaintextQuery &res, const Polynomial &query) {
-#pragma omp parallel for
-  for (u64 i = 0; i < rank_; ++i) {
+  HEVEC_TRACE_SPAN("Server.cacheQuery");
+  res.reset();
+  parallelFor(rank_, [&](u64 i) {
     Polynomial temp(DEGREE, MOD_Q);
     Polynomial &poly = res.getPolys()[eval_.getBitRev(i, rank_)];
     for (u64 j = 0; j < rank_; ++j)
       poly[j * stack_] = query[j];
     eval_.aut(temp, poly, 2 * i + 1, DEGREE);
     eval_.ntt(poly, temp);
-  }
+  });
+  res.tile();
 }
 
 void Server::cacheKeys(CachedKeys &res,
                        const std::vector<MLWECiphertext> &keys) {
+  HEVEC_TRACE_SPAN("Server.cacheKeys");
+  res.reset();
   u64 logNumber = 0;
   while ((1ULL << logNumber) < keys.size())
     ++logNumber;
@@ -125,12 +291,11 @@ void Server::cacheKeys(CachedKeys &res,
   const u64 block = rank_ * number / DEGREE;
 
   std::vector<std::vector<MLWECiphertext>> temp(block);
-#pragma omp parallel for
-  for (u64 i = 0; i < block; ++i) {
+  parallelFor(block, [&](u64 i) {
     temp[i].reserve(stack_);
     for (u64 j = 0; j < stack_; ++j)
       temp[i].emplace_back(rank_);
-  }
+  });
   for (u64 iter = 0; iter < stack_; ++iter) {
     {
       u64 i = 0;
@@ -138,47 +303,40 @@ void Server::cacheKeys(CachedKeys &res,
       const u64 size = half << 1;
       const u64 start = block / size;
       const u64 step = rank_ >> i;
-#pragma omp parallel for collapse(2)
-      for (u64 j = 0; j < start; ++j) {
-        for (u64 k = 0; k < half; ++k) {
-          const u64 factor = start + step * k;
-          const u64 index = size * j + k;
-          MLWECiphertext twiddle(rank_);
-          eval_.shift(
-              twiddle,
-              keys[eval_.getBitRev(index + half, block) * stack_ + iter],
-              factor);
-          eval_.sub(temp[index + half][iter],
-                    keys[eval_.getBitRev(index, block) * stack_ + iter],
-                    twiddle);
-          eval_.add(temp[index][iter],
-                    keys[eval_.getBitRev(index, block) * stack_ + iter],
-                    twiddle);
-        }
-      }
+      parallelFor(start, half, [&](u64 j, u64 k) {
+        const u64 factor = start + step * k;
+        const u64 index = size * j + k;
+        MLWECiphertext twiddle(rank_);
+        eval_.shift(
+            twiddle,
+            keys[eval_.getBitRev(index + half, block) * stack_ + iter],
+            factor);
+        eval_.sub(temp[index + half][iter],
+                  keys[eval_.getBitRev(index, block) * stack_ + iter],
+                  twiddle);
+        eval_.add(temp[index][iter],
+                  keys[eval_.getBitRev(index, block) * stack_ + iter],
+                  twiddle);
+      });
     }
     for (u64 i = 1; i < logNumber; ++i) {
       const u64 half = 1ULL << i;
       const u64 size = half << 1;
       const u64 start = block / size;
       const u64 step = rank_ >> i;
-#pragma omp parallel for collapse(2)
-      for (u64 j = 0; j < start; ++j) {
-        for (u64 k = 0; k < half; ++k) {
-          const u64 factor = start + step * k;
-          const u64 index = size * j + k;
-          MLWECiphertext twiddle(rank_);
-          eval_.shift(twiddle, temp[index + half][iter], factor);
-          eval_.sub(temp[index + half][iter], temp[index][iter], twiddle);
-          eval_.add(temp[index][iter], temp[index][iter], twiddle);
-        }
-      }
+      parallelFor(start, half, [&](u64 j, u64 k) {
+        const u64 factor = start + step * k;
+        const u64 index = size * j + k;
+        MLWECiphertext twiddle(rank_);
+        eval_.shift(twiddle, temp[index + half][iter], factor);
+        eval_.sub(temp[index + half][iter], temp[index][iter], twiddle);
+        eval_.add(temp[index][iter], temp[index][iter], twiddle);
+      });
     }
   }
 
   const u64 step = 2 * DEGREE / number;
-#pragma omp parallel for
-  for (u64 i = 0; i < block; ++i) {
+  parallelFor(block, [&](u64 i) {
     std::vector<MLWECiphertext> auted;
     auted.reserve(stack_);
     for (u64 i = 0; i < stack_; ++i)
@@ -189,9 +347,193 @@ void Server::cacheKeys(CachedKeys &res,
     }
     eval_.modPack(res.getCtxts()[eval_.getBitRev(i, block)], auted,
                   autedModPackKeys_.getKeys()[i * DEGREE / number]);
+  });
+  // A full block is only scanned from now on; a partial one may still be
+  // appended to.
+  if (keys.size() == DEGREE)
+    res.tile();
+}
+
+void Server::appendToCache(CachedKeys &res, u64 slot,
+                           const MLWECiphertext &key) {
+  appendToCache(res, slot, std::vector<MLWECiphertext>{key});
+}
+
+// Adds keys at block positions [slot, slot + keys.size()) of a block that is
+// filled incrementally. A single butterfly input reaches every output as a
+// signed monomial shift, so only the new keys are packed and switched; the
+// mod-QP sums of earlier appends are kept in res and reused.
+void Server::appendToCache(CachedKeys &res, u64 slot,
+                           const std::vector<MLWECiphertext> &keys) {
+  HEVEC_TRACE_SPAN("Server.appendToCache");
+  if (keys.empty())
+    return;
+  if (slot + keys.size() > DEGREE || res.isTiled())
+    throw InvalidSlotException();
+  for (const auto &key : keys) {
+    if (key.getRank() != rank_)
+      throw InvalidRankException();
+  }
+
+  std::vector<SwitchingKey> &sums = res.getPendingSums();
+  if (sums.empty()) {
+    sums.resize(rank_);
+    for (auto &sum : sums) {
+      sum.getPolyAModQ().setIsNTT(true);
+      sum.getPolyAModP().setIsNTT(true);
+      sum.getPolyBModQ().setIsNTT(true);
+      sum.getPolyBModP().setIsNTT(true);
+    }
+  }
+
+  std::vector<std::vector<u64>> exponents(keys.size());
+  std::vector<u64> components, componentOf(keys.size());
+  for (u64 n = 0; n < keys.size(); ++n) {
+    butterflyExponents(exponents[n], slot + n);
+    const u64 component = (slot + n) % stack_;
+    auto it = std::find(components.begin(), components.end(), component);
+    componentOf[n] = it - components.begin();
+    if (it == components.end())
+      components.push_back(component);
+  }
+
+  const bool spread = components.size() <= MAX_SPREAD_COMPONENTS;
+  std::vector<Polynomial> monomialsQ, monomialsP;
+  if (spread) {
+    for (const u64 component : components) {
+      monomialsQ.emplace_back(DEGREE, MOD_Q);
+      monomialsP.emplace_back(DEGREE, MOD_P);
+      monomialsQ.back()[component] = 1;
+      monomialsP.back()[component] = 1;
+      eval_.ntt(monomialsQ.back(), monomialsQ.back());
+      eval_.ntt(monomialsP.back(), monomialsP.back());
+    }
+  }
+
+  parallelFor(rank_, [&](u64 i) {
+    const u64 exponent = 2 * i + 1;
+    const u64 position = eval_.getInv(exponent, rank_) / 2;
+    const std::vector<SwitchingKey> &modPackKeys =
+        autedModPackKeys_.getKeys()[i];
+    SwitchingKey &sum = sums[i];
+
+    Polynomial shifted(rank_, MOD_Q), auted(rank_, MOD_Q),
+        autedModP(rank_, MOD_P), packedQ(DEGREE, MOD_Q),
+        packedP(DEGREE, MOD_P), tempQ(DEGREE, MOD_Q), tempP(DEGREE, MOD_P),
+        keyAQ(0, MOD_Q), keyAP(0, MOD_P);
+    std::vector<Polynomial> grouped(components.size(),
+                                    Polynomial(rank_, MOD_Q));
+
+    for (u64 j = 0; j <= stack_; ++j) {
+      for (auto &poly : grouped) {
+        std::memset(poly.getData(), 0, sizeof(u64) * rank_);
+        poly.setIsNTT(false);
+      }
+      for (u64 n = 0; n < keys.size(); ++n) {
+        const Polynomial &op = j < stack_ ? keys[n].getA(j) : keys[n].getB();
+        eval_.shift(shifted, op, exponents[n][position], rank_);
+        eval_.aut(auted, shifted, exponent, rank_);
+        eval_.add(grouped[componentOf[n]], grouped[componentOf[n]], auted);
+      }
+
+      if (j == stack_ || !spread) {
+        std::memset(packedQ.getData(), 0, sizeof(u64) * DEGREE);
+        packedQ.setIsNTT(false);
+        for (u64 c = 0; c < components.size(); ++c) {
+          for (u64 k = 0; k < rank_; ++k)
+            packedQ[k * stack_ + components[c]] = grouped[c][k];
+        }
+        if (j == stack_) {
+          // B is not switched; scale it by P so that ModDown restores it.
+          eval_.ntt(packedQ, packedQ);
+          eval_.mad(sum.getPolyBModQ(), packedQ, P_MOD_Q, sum.getPolyBModQ());
+          continue;
+        }
+        eval_.normMod(packedP, packedQ);
+        eval_.ntt(packedQ, packedQ);
+        eval_.ntt(packedP, packedP);
+      } else {
+        std::memset(packedQ.getData(), 0, sizeof(u64) * DEGREE);
+        std::memset(packedP.getData(), 0, sizeof(u64) * DEGREE);
+        packedQ.setIsNTT(true);
+        packedP.setIsNTT(true);
+        for (u64 c = 0; c < components.size(); ++c) {
+          eval_.normMod(autedModP, grouped[c]);
+          eval_.ntt(grouped[c], grouped[c]);
+          eval_.ntt(autedModP, autedModP);
+          spreadAdd(packedQ, grouped[c], monomialsQ[c]);
+          spreadAdd(packedP, autedModP, monomialsP[c]);
+        }
+      }
+
+      eval_.mult(tempQ, packedQ, modPackKeys[j].getPolyAModQ(keyAQ));
+      eval_.add(sum.getPolyAModQ(), sum.getPolyAModQ(), tempQ);
+      eval_.mult(tempQ, packedQ, modPackKeys[j].getPolyBModQ());
+      eval_.add(sum.getPolyBModQ(), sum.getPolyBModQ(), tempQ);
+      eval_.mult(tempP, packedP, modPackKeys[j].getPolyAModP(keyAP));
+      eval_.add(sum.getPolyAModP(), sum.getPolyAModP(), tempP);
+      eval_.mult(tempP, packedP, modPackKeys[j].getPolyBModP());
+      eval_.add(sum.getPolyBModP(), sum.getPolyBModP(), tempP);
+    }
+
+    Ciphertext &ctxt = res.getCtxts()[eval_.getBitRev(i, rank_)];
+    eval_.intt(tempP, sum.getPolyAModP());
+    eval_.normMod(tempQ, tempP);
+    eval_.ntt(tempQ, tempQ);
+    eval_.sub(tempQ, sum.getPolyAModQ(), tempQ);
+    eval_.mult(ctxt.getA(), tempQ, INVERSE_P_MOD_Q);
+    eval_.intt(tempP, sum.getPolyBModP());
+    eval_.normMod(tempQ, tempP);
+    eval_.ntt(tempQ, tempQ);
+    eval_.sub(tempQ, sum.getPolyBModQ(), tempQ);
+    eval_.mult(ctxt.getB(), tempQ, INVERSE_P_MOD_Q);
+  });
+}
+
+// Exponent of the monomial shift that carries the key at block position slot
+// to each butterfly output of cacheKeys; a sign flip adds rank.
+void Server::butterflyExponents(std::vector<u64> &res, u64 slot) {
+  const u64 mask = 2 * rank_ - 1;
+  std::vector<bool> reached(rank_, false);
+  res.assign(rank_, 0);
+  reached[eval_.getBitRev(slot / stack_, rank_)] = true;
+  for (u64 i = 0; i < logRank_; ++i) {
+    const u64 half = 1ULL << i;
+    const u64 size = half << 1;
+    const u64 start = rank_ / size;
+    const u64 step = rank_ >> i;
+    for (u64 j = 0; j < start; ++j) {
+      for (u64 k = 0; k < half; ++k) {
+        const u64 factor = start + step * k;
+        const u64 index = size * j + k;
+        if (reached[index + half]) {
+          res[index] = (res[index + half] + factor) & mask;
+          res[index + half] = (res[index] + rank_) & mask;
+        } else if (reached[index]) {
+          res[index + half] = res[index];
+        } else {
+          continue;
+        }
+        reached[index] = reached[index + half] = true;
+      }
+    }
   }
 }
 
+// res += monomial * op(X^stack), where op is a rank-point NTT and res,
+// monomial are DEGREE-point NTTs.
+void Server::spreadAdd(Polynomial &res, const Polynomial &op,
+                       const Polynomial &monomial) {
+  const std::vector<u64> &index =
+      op.getMod() == MOD_Q ? spreadIndexQ_ : spreadIndexP_;
+  Polynomial temp(DEGREE, op.getMod());
+  for (u64 i = 0; i < DEGREE; ++i)
+    temp[i] = op[index[i]];
+  temp.setIsNTT(true);
+  eval_.mult(temp, temp, monomial);
+  eval_.add(res, res, temp);
+}
+
 // void Server::cacheKeys(CachedPlaintextKeys &res,
 //                        const std::vector<Polynomial> &keys) {
 //   std::vector<std::vector<Polynomial>> temp(rank_);
@@ -261,16 +603,76 @@ void Server::cacheKeys(CachedKeys &res,
 
 void Server::innerProduct(Ciphertext &res, const CachedQuery &cachedQuery,
                           const CachedKeys &cachedKey) {
+  HEVEC_TRACE_SPAN("Server.innerProduct");
   Ciphertext temp(true);
-  eval_.multithreadMultSum(temp, cachedQuery.getCtxts(), cachedKey.getCtxts());
-  eval_.mult(temp, temp, rank_);
-  eval_.relin(res, temp, relinKey_);
+  multSum(temp, cachedQuery, cachedKey);
+  relin(res, temp);
 }
 
 void Server::innerProduct(Ciphertext &res,
                           const CachedPlaintextQuery &cachedQuery,
                           const CachedKeys &cachedKey) {
-  eval_.multithreadMultSum(res, cachedKey.getCtxts(), cachedQuery.getPolys());
-  eval_.mult(res, res, rank_);
+  HEVEC_TRACE_SPAN("Server.innerProduct");
+  eval_.multithreadMultSum(res, cachedKey.getSpan(), cachedQuery.getSpan(),
+                           rank_);
+}
+
+void Server::innerProduct(std::vector<Ciphertext> &res,
+                          const std::vector<CachedQuery> &cachedQueries,
+                          const CachedKeys &cachedKey) {
+  HEVEC_TRACE_SPAN("Server.innerProduct");
+  std::vector<Ciphertext> temp;
+  multSum(temp, cachedQueries, cachedKey);
+
+  res.assign(cachedQueries.size(), Ciphertext());
+  // Spans from inside the loop would only cover the calling thread's share.
+  TraceBinding untraced(nullptr);
+  parallelFor(temp.size(), [&](u64 i) { relin(res[i], temp[i]); });
+}
+
+void Server::innerProduct(
+    std::vector<Ciphertext> &res,
+    const std::vector<CachedPlaintextQuery> &cachedQueries,
+    const CachedKeys &cachedKey) {
+  HEVEC_TRACE_SPAN("Server.innerProduct");
+  std::vector<PolynomialSpan> queries;
+  queries.reserve(cachedQueries.size());
+  for (const CachedPlaintextQuery &cachedQuery : cachedQueries)
+    queries.push_back(cachedQuery.getSpan());
+
+  res.assign(cachedQueries.size(), Ciphertext());
+  eval_.multithreadMultSum(res, cachedKey.getSpan(), queries, rank_);
+}
+
+void Server::multSum(Ciphertext &res, const CachedQuery &cachedQuery,
+                     const CachedKeys &cachedKey) {
+  HEVEC_TRACE_SPAN("Server.multSum");
+  eval_.multithreadMultSum(res, cachedQuery.getSpan(), cachedKey.getSpan(),
+                           rank_);
+}
+
+void Server::multSum(std::vector<Ciphertext> &res,
+                     const std::vector<CachedQuery> &cachedQueries,
+                     const CachedKeys &cachedKey) {
+  HEVEC_TRACE_SPAN("Server.multSum");
+  std::vector<CiphertextSpan> queries;
+  queries.reserve(cachedQueries.size());
+  for (const CachedQuery &cachedQuery : cachedQueries)
+    queries.push_back(cachedQuery.getSpan());
+
+  res.assign(cachedQueries.size(), Ciphertext(true));
+  eval_.multithreadMultSum(res, queries, cachedKey.getSpan(), rank_);
+}
+
+void Server::relin(Ciphertext &res, const Ciphertext &op) {
+  HEVEC_TRACE_SPAN("Server.relin");
+  eval_.relin(res, op,
+              nodeRelinKeys_.empty() ? relinKey_
+                                     : nodeRelinKeys_[TaskNode::current()]);
+}
+
+void Server::modSwitch(PackedCiphertext &res, const Ciphertext &score) {
+  HEVEC_TRACE_SPAN("Server.modSwitch");
+  eval_.modSwitch(res, score);
 }
 } // namespace HEVEC
\ No newline at end of file
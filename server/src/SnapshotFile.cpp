@@ -0,0 +1,226 @@
+#include "HEVEC/SnapshotFile.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "HEVEC/Const.hpp"
+
+namespace HEVEC {
+
+namespace {
+
+// Large enough that fwrite hands whole blocks of polynomials to the kernel.
+constexpr u64 WRITE_BUFFER_SIZE = 1 << 22;
+
+std::runtime_error snapshotError(const std::string &path,
+                                 const std::string &what) {
+  return std::runtime_error("Snapshot " + path + ": " + what);
+}
+
+std::runtime_error systemError(const std::string &path,
+                               const std::string &what) {
+  return snapshotError(path, what + ": " + std::strerror(errno));
+}
+
+u64 paddedSize(u64 size) { return (size + 7) & ~static_cast<u64>(7); }
+
+// Makes a rename in dir durable.
+void syncDirectory(const std::string &dir) {
+  const int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0)
+    return;
+  ::fsync(fd);
+  ::close(fd);
+}
+
+} // namespace
+
+SnapshotWriter::SnapshotWriter(const std::string &path)
+    : path_(path), tmp_path_(path + ".tmp") {
+  file_ = std::fopen(tmp_path_.c_str(), "wb");
+  if (!file_)
+    throw systemError(tmp_path_, "cannot create");
+  std::setvbuf(file_, nullptr, _IOFBF, WRITE_BUFFER_SIZE);
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  if (file_)
+    std::fclose(file_);
+  if (!committed_)
+    std::remove(tmp_path_.c_str());
+}
+
+void SnapshotWriter::writeBytes(const void *data, u64 size) {
+  static const unsigned char ZEROS[8] = {};
+  const u64 padding = paddedSize(size) - size;
+  if (std::fwrite(data, 1, size, file_) != size ||
+      std::fwrite(ZEROS, 1, padding, file_) != padding)
+    throw systemError(tmp_path_, "write failed");
+  size_ += size + padding;
+}
+
+void SnapshotWriter::write(const Polynomial &poly) {
+  write(poly.getDegree());
+  write(poly.getMod());
+  write(static_cast<u64>(poly.getIsNTT()));
+  writeBytes(poly.getData(), poly.getDegree() * sizeof(u64));
+}
+
+void SnapshotWriter::write(const Ciphertext &ctxt) {
+  write(static_cast<u64>(ctxt.getIsExtended()));
+  write(ctxt.getA());
+  write(ctxt.getB());
+  if (ctxt.getIsExtended())
+    write(ctxt.getC());
+}
+
+void SnapshotWriter::write(const CiphertextSpan &ctxts) {
+  // Records hold whole polynomials, gathered (and unpacked) tile by tile
+  // from the scan layout.
+  u64 tile[SCAN_TILE];
+  for (u64 i = 0; i < ctxts.size(); ++i) {
+    write(static_cast<u64>(false));
+    for (const bool isA : {true, false}) {
+      write(DEGREE);
+      write(MOD_Q);
+      write(static_cast<u64>(ctxts.getIsNTT()));
+      for (u64 offset = 0; offset < DEGREE; offset += SCAN_TILE)
+        writeBytes(isA ? ctxts.loadA(i, offset, tile)
+                       : ctxts.loadB(i, offset, tile),
+                   SCAN_TILE * sizeof(u64));
+    }
+  }
+}
+
+void SnapshotWriter::write(const SwitchingKey &key) {
+  write(key.getPolyAModQ());
+  write(key.getPolyAModP());
+  write(key.getPolyBModQ());
+  write(key.getPolyBModP());
+  write(static_cast<u64>(key.isSeeded()));
+  if (key.isSeeded())
+    writeBytes(key.getSeed(), SEED_SIZE);
+}
+
+void SnapshotWriter::write(const MLWESwitchingKey &key) {
+  write(key.getRank());
+  for (u64 i = 0; i < key.getStack(); ++i) {
+    write(key.getPolyAModQ(i));
+    write(key.getPolyAModP(i));
+    write(key.getPolyBModQ(i));
+    write(key.getPolyBModP(i));
+  }
+  write(static_cast<u64>(key.isSeeded()));
+  if (key.isSeeded())
+    writeBytes(key.getSeed(), SEED_SIZE);
+}
+
+void SnapshotWriter::commit() {
+  if (std::fflush(file_) != 0 || ::fsync(::fileno(file_)) != 0)
+    throw systemError(tmp_path_, "flush failed");
+  const int closed = std::fclose(file_);
+  file_ = nullptr;
+  if (closed != 0)
+    throw systemError(tmp_path_, "close failed");
+  if (std::rename(tmp_path_.c_str(), path_.c_str()) != 0)
+    throw systemError(path_, "rename failed");
+  committed_ = true;
+
+  const auto slash = path_.find_last_of('/');
+  syncDirectory(slash == std::string::npos ? "." : path_.substr(0, slash));
+}
+
+SnapshotReader::SnapshotReader(const std::string &path) : path_(path) {
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw systemError(path, "cannot open");
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw systemError(path, "cannot stat");
+  }
+  size_ = static_cast<u64>(st.st_size);
+  if (size_ > 0) {
+    void *map = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      ::close(fd);
+      throw systemError(path, "mmap failed");
+    }
+    // Loading is one front-to-back pass; let the kernel read ahead.
+    ::madvise(map, size_, MADV_SEQUENTIAL);
+    ::madvise(map, size_, MADV_WILLNEED);
+    data_ = static_cast<const unsigned char *>(map);
+  }
+  ::close(fd);
+}
+
+SnapshotReader::~SnapshotReader() {
+  if (data_)
+    ::munmap(const_cast<unsigned char *>(data_), size_);
+}
+
+const void *SnapshotReader::readBytes(u64 size) {
+  if (size > size_ - pos_ || paddedSize(size) > size_ - pos_)
+    throw snapshotError(path_, "truncated");
+  const void *res = data_ + pos_;
+  pos_ += paddedSize(size);
+  return res;
+}
+
+u64 SnapshotReader::readU64() {
+  u64 value;
+  std::memcpy(&value, readBytes(sizeof(value)), sizeof(value));
+  return value;
+}
+
+void SnapshotReader::read(Polynomial &res) {
+  const u64 degree = readU64();
+  const u64 mod = readU64();
+  const bool isNTT = readU64() != 0;
+  if (degree > DEGREE || (mod != MOD_Q && mod != MOD_P))
+    throw snapshotError(path_, "malformed polynomial");
+  if (res.getDegree() != degree || res.getMod() != mod)
+    res = Polynomial(degree, mod);
+  res.setIsNTT(isNTT);
+  std::memcpy(res.getData(), readBytes(degree * sizeof(u64)),
+              degree * sizeof(u64));
+}
+
+void SnapshotReader::read(Ciphertext &res) {
+  const bool isExtended = readU64() != 0;
+  if (res.getIsExtended() != isExtended)
+    res = Ciphertext(isExtended);
+  read(res.getA());
+  read(res.getB());
+  if (isExtended)
+    read(res.getC());
+}
+
+void SnapshotReader::read(SwitchingKey &res) {
+  read(res.getPolyAModQ());
+  read(res.getPolyAModP());
+  read(res.getPolyBModQ());
+  read(res.getPolyBModP());
+  if (readU64() != 0)
+    res.setSeed(static_cast<const u8 *>(readBytes(SEED_SIZE)));
+}
+
+void SnapshotReader::read(MLWESwitchingKey &res) {
+  if (readU64() != res.getRank())
+    throw snapshotError(path_, "switching key rank mismatch");
+  for (u64 i = 0; i < res.getStack(); ++i) {
+    read(res.getPolyAModQ(i));
+    read(res.getPolyAModP(i));
+    read(res.getPolyBModQ(i));
+    read(res.getPolyBModP(i));
+  }
+  if (readU64() != 0)
+    res.setSeed(static_cast<const u8 *>(readBytes(SEED_SIZE)));
+}
+
+} // namespace HEVEC
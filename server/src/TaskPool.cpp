@@ -0,0 +1,345 @@
+#include "HEVEC/TaskPool.hpp"
+
+#include "HEVEC/Memory.hpp"
+#include "HEVEC/Numa.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <string>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace HEVEC {
+
+namespace {
+
+// Chunks a loop is cut into per thread, so threads that finish early take
+// over the work of slow ones.
+constexpr u64 CHUNKS_PER_THREAD = 4;
+
+thread_local TaskPool *t_pool = nullptr; // pool of the calling worker
+thread_local u64 t_self = 0;             // its index there
+thread_local u64 t_budget = 0;           // 0: no TaskBudget
+thread_local i64 t_node = -1;            // -1: no TaskNode
+
+// CPUs the cgroup quota allows, or 0 if there is none.
+u64 getCgroupCPUs() {
+  // cgroup v2: "<quota> <period>", quota "max" when unlimited.
+  std::ifstream v2("/sys/fs/cgroup/cpu.max");
+  std::string quota;
+  u64 period = 0;
+  if (v2 >> quota >> period) {
+    if (quota == "max" || period == 0)
+      return 0;
+    return (std::stoull(quota) + period - 1) / period;
+  }
+  // cgroup v1: quota -1 when unlimited.
+  std::ifstream v1Quota("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+  std::ifstream v1Period("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+  long long v1QuotaUs = -1, v1PeriodUs = 0;
+  if (!(v1Quota >> v1QuotaUs) || !(v1Period >> v1PeriodUs) || v1QuotaUs <= 0 ||
+      v1PeriodUs <= 0)
+    return 0;
+  return static_cast<u64>((v1QuotaUs + v1PeriodUs - 1) / v1PeriodUs);
+}
+
+// One parallelForRange call, shared with the runner tasks it queued. A
+// runner that starts after every chunk is claimed returns without touching
+// body, which lives on the caller's stack.
+struct Loop {
+  u64 count;
+  u64 grain;
+  u64 share; // budget of loops nested in a chunk
+  i64 node;  // TaskNode of the caller, for nested loops
+  std::shared_ptr<MemoryAccount> account; // MemoryScope of the caller
+  const std::function<void(u64, u64)> *body;
+  std::atomic<u64> next{0};
+  std::atomic<u64> done{0};
+  std::atomic<bool> failed{false};
+  std::mutex error_mutex;
+  std::exception_ptr error;
+
+  void runChunks() {
+    TaskBudget budget(share);
+    MemoryScope memory(account);
+    const i64 previous_node = t_node;
+    t_node = node;
+    for (;;) {
+      const u64 begin = next.fetch_add(grain);
+      if (begin >= count)
+        break;
+      runChunk(begin, std::min(begin + grain, count));
+    }
+    t_node = previous_node;
+  }
+
+  // Runs body over [begin, end) unless a chunk has failed, and counts it.
+  void runChunk(u64 begin, u64 end) {
+    if (!failed.load(std::memory_order_relaxed)) {
+      try {
+        (*body)(begin, end);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error)
+          error = std::current_exception();
+        failed = true;
+      }
+    }
+    if (done.fetch_add(end - begin) + (end - begin) == count)
+      done.notify_all();
+  }
+
+  void wait() {
+    for (u64 seen = done.load(); seen < count; seen = done.load())
+      done.wait(seen);
+  }
+};
+
+} // namespace
+
+u64 detectThreadCount() {
+  const char *threads_env = std::getenv("HEVEC_THREADS");
+  if (threads_env && std::atoll(threads_env) > 0)
+    return static_cast<u64>(std::atoll(threads_env));
+
+  u64 cpus = std::max(std::thread::hardware_concurrency(), 1U);
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (::sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0)
+    cpus = static_cast<u64>(CPU_COUNT(&set));
+#endif
+  if (const u64 quota = getCgroupCPUs())
+    cpus = std::min(cpus, quota);
+  return std::max<u64>(cpus, 1);
+}
+
+TaskPool::TaskPool(u64 numThreads) {
+  const u64 numWorkers = std::max<u64>(numThreads, 1) - 1;
+  const auto &numa = getNumaNodes();
+  const u64 numNodes = numa.size() > 1 && numWorkers >= numa.size()
+                           ? numa.size()
+                           : 1;
+  for (u64 n = 0; n < numNodes; ++n) {
+    nodes_.push_back(std::make_unique<Node>());
+    if (numNodes > 1)
+      nodes_[n]->cpus = numa[n].cpus;
+  }
+  for (u64 i = 0; i < numWorkers; ++i) {
+    workers_.push_back(std::make_unique<Worker>());
+    workers_[i]->node = i % numNodes;
+    ++nodes_[i % numNodes]->threads;
+  }
+  for (u64 i = 0; i < numWorkers; ++i)
+    workers_[i]->thread = std::thread([this, i]() { run(i); });
+}
+
+TaskPool::~TaskPool() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (auto &worker : workers_)
+    worker->thread.join();
+}
+
+TaskPool &TaskPool::get() {
+  static TaskPool pool(detectThreadCount());
+  return pool;
+}
+
+void TaskPool::push(Task task) {
+  // Counted first, so a worker that sees the count may spin briefly but
+  // never sleeps on a queued task.
+  queued_.fetch_add(1);
+  if (t_pool == this) {
+    Worker &worker = *workers_[t_self];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.tasks.push_back(std::move(task));
+  } else {
+    std::lock_guard<std::mutex> lock(shared_mutex_);
+    shared_.push_back(std::move(task));
+  }
+  { std::lock_guard<std::mutex> lock(sleep_mutex_); }
+  wake_.notify_one();
+}
+
+void TaskPool::push(Task task, u64 node) {
+  if (nodes_.size() == 1) {
+    push(std::move(task));
+    return;
+  }
+  Node &target = *nodes_[node];
+  target.queued.fetch_add(1);
+  {
+    std::lock_guard<std::mutex> lock(target.mutex);
+    target.tasks.push_back(std::move(task));
+  }
+  // All woken, as the one notify_one picks may belong to another node.
+  { std::lock_guard<std::mutex> lock(sleep_mutex_); }
+  wake_.notify_all();
+}
+
+bool TaskPool::isWorkerOn(u64 node) const {
+  return t_pool == this && workers_[t_self]->node == node;
+}
+
+bool TaskPool::pop(u64 self, Task &task) {
+  auto take = [&](std::mutex &mutex, std::deque<Task> &tasks, bool newest,
+                  std::atomic<u64> &queued) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (tasks.empty())
+      return false;
+    if (newest) {
+      task = std::move(tasks.back());
+      tasks.pop_back();
+    } else {
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+    queued.fetch_sub(1);
+    return true;
+  };
+
+  Worker &worker = *workers_[self];
+  Node &node = *nodes_[worker.node];
+  if (take(worker.mutex, worker.tasks, true, queued_))
+    return true;
+  if (take(node.mutex, node.tasks, false, node.queued))
+    return true;
+  if (take(shared_mutex_, shared_, false, queued_))
+    return true;
+  // Workers of the same node first, whose data is closer.
+  for (const bool local : {true, false}) {
+    for (u64 i = 1; i < workers_.size(); ++i) {
+      Worker &victim = *workers_[(self + i) % workers_.size()];
+      if ((victim.node == worker.node) == local &&
+          take(victim.mutex, victim.tasks, false, queued_))
+        return true;
+    }
+  }
+  return false;
+}
+
+void TaskPool::run(u64 self) {
+  t_pool = this;
+  t_self = self;
+  Node &node = *nodes_[workers_[self]->node];
+#ifdef __linux__
+  if (!node.cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const int cpu : node.cpus)
+      CPU_SET(cpu, &set);
+    ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+  }
+#endif
+  auto pending = [&]() { return queued_.load() + node.queued.load(); };
+  for (;;) {
+    Task task;
+    if (pop(self, task)) {
+      task();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    wake_.wait(lock, [&]() { return stop_ || pending() > 0; });
+    if (stop_ && pending() == 0)
+      return;
+  }
+}
+
+TaskBudget::TaskBudget(u64 threads) : previous_(t_budget) {
+  t_budget = std::max<u64>(threads, 1);
+}
+
+TaskBudget::~TaskBudget() { t_budget = previous_; }
+
+u64 TaskBudget::current() {
+  return t_budget ? t_budget : TaskPool::get().getNumThreads();
+}
+
+TaskNode::TaskNode(u64 node) : previous_(t_node) {
+  t_node = static_cast<i64>(node);
+}
+
+TaskNode::~TaskNode() { t_node = previous_; }
+
+u64 TaskNode::current() { return t_node < 0 ? 0 : static_cast<u64>(t_node); }
+
+void parallelForRange(u64 count, const std::function<void(u64, u64)> &body) {
+  if (count == 0)
+    return;
+  TaskPool &pool = TaskPool::get();
+  const u64 budget = TaskBudget::current();
+  const bool pinned = t_node >= 0 && pool.getNumNodes() > 1;
+  const u64 node = pinned ? static_cast<u64>(t_node) : 0;
+  // A caller off the node leaves the chunks to the node's workers.
+  const bool joins = !pinned || pool.isWorkerOn(node);
+  const u64 available =
+      pinned ? pool.getNodeThreads(node) : pool.getNumThreads();
+  const u64 threads = std::min({budget, available, count});
+  if (threads <= 1 && joins) {
+    body(0, count);
+    return;
+  }
+
+  auto loop = std::make_shared<Loop>();
+  loop->count = count;
+  loop->grain = std::max<u64>(count / (threads * CHUNKS_PER_THREAD), 1);
+  loop->share = std::max<u64>(budget / threads, 1);
+  loop->node = t_node;
+  loop->account = MemoryScope::current();
+  loop->body = &body;
+  const u64 runners = joins ? threads - 1 : threads;
+  for (u64 i = 0; i < runners; ++i) {
+    if (pinned)
+      pool.push([loop]() { loop->runChunks(); }, node);
+    else
+      pool.push([loop]() { loop->runChunks(); });
+  }
+  if (joins)
+    loop->runChunks();
+  loop->wait();
+  if (loop->error)
+    std::rethrow_exception(loop->error);
+}
+
+void parallelForNodes(const std::function<void(u64)> &body) {
+  TaskPool &pool = TaskPool::get();
+  const u64 numNodes = pool.getNumNodes();
+  if (numNodes == 1) {
+    body(0);
+    return;
+  }
+
+  // Node n runs chunk [n, n + 1) of a loop of numNodes iterations.
+  const u64 budget = TaskBudget::current();
+  const u64 workers = pool.getNumThreads() - 1;
+  const std::shared_ptr<MemoryAccount> account = MemoryScope::current();
+  const std::function<void(u64, u64)> runNode = [&](u64 node, u64) {
+    const TaskNode scope(node);
+    const MemoryScope memory(account);
+    const TaskBudget share(
+        std::max<u64>(budget * pool.getNodeThreads(node) / workers, 1));
+    body(node);
+  };
+  auto loop = std::make_shared<Loop>();
+  loop->count = numNodes;
+  loop->grain = 1;
+  loop->share = budget;
+  loop->node = -1;
+  loop->body = &runNode;
+  for (u64 node = 0; node < numNodes; ++node)
+    pool.push([loop, node]() { loop->runChunk(node, node + 1); }, node);
+  loop->wait();
+  if (loop->error)
+    std::rethrow_exception(loop->error);
+}
+
+} // namespace HEVEC